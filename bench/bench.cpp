@@ -0,0 +1,200 @@
+#include <miniengine/app.h>
+#include <miniengine/logging.h>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Renders a set of fixed scenes offscreen for a fixed number of frames each
+// and writes what they measured as JSON, so runs can be compared between
+// builds. Has to be run from the repository root, like the engine itself, so
+// the shaders can be found.
+
+struct Scenario {
+  const char *name;
+  const char *description;
+  MiniEngine::DrawMode drawMode;
+  uint32_t instances;
+  uint32_t uploadsPerFrame = 0;
+  uint32_t uploadSize = 4096;
+  uint32_t recreateInterval = 0;
+  uint32_t sprites = 0;
+};
+
+using MiniEngine::DrawMode;
+
+// Quads are one draw each, instances are all drawn by a single command. The
+// culled scene is all on screen, so it measures what the culling pass costs.
+static const std::vector<Scenario> scenarios = {
+    {"quads_1k", "1024 quads, a draw per quad", DrawMode::PerInstance, 1024},
+    {"quads_16k", "16384 quads, a draw per quad", DrawMode::PerInstance,
+     16 * 1024},
+    {"quads_128k", "131072 quads, a draw per quad", DrawMode::PerInstance,
+     128 * 1024},
+    {"instances_16k", "16384 instances, one instanced draw",
+     DrawMode::Instanced, 16 * 1024},
+    {"instances_128k", "131072 instances, one indirect draw",
+     DrawMode::Indirect, 128 * 1024},
+    {"culled_128k", "131072 instances, culled on the GPU then drawn indirect",
+     DrawMode::GpuCulled, 128 * 1024},
+    {"uploads_256x4k", "256 uploads of 4 KiB per frame", DrawMode::Indirect, 1,
+     256, 4 * 1024},
+    {"uploads_32x64k", "32 uploads of 64 KiB per frame", DrawMode::Indirect, 1,
+     32, 64 * 1024},
+    {"recreate_10", "Recreating the render targets every 10 frames",
+     DrawMode::Indirect, 1024, 0, 4096, 10},
+    {"sprites_128k", "131072 sprites through the sprite batch",
+     DrawMode::Indirect, 1, 0, 4096, 0, 128 * 1024},
+};
+
+static void PrintUsage() {
+  fmt::print(stderr,
+             "Usage: MiniEngineBench [--frames N] [--threads N] "
+             "[--frames-in-flight N] "
+             "[--size WIDTHxHEIGHT] [--scenario NAME]... [--output FILE] "
+             "[--list]\n");
+}
+
+static std::string ToJson(const Scenario &scenario,
+                          const MiniEngine::AppConfig &config,
+                          const MiniEngine::BenchmarkResults &results) {
+  return fmt::format(
+      R"(    {{"name": "{}", "frames": {}, "width": {}, "height": {}, )"
+      R"("instances": {}, "sprites": {}, "seconds": {:.4f}, )"
+      R"("frame_ms": {{"mean": {:.4f}, "p50": {:.4f}, "p95": {:.4f}, )"
+      R"("p99": {:.4f}, "max": {:.4f}}}, "record_ms_mean": {:.4f}, )"
+      R"("upload_mib_per_s": {:.2f}, "recreates": {}, )"
+      R"("recreate_ms_mean": {:.4f}, "frames_in_flight": {}, )"
+      R"("latency_ms": {{"p50": {:.4f}, "p99": {:.4f}}}, )"
+      R"("heap_allocations_per_frame": {:.2f}}})",
+      scenario.name, results.frames, config.headlessWidth,
+      config.headlessHeight, scenario.instances, scenario.sprites,
+      results.seconds, results.frameMean, results.frame.p50,
+      results.frame.p95, results.frame.p99, results.frame.max,
+      results.recordMean, results.uploadMiBPerSecond, results.recreates,
+      results.recreateMean, config.pacing.framesInFlight, results.latency.p50,
+      results.latency.p99, results.heapAllocationsPerFrame);
+}
+
+int main(int argc, char **argv) {
+  // The engine's info logging would drown out the progress
+  MiniEngine::InitLogging(spdlog::level::warn);
+
+  MiniEngine::AppConfig baseConfig;
+  baseConfig.headless = true;
+  baseConfig.benchmark = true;
+  baseConfig.benchmarkFrames = 500;
+
+  std::vector<std::string> selected;
+  std::string outputPath;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    if (arg == "--frames" && i + 1 < argc) {
+      baseConfig.benchmarkFrames = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--threads" && i + 1 < argc) {
+      baseConfig.workerThreads = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--frames-in-flight" && i + 1 < argc) {
+      baseConfig.pacing.framesInFlight = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--size" && i + 1 < argc) {
+      unsigned width = 0, height = 0;
+      if (std::sscanf(argv[++i], "%ux%u", &width, &height) != 2 ||
+          width == 0 || height == 0) {
+        PrintUsage();
+        return EXIT_FAILURE;
+      }
+      baseConfig.headlessWidth = width;
+      baseConfig.headlessHeight = height;
+    } else if (arg == "--scenario" && i + 1 < argc) {
+      selected.push_back(argv[++i]);
+    } else if (arg == "--output" && i + 1 < argc) {
+      outputPath = argv[++i];
+    } else if (arg == "--list") {
+      for (auto &scenario : scenarios) {
+        fmt::print("{:<16} {}\n", scenario.name, scenario.description);
+      }
+      return EXIT_SUCCESS;
+    } else {
+      PrintUsage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (baseConfig.benchmarkFrames == 0) {
+    PrintUsage();
+    return EXIT_FAILURE;
+  }
+
+  for (auto &name : selected) {
+    bool found = false;
+    for (auto &scenario : scenarios) {
+      found |= name == scenario.name;
+    }
+    if (!found) {
+      spdlog::error("Unknown scenario {}, see --list", name);
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::vector<std::string> entries;
+  bool failed = false;
+
+  for (auto &scenario : scenarios) {
+    if (!selected.empty() &&
+        std::find(selected.begin(), selected.end(), scenario.name) ==
+            selected.end()) {
+      continue;
+    }
+
+    MiniEngine::AppConfig config = baseConfig;
+    config.benchmarkDrawMode = scenario.drawMode;
+    config.benchmarkInstances = scenario.instances;
+    config.benchmarkUploadsPerFrame = scenario.uploadsPerFrame;
+    config.benchmarkUploadSize = scenario.uploadSize;
+    config.benchmarkRecreateInterval = scenario.recreateInterval;
+    config.benchmarkSprites = scenario.sprites;
+
+    // Progress goes to stderr so stdout is only the results
+    fmt::print(stderr, "Running {} ({} frames)\n", scenario.name,
+               config.benchmarkFrames);
+
+    // A fresh engine for every scenario so none of them warm up the next
+    try {
+      MiniEngine::App app(config);
+      app.Run();
+      entries.push_back(ToJson(scenario, config, app.GetBenchmarkResults()));
+    } catch (const std::exception &e) {
+      spdlog::error("{} failed: {}", scenario.name, e.what());
+      failed = true;
+    }
+  }
+
+  // So nothing still queued ends up in the middle of the results
+  MiniEngine::ShutdownLogging();
+
+  std::string json = "{\n  \"scenarios\": [\n";
+  for (size_t i = 0; i < entries.size(); i++) {
+    json += entries[i] + (i + 1 == entries.size() ? "\n" : ",\n");
+  }
+  json += "  ]\n}\n";
+
+  if (outputPath.empty()) {
+    fmt::print("{}", json);
+  } else {
+    std::FILE *file = std::fopen(outputPath.c_str(), "w");
+    if (file == nullptr) {
+      spdlog::error("Failed to open {} for writing", outputPath);
+      return EXIT_FAILURE;
+    }
+    std::fputs(json.c_str(), file);
+    std::fclose(file);
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
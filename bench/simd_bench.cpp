@@ -0,0 +1,207 @@
+#include <miniengine/simd.h>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+// Times each batch kernel in simd.h at every level the CPU supports, against
+// the scalar glm path, and checks each level gets the same answers. Nothing
+// here touches the GPU.
+
+using MiniEngine::SimdLevel;
+
+static void PrintUsage() {
+  fmt::print(stderr,
+             "Usage: MiniEngineSimdBench [--count N] [--iterations N]\n");
+}
+
+// The fastest of `iterations` runs, in nanoseconds per element. The fastest
+// is the least disturbed by whatever else the machine is doing.
+static double Time(uint32_t iterations, uint32_t count,
+                   const std::function<void()> &kernel) {
+  using Clock = std::chrono::high_resolution_clock;
+  double best = INFINITY;
+  for (uint32_t i = 0; i < iterations; i++) {
+    auto start = Clock::now();
+    kernel();
+    double ns =
+        std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    best = std::min(best, ns);
+  }
+  return best / count;
+}
+
+static float MaxDifference(const std::vector<float> &a,
+                           const std::vector<float> &b) {
+  float difference = 0.0f;
+  for (size_t i = 0; i < a.size(); i++) {
+    // Relative once the values are large, long hierarchies grow quickly
+    float scale = std::max(1.0f, std::fabs(a[i]));
+    difference = std::max(difference, std::fabs(a[i] - b[i]) / scale);
+  }
+  return difference;
+}
+
+int main(int argc, char **argv) {
+  uint32_t count = 100000;
+  uint32_t iterations = 100;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    if (arg == "--count" && i + 1 < argc) {
+      count = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--iterations" && i + 1 < argc) {
+      iterations = std::strtoul(argv[++i], nullptr, 10);
+    } else {
+      PrintUsage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (count == 0 || iterations == 0) {
+    PrintUsage();
+    return EXIT_FAILURE;
+  }
+
+  // Transforms near the identity, so long chains of them stay finite
+  std::mt19937 random(1234);
+  std::uniform_real_distribution<float> jitter(-0.1f, 0.1f);
+  std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+  std::uniform_real_distribution<float> size(0.1f, 2.0f);
+
+  std::vector<glm::mat4> a(count), b(count), out(count);
+  for (uint32_t i = 0; i < count; i++) {
+    for (int column = 0; column < 4; column++) {
+      for (int row = 0; row < 4; row++) {
+        float identity = column == row ? 1.0f : 0.0f;
+        a[i][column][row] = identity + jitter(random);
+        b[i][column][row] = identity + jitter(random);
+      }
+    }
+  }
+
+  // Small trees, a root every 16 entities and each child under one of the
+  // few before it
+  std::vector<uint32_t> parents(count);
+  for (uint32_t i = 0; i < count; i++) {
+    parents[i] = i % 16 == 0 ? UINT32_MAX : i - 1 - (i % 3 == 0 && i % 16 > 1);
+  }
+
+  // SoA boxes and spheres, the spheres reuse the boxes' centres
+  std::vector<float> box[6];
+  std::vector<float> outBox[6];
+  std::vector<float> radius(count);
+  for (int axis = 0; axis < 6; axis++) {
+    box[axis].resize(count);
+    outBox[axis].resize(count);
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    for (int axis = 0; axis < 3; axis++) {
+      box[axis][i] = position(random);
+      box[axis + 3][i] = size(random);
+    }
+    radius[i] = size(random);
+  }
+  MiniEngine::AabbArrays boxes = {box[0].data(), box[1].data(),
+                                  box[2].data(), box[3].data(),
+                                  box[4].data(), box[5].data()};
+  MiniEngine::AabbArrays outBoxes = {outBox[0].data(), outBox[1].data(),
+                                     outBox[2].data(), outBox[3].data(),
+                                     outBox[4].data(), outBox[5].data()};
+  MiniEngine::SphereArrays spheres = {box[0].data(), box[1].data(),
+                                      box[2].data(), radius.data()};
+  std::vector<uint8_t> visible(count);
+
+  // A frustum around part of the scene, in the culler's convention
+  glm::mat4 transform = a[0];
+  glm::vec4 planes[6] = {{1.0f, 0.0f, 0.0f, 5.0f},  {-1.0f, 0.0f, 0.0f, 5.0f},
+                         {0.0f, 1.0f, 0.0f, 5.0f},  {0.0f, -1.0f, 0.0f, 5.0f},
+                         {0.0f, 0.0f, 1.0f, 10.0f}, {0.0f, 0.0f, -1.0f, 10.0f}};
+
+  struct Result {
+    SimdLevel level;
+    double ns[4];
+    std::vector<float> output; // Everything the kernels wrote, flattened
+    uint32_t visibleCount;
+  };
+
+  std::vector<SimdLevel> levels = {SimdLevel::Scalar};
+  SimdLevel supported = MiniEngine::GetSupportedSimdLevel();
+  if (supported == SimdLevel::Avx2) {
+    levels.push_back(SimdLevel::Sse2);
+  }
+  if (supported != SimdLevel::Scalar) {
+    levels.push_back(supported);
+  }
+
+  std::vector<Result> results;
+  for (SimdLevel level : levels) {
+    MiniEngine::SetSimdLevel(level);
+
+    Result result = {};
+    result.level = level;
+    result.ns[0] = Time(iterations, count, [&] {
+      MiniEngine::MultiplyMatrices(a.data(), b.data(), out.data(), count);
+    });
+    std::vector<glm::mat4> products = out;
+    result.ns[1] = Time(iterations, count, [&] {
+      MiniEngine::ComposeHierarchy(parents.data(), a.data(), out.data(),
+                                   count);
+    });
+    result.ns[2] = Time(iterations, count, [&] {
+      MiniEngine::TransformAabbs(transform, boxes, outBoxes, count);
+    });
+    result.ns[3] = Time(iterations, count, [&] {
+      result.visibleCount =
+          MiniEngine::CullSpheres(planes, spheres, visible.data(), count);
+    });
+
+    const float *matrices[] = {&products[0][0][0], &out[0][0][0]};
+    for (const float *floats : matrices) {
+      result.output.insert(result.output.end(), floats, floats + count * 16);
+    }
+    for (const std::vector<float> &axis : outBox) {
+      result.output.insert(result.output.end(), axis.begin(), axis.end());
+    }
+    for (uint8_t v : visible) {
+      result.output.push_back(v);
+    }
+
+    results.push_back(std::move(result));
+  }
+
+  fmt::print("{} elements, best of {} runs, ns per element\n\n", count,
+             iterations);
+  fmt::print("{:<8} {:>10} {:>10} {:>10} {:>10} {:>12}\n", "", "multiply",
+             "hierarchy", "aabbs", "spheres", "difference");
+
+  bool matches = true;
+  for (const Result &result : results) {
+    const Result &scalar = results[0];
+    float difference = MaxDifference(scalar.output, result.output);
+    // FMA rounds differently, and the hierarchy compounds it
+    matches &= difference < 1e-3f && result.visibleCount == scalar.visibleCount;
+
+    fmt::print("{:<8}", MiniEngine::GetSimdLevelName(result.level));
+    for (int kernel = 0; kernel < 4; kernel++) {
+      fmt::print(" {:>5.2f} {:>4}", result.ns[kernel],
+                 fmt::format("{:.1f}x", scalar.ns[kernel] / result.ns[kernel]));
+    }
+    fmt::print(" {:>12.2g}\n", difference);
+  }
+
+  if (!matches) {
+    fmt::print(stderr, "The kernels don't agree with the scalar path\n");
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
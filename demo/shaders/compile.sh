@@ -1,7 +1,9 @@
-# compiles frag.glsl and vert.glsl into frag.spv and vert.spv
+# compiles frag.glsl, vert.glsl and cull.glsl into frag.spv, vert.spv and
+# cull.spv
 
 set -e
 set -x
 
 glslc -fshader-stage=vertex vert.glsl -o vert.spv 
 glslc -fshader-stage=fragment frag.glsl -o frag.spv 
+glslc -fshader-stage=compute cull.glsl -o cull.spv
@@ -0,0 +1,72 @@
+#version 450
+
+// Frustum culls every instance and packs the visible ones together for a
+// single indirect draw, see GpuCuller in culling.h
+
+// CULL_WORKGROUP_SIZE
+layout(local_size_x = 64) in;
+
+struct InstanceData {
+  mat4 transform;
+  vec4 colour;
+};
+
+// Same layout as VkDrawIndexedIndirectCommand
+struct DrawCommand {
+  uint indexCount;
+  uint instanceCount;
+  uint firstIndex;
+  int vertexOffset;
+  uint firstInstance;
+};
+
+layout(std430, binding = 0) readonly buffer Instances {
+  InstanceData instances[];
+};
+
+// xyz is the centre, w the radius
+layout(std430, binding = 1) readonly buffer Bounds {
+  vec4 bounds[];
+};
+
+layout(std430, binding = 2) writeonly buffer VisibleInstances {
+  InstanceData visibleInstances[];
+};
+
+layout(std430, binding = 3) buffer Commands {
+  DrawCommand command;
+};
+
+layout(std430, binding = 4) buffer DrawCount {
+  uint drawCount;
+};
+
+// CullParams
+layout(push_constant) uniform Params {
+  vec4 planes[6];
+  uint instanceCount;
+};
+
+void main() {
+  uint index = gl_GlobalInvocationID.x;
+  if (index >= instanceCount) {
+    return;
+  }
+
+  // Outside if the whole sphere is behind any one plane
+  vec4 sphere = bounds[index];
+  for (int i = 0; i < 6; i++) {
+    if (dot(planes[i].xyz, sphere.xyz) + planes[i].w < -sphere.w) {
+      return;
+    }
+  }
+
+  uint slot = atomicAdd(command.instanceCount, 1);
+  visibleInstances[slot] = instances[index];
+
+  // There is only the one mesh, so one command. Every visible instance
+  // writes the same value so there is no need for an atomic.
+  if (slot == 0) {
+    drawCount = 1;
+  }
+}
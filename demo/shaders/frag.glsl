@@ -1,8 +1,39 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec4 inColour;
+layout(location = 1) in vec2 inUV;
 layout(location = 0) out vec4 outColor;
 
+// The bindless heap (see bindless.h), every draw picks from it by index
+layout(set = 0, binding = 0) uniform sampler2D textures[];
+
+struct Material {
+  vec4 tint;
+};
+
+layout(set = 0, binding = 1, std430) readonly buffer MaterialBuffer {
+  Material materials[];
+} buffers[];
+
+layout(push_constant) uniform DrawConstants {
+  uint materials;
+  uint material;
+  uint texture;
+} draw;
+
+const uint BINDLESS_NONE = 0xffffffffu;
+
 void main() {
-  outColor = inColour;
+  vec4 colour = inColour;
+
+  // The indices are the same for the whole draw, so no nonuniformEXT
+  if (draw.materials != BINDLESS_NONE) {
+    colour *= buffers[draw.materials].materials[draw.material].tint;
+  }
+  if (draw.texture != BINDLESS_NONE) {
+    colour *= texture(textures[draw.texture], inUV);
+  }
+
+  outColor = colour;
 }
@@ -3,9 +3,30 @@
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColour;
 
+// Per-instance, locations 2 to 5 are the columns of the transform
+layout(location = 2) in mat4 inTransform;
+layout(location = 6) in vec4 inInstanceColour;
+
 layout(location = 0) out vec4 outColour;
+layout(location = 1) out vec2 outUV;
+
+// Written by the CPU every frame, see uniforms.h. Set 0 is the bindless heap.
+layout(set = 1, binding = 0) uniform FrameUniforms {
+  mat4 viewProjection;
+  float time;
+  float deltaTime;
+} frame;
+
+// Per draw, after the fragment stage's DrawConstants
+layout(push_constant) uniform ObjectConstants {
+  layout(offset = 16) mat4 model;
+} object;
 
 void main() {
-  gl_Position = vec4(inPosition, 0.0, 1.0);
-  outColour = vec4(inColour, 1.0);
+  gl_Position = frame.viewProjection * object.model * inTransform *
+                vec4(inPosition, 0.0, 1.0);
+  outColour = vec4(inColour, 1.0) * inInstanceColour;
+  // There are no texture coordinates in Vertex, so textures are mapped
+  // across the mesh's own -1 to 1 square
+  outUV = inPosition * 0.5 + 0.5;
 }
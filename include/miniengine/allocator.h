@@ -0,0 +1,122 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace MiniEngine {
+
+// How an allocation is placed inside a block.
+// FreeList: general purpose, allocations can be freed in any order and their
+// space is reused (best-fit with neighbour coalescing).
+// Linear: bump allocation for short lived data such as staging buffers. Space
+// is only reclaimed once every allocation in the block has been freed, at
+// which point the block rewinds to the start.
+enum class AllocationStrategy { FreeList, Linear };
+
+// What kind of resource will be bound to the memory. Vulkan requires linear
+// resources (buffers, linear images) and optimal images to be separated by
+// `bufferImageGranularity` when they share a block.
+enum class ResourceKind { Linear, Optimal };
+
+struct MemoryBlock;
+
+// A sub-range of a VkDeviceMemory block. Bind with
+// `vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset)`.
+struct Allocation {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  void *mapped = nullptr; // Only set for host-visible memory (kept mapped)
+  uint32_t memoryType = 0;
+
+  MemoryBlock *block = nullptr; // Null for dedicated allocations
+
+  bool IsValid() const { return memory != VK_NULL_HANDLE; }
+};
+
+struct MemoryTypeStats {
+  uint32_t blockCount = 0;      // Number of vkAllocateMemory calls alive
+  uint32_t allocationCount = 0; // Number of sub-allocations alive
+  VkDeviceSize reservedBytes = 0; // Bytes allocated from the driver
+  VkDeviceSize usedBytes = 0;     // Bytes handed out to resources
+};
+
+struct AllocatorStats {
+  std::array<MemoryTypeStats, VK_MAX_MEMORY_TYPES> memoryTypes{};
+  MemoryTypeStats total{};
+
+  uint32_t maxMemoryAllocationCount = 0; // Device limit, for comparison
+  uint64_t deviceAllocationCalls = 0;    // Lifetime vkAllocateMemory count
+};
+
+// A device memory allocator that carves resources out of large blocks per
+// memory type, rather than calling vkAllocateMemory for every buffer (which
+// is slow and limited by `maxMemoryAllocationCount`).
+class GpuAllocator {
+public:
+  GpuAllocator();
+  ~GpuAllocator();
+
+  GpuAllocator(const GpuAllocator &) = delete;
+  GpuAllocator &operator=(const GpuAllocator &) = delete;
+
+  void Init(VkPhysicalDevice physicalDevice, VkDevice device,
+            const VkAllocationCallbacks *hostCallbacks);
+  void Destroy();
+
+  // Uses the memory properties cached in `Init`, so this is cheap to call.
+  uint32_t FindMemoryType(uint32_t typeFilter,
+                          VkMemoryPropertyFlags properties) const;
+
+  Allocation Allocate(const VkMemoryRequirements &requirements,
+                      VkMemoryPropertyFlags properties,
+                      ResourceKind kind = ResourceKind::Linear,
+                      AllocationStrategy strategy = AllocationStrategy::FreeList);
+
+  void Free(Allocation &allocation);
+
+  AllocatorStats GetStats() const;
+
+  const VkPhysicalDeviceMemoryProperties &GetMemoryProperties() const {
+    return memoryProperties;
+  }
+
+  const VkPhysicalDeviceProperties &GetDeviceProperties() const {
+    return deviceProperties;
+  }
+
+private:
+  VkDeviceSize GetBlockSize(uint32_t memoryType) const;
+
+  MemoryBlock *CreateBlock(uint32_t memoryType, VkDeviceSize size,
+                           AllocationStrategy strategy);
+  void DestroyBlock(MemoryBlock *block);
+
+  VkDeviceMemory AllocateDeviceMemory(uint32_t memoryType, VkDeviceSize size,
+                                      void **mapped);
+
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *hostCallbacks = nullptr;
+  VkPhysicalDeviceMemoryProperties memoryProperties{};
+  VkPhysicalDeviceProperties deviceProperties{};
+  VkDeviceSize bufferImageGranularity = 1;
+
+  // Blocks per memory type. unique_ptr keeps the addresses stable so
+  // `Allocation::block` can point straight at them.
+  std::array<std::vector<std::unique_ptr<MemoryBlock>>, VK_MAX_MEMORY_TYPES>
+      blocks;
+
+  // Allocations too large to share a block get their own VkDeviceMemory.
+  std::map<VkDeviceMemory, Allocation> dedicated;
+
+  AllocatorStats stats{};
+
+  mutable std::mutex mutex;
+};
+
+} // namespace MiniEngine
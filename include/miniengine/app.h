@@ -1,11 +1,37 @@
+#pragma once
+
 #define GLFW_INCLUDE_VULKAN
 
+#include <miniengine/allocator.h>
+#include <miniengine/bindless.h>
+#include <miniengine/culling.h>
+#include <miniengine/ecs.h>
+#include <miniengine/host_memory.h>
+#include <miniengine/init_graph.h>
+#include <miniengine/jobs.h>
+#include <miniengine/mesh.h>
+#include <miniengine/package.h>
+#include <miniengine/pipeline_cache.h>
+#include <miniengine/pipeline_registry.h>
+#include <miniengine/profiler.h>
+#include <miniengine/recording.h>
+#include <miniengine/render_graph.h>
+#include <miniengine/shaders.h>
+#include <miniengine/sprites.h>
+#include <miniengine/staging.h>
+#include <miniengine/textures.h>
+#include <miniengine/uniforms.h>
+#include <miniengine/upload.h>
+#include <miniengine/vertex_layout.h>
+
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <vulkan/vulkan.h>
 
+#include <array>
 #include <chrono>
 #include <optional>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -25,12 +51,70 @@ constexpr bool enableValidationLayers = false;
 constexpr bool enableValidationLayers = true;
 #endif
 
-constexpr int MAX_FRAMES_IN_FLIGHT = 2;
+// Upper limit for FramePacing::framesInFlight
+constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 4;
+
+// On-demand frames drawn after the last change, so what lags it by a frame or
+// two (ImGui's layout, pipeline swaps, uploads landing) still gets shown
+constexpr uint32_t ON_DEMAND_SETTLE_FRAMES = 3;
+
+// Dynamic resolution moves the render scale this fraction of the way to what
+// the last measured frame asks for, in steps this big, so the extent (and the
+// transient images made for it) doesn't change every frame
+constexpr float RENDER_SCALE_RESPONSE = 0.2f;
+constexpr float RENDER_SCALE_STEP = 0.05f;
+
+// Per-frame staging space for dynamic uploads (see StagingRing)
+constexpr VkDeviceSize STAGING_RING_FRAME_SIZE = 4 * 1024 * 1024;
+
+// Each frame's ScratchArena starts this big, and grows if a frame needs more
+constexpr size_t FRAME_SCRATCH_SIZE = 64 * 1024;
+
+// Benchmark frames not counted towards heapAllocationsPerFrame, while pools
+// and arenas grow to what the scene needs
+constexpr uint32_t BENCHMARK_WARMUP_FRAMES = 16;
+
+// Resize events are coalesced until the window has stopped changing size for
+// this long, or one has been pending for the maximum delay. Out of date
+// swapchains are always recreated straight away.
+constexpr double RESIZE_DEBOUNCE_MS = 50.0;
+constexpr double RESIZE_MAX_DELAY_MS = 250.0;
+
+// Where compiled pipelines are kept between runs (see PipelineCache)
+const std::string PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+// Compiled SPIR-V keyed by a hash of its GLSL, see shaders.h
+const std::string SHADER_CACHE_DIRECTORY = "shader_cache";
+// Where in a package the scene is loaded from, see tools/pack.cpp
+const std::string SCENE_MESH_ASSET = "meshes/scene";
+
+// Capacity of the GPU-resident instance buffer and the indirect draw buffer
+constexpr uint32_t MAX_INSTANCES = 128 * 1024;
+constexpr uint32_t MAX_INDIRECT_DRAWS = 64;
+
+// Quads the sprite batch takes per frame, see SpriteBatch
+constexpr uint32_t SPRITE_MAX_QUADS = 128 * 1024;
+
+// FrameUniforms blocks per frame, see UniformRing. The scene and the sprites
+// take one each.
+constexpr uint32_t UNIFORM_BLOCKS_PER_FRAME = 16;
+
+// Components of the scene's entities, see World. Positions and sizes are in
+// clip space, like the instances the entities become.
+struct Transform2D {
+  glm::vec2 position;
+  glm::vec2 scale;
+  float rotation; // Radians
+};
 
-#define SHADER_FLOAT VK_FORMAT_R32_SFLOAT
-#define SHADER_VEC2 VK_FORMAT_R32G32_SFLOAT
-#define SHADER_VEC3 VK_FORMAT_R32G32B32_SFLOAT
-#define SHADER_VEC4 VK_FORMAT_R32G32B32A32_SFLOAT
+struct Tint {
+  glm::vec4 colour;
+};
+
+// Radians per second. Only some entities spin, so the scene is two
+// archetypes.
+struct Spin {
+  float speed;
+};
 
 // NOLINTNEXTLINE
 static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(
@@ -42,66 +126,190 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(
 static void FramebufferResizeCallback(GLFWwindow *window, int width,
                                       int height);
 
+// Every input callback, see FramePacing::onDemand
+// NOLINTNEXTLINE
+static void MarkInput(GLFWwindow *window);
+
+// 8 bytes rather than the 20 that full floats would take. The shader still
+// reads a vec2 and a vec3, see vertex_layout.h.
 struct Vertex {
-  glm::vec2 pos;
-  glm::vec3 colour;
-
-  static VkVertexInputBindingDescription GetBindingDescription() {
-    VkVertexInputBindingDescription bindingDescription{};
-    bindingDescription.binding = 0; // This is like the index of the buffer.
-    bindingDescription.stride = sizeof(Vertex); // Same as OpenGL.
-    bindingDescription.inputRate =
-        VK_VERTEX_INPUT_RATE_VERTEX; // Move to the next data entry after each
-                                     // vertex, not after each instance.
-
-    return bindingDescription;
+  Half2 pos;
+  UNorm8x4 colour; // The alpha byte isn't read
+
+  static constexpr auto Attributes() {
+    return std::array{VERTEX_ATTRIBUTE(Vertex, pos, 0),
+                      VERTEX_ATTRIBUTE(Vertex, colour, 1)};
   }
 
-  static std::array<VkVertexInputAttributeDescription, 2>
-  GetAttributeDescriptions() {
-    std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
-
-    // Position attribute
-    attributeDescriptions[0].binding = 0; // This is the index of the buffer.
-    attributeDescriptions[0].location =
-        0; // This is the location in the shader.
-    attributeDescriptions[0].format = SHADER_VEC2; // 2x32-bit float. (vec2)
-    attributeDescriptions[0].offset =
-        offsetof(Vertex, pos); // Offset of the data.
-
-    // Colour attribute
-    attributeDescriptions[1].binding = 0; // This is the index of the buffer.
-    attributeDescriptions[1].location =
-        1; // This is the location in the shader.
-    attributeDescriptions[1].format = SHADER_VEC3; // 3x32-bit float. (vec3)
-    attributeDescriptions[1].offset =
-        offsetof(Vertex, colour); // Offset of the data.
-
-    return attributeDescriptions;
+  static constexpr Vertex Make(glm::vec2 pos, glm::vec3 colour) {
+    return {PackHalf2(pos), PackUNorm8x4(colour)};
   }
 };
 
+// Per-instance data, read from a second vertex buffer that only advances once
+// per instance. This is what lets a single draw place thousands of copies of
+// the same mesh. Also read by cull.glsl, which has to agree on the layout.
+struct InstanceData {
+  glm::mat4 transform; // Locations 2 to 5, one per column
+  glm::vec4 colour;    // Multiplied with the vertex colour
+
+  static constexpr auto Attributes() {
+    return std::array{VERTEX_ATTRIBUTE(InstanceData, transform, 2),
+                      VERTEX_ATTRIBUTE(InstanceData, colour, 6)};
+  }
+};
+
+// The demo mesh, it goes through the same optimisation and index type
+// selection as a loaded one would (see LoadSceneMesh)
 constexpr std::array<Vertex, 4> vertices = {
-    Vertex{{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
-    Vertex{{0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
-    Vertex{{0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
-    Vertex{{-0.5f, 0.5f}, {1.0f, 1.0f, 1.0f}}};
+    Vertex::Make({-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}),
+    Vertex::Make({0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}),
+    Vertex::Make({0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}),
+    Vertex::Make({-0.5f, 0.5f}, {1.0f, 1.0f, 1.0f})};
+
+constexpr std::array<uint32_t, 6> indices = {0, 1, 2, 2, 3, 0};
+
+enum class DrawMode {
+  Indirect,   // Commands (and their count) read from GPU memory
+  Instanced,  // One instanced draw from the CPU
+  PerInstance, // One draw per instance, this is what is heavy to record
+  GpuCulled    // A compute pass culls the instances and writes the command
+};
 
-constexpr std::array<uint16_t, 6> indices = {0, 1, 2, 2, 3, 0};
+// How frames are paced, trading latency for throughput. Fewer frames in flight
+// and a late latch mean less time between reading input and the frame that
+// uses it reaching the screen, more frames in flight keep a slow GPU busier.
+struct FramePacing {
+  // How many frames the CPU may get ahead of the GPU, 1 to
+  // MAX_FRAMES_IN_FLIGHT
+  uint32_t framesInFlight = 2;
+
+  // Falls back to FIFO (which every device supports) if it isn't available
+  VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+
+  // Swapchain images, 0 asks for one more than the surface's minimum. Clamped
+  // to what the surface supports.
+  uint32_t swapchainImages = 0;
+
+  // Frames per second to cap at, 0 for no limit
+  double frameRateLimit = 0.0;
+
+  // Wait for the frame's GPU work to finish before polling input rather than
+  // after, so the input isn't stale by the time it is used
+  bool lateLatch = false;
+
+  // Only draw a frame when something has changed (input, animation, uploads
+  // and texture streaming, or a shader reload) and sleep in
+  // glfwWaitEventsTimeout in between. Benchmarks always draw every frame.
+  bool onDemand = false;
+  // With onDemand, the most frames per second drawn for anything but input,
+  // which is also how often the loop wakes to look for background work
+  double idleFrameRate = 10.0;
+};
+
+// What resolution the scene is drawn at, and with how many samples. Below a
+// scale of 1 it is drawn into an image of its own and blitted up to the
+// swapchain, the UI is always drawn at the swapchain's resolution.
+struct RenderResolution {
+  // Of the swapchain's width and height, 1 draws straight into it. Stays at
+  // 1 if the swapchain format can't be blitted.
+  float scale = 1.0f;
+
+  // GPU milliseconds per frame to keep to by changing the scale every
+  // frame, down to minScale. 0 keeps it where `scale` puts it.
+  double targetGpuMs = 0.0;
+  float minScale = 0.5f;
+
+  // MSAA, 1 for none. Rounded down to what the device supports.
+  uint32_t msaaSamples = 1;
+};
+
+// Options picked on the command line, see main.cpp and bench/bench.cpp
+struct AppConfig {
+  // Run a fixed number of frames of a recording heavy scene then report how
+  // long each recording thread took
+  bool benchmark = false;
+  uint32_t benchmarkFrames = 1000;
+
+  // The benchmark's scene
+  DrawMode benchmarkDrawMode = DrawMode::PerInstance;
+  uint32_t benchmarkInstances = MAX_INSTANCES;
+  // Streamed through the staging ring every frame
+  uint32_t benchmarkUploadsPerFrame = 0;
+  uint32_t benchmarkUploadSize = 4096;
+  // Recreate the swapchain (or offscreen targets) every this many frames
+  uint32_t benchmarkRecreateInterval = 0;
+  // Sprites submitted to the sprite batch every frame
+  uint32_t benchmarkSprites = 0;
+
+  // Render into offscreen images instead of a window. There is no swapchain,
+  // no UI and no GLFW at all, so this implies `benchmark`.
+  bool headless = false;
+  uint32_t headlessWidth = 1280;
+  uint32_t headlessHeight = 720;
+
+  // Worker threads for the job scheduler, 0 picks one per core
+  uint32_t workerThreads = 0;
+
+  // Keep to render passes, framebuffers and vkCmdPipelineBarrier even on a
+  // Vulkan 1.3 device
+  bool legacyRendering = false;
+
+  // Load shaders and the scene from this package rather than loose files
+  std::string packagePath;
+
+  // Images loaded on top of the package's textures, see TextureStreamer
+  std::vector<std::string> texturePaths;
+  // What streamed textures may use of device memory
+  uint32_t textureBudgetMiB = 256;
+
+  FramePacing pacing;
+  RenderResolution resolution;
+};
+
+// What a benchmark run measured, every time is in milliseconds
+struct BenchmarkResults {
+  uint32_t frames = 0;
+  double seconds = 0.0;
+  double frameMean = 0.0;
+  ProfilePercentiles frame; // Whole frames, start to start
+  double recordMean = 0.0;  // CPU time spent recording each frame
+  // Everything that went through the staging ring and the upload engine
+  double uploadMiBPerSecond = 0.0;
+  // Input to GPU done, over the profiler's history (see Profiler)
+  ProfilePercentiles latency;
+  uint32_t recreates = 0;
+  double recreateMean = 0.0;
+  // Global operator new calls per frame after BENCHMARK_WARMUP_FRAMES, not
+  // counting swapchain recreation. Zero in a steady state.
+  double heapAllocationsPerFrame = 0.0;
+};
 
 class App {
 public:
-  App();
+  App(const AppConfig &config = {});
   ~App();
 
   void Run();
 
+  // The engine's shared worker threads, subsystems schedule their work here
+  // rather than spawning threads of their own
+  JobScheduler &GetJobs() { return jobs; }
+
+  // Filled in once a benchmark run has finished
+  const BenchmarkResults &GetBenchmarkResults() const {
+    return benchmarkResults;
+  }
+
   bool framebufferResized = false;
+  // Set by the input callbacks, wakes an on-demand loop straight away
+  bool inputReceived = false;
 
 private:
   // Member functions
+  // Everything up to the first frame but ImGui, as an InitGraph
+  void Init();
   void InitWindow();
-  void InitVulkan();
   void CreateInstance();
   void SetupDebugMessenger();
   void PopulateDebugMessengerCreateInfo(
@@ -109,27 +317,102 @@ private:
   void CreateSurface();
   void PickPhysicalDevice();
   void CreateLogicalDevice();
+  void CreateAllocator();
+  void CreateUploadEngine();
+  void OpenPackage();
+  void CreatePipelineCache();
+  void CreateShaderManager();
+  void CreateProfiler();
+  // Needed by the pipeline layout, so before any pipeline
+  void CreateBindlessHeap();
+  void CreateUniformRing();
+  void CreateRenderGraph();
+  // Kept for every swapchain after, so it is all the pipelines need
+  void ChooseSwapchainFormat();
   void CreateSwapchain();
+  void CreateOffscreenTargets();
   void CreateImageViews();
   void CreateRenderPass();
+  // What pipelines drawing `samples` sample attachments are built against,
+  // made the first time it is asked for. Null with dynamic rendering.
+  VkRenderPass GetCompatibleRenderPass(VkSampleCountFlagBits samples);
   void CreateGraphicsPipeline();
-  void CreateFramebuffers();
   void CreateCommandPool();
+  void CreateParallelRecorder();
+  // Optimises the scene mesh and picks its index type
+  void LoadSceneMesh();
   void CreateVertexBuffer();
   void CreateIndexBuffer();
+  void CreateInstanceBuffer();
+  void CreateIndirectBuffer();
+  void CreateMaterialBuffer();
+  void CreateCullingBuffers();
+  // The compute pipeline, once the culling buffers exist
+  void CreateCuller();
+  void CreateSpriteBatch();
+  void CreateBenchmarkUploadBuffer();
+  void CreateStagingRing();
+  // Loads every texture in the package and config.texturePaths
+  void CreateTextureStreamer();
   void CreateCommandBuffers();
   void CreateSyncObjects();
   void CleanupSwapchain();
   void RecreateSwapchain();
+  // Hands the current swapchain and everything made from it over to be
+  // destroyed once no frame in flight can be using them
+  void RetireSwapchain();
+  void CollectRetiredSwapchains();
   void SetupImGui();
+  void BuildImGui();
+  // The demo's sprites, a wobbling grid of spriteCount quads
+  void SubmitSprites();
+  // Writes this frame's camera and time for the scene and the sprites, and
+  // advances the scene's animation
+  void UpdateUniforms();
+  // The camera's, which is also what the scene is culled against
+  glm::mat4 GetViewProjection() const;
+  // The scene's per draw transform, spun around the middle of the screen
+  glm::mat4 GetSceneTransform() const;
+  // Gives each texture a heap slot once it has a view, and points the slot
+  // at the new view whenever streaming replaces it
+  void UpdateTextureSlots();
+  // BINDLESS_NONE for no texture or one without a view yet
+  uint32_t GetTextureSlot(int texture) const;
+  // Waits for the current frame's previous use to finish on the GPU
+  void WaitForFrame();
+  // The most samples the device has up to `requested`
+  VkSampleCountFlagBits ChooseSampleCount(uint32_t requested) const;
+  // Starts compiling the scene's pipelines for `samples`, the frames switch
+  // over once they are ready
+  void SetSampleCount(VkSampleCountFlagBits samples);
+  // scenePipeline for sceneDesc and additiveBlending
+  void SelectScenePipeline();
+  // Picks this frame's render extent from config.resolution (and the GPU
+  // time measured for earlier frames), and swaps in the pipelines for a new
+  // sample count once they have compiled
+  void UpdateRenderResolution();
+  // Rebuilds the pipelines whose shaders were edited, between frames
+  void ReloadShaders();
   void DrawFrame();
+  // Sleeps until it is time to start the next frame
+  void LimitFrameRate();
+  // Sleeps in glfwWaitEventsTimeout until there is something new to draw,
+  // see FramePacing::onDemand. False if the window was closed meanwhile.
+  bool WaitForRedraw();
+  // Whether anything but input changes what is on screen: animation,
+  // uploads, texture streaming and pipelines being compiled
+  bool NeedsRedraw();
   void MainLoop();
+  void ReportBenchmark(uint32_t frames, double seconds,
+                       std::vector<double> &frameTimes);
   void Cleanup();
 
   // Helper functions
   bool CheckValidationLayerSupport();
   bool CheckDeviceExtensionSupport(VkPhysicalDevice device);
   std::vector<const char *> GetRequiredExtensions();
+  // Headless runs don't need a swapchain
+  std::vector<const char *> GetDeviceExtensions();
 
   // NOTE: This is a Vulkan extension function, but it is not defined in the
   // Vulkan headers. This is a proxy function that will load the function if it
@@ -148,10 +431,19 @@ private:
                                      const VkAllocationCallbacks *pAllocator);
 
   int RateDeviceSuitability(VkPhysicalDevice device);
+  // Whether the device has dynamic rendering and synchronization2, which
+  // the render graph and submission use when it does
+  bool SupportsVulkan13(VkPhysicalDevice device);
 
   struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily = std::nullopt;
     std::optional<uint32_t> presentFamily = std::nullopt;
+    // Always set once graphicsFamily is, falls back to the graphics family
+    // when the device has no separate transfer family.
+    std::optional<uint32_t> transferFamily = std::nullopt;
+    // Index of the transfer queue within its family, this is 1 rather than 0
+    // when sharing the graphics family (if it has a spare queue).
+    uint32_t transferQueueIndex = 0;
 
     bool IsComplete() {
       return graphicsFamily.has_value() && presentFamily.has_value();
@@ -176,44 +468,258 @@ private:
 
   VkExtent2D ChooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities);
 
-  std::vector<char> ReadFile(const std::string &filename);
-
-  VkShaderModule CreateShaderModule(const std::vector<char> &code);
-
   void RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
-
-  uint32_t FindMemoryType(uint32_t typeFilter,
-                          VkMemoryPropertyFlags properties);
+  // The render graph's scene pass: the scene, sprites and (drawing straight
+  // into the backbuffer) the UI as secondaries
+  void RecordRenderPass(const RenderPassContext &context);
+  // Records instances [firstInstance, firstInstance + count) of the scene
+  // into a secondary command buffer
+  void RecordScene(VkCommandBuffer commandBuffer, uint32_t firstInstance,
+                   uint32_t count);
 
   void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
                     VkMemoryPropertyFlags properties, VkBuffer &buffer,
-                    VkDeviceMemory &bufferMemory);
+                    Allocation &bufferAllocation,
+                    AllocationStrategy strategy = AllocationStrategy::FreeList);
 
-  void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+  void DestroyBuffer(VkBuffer &buffer, Allocation &bufferAllocation);
+
+  // Lays `count` entities out in a grid and streams their instances, along
+  // with the matching indirect command, to the GPU
+  void UploadInstances(uint32_t count);
+  // Every entity's InstanceData, and bounding sphere if `bounds` isn't null,
+  // written on the job scheduler in the world's iteration order
+  void ExtractInstances(InstanceData *instances, glm::vec4 *bounds);
+  // Spins the entities that have a Spin and extracts them into this frame's
+  // region of entityInstanceBuffer, when they are animated
+  void UpdateEntities();
 
   // Data members
+  AppConfig config;
+
+  // Host memory for the Vulkan objects created here, first so it outlives
+  // every one of them
+  HostAllocator hostAllocator;
+  const VkAllocationCallbacks *hostCallbacks = hostAllocator.GetCallbacks();
+
+  JobScheduler jobs;
+
+  // CPU scopes and GPU timestamps, shown in the Controls window
+  Profiler profiler;
+
   std::chrono::time_point<std::chrono::high_resolution_clock> startTime;
+  // How long each step of Init took, and when the first frame was presented
+  // (from startTime)
+  InitGraph startup;
+  double firstFrameMs = 0.0;
 
-  GLFWwindow *window;
+  GLFWwindow *window = nullptr;
   VkInstance instance;
   VkDebugUtilsMessengerEXT debugMessenger;
   VkPhysicalDevice physicalDevice;
   VkDevice device;
   VkQueue graphicsQueue;
   VkQueue presentQueue;
-  VkSurfaceKHR surface;
-  VkSwapchainKHR swapchain;
+  VkQueue transferQueue;
+  QueueFamilyIndices queueFamilies;
+  VkSurfaceKHR surface = VK_NULL_HANDLE;
+  VkSwapchainKHR swapchain = VK_NULL_HANDLE;
   VkFormat swapchainImageFormat;
+  VkColorSpaceKHR swapchainColorSpace;
   VkExtent2D swapchainExtent;
-  VkRenderPass renderPass;
+  // Only without dynamic rendering, see CreateRenderPass
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+  // The same for multisampled attachments, by log2 of the sample count
+  std::array<VkRenderPass, 7> msaaRenderPasses{};
+  // Set 0 is the bindless heap and set 1 the frame's uniforms. DrawConstants
+  // and ObjectConstants are pushed per draw.
   VkPipelineLayout pipelineLayout;
-  VkPipeline pipeline;
+  BindlessHeap bindless;
+  UniformRing uniforms;
+  uint32_t sceneUniforms = 0;   // This frame's blocks in uniforms
+  uint32_t overlayUniforms = 0; // Identity, for the sprites
+  // Rebuilt every frame in RecordCommandBuffer
+  RenderGraph graph;
+  PipelineCache pipelineCache;
+  ShaderManager shaders;
+
+  // Every graphics pipeline lives in here, see pipeline_registry.h
+  PipelineRegistry pipelines;
+  PipelineDesc sceneDesc;
+  PipelineHandle defaultPipeline; // Always ready, the fallback for variants
+  PipelineHandle scenePipeline;   // What the scene is drawn with
+  VkPipeline framePipeline = VK_NULL_HANDLE; // scenePipeline for this frame
+  bool additiveBlending = false;
   VkCommandPool commandPool;
 
+  // See RenderResolution. The scene is drawn at renderExtent with
+  // activeSamples, and sceneDesc and defaultPipeline are for those samples.
+  VkExtent2D renderExtent = {};
+  float renderScale = 1.0f;  // What renderExtent was made from
+  float dynamicScale = 1.0f; // Dynamic resolution's, before rounding
+  VkSampleCountFlagBits activeSamples = VK_SAMPLE_COUNT_1_BIT;
+  VkSampleCountFlags supportedSamples = VK_SAMPLE_COUNT_1_BIT;
+  // A sample count waiting for its default pipeline to compile
+  VkSampleCountFlagBits pendingSamples = VK_SAMPLE_COUNT_1_BIT;
+  PipelineDesc pendingDesc;
+  PipelineHandle pendingDefault;
+  // Whether the swapchain format can be blitted (and filtered linearly), and
+  // the swapchain images blitted to. Without both the scale stays at 1.
+  bool blitSupported = false;
+  VkFilter blitFilter = VK_FILTER_NEAREST;
+  bool swapchainTransferDst = false;
+  // The oldest frame (a profiler frame number) whose GPU time dynamic
+  // resolution can still go by: drawn at the current extent, and not
+  // already used
+  uint64_t renderScaleFrame = 0;
+  // The latest measurement dynamic resolution went by, for the UI
+  double sceneGpuMs = 0.0;
+  double frameGpuMs = 0.0;
+  // Set while recording, whether the scene pass also draws the UI
+  bool uiInScenePass = true;
+
+  // Records the scene and the UI into secondary command buffers, which the
+  // frame's primary command buffer then executes
+  ParallelRecorder recorder;
+
+  // Sub-allocates device memory for every buffer, see allocator.h
+  GpuAllocator allocator;
+
   VkBuffer vertexBuffer;
-  VkDeviceMemory vertexBufferMemory;
+  Allocation vertexBufferAllocation;
   VkBuffer indexBuffer;
-  VkDeviceMemory indexBufferMemory;
+  Allocation indexBufferAllocation;
+
+  // What the vertex and index buffers are made from. The bytes point into
+  // either sceneMesh or the package's mapping, so a packaged scene goes
+  // straight from the file to staging memory.
+  Mesh<Vertex> sceneMesh;
+  IndexData sceneIndices;
+  std::span<const std::byte> sceneVertexBytes;
+  std::span<const std::byte> sceneIndexBytes;
+  // Packed meshes aren't the quad the vertex editor knows about
+  bool scenePackaged = false;
+
+  // Stays mapped for the whole run, see package.h
+  AssetPackage package;
+
+  // Per-instance transforms and colours (binding 1), and the draw commands
+  // that consume them. The commands live on the GPU so a compute pass can
+  // write them without the CPU looping over objects.
+  VkBuffer instanceBuffer;
+  Allocation instanceBufferAllocation;
+
+  // The scene's objects, which become the instances above
+  World world;
+  // Host-visible, a region of MAX_INSTANCES per frame in flight. Animated
+  // entities are extracted straight into it every frame and drawn from
+  // there, so moving them never goes through a copy.
+  VkBuffer entityInstanceBuffer;
+  Allocation entityInstanceBufferAllocation;
+  VkDeviceSize entityInstanceOffset = 0; // This frame's region
+  bool animateEntities = false;
+  bool entitiesExtracted = false; // This frame, the draws read the region
+  VkBuffer indirectBuffer; // VkDrawIndexedIndirectCommand[MAX_INDIRECT_DRAWS]
+  Allocation indirectBufferAllocation;
+  VkBuffer drawCountBuffer; // A single uint32_t, for the draw-indirect-count
+  Allocation drawCountBufferAllocation;
+
+  // Every Material, read through the bindless heap by the scene and sprites
+  VkBuffer materialBuffer;
+  Allocation materialBufferAllocation;
+  uint32_t materialBufferSlot = BINDLESS_NONE;
+  // What the scene is drawn with, a material and an index into
+  // textureHandles (-1 for none)
+  int sceneMaterial = 0;
+  int sceneTexture = -1;
+
+  // What GPU culling reads and writes, see GpuCuller. It has a command and
+  // count of its own so the CPU-written ones above are left alone.
+  GpuCuller culler;
+  VkBuffer boundsBuffer; // vec4 bounding sphere per instance
+  Allocation boundsBufferAllocation;
+  VkBuffer visibleInstanceBuffer; // Compacted InstanceData, binding 1
+  Allocation visibleInstanceBufferAllocation;
+  VkBuffer culledIndirectBuffer; // A single VkDrawIndexedIndirectCommand
+  Allocation culledIndirectBufferAllocation;
+  VkBuffer culledDrawCountBuffer;
+  Allocation culledDrawCountBufferAllocation;
+  // Half extent of the box the culling frustum covers in clip space, so
+  // anything under 1 culls what is on screen, which is how the culling can
+  // be seen.
+  float cullFrustumSize = 1.0f;
+
+  // A 2D camera over the scene, which is laid out in clip space. Moving it
+  // only rewrites FrameUniforms.
+  glm::vec2 cameraPosition = glm::vec2(0.0f);
+  float cameraZoom = 1.0f;
+  // Spins the scene as a whole with its ObjectConstants
+  bool animateScene = false;
+  float sceneAngle = 0.0f; // Radians
+  float lastUniformTime = 0.0f;
+  float frameDeltaTime = 0.0f; // Seconds, set by UpdateUniforms
+
+  // 2D quads drawn over the scene, see sprites.h. The index buffer is shared
+  // by every frame and never changes.
+  SpriteBatch sprites;
+  VkBuffer spriteIndexBuffer;
+  Allocation spriteIndexBufferAllocation;
+  uint32_t spriteCount = 0;
+
+  // What was last uploaded, and so what gets culled and drawn. The slider
+  // has its own count until the edit is finished.
+  uint32_t instanceCount = 1;
+  uint32_t instanceSliderCount = 1;
+  DrawMode drawMode = DrawMode::Indirect;
+  // VK_KHR_draw_indirect_count is core but optional in Vulkan 1.2
+  bool drawIndirectCountSupported = false;
+  // Dynamic rendering and synchronization2, both core in Vulkan 1.3. Older
+  // drivers get render passes and the original barriers and submits.
+  bool vulkan13 = false;
+
+  // Streams static data in on the transfer queue, see upload.h
+  UploadEngine uploadEngine;
+  // The scene draws can't start until this has landed
+  UploadTicket geometryUpload;
+
+  // Dynamic uploads (e.g. vertex edits) go through here, recorded into the
+  // frame's own command buffer rather than a blocking CopyBuffer
+  StagingRing stagingRing;
+
+  // Stream in and out against the budget, each one's current view is in the
+  // bindless heap for the scene to sample
+  TextureStreamer textures;
+  std::vector<TextureHandle> textureHandles;
+  // Per handle, the heap slot and the view generation it points at
+  std::vector<uint32_t> textureSlots;
+  std::vector<uint32_t> textureGenerations;
+
+  uint32_t currentFrame = 0;
+  uint32_t framesInFlight = 2; // From config.pacing, fixed once running
+
+  // Per frame in flight, for what only lives until the frame's fence next
+  // signals. Reset in WaitForFrame.
+  ScratchArena frameArenas[MAX_FRAMES_IN_FLIGHT];
+  // Global operator new calls, see GetHeapAllocationCount
+  uint64_t frameHeapAllocations = 0; // Between the last two WaitForFrames
+  uint64_t lastHeapAllocationCount = 0;
+
+  // What the swapchain actually uses
+  VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+  // When the latest input was polled, for latency measurements
+  std::chrono::high_resolution_clock::time_point inputTime;
+  // When the frame limiter lets the next frame start
+  std::chrono::high_resolution_clock::time_point nextFrameDeadline;
+
+  // Benchmark bookkeeping, see BenchmarkResults
+  BenchmarkResults benchmarkResults;
+  double recordMs = 0.0;
+  double recreateMs = 0.0;
+  uint32_t recreates = 0;
+  // Destination of the per-frame benchmark uploads
+  VkBuffer benchmarkUploadBuffer = VK_NULL_HANDLE;
+  Allocation benchmarkUploadBufferAllocation;
+  std::vector<uint8_t> benchmarkUploadData;
 
   VkDescriptorPool imguiDescriptorPool;
   VkClearValue clearColor = {{{0.01f, 0.01f, 0.02f, 1.0f}}};
@@ -223,8 +729,38 @@ private:
 
   std::vector<VkImage> swapchainImages;
   std::vector<VkImageView> swapchainImageViews;
-
-  std::vector<VkFramebuffer> swapchainFramebuffers;
+  // Only used when headless, where the "swapchain" images are our own
+  std::vector<Allocation> offscreenAllocations;
+
+  // A swapchain that has been replaced, along with its views
+  struct RetiredSwapchain {
+    VkSwapchainKHR swapchain;
+    std::vector<VkImage> images; // Only destroyed when headless
+    std::vector<Allocation> allocations;
+    std::vector<VkImageView> imageViews;
+    uint64_t lastFrame; // Safe to destroy once this frame has completed
+  };
+  std::vector<RetiredSwapchain> retiredSwapchains;
+
+  // Frames are numbered from 1 as they are submitted. frameSerials holds the
+  // number of the frame last submitted from each slot.
+  uint64_t framesSubmitted = 0;
+  uint64_t framesCompleted = 0;
+  std::vector<uint64_t> frameSerials;
+
+  // On-demand frames still to draw for the last input and the last
+  // background change, see ON_DEMAND_SETTLE_FRAMES
+  uint32_t inputFrames = 0;
+  uint32_t idleFrames = 0;
+  std::chrono::high_resolution_clock::time_point nextIdleFrame;
+  uint64_t lastTextureProgress = 0; // Mips streamed and evicted
+  uint64_t framesDrawn = 0;         // Every DrawFrame, for the UI
+  double idleSeconds = 0.0;         // Spent in WaitForRedraw
+
+  // See RESIZE_DEBOUNCE_MS
+  bool resizePending = false;
+  std::chrono::high_resolution_clock::time_point resizeFirstEvent;
+  std::chrono::high_resolution_clock::time_point resizeLastEvent;
 
   // This semaphore will signal when the image is available to render to.
   std::vector<VkSemaphore> imageAvailableSemaphores;
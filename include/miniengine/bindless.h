@@ -0,0 +1,119 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace MiniEngine {
+
+// An index that refers to nothing, shaders check for it before indexing
+constexpr uint32_t BINDLESS_NONE = UINT32_MAX;
+
+// Slots in the heap, lowered to the device's limits if they are smaller
+constexpr uint32_t BINDLESS_MAX_TEXTURES = 4096;
+constexpr uint32_t BINDLESS_MAX_BUFFERS = 1024;
+
+// Bindings of the heap's set, see frag.glsl
+constexpr uint32_t BINDLESS_TEXTURE_BINDING = 0; // sampler2D textures[]
+constexpr uint32_t BINDLESS_BUFFER_BINDING = 1;  // readonly buffer ... []
+
+// Pushed per draw. Every index is a slot in the heap, so changing what a draw
+// reads is a push constant rather than a descriptor set bind.
+struct DrawConstants {
+  uint32_t materials = BINDLESS_NONE; // A buffer of Materials
+  uint32_t material = 0;              // Within it
+  uint32_t texture = BINDLESS_NONE;
+};
+
+// std430, one entry of a material buffer
+struct Material {
+  glm::vec4 tint = glm::vec4(1.0f);
+};
+
+struct BindlessStats {
+  uint32_t textures = 0;
+  uint32_t textureCapacity = 0;
+  uint32_t buffers = 0;
+  uint32_t bufferCapacity = 0;
+  uint64_t writes = 0; // Descriptor writes, counting each set separately
+};
+
+// Every texture and storage buffer the renderer reads, in one descriptor set
+// that is bound once per command buffer. Draws pick what they read by index
+// (see DrawConstants) instead of binding sets of their own, so the batched
+// and instanced paths never rebind anything.
+//
+// The bindings are partially bound (unused slots can stay empty) and update
+// after bind, so a slot can be written after the set has been bound, right up
+// to the frame's submission. There is one set per frame in flight: a write
+// goes into the set of the frame being recorded straight away, and into every
+// other set when its frame begins, once the GPU is done with it. A slot keeps
+// its index for good, only what it points at changes.
+class BindlessHeap {
+public:
+  void Init(VkPhysicalDevice physicalDevice, VkDevice device,
+            uint32_t frameCount, const VkAllocationCallbacks *hostCallbacks);
+  void Destroy();
+
+  // The layout of set 0 in any pipeline layout that reads the heap
+  VkDescriptorSetLayout GetSetLayout() const { return setLayout; }
+  // DrawConstants, for the fragment stage
+  static VkPushConstantRange GetPushConstantRange();
+
+  // BINDLESS_NONE once the heap is full. Call these before the first frame,
+  // or while recording a frame (between BeginFrame and its submission), and
+  // from one thread.
+  uint32_t AddTexture(VkImageView view, VkSampler sampler);
+  uint32_t AddBuffer(VkBuffer buffer, VkDeviceSize offset = 0,
+                     VkDeviceSize range = VK_WHOLE_SIZE);
+  void SetTexture(uint32_t index, VkImageView view, VkSampler sampler);
+
+  // Must be called after the frame's in flight fence has been waited on.
+  // Catches the frame's set up on the writes made since it was last used.
+  void BeginFrame(uint32_t frameIndex);
+
+  // Binds the current frame's set as set 0. Only reads, so it is safe from
+  // any recording thread.
+  void Bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint,
+            VkPipelineLayout layout) const;
+
+  BindlessStats GetStats() const;
+
+private:
+  struct PendingWrite {
+    uint32_t binding;
+    uint32_t index;
+    VkDescriptorImageInfo image;
+    VkDescriptorBufferInfo buffer;
+    uint32_t setsLeft; // A bit per frame set that hasn't had it yet
+  };
+
+  // Into the sets nothing can be using yet, queued for the others
+  void Write(const PendingWrite &write);
+  void Flush(uint32_t set);
+
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *hostCallbacks = nullptr;
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  std::vector<VkDescriptorSet> sets;
+
+  uint32_t textureCapacity = 0;
+  uint32_t bufferCapacity = 0;
+  uint32_t textureCount = 0;
+  uint32_t bufferCount = 0;
+
+  // The frame being recorded, until the first BeginFrame every set is idle
+  uint32_t currentSet = 0;
+  bool started = false;
+
+  // Kept between frames so the steady state doesn't allocate
+  std::vector<PendingWrite> pending;
+  std::vector<VkWriteDescriptorSet> writes;
+
+  uint64_t writeCount = 0;
+};
+
+} // namespace MiniEngine
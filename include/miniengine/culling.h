@@ -0,0 +1,76 @@
+#pragma once
+
+#include <miniengine/pipeline_cache.h>
+#include <miniengine/pipeline_registry.h>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include <string>
+
+namespace MiniEngine {
+
+// Instances per compute workgroup, has to match local_size_x in cull.glsl
+constexpr uint32_t CULL_WORKGROUP_SIZE = 64;
+
+// Push constants of cull.glsl, the layouts have to match
+struct CullParams {
+  // xyz is the inward facing normal, w the distance. A point is inside a plane
+  // when dot(normal, point) + w >= 0.
+  glm::vec4 planes[6];
+  uint32_t instanceCount;
+};
+
+// Buffers the culling pass reads and writes, they all need storage usage
+struct CullBuffers {
+  VkBuffer instances;        // InstanceData[], every instance
+  VkBuffer bounds;           // vec4[], bounding sphere per instance
+  VkBuffer visibleInstances; // InstanceData[], the ones that survived
+  VkBuffer commands;         // VkDrawIndexedIndirectCommand, also indirect
+  VkBuffer drawCount;        // uint32_t, also indirect
+};
+
+// Tests every instance's bounding sphere against the frustum in a compute
+// shader and packs the visible ones together, counting them into the draw
+// command's instance count. The scene is then one indirect draw of whatever
+// survived, without the CPU ever looking at an instance.
+class GpuCuller {
+public:
+  // The registry is only borrowed to load the shader
+  void Init(VkDevice device, PipelineRegistry &pipelines, PipelineCache &cache,
+            const std::string &shaderPath,
+            const VkAllocationCallbacks *hostCallbacks);
+  void Destroy();
+
+  // Points the descriptor set at the buffers, only call while no frame using
+  // them is in flight
+  void SetBuffers(const CullBuffers &buffers);
+
+  // Records the reset of the command and count, then the dispatch. Only the
+  // barrier between those two is recorded here, the caller (the render
+  // graph's culling pass) orders the whole thing against the draws reading the
+  // results, this frame's and the last. Must be recorded outside a render
+  // pass.
+  void Record(VkCommandBuffer commandBuffer, const glm::mat4 &viewProjection,
+              uint32_t instanceCount, uint32_t indexCount);
+
+  // Gribb and Hartmann's plane extraction, for Vulkan's 0 to 1 depth range
+  static void ExtractFrustumPlanes(const glm::mat4 &viewProjection,
+                                   glm::vec4 planes[6]);
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *hostCallbacks = nullptr;
+
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+
+  // Reset by Record before every dispatch
+  VkBuffer commands = VK_NULL_HANDLE;
+  VkBuffer drawCount = VK_NULL_HANDLE;
+};
+
+} // namespace MiniEngine
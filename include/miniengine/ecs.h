@@ -0,0 +1,276 @@
+#pragma once
+
+#include <miniengine/jobs.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace MiniEngine {
+
+// Components are plain data, moved around with memcpy and never destroyed,
+// so every one of them has to be trivially copyable
+constexpr uint32_t ECS_MAX_COMPONENTS = 64;
+using ComponentMask = uint64_t;
+
+// Entities live in fixed size chunks, one component array after another
+constexpr size_t ECS_CHUNK_SIZE = 16 * 1024;
+constexpr size_t ECS_CACHE_LINE = 64;
+
+// An index into the world's entities and the generation of that index it was
+// handed out with, so a handle to a destroyed entity stays invalid even once
+// its index is reused
+struct Entity {
+  uint32_t index = UINT32_MAX;
+  uint32_t generation = 0;
+
+  bool operator==(const Entity &) const = default;
+};
+
+constexpr Entity NULL_ENTITY = {};
+
+namespace detail {
+uint32_t NextComponentId();
+} // namespace detail
+
+// Handed out the first time each type is used, in whatever order that is
+template <typename T> uint32_t ComponentId() {
+  static const uint32_t id = detail::NextComponentId();
+  return id;
+}
+
+template <typename... Ts> ComponentMask ComponentMaskOf() {
+  return ((ComponentMask(1) << ComponentId<std::remove_const_t<Ts>>()) | ... |
+          ComponentMask(0));
+}
+
+struct WorldStats {
+  uint32_t entities = 0;
+  uint32_t archetypes = 0; // Including ones that are empty now
+  uint32_t chunks = 0;
+};
+
+// Entities grouped by archetype, the exact set of components they have. Each
+// archetype stores its entities in chunks of ECS_CHUNK_SIZE bytes as a
+// structure of arrays: one array per component, each starting on its own
+// cache line, so a system iterating a few components streams through exactly
+// the memory it reads and nothing else. An archetype's chunks are kept dense
+// (an entity leaving moves the last one into its place), so every chunk but
+// the last is full.
+//
+// Systems are written per chunk rather than per entity:
+//
+//   world.Each<Transform, const Velocity>(
+//       [](uint32_t first, uint32_t count, Transform *transforms,
+//          const Velocity *velocities) { ... });
+//
+// `first` is where the chunk starts among everything the call visits, which
+// lets a system write its own output (such as GPU instance data) in parallel
+// without any atomics. The visiting order is stable as long as no entity is
+// created, destroyed or changes archetype in between.
+//
+// A world is not thread safe, only the iteration fans out to other threads.
+class World {
+public:
+  World() = default;
+  ~World();
+
+  World(const World &) = delete;
+  World &operator=(const World &) = delete;
+
+  template <typename... Ts> Entity Create(const Ts &...components) {
+    (Register<Ts>(), ...);
+    Entity entity = NewEntity();
+    Place(entity, GetArchetype(ComponentMaskOf<Ts...>()));
+    (Write(entity, components), ...);
+    return entity;
+  }
+
+  void Destroy(Entity entity);
+  bool IsAlive(const Entity &entity) const;
+
+  // Null if the entity doesn't have it
+  template <typename T> T *Get(Entity entity) {
+    if (!IsAlive(entity)) {
+      return nullptr;
+    }
+    const Record &record = records[entity.index];
+    Archetype &archetype = *archetypes[record.archetype];
+    if (!(archetype.mask & ComponentMaskOf<T>())) {
+      return nullptr;
+    }
+    return Column<T>(archetype, archetype.chunks[record.chunk]) + record.row;
+  }
+
+  // Moves the entity to the archetype with T added, or overwrites its T
+  template <typename T> void Add(Entity entity, const T &component) {
+    Register<T>();
+    if (!IsAlive(entity)) {
+      return;
+    }
+    ComponentMask mask = archetypes[records[entity.index].archetype]->mask;
+    Move(entity, mask | ComponentMaskOf<T>());
+    Write(entity, component);
+  }
+
+  template <typename T> void Remove(Entity entity) {
+    if (!IsAlive(entity)) {
+      return;
+    }
+    ComponentMask mask = archetypes[records[entity.index].archetype]->mask;
+    Move(entity, mask & ~ComponentMaskOf<T>());
+  }
+
+  // Calls `function(first, count, Ts *...)` for every chunk whose entities
+  // have all of Ts. Const components are only read.
+  template <typename... Ts, typename F> void Each(F &&function) {
+    ComponentMask mask = ComponentMaskOf<Ts...>();
+    uint32_t first = 0;
+    for (const std::unique_ptr<Archetype> &archetype : archetypes) {
+      if ((archetype->mask & mask) != mask) {
+        continue;
+      }
+      for (Chunk &chunk : archetype->chunks) {
+        function(first, chunk.count, Column<Ts>(*archetype, chunk)...);
+        first += chunk.count;
+      }
+    }
+  }
+
+  // The same, with `chunksPerJob` chunks per job on the scheduler. Returns
+  // once every chunk has been visited. `function` is called from several
+  // threads at once, so it may only write to the chunk it is given (and to
+  // its own part of any output).
+  template <typename... Ts, typename F>
+  void ParallelEach(JobScheduler &jobs, F &&function,
+                    uint32_t chunksPerJob = 4) {
+    ComponentMask mask = ComponentMaskOf<Ts...>();
+    visits.clear();
+    uint32_t first = 0;
+    for (const std::unique_ptr<Archetype> &archetype : archetypes) {
+      if ((archetype->mask & mask) != mask) {
+        continue;
+      }
+      for (Chunk &chunk : archetype->chunks) {
+        visits.push_back({archetype.get(), &chunk, first});
+        first += chunk.count;
+      }
+    }
+
+    // Referenced by the jobs, so it has to outlive them
+    std::function<void(uint32_t, uint32_t)> job = [&](uint32_t begin,
+                                                      uint32_t end) {
+      for (uint32_t i = begin; i < end; i++) {
+        const Visit &visit = visits[i];
+        function(visit.first, visit.chunk->count,
+                 Column<Ts>(*visit.archetype, *visit.chunk)...);
+      }
+    };
+
+    JobCounter counter;
+    jobs.ParallelFor(static_cast<uint32_t>(visits.size()), chunksPerJob, job,
+                     counter);
+    jobs.Wait(counter);
+  }
+
+  // How many entities Each<Ts...> would visit
+  template <typename... Ts> uint32_t Count() const {
+    ComponentMask mask = ComponentMaskOf<Ts...>();
+    uint32_t count = 0;
+    for (const std::unique_ptr<Archetype> &archetype : archetypes) {
+      if ((archetype->mask & mask) == mask) {
+        count += archetype->count;
+      }
+    }
+    return count;
+  }
+
+  // Destroys every entity, the archetypes and their chunks are kept
+  void Clear();
+
+  WorldStats GetStats() const;
+
+private:
+  struct ComponentInfo {
+    uint32_t size = 0;
+  };
+
+  struct Chunk {
+    std::byte *data = nullptr;
+    uint32_t count = 0;
+  };
+
+  struct Archetype {
+    ComponentMask mask = 0;
+    uint32_t capacity = 0; // Entities per chunk
+    uint32_t count = 0;    // Entities across every chunk
+    // Per component id, where its array starts in a chunk. The entity
+    // handles, which a row needs to find its record when it moves, are at 0.
+    std::array<uint32_t, ECS_MAX_COMPONENTS> offsets{};
+    std::vector<Chunk> chunks;
+  };
+
+  // Where each entity index is stored
+  struct Record {
+    uint32_t generation = 0;
+    uint32_t archetype = 0;
+    uint32_t chunk = 0;
+    uint32_t row = 0;
+    bool alive = false;
+  };
+
+  struct Visit {
+    Archetype *archetype;
+    Chunk *chunk;
+    uint32_t first;
+  };
+
+  template <typename T> void Register() {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Components are copied with memcpy");
+    static_assert(alignof(T) <= ECS_CACHE_LINE);
+    components[ComponentId<T>()].size = sizeof(T);
+  }
+
+  template <typename T> static T *Column(Archetype &archetype, Chunk &chunk) {
+    return reinterpret_cast<T *>(
+        chunk.data +
+        archetype.offsets[ComponentId<std::remove_const_t<T>>()]);
+  }
+
+  template <typename T> void Write(Entity entity, const T &component) {
+    const Record &record = records[entity.index];
+    Archetype &archetype = *archetypes[record.archetype];
+    memcpy(Column<T>(archetype, archetype.chunks[record.chunk]) + record.row,
+           &component, sizeof(T));
+  }
+
+  Entity NewEntity();
+  // Created on first use, with every component in `mask` registered
+  uint32_t GetArchetype(ComponentMask mask);
+  // Gives the entity a row at the end of the archetype, uninitialised
+  void Place(Entity entity, uint32_t archetype);
+  // Takes the entity's row out, moving the archetype's last row into it
+  void Unplace(const Record &record);
+  // Changes the entity's archetype, keeping the components both share
+  void Move(Entity entity, ComponentMask mask);
+
+  std::array<ComponentInfo, ECS_MAX_COMPONENTS> components{};
+  std::vector<std::unique_ptr<Archetype>> archetypes;
+  std::unordered_map<ComponentMask, uint32_t> archetypeIndices;
+
+  std::vector<Record> records;
+  std::vector<uint32_t> freeIndices;
+  uint32_t entityCount = 0;
+
+  // Kept between calls so iterating doesn't allocate
+  std::vector<Visit> visits;
+};
+
+} // namespace MiniEngine
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace MiniEngine {
+
+// Every global operator new since the program started, on any thread. The
+// engine replaces operator new to count them, so the difference across a
+// frame shows whether the frame allocated at all.
+uint64_t GetHeapAllocationCount();
+
+// Linear memory for things that only live until the end of a frame. Each
+// allocation bumps a pointer and nothing is freed on its own: Reset hands
+// everything back at once, which is only safe once nothing (the GPU
+// included) can still be reading it. When a frame needs more than the arena
+// has another block is added, and kept, so after the first few frames it no
+// longer touches the heap.
+class ScratchArena {
+public:
+  ScratchArena() = default;
+  ~ScratchArena();
+
+  ScratchArena(const ScratchArena &) = delete;
+  ScratchArena &operator=(const ScratchArena &) = delete;
+
+  void Init(size_t blockSize);
+  void Destroy();
+
+  // Never null, `alignment` has to be a power of two
+  void *Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+  template <typename T> T *Allocate(size_t count) {
+    return static_cast<T *>(Allocate(sizeof(T) * count, alignof(T)));
+  }
+
+  void Reset();
+
+  // Across every block, since the last Reset
+  size_t GetUsed() const;
+  size_t GetCapacity() const;
+  // The most that was used between any two Resets
+  size_t GetHighWater() const { return highWater; }
+
+private:
+  struct Block {
+    std::byte *data;
+    size_t size;
+  };
+
+  size_t blockSize = 0;
+  std::vector<Block> blocks;
+  size_t current = 0;    // Block being allocated from
+  size_t head = 0;       // Into that block
+  size_t usedBefore = 0; // In the blocks before `current`
+  size_t highWater = 0;
+};
+
+// Lets standard containers live in a ScratchArena. Memory is only given back
+// by the arena's Reset, so a container using it has to be gone by then.
+template <typename T> class ScratchAllocator {
+public:
+  using value_type = T;
+
+  ScratchAllocator(ScratchArena &arena) : arena(&arena) {}
+  template <typename U>
+  ScratchAllocator(const ScratchAllocator<U> &other) : arena(other.arena) {}
+
+  T *allocate(size_t count) { return arena->Allocate<T>(count); }
+  void deallocate(T *, size_t) {}
+
+  template <typename U>
+  bool operator==(const ScratchAllocator<U> &other) const {
+    return arena == other.arena;
+  }
+
+private:
+  template <typename U> friend class ScratchAllocator;
+
+  ScratchArena *arena;
+};
+
+template <typename T> using ScratchVector = std::vector<T, ScratchAllocator<T>>;
+
+// Allocations bigger than this go straight to the heap
+constexpr size_t HOST_POOL_MAX_SIZE = 4096;
+// The pools carve their blocks out of chunks this big
+constexpr size_t HOST_POOL_CHUNK_SIZE = 64 * 1024;
+
+struct HostAllocatorStats {
+  uint64_t allocations = 0;
+  uint64_t reallocations = 0;
+  uint64_t frees = 0;
+  // Allocations that didn't fit a pool and went to the heap
+  uint64_t heapAllocations = 0;
+  uint64_t liveAllocations = 0;
+  uint64_t liveBytes = 0; // What was asked for, not what the pools reserved
+  uint64_t peakBytes = 0;
+  uint64_t pooledBytes = 0; // Reserved by the pools' chunks
+  // Live bytes by VkSystemAllocationScope
+  std::array<uint64_t, 5> scopeBytes{};
+};
+
+// Host memory for Vulkan, through VkAllocationCallbacks. Small allocations
+// (the bulk of what drivers ask for) come from power of two pools that keep
+// their freed blocks, so once the pools have grown to what the driver uses
+// they stop touching the heap. Everything is counted, by allocation scope.
+//
+// Objects have to be destroyed with the same callbacks they were created
+// with, and the allocator has to outlive every object using it.
+class HostAllocator {
+public:
+  HostAllocator();
+  ~HostAllocator();
+
+  HostAllocator(const HostAllocator &) = delete;
+  HostAllocator &operator=(const HostAllocator &) = delete;
+
+  // Pass to the create and destroy calls
+  const VkAllocationCallbacks *GetCallbacks() const { return &callbacks; }
+
+  HostAllocatorStats GetStats() const;
+
+private:
+  // Stored just before every pointer handed out, 16 byte aligned so the
+  // pointer after it is too
+  struct alignas(16) Header {
+    void *base;          // What the pool or heap actually returned
+    uint32_t sizeClass;  // A pool, or UINT32_MAX for the heap
+    uint32_t scope;
+    size_t size;
+  };
+
+  // Blocks of 64 bytes up to HOST_POOL_MAX_SIZE, header included
+  static constexpr uint32_t POOL_COUNT = 7;
+
+  static void *VKAPI_CALL AllocateCallback(void *userData, size_t size,
+                                           size_t alignment,
+                                           VkSystemAllocationScope scope);
+  static void *VKAPI_CALL ReallocateCallback(void *userData, void *original,
+                                             size_t size, size_t alignment,
+                                             VkSystemAllocationScope scope);
+  static void VKAPI_CALL FreeCallback(void *userData, void *memory);
+
+  void *Allocate(size_t size, size_t alignment, VkSystemAllocationScope scope);
+  void Free(void *memory);
+  static Header &GetHeader(void *memory);
+
+  VkAllocationCallbacks callbacks = {};
+
+  mutable std::mutex mutex;
+  // Intrusive lists of free blocks, one per power of two
+  std::array<void *, POOL_COUNT> freeBlocks{};
+  std::vector<std::byte *> chunks;
+  HostAllocatorStats stats{};
+};
+
+} // namespace MiniEngine
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <miniengine/jobs.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace MiniEngine {
+
+// How one step of an InitGraph went, times are from the start of Run
+struct InitPhase {
+  std::string name;
+  double startMs = 0.0;
+  double durationMs = 0.0;
+  uint32_t thread = 0;   // JobScheduler::GetThreadIndex of whoever ran it
+  bool skipped = false; // Another step failed before this one started
+};
+
+// Startup as a set of steps and what each has to wait for, run on the job
+// scheduler so steps that don't depend on each other (reading shaders and
+// assets, say, while the device is created) overlap. Each step only starts
+// once every step it depends on has finished, and may run on any thread
+// unless it is added with JobAffinity::MainThread (anything that calls GLFW).
+//
+//   InitGraph graph;
+//   InitGraph::Step device = graph.Add("Device", [&] { ... });
+//   InitGraph::Step assets = graph.Add("Assets", [&] { ... });
+//   graph.Add("Pipelines", [&] { ... }, {device, assets});
+//   graph.Run(jobs);
+class InitGraph {
+public:
+  using Step = uint32_t;
+
+  // Dependencies have to have been added already, so there can't be a cycle
+  Step Add(std::string name, std::function<void()> function,
+           std::initializer_list<Step> dependencies = {},
+           JobAffinity affinity = JobAffinity::Any);
+
+  // Runs every step and returns once they have all finished, call it from
+  // the main thread. If a step throws no other step starts after it, and the
+  // exception is rethrown here once those already running have finished.
+  void Run(JobScheduler &jobs);
+
+  // In the order the steps were added
+  const std::vector<InitPhase> &GetPhases() const { return phases; }
+  // From Run starting to the last step finishing
+  double GetTotalMs() const { return totalMs; }
+
+  // Every phase's timing at info level, and the total
+  void Log() const;
+
+private:
+  struct Node {
+    std::function<void()> function;
+    JobAffinity affinity;
+    std::vector<Step> dependents;
+    uint32_t dependencies = 0;
+    // Dependencies still to finish once Run has started
+    std::atomic<uint32_t> waiting = 0;
+  };
+
+  void Schedule(Step step);
+  void Execute(Step step);
+
+  // A deque so nodes (and their atomics) never move
+  std::deque<Node> nodes;
+  std::vector<InitPhase> phases;
+  double totalMs = 0.0;
+
+  JobScheduler *jobs = nullptr;
+  JobCounter counter;
+  std::chrono::high_resolution_clock::time_point start;
+
+  std::atomic<bool> failed = false;
+  std::mutex errorMutex;
+  std::exception_ptr error;
+};
+
+} // namespace MiniEngine
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace MiniEngine {
+
+enum class JobAffinity {
+  Any,       // Whichever thread gets to it first
+  MainThread // Things like GLFW which may only be called from the main thread
+};
+
+class JobScheduler;
+
+// Counts outstanding jobs, every job scheduled with a counter increments it
+// and decrements it once it has run. Jobs can also wait on a counter before
+// they start, which is how dependencies between jobs are expressed.
+class JobCounter {
+public:
+  bool IsDone() const { return value.load(std::memory_order_acquire) == 0; }
+  uint32_t GetValue() const { return value.load(std::memory_order_acquire); }
+
+private:
+  friend class JobScheduler;
+
+  struct Dependent {
+    std::function<void()> job;
+    JobCounter *counter;
+    JobAffinity affinity;
+  };
+
+  std::atomic<uint32_t> value = 0;
+
+  // Jobs waiting for this to reach zero
+  std::mutex mutex;
+  std::vector<Dependent> dependents;
+};
+
+// The engine's shared pool of worker threads. Each thread has its own deque,
+// it pushes and pops its own jobs at the back (so they are still warm in the
+// cache) while idle threads steal from the front of everybody else's.
+class JobScheduler {
+public:
+  // A `workerCount` of 0 uses one worker per remaining hardware thread, the
+  // main thread makes up the last one.
+  void Init(uint32_t workerCount = 0);
+  void Destroy();
+
+  // Runs `job` once `dependency` (if any) reaches zero, `counter` (if any) is
+  // incremented now and decremented once the job has run.
+  void Schedule(std::function<void()> job, JobCounter *counter = nullptr,
+                JobAffinity affinity = JobAffinity::Any,
+                JobCounter *dependency = nullptr);
+
+  // Splits [0, count) into batches of at most `batchSize` and schedules one
+  // job per batch. `job` is referenced, not copied, so it has to outlive
+  // `counter` reaching zero.
+  void ParallelFor(uint32_t count, uint32_t batchSize,
+                   const std::function<void(uint32_t begin, uint32_t end)> &job,
+                   JobCounter &counter);
+
+  // Runs other jobs until `counter` reaches zero rather than sleeping. When
+  // called from the main thread that includes main thread jobs. A counter
+  // jobs were scheduled with may only be destroyed after this has returned.
+  void Wait(JobCounter &counter);
+
+  // Runs every main thread job that is ready, called once per frame.
+  void RunMainThreadJobs();
+
+  // Workers plus the main thread
+  uint32_t GetThreadCount() const {
+    return static_cast<uint32_t>(workers.size()) + 1;
+  }
+
+  // Index of the calling thread in [0, GetThreadCount()). Workers come first
+  // and the main thread is last, which lets per-thread data be a plain array.
+  uint32_t GetThreadIndex() const;
+  bool IsMainThread() const { return GetThreadIndex() == workers.size(); }
+
+private:
+  struct Job {
+    std::function<void()> function;
+    JobCounter *counter;
+  };
+
+  // A ring that only ever grows, so once it has had room for the most jobs
+  // queued at once, queueing never allocates
+  struct WorkQueue {
+    std::mutex mutex;
+    std::vector<Job> ring; // A power of two long
+    size_t head = 0;       // The oldest job
+    size_t count = 0;
+
+    bool IsEmpty() const { return count == 0; }
+    void PushBack(Job job);
+    Job PopBack();
+    Job PopFront();
+  };
+
+  void Push(Job job, JobAffinity affinity);
+  bool TryRunJob(uint32_t thread);
+  void Run(Job &job);
+  void WorkerLoop(uint32_t thread);
+
+  std::vector<std::thread> workers;
+  // One per thread, the main thread's is last
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+  WorkQueue mainThreadQueue;
+
+  // Jobs sitting in any queue, idle workers sleep while this is zero
+  std::atomic<uint32_t> queuedJobs = 0;
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+  bool stopping = false;
+};
+
+} // namespace MiniEngine
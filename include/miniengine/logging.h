@@ -0,0 +1,44 @@
+#pragma once
+
+#include <spdlog/spdlog.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace MiniEngine {
+
+// Messages waiting for the logging thread. Once it is full the oldest are
+// dropped rather than making whoever is logging wait.
+constexpr size_t LOG_QUEUE_SIZE = 8192;
+
+// Each distinct validation message is logged this many times, after that
+// only every power of two'th time along with how often it has been seen
+constexpr uint64_t VALIDATION_REPEATS_LOGGED = 3;
+// Validation messages logged per second at most, across all of them
+constexpr uint32_t VALIDATION_MESSAGES_PER_SECOND = 20;
+
+// Replaces the default logger with an asynchronous one, and makes the
+// "validation" logger too. Logging only formats the message and queues it,
+// writing it out happens on a thread of its own. Call before anything logs.
+//
+// SPDLOG_TRACE and SPDLOG_DEBUG are compiled out of Release builds (see
+// CMakeLists.txt), `level` only filters what is left.
+void InitLogging(spdlog::level::level_enum level);
+// Writes out whatever is still queued and stops the logging thread. The
+// default logger is synchronous again afterwards, the validation logger can't
+// be used at all.
+void ShutdownLogging();
+
+// The one made by InitLogging, or a synchronous one if it hasn't run
+std::shared_ptr<spdlog::logger> GetValidationLogger();
+
+// Whether a validation message should be logged, see
+// VALIDATION_REPEATS_LOGGED. `count` is set to how many times this one has
+// been seen, including now. Safe to call from any thread.
+bool FilterValidationMessage(int32_t messageId, const char *message,
+                             uint64_t &count);
+// Validation messages dropped by FilterValidationMessage so far
+uint64_t GetSuppressedValidationCount();
+
+} // namespace MiniEngine
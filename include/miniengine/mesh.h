@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace MiniEngine {
+
+// Post-transform cache size the optimiser plans for. Real caches vary (and
+// some GPUs batch rather than cache), but anything from 12 to 32 gives
+// close to the same ordering.
+constexpr uint32_t MESH_VERTEX_CACHE_SIZE = 16;
+
+// An indexed triangle list as it comes out of a loader. Indices are always 32
+// bits here, PackIndices narrows them for the GPU.
+template <typename V> struct Mesh {
+  std::vector<V> vertices;
+  std::vector<uint32_t> indices;
+};
+
+// What OptimizeMesh did, the average cache miss ratio is vertex shader
+// invocations per triangle (0.5 is the best a regular grid can do, 3 the
+// worst)
+struct MeshStats {
+  double acmrBefore = 0.0;
+  double acmrAfter = 0.0;
+  size_t verticesRemoved = 0; // Never referenced by an index
+};
+
+// The index buffer contents and how to bind them
+struct IndexData {
+  VkIndexType type = VK_INDEX_TYPE_UINT16;
+  uint32_t count = 0;
+  std::vector<uint8_t> bytes;
+};
+
+// 16 bit indices whenever every vertex can be addressed with them
+VkIndexType ChooseIndexType(size_t vertexCount);
+
+// Narrows the indices to ChooseIndexType(vertexCount)
+IndexData PackIndices(const std::vector<uint32_t> &indices,
+                      size_t vertexCount);
+
+// Simulates a FIFO cache of `cacheSize` vertices, see MeshStats. Throws if
+// an index is past the last vertex, as do the passes below.
+double ComputeACMR(const std::vector<uint32_t> &indices, size_t vertexCount,
+                   uint32_t cacheSize = MESH_VERTEX_CACHE_SIZE);
+
+// Reorders the triangles so vertices are reused while they are still in
+// the post-transform cache (Tipsify, Sander et al. 2007). Linear time.
+void OptimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount,
+                         uint32_t cacheSize = MESH_VERTEX_CACHE_SIZE);
+
+// Renumbers the vertices in the order the (cache optimised) indices first
+// use them, so vertex fetch walks memory forwards. Rewrites `indices` and
+// returns the old index of every new vertex, vertices nothing uses are left
+// out.
+std::vector<uint32_t> OptimizeVertexFetch(std::vector<uint32_t> &indices,
+                                          size_t vertexCount);
+
+// Both of the above, call once on load. Throws before changing anything if
+// an index is out of range.
+template <typename V> MeshStats OptimizeMesh(Mesh<V> &mesh) {
+  MeshStats stats;
+  stats.acmrBefore = ComputeACMR(mesh.indices, mesh.vertices.size());
+
+  OptimizeVertexCache(mesh.indices, mesh.vertices.size());
+  std::vector<uint32_t> order =
+      OptimizeVertexFetch(mesh.indices, mesh.vertices.size());
+
+  std::vector<V> vertices(order.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    vertices[i] = mesh.vertices[order[i]];
+  }
+
+  stats.verticesRemoved = mesh.vertices.size() - vertices.size();
+  mesh.vertices = std::move(vertices);
+
+  // Fetch order doesn't change which vertices are reused, so this is what
+  // the cache pass got us
+  stats.acmrAfter = ComputeACMR(mesh.indices, mesh.vertices.size());
+  return stats;
+}
+
+} // namespace MiniEngine
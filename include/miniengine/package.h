@@ -0,0 +1,188 @@
+#pragma once
+
+#include <miniengine/mesh.h>
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace MiniEngine {
+
+constexpr uint32_t PACKAGE_MAGIC = 0x4b50454d; // "MEPK"
+constexpr uint32_t PACKAGE_VERSION = 1;
+
+// Every asset (and every part of a mesh or texture) starts on a multiple of
+// this. It is more than any device's optimalBufferCopyOffsetAlignment or
+// nonCoherentAtomSize, so anything in a package can be copied to the GPU
+// straight from where it is mapped.
+constexpr uint64_t PACKAGE_ALIGNMENT = 256;
+
+constexpr uint32_t PACKAGE_MAX_MIPS = 16;
+
+enum class AssetType : uint32_t {
+  Raw = 0,
+  Shader = 1,  // SPIR-V
+  Mesh = 2,    // PackedMeshHeader, then vertices, then indices
+  Texture = 3, // PackedTextureHeader, then every mip, largest first
+};
+
+// The file starts with this. Everything is little endian, and offsets are
+// from the start of the file unless they say otherwise.
+struct PackageHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t assetCount;
+  uint32_t reserved;
+  uint64_t tocOffset;   // assetCount PackageEntries
+  uint64_t namesOffset; // Every name back to back, not null terminated
+  uint64_t namesSize;
+};
+
+struct PackageEntry {
+  uint64_t offset;
+  uint64_t size;
+  uint32_t nameOffset; // From namesOffset
+  uint32_t nameLength;
+  AssetType type;
+  uint32_t reserved;
+};
+
+// Offsets from the start of the asset
+struct PackedMeshHeader {
+  uint32_t vertexCount;
+  uint32_t vertexStride;
+  uint32_t indexCount;
+  VkIndexType indexType;
+  uint64_t vertexOffset;
+  uint64_t indexOffset;
+};
+
+struct PackedTextureHeader {
+  uint32_t width;
+  uint32_t height;
+  VkFormat format;
+  uint32_t mipLevels;
+  // From the start of the asset, and the size of each
+  uint64_t mipOffsets[PACKAGE_MAX_MIPS];
+  uint64_t mipSizes[PACKAGE_MAX_MIPS];
+};
+
+// An asset inside a mapped package. It points straight into the mapping, so
+// using it costs nothing until its pages are touched.
+struct AssetView {
+  AssetType type = AssetType::Raw;
+  std::span<const std::byte> data;
+
+  bool IsValid() const { return data.data() != nullptr; }
+};
+
+struct MeshView {
+  uint32_t vertexCount = 0;
+  uint32_t vertexStride = 0;
+  uint32_t indexCount = 0;
+  VkIndexType indexType = VK_INDEX_TYPE_UINT16;
+  std::span<const std::byte> vertices;
+  std::span<const std::byte> indices;
+};
+
+struct TextureView {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  uint32_t mipLevels = 0;
+  std::span<const std::byte> mips[PACKAGE_MAX_MIPS];
+};
+
+// A read-only package of assets, mapped into memory as a whole. Opening one
+// is a single map of the file and a walk of its table of contents, finding an
+// asset is a hash lookup, and the data is never copied (the upload engine
+// reads it straight out of the mapping into staging memory).
+class AssetPackage {
+public:
+  AssetPackage() = default;
+  AssetPackage(const AssetPackage &) = delete;
+  AssetPackage &operator=(const AssetPackage &) = delete;
+  ~AssetPackage();
+
+  // Throws if the file can't be mapped or isn't a valid package
+  void Open(const std::string &path);
+  void Close();
+  bool IsOpen() const { return mapped != nullptr; }
+
+  // An invalid view if there is no asset called `name`. Views stay valid until
+  // the package is closed.
+  AssetView Find(std::string_view name) const;
+
+  // Split a Mesh or Texture asset into its parts, throwing if it isn't one.
+  // Every mesh index is checked against the vertex count so the GPU never
+  // reads past the vertices.
+  static MeshView GetMesh(const AssetView &asset);
+  static TextureView GetTexture(const AssetView &asset);
+
+  // Asks the OS to start reading the asset's pages in, so the first copy out
+  // of them doesn't fault every page on its own
+  void Prefetch(const AssetView &asset) const;
+
+  uint32_t GetAssetCount() const;
+  // Every asset of `type`, in package order. The names point into the
+  // mapping.
+  std::vector<std::string_view> GetNames(AssetType type) const;
+  size_t GetSize() const { return size; }
+
+private:
+  const std::byte *mapped = nullptr;
+  size_t size = 0;
+
+  const PackageEntry *entries = nullptr;
+  uint32_t assetCount = 0;
+  const char *names = nullptr; // The mapping's name table
+  // The keys point into the mapping's name table
+  std::unordered_map<std::string_view, uint32_t> lookup;
+};
+
+// Lays assets out in the package format, used by the packer (tools/pack.cpp)
+class PackageWriter {
+public:
+  void Add(const std::string &name, AssetType type,
+           std::span<const std::byte> data);
+
+  // Already optimised, see OptimizeMesh
+  template <typename V>
+  void AddMesh(const std::string &name, const Mesh<V> &mesh) {
+    IndexData indices = PackIndices(mesh.indices, mesh.vertices.size());
+    AddMesh(name, std::as_bytes(std::span(mesh.vertices)),
+            static_cast<uint32_t>(mesh.vertices.size()), sizeof(V), indices);
+  }
+  void AddMesh(const std::string &name, std::span<const std::byte> vertices,
+               uint32_t vertexCount, uint32_t vertexStride,
+               const IndexData &indices);
+
+  // 8 bit RGBA, the mip chain is generated with a box filter
+  void AddTexture(const std::string &name, uint32_t width, uint32_t height,
+                  const uint8_t *pixels);
+  // Mips that were made (and usually block compressed) elsewhere, largest
+  // first
+  void AddTexture(const std::string &name, VkFormat format, uint32_t width,
+                  uint32_t height,
+                  std::span<const std::span<const std::byte>> mips);
+
+  // Throws if the file can't be written, or two assets have the same name
+  void Write(const std::string &path) const;
+
+private:
+  struct PendingAsset {
+    std::string name;
+    AssetType type;
+    std::vector<std::byte> data;
+  };
+
+  std::vector<PendingAsset> assets;
+};
+
+} // namespace MiniEngine
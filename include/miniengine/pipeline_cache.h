@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+
+namespace MiniEngine {
+
+// A VkPipelineCache kept on disk between runs, so pipelines compiled by a
+// previous launch don't have to be compiled again. The data is only trusted
+// if its header says it came from the same driver and device we are running
+// on, otherwise we start from an empty cache.
+class PipelineCache {
+public:
+  void Init(VkDevice device, const VkPhysicalDeviceProperties &properties,
+            const std::string &path,
+            const VkAllocationCallbacks *hostCallbacks);
+  // Saves the cache before destroying it
+  void Destroy();
+
+  void Save();
+
+  VkPipelineCache GetHandle() const { return cache; }
+
+  // Whether valid data was loaded from disk
+  bool IsWarm() const { return warm; }
+
+  // Time spent creating pipelines this run, report it with AddBuildTime
+  void AddBuildTime(double ms) { buildMs += ms; }
+  double GetBuildMs() const { return buildMs; }
+
+  // How long the run that filled the cache spent creating pipelines, or 0 if
+  // it isn't known. Comparing it with GetBuildMs gives the time saved.
+  double GetColdBuildMs() const { return coldBuildMs; }
+
+private:
+  bool Validate(const std::string &data) const;
+
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *hostCallbacks = nullptr;
+  VkPhysicalDeviceProperties properties{};
+  std::string path;
+
+  VkPipelineCache cache = VK_NULL_HANDLE;
+  bool warm = false;
+  double buildMs = 0.0;
+  double coldBuildMs = 0.0;
+};
+
+} // namespace MiniEngine
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <miniengine/jobs.h>
+#include <miniengine/package.h>
+#include <miniengine/pipeline_cache.h>
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace MiniEngine {
+
+// Everything that makes one graphics pipeline different from another.
+// Viewport and scissor are always dynamic so they are not part of it.
+struct PipelineDesc {
+  // Paths to SPIR-V
+  std::string vertexShader;
+  std::string fragmentShader;
+
+  std::vector<VkVertexInputBindingDescription> bindings;
+  std::vector<VkVertexInputAttributeDescription> attributes;
+  VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+  VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+  VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+  VkFrontFace frontFace = VK_FRONT_FACE_CLOCKWISE;
+
+  bool blendEnable = false;
+  VkBlendFactor srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+  VkBlendFactor dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+  VkBlendOp colorBlendOp = VK_BLEND_OP_ADD;
+  VkBlendFactor srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  VkBlendFactor dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+  VkBlendOp alphaBlendOp = VK_BLEND_OP_ADD;
+
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+
+  // Render passes with the same attachment formats and sample counts are
+  // compatible, so those are what get hashed rather than the handle. The
+  // handle is only used to create the pipeline, and is null for dynamic
+  // rendering, where the formats are all there is.
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+  uint32_t subpass = 0;
+  std::vector<VkFormat> colorFormats;
+  VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+
+  uint64_t Hash() const;
+  bool operator==(const PipelineDesc &other) const;
+};
+
+// A registry entry, only the registry touches these
+struct PipelineEntry {
+  PipelineDesc desc;
+  std::atomic<VkPipeline> pipeline = VK_NULL_HANDLE;
+  std::atomic<bool> failed = false;
+  PipelineEntry *fallback = nullptr;
+  // A rebuild from new shaders waiting for ApplyReloads
+  std::atomic<VkPipeline> reloaded = VK_NULL_HANDLE;
+};
+
+// Refers to a pipeline in the registry, valid until the registry is destroyed
+class PipelineHandle {
+public:
+  bool IsValid() const { return entry != nullptr; }
+
+private:
+  friend class PipelineRegistry;
+
+  PipelineEntry *entry = nullptr;
+};
+
+struct PipelineRegistryStats {
+  uint32_t pipelines = 0;
+  uint32_t pending = 0; // Still compiling
+  uint32_t failed = 0;
+  uint64_t requests = 0;
+  uint64_t deduplicated = 0; // Requests that found an existing pipeline
+  uint64_t reloads = 0;      // Pipelines swapped for ones with new shaders
+};
+
+// Owns every graphics pipeline, keyed by a hash of its description so the
+// same description always gives back the same pipeline. New pipelines are
+// compiled on the job scheduler and a fallback is handed out until they are
+// ready, so asking for one never stalls a frame.
+class PipelineRegistry {
+public:
+  void Init(VkDevice device, PipelineCache &cache, JobScheduler &jobs,
+            const VkAllocationCallbacks *hostCallbacks);
+  // Waits for compiles in flight, then destroys every pipeline
+  void Destroy();
+
+  // Compiles on the calling thread if the pipeline doesn't exist yet. Use this
+  // for pipelines that have to be there from the first frame (fallbacks).
+  PipelineHandle Build(const PipelineDesc &desc);
+
+  // Returns straight away, compiling in the background if needed. Until it is
+  // ready (or if it fails) Get gives `fallback`'s pipeline instead.
+  PipelineHandle Request(const PipelineDesc &desc, PipelineHandle fallback);
+
+  // Safe to call from any thread, never blocks
+  VkPipeline Get(PipelineHandle handle) const;
+  bool IsReady(PipelineHandle handle) const;
+
+  // Rebuilds every pipeline using the SPIR-V at `shaderPath` in the
+  // background, keeping the current ones until ApplyReloads. A rebuild that
+  // fails is logged and the old pipeline stays. Returns how many are being
+  // rebuilt.
+  uint32_t Reload(const std::string &shaderPath);
+
+  // Swaps in the rebuilt pipelines, call between frames. The replaced ones
+  // may still be in use by the frames already submitted, so they are kept
+  // until CollectRetired sees `frame` complete.
+  uint32_t ApplyReloads(uint64_t frame);
+  void CollectRetired(uint64_t completedFrame);
+
+  PipelineRegistryStats GetStats() const;
+
+  // Shaders are looked up in `package` (by their path) before the disk. It
+  // has to stay open until the registry is destroyed.
+  void SetPackage(const AssetPackage *package) { this->package = package; }
+
+  // Loads SPIR-V from `path`, also used for the compute pipelines the
+  // registry doesn't own. The caller destroys the module.
+  VkShaderModule CreateShaderModule(const std::string &path);
+
+private:
+  // Finds or adds the entry, `created` is set if it was added. The fallback
+  // only applies to new entries.
+  PipelineEntry *FindOrAdd(const PipelineDesc &desc, PipelineEntry *fallback,
+                           bool &created);
+  // Throws on failure
+  VkPipeline Compile(const PipelineDesc &desc);
+
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *hostCallbacks = nullptr;
+  PipelineCache *cache = nullptr;
+  JobScheduler *jobs = nullptr;
+  const AssetPackage *package = nullptr;
+
+  mutable std::mutex mutex;
+  std::unordered_map<uint64_t, std::unique_ptr<PipelineEntry>> entries;
+  PipelineRegistryStats stats{};
+
+  // Set by rebuilds so ApplyReloads can skip looking most frames
+  std::atomic<uint32_t> reloadsReady = 0;
+
+  struct RetiredPipeline {
+    VkPipeline pipeline;
+    uint64_t lastFrame;
+  };
+  std::vector<RetiredPipeline> retired;
+
+  // Every background compile, Destroy waits on this
+  JobCounter compiles;
+};
+
+} // namespace MiniEngine
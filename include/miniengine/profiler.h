@@ -0,0 +1,175 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace MiniEngine {
+
+// Frames of history kept for the graph, percentiles and trace export
+constexpr uint32_t PROFILER_HISTORY = 240;
+// GPU scopes per frame, each takes two timestamp queries
+constexpr uint32_t PROFILER_MAX_GPU_SCOPES = 32;
+
+struct ProfileEvent {
+  const char *name; // Must be a string literal, or at least outlive us
+  uint32_t thread;  // Small per-thread number, the GPU has its own
+  double startMs;   // Since the profiler was created
+  double durationMs;
+};
+
+struct ProfileFrame {
+  uint64_t frame;
+  double startMs;
+  double cpuMs; // From this frame's BeginFrame to the next one's
+  // From reading the input this frame used to its fence being seen signalled,
+  // filled in when its slot comes back round. 0 until then.
+  double latencyMs;
+  std::vector<ProfileEvent> cpuEvents;
+  // Filled in a couple of frames late, when the timestamps are read back
+  std::vector<ProfileEvent> gpuEvents;
+};
+
+struct ProfilePercentiles {
+  double p50 = 0.0;
+  double p95 = 0.0;
+  double p99 = 0.0;
+  double max = 0.0;
+};
+
+// Nearest rank percentiles of `values`, which can be in any order
+ProfilePercentiles ComputePercentiles(std::vector<double> values);
+// The same, sorting `values` in place rather than copying them
+ProfilePercentiles ComputePercentiles(std::span<double> values);
+
+// CPU scopes and GPU timestamps for every frame. GPU results are only read
+// once the frame's fence has signalled (when its query pool comes back round)
+// so reading them never stalls.
+class Profiler {
+public:
+  void Init(VkDevice device, uint32_t frameCount, float timestampPeriod,
+            bool gpuTimestamps, const VkAllocationCallbacks *hostCallbacks);
+  void Destroy();
+
+  // Call once the frame's in flight fence has been waited on, this reads the
+  // timestamps the slot wrote last time round. `start` is where the previous
+  // frame ends and this one begins, pass when the wait started so the wait
+  // counts towards this frame.
+  void BeginFrame(uint32_t frameIndex,
+                  std::chrono::high_resolution_clock::time_point start =
+                      std::chrono::high_resolution_clock::now());
+
+  // When the input the current frame is built from was read, call before the
+  // frame is submitted. Frames without one don't count towards latency.
+  void SetInputTime(std::chrono::high_resolution_clock::time_point time);
+
+  // Resets this frame's queries, must be recorded before any GPU scope and
+  // outside a render pass.
+  void BeginGpuFrame(VkCommandBuffer commandBuffer);
+
+  // GPU scopes can be opened in one command buffer and closed in another as
+  // long as they execute in that order. Returns UINT32_MAX (which End
+  // ignores) if there are no queries left.
+  uint32_t BeginGpuScope(VkCommandBuffer commandBuffer, const char *name);
+  void EndGpuScope(VkCommandBuffer commandBuffer, uint32_t scope);
+
+  // Thread safe, see ProfileScope
+  void AddCpuEvent(const char *name,
+                   std::chrono::high_resolution_clock::time_point start,
+                   std::chrono::high_resolution_clock::time_point end);
+
+  // The frame being recorded, numbered like ProfileFrame::frame
+  uint64_t GetCurrentFrame() const { return current.frame; }
+
+  // The newest frame whose GPU timestamps have been read: its number, how
+  // long the scope `name` took in it (0 if there wasn't one) and the time
+  // from its first GPU scope starting to its last one ending. False until
+  // there is such a frame.
+  bool GetLatestGpuFrame(const char *name, uint64_t &frame, double &scopeMs,
+                         double &frameMs) const;
+
+  // Oldest first, at most PROFILER_HISTORY frames
+  uint32_t GetHistorySize() const { return historyCount; }
+  const ProfileFrame &GetHistoryFrame(uint32_t i) const {
+    return history[(historyStart + i) % PROFILER_HISTORY];
+  }
+  ProfilePercentiles GetCpuFramePercentiles() const;
+  ProfilePercentiles GetGpuPercentiles(const char *name) const;
+  // The time between polling input and the GPU finishing the frame. It leaves
+  // out how long the image then waits to be displayed (that would need
+  // VK_KHR_present_wait), and the fence is only checked when its slot comes
+  // back round, so it is for comparing pacing policies more than anything.
+  ProfilePercentiles GetLatencyPercentiles() const;
+
+  // Dumps the history in Chrome's trace event format, open it with
+  // chrome://tracing or https://ui.perfetto.dev
+  bool ExportChromeTrace(const std::string &path) const;
+
+  // Adds the profiler's section to the current ImGui window
+  void DrawImGui();
+
+  double ToMs(std::chrono::high_resolution_clock::time_point time) const;
+
+private:
+  struct FrameSlot {
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    uint64_t frame = 0; // Frame the queries belong to
+    double submitMs = 0.0;
+    double inputMs = 0.0; // 0 if the frame never set one
+    std::atomic<uint32_t> scopeCount = 0;
+    const char *scopeNames[PROFILER_MAX_GPU_SCOPES];
+  };
+
+  ProfileFrame *FindFrame(uint64_t frame);
+  void ReadGpuResults(FrameSlot &slot, ProfileFrame &frame);
+
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *hostCallbacks = nullptr;
+  float timestampPeriod = 1.0f; // Nanoseconds per tick
+  bool gpuTimestamps = false;
+
+  std::chrono::high_resolution_clock::time_point epoch;
+
+  std::vector<std::unique_ptr<FrameSlot>> slots;
+  FrameSlot *currentSlot = nullptr;
+  uint64_t frameNumber = 0;
+
+  std::mutex mutex; // Guards `current` for CPU events from workers
+  ProfileFrame current{};
+  // A ring of PROFILER_HISTORY frames. The frame each new one replaces is
+  // reused as the next `current`, event lists and all, so once those have
+  // grown to a frame's worth of events recording doesn't allocate.
+  std::vector<ProfileFrame> history;
+  uint32_t historyStart = 0;
+  uint32_t historyCount = 0;
+  // Reused by the percentile getters
+  mutable std::vector<double> percentileValues;
+
+  std::vector<float> frameTimes; // Ring for the graph
+  uint32_t frameTimesOffset = 0;
+};
+
+// Times the enclosing scope on the CPU
+class ProfileScope {
+public:
+  ProfileScope(Profiler &profiler, const char *name)
+      : profiler(profiler), name(name),
+        start(std::chrono::high_resolution_clock::now()) {}
+  ~ProfileScope() {
+    profiler.AddCpuEvent(name, start, std::chrono::high_resolution_clock::now());
+  }
+
+private:
+  Profiler &profiler;
+  const char *name;
+  std::chrono::high_resolution_clock::time_point start;
+};
+
+} // namespace MiniEngine
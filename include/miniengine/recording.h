@@ -0,0 +1,94 @@
+#pragma once
+
+#include <miniengine/jobs.h>
+
+#include <vulkan/vulkan.h>
+
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace MiniEngine {
+
+struct RecorderThreadStats {
+  double lastFrameMs = 0.0; // Time spent recording in the last frame
+  double totalMs = 0.0;     // Since the last ResetStats
+  uint64_t commandBuffers = 0;
+};
+
+// Records secondary command buffers in parallel on the job scheduler. Every
+// scheduler thread has its own command pool per frame in flight, pools are
+// never shared between threads so recording needs no locking, and a frame's
+// pools are reset in one go with vkResetCommandPool once its fence has
+// signalled.
+class ParallelRecorder {
+public:
+  // Called once per chunk, on whichever thread picked the chunk up. The
+  // command buffer has already been begun and is ended afterwards.
+  using RecordFunction =
+      std::function<void(VkCommandBuffer commandBuffer, uint32_t chunk)>;
+
+  void Init(VkDevice device, JobScheduler &jobs, uint32_t queueFamily,
+            uint32_t frameCount, const VkAllocationCallbacks *hostCallbacks);
+  void Destroy();
+
+  // Must be called after the frame's in flight fence has been waited on.
+  void BeginFrame(uint32_t frameIndex);
+
+  // Records `chunkCount` secondary command buffers continuing the render pass
+  // in `inheritance` and returns them in chunk order. Blocks until every
+  // chunk is done, the calling thread helps record them while it waits.
+  const std::vector<VkCommandBuffer> &
+  Record(const VkCommandBufferInheritanceInfo &inheritance,
+         uint32_t chunkCount, const RecordFunction &record);
+
+  // Records a single secondary command buffer on the calling thread.
+  VkCommandBuffer
+  RecordOnCaller(const VkCommandBufferInheritanceInfo &inheritance,
+                 const std::function<void(VkCommandBuffer)> &record);
+
+  // Same as the scheduler's, this is also the size of GetStats().
+  uint32_t GetThreadCount() const {
+    return static_cast<uint32_t>(threads.size());
+  }
+
+  // Indexed by scheduler thread, so the last entry is the main thread.
+  std::vector<RecorderThreadStats> GetStats() const;
+  // The same for one thread, without copying them all
+  const RecorderThreadStats &GetThreadStats(uint32_t thread) const;
+  void ResetStats();
+
+private:
+  struct ThreadPool {
+    VkCommandPool pool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> buffers; // Reused once the pool is reset
+    uint32_t used = 0;
+  };
+
+  struct ThreadState {
+    std::vector<ThreadPool> frames; // One pool per frame in flight
+    RecorderThreadStats stats;
+  };
+
+  VkCommandBuffer BeginSecondary(uint32_t thread,
+                                 const VkCommandBufferInheritanceInfo &info);
+  void RecordChunk(const VkCommandBufferInheritanceInfo &inheritance,
+                   const RecordFunction &record, uint32_t chunk);
+
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *hostCallbacks = nullptr;
+  JobScheduler *jobs = nullptr;
+  uint32_t frameIndex = 0;
+
+  std::vector<ThreadState> threads;
+
+  std::vector<VkCommandBuffer> results;
+  // What the chunk jobs of the Record in progress use
+  const VkCommandBufferInheritanceInfo *currentInheritance = nullptr;
+  const RecordFunction *currentRecord = nullptr;
+  std::mutex errorMutex;
+  std::exception_ptr error; // The first chunk to fail, rethrown by Record
+};
+
+} // namespace MiniEngine
@@ -0,0 +1,401 @@
+#pragma once
+
+#include <miniengine/allocator.h>
+#include <miniengine/profiler.h>
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace MiniEngine {
+
+// Every attachment a graphics pass can have, colour and resolve together
+constexpr uint32_t RENDER_GRAPH_MAX_ATTACHMENTS = 8;
+
+// Cached framebuffers nothing has used for this many frames are destroyed
+constexpr uint64_t RENDER_GRAPH_FRAMEBUFFER_IDLE_FRAMES = 8;
+
+// Only valid for the frame it was made in
+struct RenderGraphImage {
+  uint32_t index = UINT32_MAX;
+
+  bool IsValid() const { return index != UINT32_MAX; }
+};
+
+struct RenderGraphBuffer {
+  uint32_t index = UINT32_MAX;
+
+  bool IsValid() const { return index != UINT32_MAX; }
+};
+
+// An image the graph owns. It lives only for the passes that use it, so
+// images whose passes don't overlap share memory, and ones that never leave
+// a render pass are lazily allocated where the device has memory for it.
+struct TransientImageDesc {
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkExtent2D extent = {};
+  VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+  // On top of whatever the passes using it need
+  VkImageUsageFlags usage = 0;
+};
+
+enum class RenderPassType {
+  Graphics, // Inside a render pass made of its attachments
+  Compute,
+  Transfer,
+};
+
+// What a pass's record function gets. For graphics passes rendering has
+// begun, and `inheritance` is what secondaries recorded for it inherit: the
+// render pass and framebuffer, or with dynamic rendering (where those are
+// null) the attachment formats chained after it.
+struct RenderPassContext {
+  VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+  VkFramebuffer framebuffer = VK_NULL_HANDLE;
+  VkExtent2D extent = {};
+  const VkCommandBufferInheritanceInfo *inheritance = nullptr;
+};
+
+using RenderPassFunction = std::function<void(const RenderPassContext &)>;
+
+struct RenderGraphStats {
+  uint32_t passes = 0;
+  uint32_t culledPasses = 0;
+  uint32_t barriers = 0; // vkCmdPipelineBarrier calls
+  uint32_t imageBarriers = 0;
+  uint32_t transientImages = 0;
+  uint32_t lazyImages = 0;
+  // What the transient images would take each on their own, and what they
+  // take with aliasing
+  VkDeviceSize transientBytes = 0;
+  VkDeviceSize aliasedBytes = 0;
+  uint32_t renderPasses = 0; // Cached VkRenderPasses, none when dynamic
+  uint32_t framebuffers = 0;
+};
+
+class RenderGraph;
+
+// Declares what a pass reads and writes. Stages and access masks are the
+// ones the pass itself uses, the graph works out the barriers between them.
+// They are synchronization2's, so they can be as precise as a COPY or
+// VERTEX_ATTRIBUTE_INPUT stage, and are widened to the Vulkan 1.0 stage
+// containing them when the device doesn't have synchronization2.
+class RenderPassBuilder {
+public:
+  // A cleared attachment doesn't load what was there before. Without a clear
+  // it is loaded if an earlier pass (or the importer) left anything in it.
+  // A multisampled attachment can be resolved into `resolve` at the end of
+  // the pass.
+  RenderPassBuilder &WriteColor(RenderGraphImage image,
+                                const VkClearValue *clear = nullptr,
+                                RenderGraphImage resolve = {});
+  RenderPassBuilder &WriteDepth(RenderGraphImage image,
+                                const VkClearValue *clear = nullptr);
+  // Sampled from shaders in `stages`
+  RenderPassBuilder &ReadTexture(RenderGraphImage image,
+                                 VkPipelineStageFlags2 stages);
+  RenderPassBuilder &ReadImage(RenderGraphImage image, VkImageLayout layout,
+                               VkPipelineStageFlags2 stages,
+                               VkAccessFlags2 access);
+  RenderPassBuilder &WriteImage(RenderGraphImage image, VkImageLayout layout,
+                                VkPipelineStageFlags2 stages,
+                                VkAccessFlags2 access);
+
+  RenderPassBuilder &ReadBuffer(RenderGraphBuffer buffer,
+                                VkPipelineStageFlags2 stages,
+                                VkAccessFlags2 access);
+  RenderPassBuilder &WriteBuffer(RenderGraphBuffer buffer,
+                                 VkPipelineStageFlags2 stages,
+                                 VkAccessFlags2 access);
+
+  // The pass does something the graph can't see (uploads, queries), so it is
+  // never culled
+  RenderPassBuilder &SetSideEffects();
+  // The render pass is begun for vkCmdExecuteCommands rather than inline
+  // commands
+  RenderPassBuilder &UseSecondaries();
+
+private:
+  friend class RenderGraph;
+  RenderPassBuilder(RenderGraph &graph, uint32_t pass)
+      : graph(graph), pass(pass) {}
+
+  RenderGraph &graph;
+  uint32_t pass;
+};
+
+// A frame's passes, rebuilt every frame. Passes declare the images and
+// buffers they use, and the graph then:
+//  - culls passes nothing observable depends on,
+//  - batches the barriers and layout transitions each pass needs into one
+//    vkCmdPipelineBarrier before it, only for hazards that are really there,
+//  - picks each attachment's load and store ops, so nothing is loaded that
+//    will be overwritten and nothing is stored that no one reads (which is
+//    what saves bandwidth on tiled GPUs),
+//  - and places transient images, aliased where their lifetimes don't
+//    overlap.
+//
+// The render passes, framebuffers and transient images are kept between
+// frames and only rebuilt when the graph's shape changes, so a frame that
+// looks like the last one creates nothing. Passes run in the order they were
+// added.
+//
+// Imported buffers keep their state from one frame to the next: the first
+// pass to write one waits on whatever read it the frame before.
+class RenderGraph {
+public:
+  // With `vulkan13`, graphics passes use dynamic rendering (no render pass
+  // or framebuffer objects at all) and barriers are synchronization2's, with
+  // each barrier carrying its own stages. Both are core in Vulkan 1.3 and
+  // have to have been enabled on the device.
+  void Init(VkDevice device, GpuAllocator &allocator, bool vulkan13,
+            const VkAllocationCallbacks *hostCallbacks);
+  void Destroy();
+
+  // Destroys framebuffers and transient images retired by frames up to
+  // `completedFrame`, then starts a new, empty graph
+  void BeginFrame(uint64_t completedFrame);
+
+  // Something the graph doesn't own, such as a swapchain image. It starts in
+  // `initialLayout` once `stages` (e.g. the acquire semaphore's wait stage)
+  // are done with it, and is left in `finalLayout`. UNDEFINED as the initial
+  // layout means its contents don't matter.
+  RenderGraphImage ImportImage(VkImage image, VkImageView view,
+                               VkFormat format, VkExtent2D extent,
+                               VkImageLayout initialLayout,
+                               VkPipelineStageFlags2 stages,
+                               VkImageLayout finalLayout,
+                               VkSampleCountFlagBits samples =
+                                   VK_SAMPLE_COUNT_1_BIT);
+  RenderGraphImage CreateImage(const TransientImageDesc &desc);
+  RenderGraphBuffer ImportBuffer(VkBuffer buffer);
+
+  // `name` must outlive the frame, it is also the pass's GPU profiler scope
+  RenderPassBuilder AddPass(const char *name, RenderPassType type,
+                            RenderPassFunction record);
+
+  // Culls, then places the images and barriers. Rebuilds cached objects
+  // only if the graph changed shape since the last frame.
+  void Compile();
+  // Records every pass that survived. `frame` is the serial this frame will
+  // be submitted as.
+  void Execute(VkCommandBuffer commandBuffer, uint64_t frame,
+               Profiler *profiler = nullptr);
+
+  // Forget framebuffers using `view` once `lastFrame` has completed, call
+  // before destroying a view that has been imported. Nothing to do with
+  // dynamic rendering, where there are none.
+  void ReleaseView(VkImageView view, uint64_t lastFrame);
+  // Forget the state kept for an imported buffer, call when destroying it so
+  // a new buffer given the same handle starts clean
+  void ReleaseBuffer(VkBuffer buffer);
+
+  // The transient image's view, valid after Compile
+  VkImageView GetView(RenderGraphImage image) const;
+  // And the image itself, for passes that copy or blit it. Imported images
+  // give back what they were imported with.
+  VkImage GetImage(RenderGraphImage image) const;
+  RenderGraphStats GetStats() const;
+
+private:
+  friend class RenderPassBuilder;
+
+  // An image or buffer as far as the hazards go. Reads since the last write
+  // only need an execution dependency on it, and the stages that have seen
+  // the write don't need it made visible again.
+  struct ResourceState {
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags2 writeStages = 0;
+    VkAccessFlags2 writeAccess = 0;
+    VkPipelineStageFlags2 readStages = 0;
+    VkAccessFlags2 visibleAccess = 0;
+    VkPipelineStageFlags2 visibleStages = 0;
+  };
+
+  enum class UseKind : uint32_t {
+    Color,
+    Depth,
+    Resolve,
+    Image,
+    Buffer,
+  };
+
+  struct Use {
+    UseKind kind;
+    uint32_t resource;
+    VkImageLayout layout;
+    VkPipelineStageFlags2 stages;
+    VkAccessFlags2 access;
+    bool write;
+    bool clear;
+    VkClearValue clearValue;
+    // From Compile: what was in the image doesn't matter to this use
+    bool discard;
+  };
+
+  struct Image {
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent2D extent = {};
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+
+    bool imported = false;
+    VkImageLayout importLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags2 importStages = 0;
+    VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    // Transient only
+    TransientImageDesc desc;
+    uint32_t physical = UINT32_MAX; // Into physicalImages
+    VkImageUsageFlags usage = 0;
+    uint32_t firstPass = UINT32_MAX;
+    uint32_t lastPass = 0;
+    bool attachmentOnly = true;
+
+    ResourceState state;
+    // Whether the contents are worth loading, so a pass can skip it
+    bool hasContents = false;
+  };
+
+  struct Buffer {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    ResourceState state;
+  };
+
+  struct Pass {
+    const char *name;
+    RenderPassType type;
+    RenderPassFunction record;
+    uint32_t firstUse = 0;
+    uint32_t useCount = 0;
+    bool sideEffects = false;
+    bool secondaries = false;
+    bool alive = false;
+
+    // Filled in by Compile
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    uint32_t framebuffer = 0; // Into framebuffers
+    VkExtent2D extent = {};
+    uint32_t clearCount = 0;
+    VkClearValue clears[RENDER_GRAPH_MAX_ATTACHMENTS];
+    // Or with dynamic rendering, the attachments themselves
+    uint32_t colorCount = 0;
+    VkRenderingAttachmentInfo colors[RENDER_GRAPH_MAX_ATTACHMENTS];
+    VkRenderingAttachmentInfo depth;
+    bool hasDepth = false;
+    VkFormat colorFormats[RENDER_GRAPH_MAX_ATTACHMENTS];
+    VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    // Either way, what secondaries inherit
+    VkCommandBufferInheritanceRenderingInfo renderingInheritance;
+    VkCommandBufferInheritanceInfo inheritance;
+  };
+
+  // One transient image and the memory it is bound to, kept across frames
+  struct PhysicalImage {
+    TransientImageDesc desc;
+    VkImageUsageFlags usage;
+    VkImage image;
+    VkImageView view;
+    uint32_t slot; // Into memorySlots, images in a slot alias
+    bool lazy;
+    // What the graph asked for, lazy drops it if no lazily allocated type
+    // fits. Next frame's images are compared with this.
+    bool lazyWanted;
+    uint32_t firstPass;
+    uint32_t lastPass;
+  };
+
+  struct MemorySlot {
+    Allocation allocation;
+    // Whatever last touched the memory, through any of its images
+    VkPipelineStageFlags2 stages = 0;
+    VkAccessFlags2 access = 0;
+  };
+
+  struct CachedRenderPass {
+    VkAttachmentDescription attachments[RENDER_GRAPH_MAX_ATTACHMENTS];
+    uint32_t colorCount;
+    uint32_t resolveCount;
+    bool depth;
+    VkRenderPass renderPass;
+  };
+
+  struct CachedFramebuffer {
+    VkRenderPass renderPass;
+    VkImageView views[RENDER_GRAPH_MAX_ATTACHMENTS];
+    uint32_t viewCount;
+    VkExtent2D extent;
+    VkFramebuffer framebuffer;
+    uint64_t lastFrame;
+  };
+
+  struct RetiredObject {
+    VkFramebuffer framebuffer = VK_NULL_HANDLE;
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    Allocation allocation;
+    uint64_t lastFrame = 0;
+  };
+
+  void AddUse(uint32_t pass, const Use &use);
+  void Cull();
+  // Creates the transient images again if their descriptions or lifetimes
+  // changed, retiring the old ones
+  void PlaceTransients();
+  void RetireTransients();
+  VkRenderPass GetRenderPass(const CachedRenderPass &key);
+  uint32_t GetFramebuffer(VkRenderPass renderPass, const VkImageView *views,
+                          uint32_t viewCount, VkExtent2D extent);
+  // How an attachment is loaded and stored in pass `pass`
+  VkAttachmentLoadOp GetLoadOp(const Use &use) const;
+  VkAttachmentStoreOp GetStoreOp(const Use &use, uint32_t pass) const;
+  // A render pass and framebuffer, or dynamic rendering's attachments
+  void PrepareAttachments(uint32_t pass);
+  // Moves `state` to what `use` needs, adding the barrier if it needs one.
+  // `image` for images, `buffer` for buffers.
+  void Transition(const Use &use, ResourceState &state, VkImage image,
+                  VkImageAspectFlags aspect, VkBuffer buffer,
+                  MemorySlot *slot);
+  void FlushBarriers(VkCommandBuffer commandBuffer);
+
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *hostCallbacks = nullptr;
+  GpuAllocator *allocator = nullptr;
+  bool vulkan13 = false;
+  bool lazyMemory = false; // Whether the device has any
+
+  std::vector<Pass> passes;
+  std::vector<Use> uses;
+  std::vector<Image> images;
+  std::vector<Buffer> buffers;
+  // Image or buffer index, by pass from Cull
+  std::vector<uint8_t> needed;
+
+  // Imported buffers' state as the last frame left it, until ReleaseBuffer
+  std::vector<std::pair<VkBuffer, ResourceState>> bufferStates;
+
+  std::vector<PhysicalImage> physicalImages;
+  std::vector<PhysicalImage> wantedImages; // Scratch for PlaceTransients
+  std::vector<MemorySlot> memorySlots;
+  std::vector<CachedRenderPass> renderPasses;
+  std::vector<CachedFramebuffer> framebuffers;
+  std::vector<RetiredObject> retired;
+
+  // Barriers for the pass about to run, in synchronization2's terms. Without
+  // it they are merged into one vkCmdPipelineBarrier, and the buffers' into
+  // a single global barrier.
+  std::vector<VkImageMemoryBarrier2> imageBarriers;
+  std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+  std::vector<VkImageMemoryBarrier> legacyImageBarriers;
+
+  uint64_t frame = 0;
+  RenderGraphStats stats;
+};
+
+} // namespace MiniEngine
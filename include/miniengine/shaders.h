@@ -0,0 +1,90 @@
+#pragma once
+
+#include <miniengine/jobs.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace MiniEngine {
+
+// How often the GLSL sources are checked for changes
+constexpr double SHADER_POLL_MS = 250.0;
+
+struct ShaderStats {
+  uint32_t compiles = 0;
+  uint32_t cacheHits = 0;
+  uint32_t failures = 0;
+  uint32_t pending = 0;
+  double lastCompileMs = 0.0;
+};
+
+// Keeps the SPIR-V the pipelines load in step with the GLSL it comes from.
+// Sources are compiled with glslc (which has to be on the PATH) on the job
+// scheduler, and every result is cached by a hash of the source so going back
+// to an earlier version of a shader doesn't recompile it. Poll hands back the
+// SPIR-V that has changed so its pipelines can be rebuilt (see
+// PipelineRegistry::Reload).
+class ShaderManager {
+public:
+  void Init(JobScheduler &jobs, const std::string &cacheDirectory);
+  // Waits for compiles in flight
+  void Destroy();
+
+  // Brings `spirvPath` up to date with `glslPath`, compiling on the calling
+  // thread if it isn't cached, then watches it for changes. If the source
+  // can't be compiled (no glslc, say) whatever is at `spirvPath` is kept.
+  // `stage` is glslc's name for it, e.g. "vertex".
+  void Watch(const std::string &glslPath, const std::string &spirvPath,
+             const std::string &stage);
+
+  // Checks the sources at most every SHADER_POLL_MS, starting background
+  // compiles for those that changed. Returns the SPIR-V paths rewritten since
+  // the last call, call it at a frame boundary.
+  const std::vector<std::string> &Poll();
+
+  ShaderStats GetStats() const;
+
+private:
+  struct Source {
+    std::string glslPath;
+    // The same, converted once so polling doesn't have to allocate
+    std::filesystem::path glslFile;
+    std::string spirvPath;
+    std::string stage;
+    std::filesystem::file_time_type lastWrite;
+    // Of the newest version seen, older compiles finishing late are ignored
+    std::atomic<uint64_t> hash = 0;
+  };
+
+  std::string GetCachePath(uint64_t hash) const;
+  // Reads and hashes the source, false if it can't be read
+  bool HashSource(const Source &source, uint64_t &hash) const;
+  // Compiles into the cache, logging glslc's output on failure
+  bool Compile(const Source &source, uint64_t hash);
+  // Copies the cached SPIR-V over the source's (through a temporary file, so
+  // nothing ever reads half of one)
+  bool Install(const Source &source, uint64_t hash);
+
+  JobScheduler *jobs = nullptr;
+  std::string cacheDirectory;
+
+  // A deque so sources don't move when more are watched
+  std::deque<Source> sources;
+  std::chrono::high_resolution_clock::time_point lastPoll;
+
+  mutable std::mutex mutex; // Guards stats and `finished`
+  ShaderStats stats{};
+  std::vector<std::string> finished; // Installed by background compiles
+  std::vector<std::string> updated;  // What Poll last returned
+  std::mutex installMutex;
+
+  JobCounter compiles;
+};
+
+} // namespace MiniEngine
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+namespace MiniEngine {
+
+// Instruction sets the batch kernels below have a version for. Scalar is the
+// plain glm path, the others are picked at runtime by what the CPU supports:
+// SSE2 is always there on x86-64, AVX2 (with FMA) is checked for, and NEON is
+// always there on ARM64.
+enum class SimdLevel { Scalar, Sse2, Avx2, Neon };
+
+// The best the CPU supports, detected once
+SimdLevel GetSupportedSimdLevel();
+// What the kernels use, the supported level unless it has been overridden
+SimdLevel GetSimdLevel();
+// Anything above what the CPU supports falls back to the supported level.
+// For comparing the kernels, call it before any other thread uses them.
+void SetSimdLevel(SimdLevel level);
+const char *GetSimdLevelName(SimdLevel level);
+
+// Axis aligned boxes as a centre and half extent per axis, each its own
+// array so a kernel loads a register's worth of boxes at a time
+struct AabbArrays {
+  float *centerX;
+  float *centerY;
+  float *centerZ;
+  float *extentX;
+  float *extentY;
+  float *extentZ;
+};
+
+// The same for bounding spheres
+struct SphereArrays {
+  const float *centerX;
+  const float *centerY;
+  const float *centerZ;
+  const float *radius;
+};
+
+// Every transform in these is a glm::mat4, column major.
+
+// out[i] = a[i] * b[i]. `out` may be either input.
+void MultiplyMatrices(const glm::mat4 *a, const glm::mat4 *b, glm::mat4 *out,
+                      uint32_t count);
+
+// worlds[i] = worlds[parents[i]] * locals[i], or locals[i] for roots (a
+// parent of UINT32_MAX). Parents have to come before their children.
+void ComposeHierarchy(const uint32_t *parents, const glm::mat4 *locals,
+                      glm::mat4 *worlds, uint32_t count);
+
+// The boxes that enclose `in`'s boxes once transformed by `transform`.
+// `out` may be `in`.
+void TransformAabbs(const glm::mat4 &transform, const AabbArrays &in,
+                    const AabbArrays &out, uint32_t count);
+
+// Tests each sphere against the planes from GpuCuller::ExtractFrustumPlanes
+// (normalised, pointing in), the same test cull.glsl does. Writes 1 to
+// visible[i] for the ones at least partly inside, 0 for the rest, and
+// returns how many are visible.
+uint32_t CullSpheres(const glm::vec4 planes[6], const SphereArrays &spheres,
+                     uint8_t *visible, uint32_t count);
+
+} // namespace MiniEngine
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <miniengine/allocator.h>
+#include <miniengine/bindless.h>
+#include <miniengine/uniforms.h>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+namespace MiniEngine {
+
+// An axis aligned, flat coloured quad in clip space
+struct SpriteQuad {
+  glm::vec2 min;
+  glm::vec2 max;
+  glm::vec3 colour;
+  // Must use the scene's vertex layout (Vertex at binding 0, InstanceData at
+  // binding 1) and pipeline layout
+  VkPipeline pipeline;
+  // In the material buffer given to Record, and a slot in the bindless heap
+  uint32_t material = 0;
+  uint32_t texture = BINDLESS_NONE;
+  // Lower layers are drawn first, within a layer quads keep the order they
+  // were submitted in
+  uint16_t layer = 0;
+};
+
+// Collects quads over a frame, then writes them all into a persistently
+// mapped vertex buffer (one region per frame in flight, like StagingRing) and
+// draws them through a shared index buffer. Quads are sorted by layer then
+// pipeline, so there is one vkCmdDrawIndexed per run of quads that share a
+// pipeline rather than one per quad. Materials and textures are picked with
+// push constants, so a change of either splits a run but binds nothing.
+class SpriteBatch {
+public:
+  // `indexBuffer` must hold BuildIndices(maxQuads), it is never written here
+  void Init(VkDevice device, GpuAllocator &allocator, uint32_t frameCount,
+            uint32_t maxQuads, VkBuffer indexBuffer,
+            const VkAllocationCallbacks *hostCallbacks);
+  void Destroy();
+
+  // Six 32-bit indices per quad, two clockwise triangles like the demo quad
+  static std::vector<uint32_t> BuildIndices(uint32_t maxQuads);
+
+  // Must be called after the frame's in flight fence has been waited on, the
+  // GPU is done with the frame's region then
+  void BeginFrame(uint32_t frameIndex);
+
+  // Returns false (and drops the quad) once the frame has maxQuads
+  bool Submit(const SpriteQuad &quad);
+
+  // Sorts the frame's quads and writes their vertices. Call once everything
+  // is submitted and before Record.
+  void Prepare();
+
+  // Records the draws, inside a render pass. Only reads what Prepare built,
+  // so it is safe from any thread. `materials` is the heap slot of the
+  // buffer the quads' materials index into, and `frameUniforms` the block of
+  // `uniforms` they are drawn with (an identity viewProjection keeps them in
+  // clip space).
+  void Record(VkCommandBuffer commandBuffer, VkExtent2D extent,
+              const BindlessHeap &heap, const UniformRing &uniforms,
+              uint32_t frameUniforms, VkPipelineLayout layout,
+              uint32_t materials) const;
+
+  uint32_t GetQuadCount() const { return static_cast<uint32_t>(quads.size()); }
+  uint32_t GetDrawCount() const { return static_cast<uint32_t>(draws.size()); }
+
+private:
+  struct Draw {
+    VkPipeline pipeline;
+    uint32_t material;
+    uint32_t texture;
+    uint32_t firstQuad;
+    uint32_t quadCount;
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *hostCallbacks = nullptr;
+  GpuAllocator *allocator = nullptr;
+
+  // Every frame's vertices, followed by the one instance they are all drawn
+  // with (an identity transform and a white tint)
+  VkBuffer buffer = VK_NULL_HANDLE;
+  Allocation allocation;
+  VkBuffer indexBuffer = VK_NULL_HANDLE;
+
+  uint32_t maxQuads = 0;
+  VkDeviceSize frameBase = 0; // Start of the current frame's vertices
+  VkDeviceSize instanceOffset = 0;
+
+  // Kept between frames so the steady state does not allocate
+  std::vector<SpriteQuad> quads;
+  // Layer, pipeline slot and submission index packed so a plain integer sort
+  // gives the draw order
+  std::vector<uint64_t> keys;
+  std::vector<VkPipeline> pipelineSlots;
+  std::vector<Draw> draws;
+};
+
+} // namespace MiniEngine
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <miniengine/allocator.h>
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+namespace MiniEngine {
+
+// A buffer copy waiting to be recorded by RecordBufferCopies
+struct QueuedCopy {
+  VkBuffer srcBuffer;
+  VkBuffer dstBuffer;
+  VkBufferCopy region;
+  uint64_t order; // When it was queued, later copies win where they overlap
+};
+
+// Records `copies` with as few vkCmdCopyBuffer calls as it can, one per
+// destination and source with every region between the two. The regions of
+// one command (or of commands without a barrier between them) are written in
+// no particular order, so a copy overlapping one already recorded for its
+// destination gets a transfer barrier first, and the later copy wins as if
+// each had been recorded on its own. Sorts `copies`, `regions` is scratch.
+void RecordBufferCopies(VkCommandBuffer commandBuffer,
+                        std::vector<QueuedCopy> &copies,
+                        std::vector<VkBufferCopy> &regions);
+
+// A persistently mapped, host-visible buffer split into one region per frame
+// in flight. A frame's region is only rewritten once that frame's in flight
+// fence has signalled, so uploads never have to wait on the GPU and the copies
+// are recorded straight into the frame's own command buffer.
+class StagingRing {
+public:
+  void Init(VkDevice device, GpuAllocator &allocator, uint32_t frameCount,
+            VkDeviceSize frameCapacity,
+            const VkAllocationCallbacks *hostCallbacks);
+  void Destroy();
+
+  // Must be called after the frame's in flight fence has been waited on, this
+  // is what makes reusing the region safe.
+  void BeginFrame(uint32_t frameIndex);
+
+  // Copies `data` into the current frame's region and queues a copy into
+  // `dstBuffer`. Returns false if the region is full, nothing is queued then.
+  bool Upload(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void *data,
+              VkDeviceSize size);
+
+  // Records every queued copy into `commandBuffer`, surrounded by the barriers
+  // needed against earlier reads of the destinations and the later reads in
+  // `dstStageMask`/`dstAccessMask`. Must be recorded outside a render pass.
+  void Flush(VkCommandBuffer commandBuffer,
+             VkPipelineStageFlags dstStageMask =
+                 VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+             VkAccessFlags dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+                                           VK_ACCESS_INDEX_READ_BIT);
+
+  bool HasPendingUploads() const { return !pending.empty(); }
+
+  VkDeviceSize GetFrameCapacity() const { return frameCapacity; }
+  VkDeviceSize GetFrameUsage() const { return head; }
+  // Over the ring's lifetime
+  uint64_t GetBytesUploaded() const { return bytesUploaded; }
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *hostCallbacks = nullptr;
+  GpuAllocator *allocator = nullptr;
+
+  VkBuffer buffer = VK_NULL_HANDLE;
+  Allocation allocation;
+
+  VkDeviceSize frameCapacity = 0;
+  VkDeviceSize frameBase = 0; // Start of the current frame's region
+  VkDeviceSize head = 0;      // Bytes used in the current frame's region
+  uint64_t bytesUploaded = 0;
+
+  // Kept between frames so the steady state does not allocate
+  std::vector<QueuedCopy> pending;
+  std::vector<VkBufferCopy> regions;
+};
+
+} // namespace MiniEngine
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <miniengine/allocator.h>
+#include <miniengine/package.h>
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace MiniEngine {
+
+// Most that is streamed in a single frame, every mip has to fit in this
+constexpr VkDeviceSize TEXTURE_STREAM_FRAME_SIZE = 16 * 1024 * 1024;
+
+// Mips this size and smaller are loaded straight away and never evicted, so
+// every texture always has something to sample
+constexpr uint32_t TEXTURE_TAIL_SIZE = 64;
+
+// How a format's data is laid out, block compressed formats store each
+// blockWidth x blockHeight block of texels in blockBytes
+struct TextureFormatInfo {
+  uint32_t blockWidth = 1;
+  uint32_t blockHeight = 1;
+  uint32_t blockBytes = 0; // 0 for formats the streamer doesn't know
+  bool compressed = false;
+};
+
+TextureFormatInfo GetTextureFormatInfo(VkFormat format);
+
+// Bytes in one mip of `format`, a partial block at the edge is a whole one
+VkDeviceSize GetMipSize(VkFormat format, uint32_t width, uint32_t height);
+
+struct TextureHandle {
+  uint32_t index = UINT32_MAX;
+
+  bool IsValid() const { return index != UINT32_MAX; }
+};
+
+struct TextureStats {
+  uint32_t textures = 0;
+  uint32_t fullyResident = 0;
+  VkDeviceSize residentBytes = 0;
+  VkDeviceSize budgetBytes = 0;
+  VkDeviceSize wantedBytes = 0; // If every texture were fully resident
+  uint64_t mipsStreamed = 0;
+  uint64_t mipsEvicted = 0;
+  uint64_t bytesStreamed = 0;
+};
+
+// Streams textures into device local images a mip at a time, highest
+// priority first, keeping the total under a memory budget by evicting the top
+// mips of the lowest priority textures.
+//
+// An image can't gain or lose mips, so a texture changing residency gets a new
+// image with the new mip count, the mips it keeps are copied across on the GPU
+// and the old image is destroyed once no frame in flight can be using it. The
+// view handed out changes whenever that happens.
+//
+// Package textures come with every mip (compressed ones have to), and only the
+// tail is loaded up front. Images loaded from files are uploaded whole and
+// have their mips generated with vkCmdBlitImage, they don't stream.
+class TextureStreamer {
+public:
+  void Init(VkPhysicalDevice physicalDevice, VkDevice device,
+            GpuAllocator &allocator, uint32_t frameCount, VkDeviceSize budget,
+            const VkAllocationCallbacks *hostCallbacks);
+  void Destroy();
+
+  // The data stays in the package's mapping until it is streamed, so the
+  // package has to stay open. Invalid if the GPU can't sample its format.
+  TextureHandle Load(const AssetPackage &package, std::string_view name);
+  // Any image stb_image can decode. Throws if it can't be read.
+  TextureHandle LoadFile(const std::string &path);
+
+  // Higher streams in first and is evicted last, 0 keeps only the tail
+  void SetPriority(TextureHandle handle, float priority);
+  void SetBudget(VkDeviceSize budget) { this->budget = budget; }
+
+  // Must be called after the frame's in flight fence has been waited on.
+  // Destroys images retired by frames up to `completedFrame`.
+  void BeginFrame(uint32_t frameIndex, uint64_t completedFrame);
+
+  // Decides what to stream in and evict this frame and records it, outside a
+  // render pass. `frame` is the serial this frame will be submitted as. Every
+  // texture is in SHADER_READ_ONLY_OPTIMAL afterwards.
+  void Record(VkCommandBuffer commandBuffer, uint64_t frame);
+
+  // VK_NULL_HANDLE until the first Record after loading
+  VkImageView GetView(TextureHandle handle) const;
+  // Bumped whenever the view changes
+  uint32_t GetGeneration(TextureHandle handle) const;
+  // Linear filtering across every mip, shared by all textures
+  VkSampler GetSampler() const { return sampler; }
+
+  TextureStats GetStats() const;
+
+private:
+  struct Texture {
+    std::string name;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mipLevels = 0;
+    // Where each mip comes from, the package mapping or `pixels`
+    std::span<const std::byte> mips[PACKAGE_MAX_MIPS];
+    std::vector<std::byte> pixels;
+    // Only mip 0 is given, the rest are blitted from it
+    bool generateMips = false;
+
+    float priority = 1.0f;
+    // The first mip that never gets evicted
+    uint32_t tailBase = 0;
+    // The largest mip in the image, mipLevels when there is no image yet
+    uint32_t residentBase = 0;
+    VkDeviceSize residentBytes = 0;
+    uint64_t lastChanged = 0; // Frame serial, one change per frame
+
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    Allocation allocation;
+    uint32_t generation = 0;
+  };
+
+  struct RetiredImage {
+    VkImage image;
+    VkImageView view;
+    Allocation allocation;
+    uint64_t lastFrame;
+  };
+
+  TextureHandle Add(Texture &&texture);
+  // Copies a mip into this frame's staging region, false if it is full
+  bool Stage(const Texture &texture, uint32_t level, VkDeviceSize &offset);
+  VkDeviceSize GetResidentSize(const Texture &texture, uint32_t base) const;
+  // Replaces the texture's image with one starting at mip `base`. Mips the
+  // old image had are copied across, the rest come from staging.
+  bool Rebuild(VkCommandBuffer commandBuffer, Texture &texture, uint32_t base,
+               uint64_t frame);
+  // Mips 1 and up from mip 0, the image is left all in TRANSFER_DST
+  void GenerateMips(VkCommandBuffer commandBuffer, VkImage image,
+                    const Texture &texture);
+  // The lowest priority texture that still has a mip above its tail, other
+  // than ones changed this frame. Null if there is none below `priority`.
+  Texture *FindEvictable(float priority, uint64_t frame);
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *hostCallbacks = nullptr;
+  GpuAllocator *allocator = nullptr;
+  VkSampler sampler = VK_NULL_HANDLE;
+
+  VkDeviceSize budget = 0;
+  VkDeviceSize residentBytes = 0;
+
+  // One region of TEXTURE_STREAM_FRAME_SIZE per frame in flight, like the
+  // staging ring
+  VkBuffer stagingBuffer = VK_NULL_HANDLE;
+  Allocation stagingAllocation;
+  VkDeviceSize frameBase = 0;
+  VkDeviceSize head = 0;
+
+  std::vector<Texture> textures;
+  std::vector<RetiredImage> retired;
+  // Kept between frames so the steady state doesn't allocate
+  std::vector<uint32_t> order;
+
+  uint64_t mipsStreamed = 0;
+  uint64_t mipsEvicted = 0;
+  uint64_t bytesStreamed = 0;
+};
+
+} // namespace MiniEngine
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <miniengine/allocator.h>
+#include <miniengine/bindless.h>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <type_traits>
+
+namespace MiniEngine {
+
+// An offset that refers to no block, Push returns it when a frame is full
+constexpr uint32_t UNIFORM_NONE = UINT32_MAX;
+
+// std140, read by vert.glsl from set 1. The scene and the sprites each push
+// one of these a frame.
+struct FrameUniforms {
+  glm::mat4 viewProjection = glm::mat4(1.0f);
+  float time = 0.0f;      // Seconds since startup
+  float deltaTime = 0.0f; // Seconds since the last frame
+  float padding[2] = {};
+};
+
+// Pushed per draw for the vertex stage. DrawConstants (for the fragment
+// stage) take the first bytes of the push constants, these come after them.
+struct ObjectConstants {
+  glm::mat4 model = glm::mat4(1.0f);
+};
+
+constexpr uint32_t OBJECT_CONSTANTS_OFFSET = 16;
+static_assert(sizeof(DrawConstants) <= OBJECT_CONSTANTS_OFFSET);
+
+// ObjectConstants, for the vertex stage
+VkPushConstantRange GetObjectPushConstantRange();
+
+// Blocks of uniform data the CPU writes every frame, in a persistently
+// mapped, host-visible buffer with one region per frame in flight. Like
+// StagingRing a region is only rewritten once its frame's in flight fence has
+// signalled, but the shaders read the blocks where they are, so nothing is
+// copied or submitted.
+//
+// Every block starts on `minUniformBufferOffsetAlignment` and is bound as a
+// dynamic uniform buffer: there is a single descriptor set covering the whole
+// buffer, and which block a draw reads is the dynamic offset it is bound
+// with. Changing a transform is a few bytes written and a bind.
+class UniformRing {
+public:
+  void Init(VkDevice device, GpuAllocator &allocator, uint32_t frameCount,
+            VkDeviceSize blockSize, uint32_t blocksPerFrame,
+            const VkAllocationCallbacks *hostCallbacks);
+  void Destroy();
+
+  // One dynamic uniform buffer at binding 0, for the vertex stage
+  VkDescriptorSetLayout GetSetLayout() const { return setLayout; }
+
+  // Must be called after the frame's in flight fence has been waited on
+  void BeginFrame(uint32_t frameIndex);
+
+  // Copies `data`, at most the block size, into the current frame's next
+  // block and returns its dynamic offset. UNIFORM_NONE once the frame's
+  // blocks are used up. Call from one thread, before recording the draws
+  // that read it.
+  uint32_t Push(const void *data, VkDeviceSize size);
+
+  template <typename T> uint32_t Push(const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    return Push(&value, sizeof(T));
+  }
+
+  // Binds the set as `set` of `layout`, reading the block at `offset`. Only
+  // reads, so it is safe from any recording thread.
+  void Bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint,
+            VkPipelineLayout layout, uint32_t set, uint32_t offset) const;
+
+  VkDeviceSize GetBlockSize() const { return blockSize; }
+  uint32_t GetBlocksPerFrame() const { return blocksPerFrame; }
+  uint32_t GetFrameUsage() const { return head; } // Blocks this frame
+  // Over the ring's lifetime
+  uint64_t GetBytesWritten() const { return bytesWritten; }
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *hostCallbacks = nullptr;
+  GpuAllocator *allocator = nullptr;
+
+  VkBuffer buffer = VK_NULL_HANDLE;
+  Allocation allocation;
+
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+  VkDeviceSize blockSize = 0; // What the descriptor covers
+  VkDeviceSize stride = 0;    // blockSize rounded up to the alignment
+  uint32_t blocksPerFrame = 0;
+
+  VkDeviceSize frameBase = 0; // Start of the current frame's region
+  uint32_t head = 0;          // Blocks used in the current frame's region
+  uint64_t bytesWritten = 0;
+};
+
+} // namespace MiniEngine
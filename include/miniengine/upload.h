@@ -0,0 +1,108 @@
+#pragma once
+
+#include <miniengine/allocator.h>
+#include <miniengine/staging.h>
+
+#include <vulkan/vulkan.h>
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace MiniEngine {
+
+// Handle to an upload queued on the UploadEngine. The upload has landed once
+// the engine's timeline semaphore reaches `value`.
+struct UploadTicket {
+  uint64_t value = 0;
+
+  bool IsValid() const { return value != 0; }
+};
+
+struct UploadStats {
+  uint64_t bytesUploaded = 0; // Submitted, not just queued
+  uint64_t copiesSubmitted = 0;
+  uint64_t batchesSubmitted = 0;
+  uint32_t batchesInFlight = 0;
+};
+
+// Streams buffer uploads through a (preferably dedicated) transfer queue.
+// Copies are queued from any thread, then batched into a single submission
+// that signals a timeline semaphore, nothing here blocks the caller unless
+// they explicitly `Wait` on a ticket.
+//
+// Submit (and Wait, which may submit) must run on the thread that submits
+// to the graphics queue. Without a dedicated transfer family `queue` is the
+// graphics queue, and Vulkan requires submissions to a queue to be
+// externally synchronised.
+class UploadEngine {
+public:
+  void Init(VkDevice device, GpuAllocator &allocator, uint32_t queueFamily,
+            VkQueue queue, const VkAllocationCallbacks *hostCallbacks);
+  void Destroy();
+
+  // Copies `data` into staging memory straight away, so the caller may free it
+  // as soon as this returns. The copy itself happens on the next `Submit`.
+  UploadTicket Enqueue(VkBuffer dstBuffer, VkDeviceSize dstOffset,
+                       const void *data, VkDeviceSize size);
+
+  // Submits everything queued since the last call as one batch. Only from
+  // the thread that owns the queue, see above.
+  void Submit();
+
+  // Frees staging memory and command buffers of batches that have finished.
+  void Collect();
+
+  bool IsComplete(UploadTicket ticket) const;
+  // Submits the batch first if the ticket is still queued, so the same
+  // thread rule as Submit applies. Returns false if `timeout` (in
+  // nanoseconds) ran out first, throws if the wait failed.
+  bool Wait(UploadTicket ticket, uint64_t timeout = UINT64_MAX);
+
+  // Wait on this (with a ticket's value) in a submission that reads the data
+  // on another queue, it provides the memory dependency for the copy.
+  VkSemaphore GetSemaphore() const { return timeline; }
+  uint64_t GetCompletedValue() const;
+
+  UploadStats GetStats() const;
+
+private:
+  struct StagingPage {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    Allocation allocation;
+    VkDeviceSize capacity = 0;
+    VkDeviceSize head = 0;
+  };
+
+  struct Batch {
+    uint64_t value;
+    VkCommandBuffer commandBuffer;
+    std::vector<StagingPage> pages;
+  };
+
+  StagingPage AcquirePage(VkDeviceSize minSize);
+  void ReleasePage(StagingPage &page);
+
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *hostCallbacks = nullptr;
+  GpuAllocator *allocator = nullptr;
+  VkQueue queue = VK_NULL_HANDLE;
+  VkCommandPool commandPool = VK_NULL_HANDLE;
+  VkSemaphore timeline = VK_NULL_HANDLE;
+
+  // Value the batch currently being built will signal
+  uint64_t nextValue = 1;
+
+  std::vector<StagingPage> currentPages;
+  std::vector<QueuedCopy> pending;
+
+  std::vector<StagingPage> freePages;
+  std::vector<VkCommandBuffer> freeCommandBuffers;
+  std::deque<Batch> inFlight;
+
+  UploadStats stats{};
+
+  mutable std::mutex mutex;
+};
+
+} // namespace MiniEngine
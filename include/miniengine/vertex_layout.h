@@ -0,0 +1,234 @@
+#pragma once
+
+#include <miniengine/pipeline_registry.h>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+namespace MiniEngine {
+
+// Compact attribute types. The vertex fetch hardware turns every one of these
+// into floats on the way in, so the shader declares them as plain vec2/vec4
+// and doesn't change when a stream is made smaller.
+
+// Two IEEE half floats, read as a vec2
+struct Half2 {
+  uint16_t x, y;
+};
+
+// Four IEEE half floats, read as a vec4
+struct Half4 {
+  uint16_t x, y, z, w;
+};
+
+// Four bytes mapped from 0-255 to 0-1, read as a vec4 (or a vec3, dropping
+// the last byte)
+struct UNorm8x4 {
+  uint8_t r, g, b, a;
+};
+
+// Ten bits each of x, y and z mapped from -1 to 1, read as a vec4 (w gets the
+// top two bits, always 0 here)
+struct PackedNormal {
+  uint32_t bits;
+};
+
+// Rounds to nearest even, like the hardware does. Too large values become
+// infinity and tiny ones become subnormal or zero.
+constexpr uint16_t FloatToHalf(float value) {
+  uint32_t bits = std::bit_cast<uint32_t>(value);
+  uint32_t sign = (bits >> 16) & 0x8000;
+  uint32_t floatExponent = (bits >> 23) & 0xff;
+  uint32_t mantissa = bits & 0x7fffff;
+  int32_t exponent = static_cast<int32_t>(floatExponent) - 127 + 15;
+
+  // Infinity stays infinity, NaN stays (a quiet) NaN
+  if (floatExponent == 0xff) {
+    return static_cast<uint16_t>(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+  }
+  if (exponent >= 31) {
+    return static_cast<uint16_t>(sign | 0x7c00);
+  }
+
+  uint32_t half;
+  uint32_t remainder;
+  uint32_t halfway;
+  if (exponent <= 0) {
+    // Subnormal, the implicit leading 1 becomes part of the mantissa
+    if (exponent < -10) {
+      return static_cast<uint16_t>(sign);
+    }
+    mantissa |= 0x800000;
+    uint32_t shift = static_cast<uint32_t>(14 - exponent);
+    half = mantissa >> shift;
+    remainder = mantissa & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+  } else {
+    half = static_cast<uint32_t>(exponent) << 10 | mantissa >> 13;
+    remainder = mantissa & 0x1fff;
+    halfway = 0x1000;
+  }
+
+  // A carry out of the mantissa moves into the exponent, which is exactly
+  // what rounding up should do (all the way to infinity at the top end)
+  if (remainder > halfway || (remainder == halfway && (half & 1))) {
+    half++;
+  }
+  return static_cast<uint16_t>(sign | half);
+}
+
+constexpr Half2 PackHalf2(glm::vec2 value) {
+  return {FloatToHalf(value.x), FloatToHalf(value.y)};
+}
+
+constexpr Half4 PackHalf4(glm::vec4 value) {
+  return {FloatToHalf(value.x), FloatToHalf(value.y), FloatToHalf(value.z),
+          FloatToHalf(value.w)};
+}
+
+constexpr uint8_t FloatToUNorm8(float value) {
+  return static_cast<uint8_t>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+constexpr UNorm8x4 PackUNorm8x4(glm::vec3 value, float alpha = 1.0f) {
+  return {FloatToUNorm8(value.x), FloatToUNorm8(value.y),
+          FloatToUNorm8(value.z), FloatToUNorm8(alpha)};
+}
+
+constexpr uint32_t FloatToSNorm10(float value) {
+  float scaled = std::clamp(value, -1.0f, 1.0f) * 511.0f;
+  int32_t rounded = static_cast<int32_t>(scaled + (scaled < 0 ? -0.5f : 0.5f));
+  // Two's complement in 10 bits
+  return static_cast<uint32_t>(rounded) & 0x3ff;
+}
+
+// VK_FORMAT_A2B10G10R10_SNORM_PACK32 puts x in the lowest bits
+constexpr PackedNormal PackNormal(glm::vec3 normal) {
+  return {FloatToSNorm10(normal.x) | FloatToSNorm10(normal.y) << 10 |
+          FloatToSNorm10(normal.z) << 20};
+}
+
+// What a C++ attribute type looks like to Vulkan. Types bigger than a vec4
+// take several consecutive locations, one per `locationSize` bytes.
+template <typename T> struct VertexFormatOf;
+
+template <VkFormat Format, uint32_t Locations = 1, uint32_t LocationSize = 0>
+struct VertexFormatInfo {
+  static constexpr VkFormat format = Format;
+  static constexpr uint32_t locations = Locations;
+  static constexpr uint32_t locationSize = LocationSize;
+};
+
+template <>
+struct VertexFormatOf<float> : VertexFormatInfo<VK_FORMAT_R32_SFLOAT> {};
+template <>
+struct VertexFormatOf<glm::vec2> : VertexFormatInfo<VK_FORMAT_R32G32_SFLOAT> {
+};
+template <>
+struct VertexFormatOf<glm::vec3>
+    : VertexFormatInfo<VK_FORMAT_R32G32B32_SFLOAT> {};
+template <>
+struct VertexFormatOf<glm::vec4>
+    : VertexFormatInfo<VK_FORMAT_R32G32B32A32_SFLOAT> {};
+// A mat4 is four vec4 columns
+template <>
+struct VertexFormatOf<glm::mat4>
+    : VertexFormatInfo<VK_FORMAT_R32G32B32A32_SFLOAT, 4, sizeof(glm::vec4)> {
+};
+template <>
+struct VertexFormatOf<Half2> : VertexFormatInfo<VK_FORMAT_R16G16_SFLOAT> {};
+template <>
+struct VertexFormatOf<Half4>
+    : VertexFormatInfo<VK_FORMAT_R16G16B16A16_SFLOAT> {};
+template <>
+struct VertexFormatOf<UNorm8x4> : VertexFormatInfo<VK_FORMAT_R8G8B8A8_UNORM> {
+};
+template <>
+struct VertexFormatOf<PackedNormal>
+    : VertexFormatInfo<VK_FORMAT_A2B10G10R10_SNORM_PACK32> {};
+
+// One member of a vertex stream
+struct VertexAttribute {
+  uint32_t location;
+  VkFormat format;
+  uint32_t offset;
+  uint32_t locations;
+  uint32_t locationSize;
+  uint32_t size;
+};
+
+template <typename T>
+constexpr VertexAttribute MakeVertexAttribute(uint32_t location,
+                                              size_t offset) {
+  VertexAttribute attribute = {};
+  attribute.location = location;
+  attribute.format = VertexFormatOf<T>::format;
+  attribute.offset = static_cast<uint32_t>(offset);
+  attribute.locations = VertexFormatOf<T>::locations;
+  attribute.locationSize = VertexFormatOf<T>::locationSize;
+  attribute.size = sizeof(T);
+  return attribute;
+}
+
+// Describes `member` of the struct `Type` at shader location `location`. The
+// member's type picks the format, see VertexFormatOf.
+#define VERTEX_ATTRIBUTE(Type, member, location)                               \
+  ::MiniEngine::MakeVertexAttribute<decltype(Type::member)>(                   \
+      location, offsetof(Type, member))
+
+// A vertex stream is a struct read from one binding, with a
+//
+//   static constexpr auto Attributes() {
+//     return std::array{VERTEX_ATTRIBUTE(Type, member, location), ...};
+//   }
+//
+// listing what the shader reads from it. Different passes can read different
+// streams of the same mesh, a depth pass only needs a position stream.
+template <typename T> constexpr bool VertexAttributesFit() {
+  for (const VertexAttribute &attribute : T::Attributes()) {
+    if (attribute.offset + attribute.size > sizeof(T)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename T>
+VkVertexInputBindingDescription
+GetVertexBindingDescription(uint32_t binding, VkVertexInputRate inputRate) {
+  VkVertexInputBindingDescription bindingDescription = {};
+  bindingDescription.binding = binding;
+  bindingDescription.stride = sizeof(T);
+  // Per vertex, or only once per instance
+  bindingDescription.inputRate = inputRate;
+  return bindingDescription;
+}
+
+// Adds the stream's binding and every location of its attributes to `desc`
+template <typename T>
+void AddVertexStream(PipelineDesc &desc, uint32_t binding,
+                     VkVertexInputRate inputRate) {
+  static_assert(VertexAttributesFit<T>(),
+                "Vertex attribute reads past the end of its stream");
+
+  desc.bindings.push_back(GetVertexBindingDescription<T>(binding, inputRate));
+
+  for (const VertexAttribute &attribute : T::Attributes()) {
+    for (uint32_t i = 0; i < attribute.locations; i++) {
+      VkVertexInputAttributeDescription description = {};
+      description.binding = binding;
+      description.location = attribute.location + i;
+      description.format = attribute.format;
+      description.offset = attribute.offset + attribute.locationSize * i;
+      desc.attributes.push_back(description);
+    }
+  }
+}
+
+} // namespace MiniEngine
@@ -0,0 +1,453 @@
+#include <miniengine/allocator.h>
+
+#include <spdlog/spdlog.h>
+
+#include <stdexcept>
+
+namespace MiniEngine {
+
+// Default size of a block, heaps smaller than this get `heapSize / 8` blocks
+// so we don't attempt to reserve most of a small heap in one go.
+constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+constexpr VkDeviceSize SMALL_HEAP_SIZE = 512ull * 1024 * 1024;
+
+struct MemoryBlock {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize size = 0;
+  void *mapped = nullptr;
+  uint32_t memoryType = 0;
+  AllocationStrategy strategy = AllocationStrategy::FreeList;
+
+  VkDeviceSize usedBytes = 0;
+  uint32_t liveCount = 0;
+
+  // Free-list strategy: every byte of the block is covered by exactly one
+  // chunk, keyed by its offset. Adjacent free chunks are always merged, so
+  // the neighbours of a free chunk are always in use (or the block edge).
+  struct Chunk {
+    VkDeviceSize size;
+    bool free;
+    ResourceKind kind;
+  };
+  std::map<VkDeviceSize, Chunk> chunks;
+
+  // Linear strategy
+  VkDeviceSize head = 0;
+  ResourceKind lastKind = ResourceKind::Linear;
+};
+
+static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// Whether the last byte of resource A and the first byte of resource B fall
+// on the same `pageSize` page. If they do and one is linear and the other
+// optimal, the spec requires them to be moved apart.
+static bool OnSamePage(VkDeviceSize aOffset, VkDeviceSize aSize,
+                       VkDeviceSize bOffset, VkDeviceSize pageSize) {
+  VkDeviceSize aEndPage = (aOffset + aSize - 1) & ~(pageSize - 1);
+  VkDeviceSize bStartPage = bOffset & ~(pageSize - 1);
+  return aEndPage == bStartPage;
+}
+
+GpuAllocator::GpuAllocator() = default;
+
+GpuAllocator::~GpuAllocator() { Destroy(); }
+
+void GpuAllocator::Init(VkPhysicalDevice physicalDevice, VkDevice device,
+                        const VkAllocationCallbacks *hostCallbacks) {
+  SPDLOG_TRACE("GpuAllocator::Init()");
+
+  this->device = device;
+  this->hostCallbacks = hostCallbacks;
+
+  // Query these once, `FindMemoryType` used to do this for every buffer
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+  vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+  bufferImageGranularity = deviceProperties.limits.bufferImageGranularity;
+  if (bufferImageGranularity == 0) {
+    bufferImageGranularity = 1;
+  }
+
+  stats.maxMemoryAllocationCount =
+      deviceProperties.limits.maxMemoryAllocationCount;
+
+  for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+    spdlog::info("Memory heap {}: {} MiB{}", i,
+                 memoryProperties.memoryHeaps[i].size / (1024 * 1024),
+                 (memoryProperties.memoryHeaps[i].flags &
+                  VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+                     ? " (device local)"
+                     : "");
+  }
+}
+
+void GpuAllocator::Destroy() {
+  if (device == VK_NULL_HANDLE) {
+    return;
+  }
+
+  SPDLOG_TRACE("GpuAllocator::Destroy()");
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (stats.total.allocationCount > 0) {
+    spdlog::warn("GpuAllocator destroyed with {} live allocations ({} bytes)",
+                 stats.total.allocationCount, stats.total.usedBytes);
+  }
+
+  for (auto &typeBlocks : blocks) {
+    for (auto &block : typeBlocks) {
+      vkFreeMemory(device, block->memory, hostCallbacks);
+    }
+    typeBlocks.clear();
+  }
+
+  for (auto &[memory, allocation] : dedicated) {
+    vkFreeMemory(device, memory, hostCallbacks);
+  }
+  dedicated.clear();
+
+  device = VK_NULL_HANDLE;
+}
+
+uint32_t GpuAllocator::FindMemoryType(uint32_t typeFilter,
+                                      VkMemoryPropertyFlags properties) const {
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+    if ((typeFilter & (1 << i)) &&
+        (memoryProperties.memoryTypes[i].propertyFlags & properties) ==
+            properties) {
+      // The memory type is suitable for the buffer (it's in the type filter and
+      // has the required properties)
+      // We aren't concerned with the index of the memory type, just that it
+      // exists, we could check for whether it's the best memory type for the
+      // buffer, but we're not doing that here
+      return i;
+    }
+  }
+
+  throw std::runtime_error("Failed to find suitable memory type");
+}
+
+VkDeviceSize GpuAllocator::GetBlockSize(uint32_t memoryType) const {
+  uint32_t heapIndex = memoryProperties.memoryTypes[memoryType].heapIndex;
+  VkDeviceSize heapSize = memoryProperties.memoryHeaps[heapIndex].size;
+
+  return heapSize <= SMALL_HEAP_SIZE ? AlignUp(heapSize / 8, 256)
+                                     : DEFAULT_BLOCK_SIZE;
+}
+
+VkDeviceMemory GpuAllocator::AllocateDeviceMemory(uint32_t memoryType,
+                                                  VkDeviceSize size,
+                                                  void **mapped) {
+  VkMemoryAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = size;
+  allocInfo.memoryTypeIndex = memoryType;
+
+  VkDeviceMemory memory;
+  if (vkAllocateMemory(device, &allocInfo, hostCallbacks, &memory) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate device memory");
+  }
+
+  stats.deviceAllocationCalls++;
+  stats.memoryTypes[memoryType].blockCount++;
+  stats.memoryTypes[memoryType].reservedBytes += size;
+  stats.total.blockCount++;
+  stats.total.reservedBytes += size;
+
+  // Host visible memory stays mapped for its whole lifetime, mapping is not
+  // free and persistently mapped memory is explicitly allowed by the spec.
+  *mapped = nullptr;
+  if (memoryProperties.memoryTypes[memoryType].propertyFlags &
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("Failed to map device memory");
+    }
+  }
+
+  return memory;
+}
+
+MemoryBlock *GpuAllocator::CreateBlock(uint32_t memoryType, VkDeviceSize size,
+                                       AllocationStrategy strategy) {
+  SPDLOG_TRACE("GpuAllocator::CreateBlock({}, {})", memoryType, size);
+
+  auto block = std::make_unique<MemoryBlock>();
+  block->memory = AllocateDeviceMemory(memoryType, size, &block->mapped);
+  block->size = size;
+  block->memoryType = memoryType;
+  block->strategy = strategy;
+  block->chunks[0] = {size, true, ResourceKind::Linear};
+
+  blocks[memoryType].push_back(std::move(block));
+  return blocks[memoryType].back().get();
+}
+
+void GpuAllocator::DestroyBlock(MemoryBlock *block) {
+  SPDLOG_TRACE("GpuAllocator::DestroyBlock({})", block->memoryType);
+
+  auto &typeBlocks = blocks[block->memoryType];
+
+  stats.memoryTypes[block->memoryType].blockCount--;
+  stats.memoryTypes[block->memoryType].reservedBytes -= block->size;
+  stats.total.blockCount--;
+  stats.total.reservedBytes -= block->size;
+
+  vkFreeMemory(device, block->memory, hostCallbacks);
+
+  for (auto it = typeBlocks.begin(); it != typeBlocks.end(); ++it) {
+    if (it->get() == block) {
+      typeBlocks.erase(it);
+      break;
+    }
+  }
+}
+
+// Finds space in a free-list block, returns false if it doesn't fit.
+static bool AllocateFreeList(MemoryBlock &block, VkDeviceSize size,
+                             VkDeviceSize alignment, ResourceKind kind,
+                             VkDeviceSize granularity, VkDeviceSize &outOffset) {
+  auto best = block.chunks.end();
+  VkDeviceSize bestOffset = 0;
+
+  for (auto it = block.chunks.begin(); it != block.chunks.end(); ++it) {
+    const auto &[chunkOffset, chunk] = *it;
+    if (!chunk.free || chunk.size < size) {
+      continue;
+    }
+
+    VkDeviceSize offset = AlignUp(chunkOffset, alignment);
+
+    // Keep away from a neighbour of the other resource kind
+    if (granularity > 1 && it != block.chunks.begin()) {
+      const auto &[prevOffset, prev] = *std::prev(it);
+      if (prev.kind != kind &&
+          OnSamePage(prevOffset, prev.size, offset, granularity)) {
+        offset = AlignUp(offset, granularity);
+      }
+    }
+
+    if (offset + size > chunkOffset + chunk.size) {
+      continue;
+    }
+
+    auto next = std::next(it);
+    if (granularity > 1 && next != block.chunks.end() &&
+        next->second.kind != kind &&
+        OnSamePage(offset, size, next->first, granularity)) {
+      continue;
+    }
+
+    // Best fit keeps large chunks intact for large resources
+    if (best == block.chunks.end() || chunk.size < best->second.size) {
+      best = it;
+      bestOffset = offset;
+    }
+  }
+
+  if (best == block.chunks.end()) {
+    return false;
+  }
+
+  VkDeviceSize chunkOffset = best->first;
+  VkDeviceSize chunkEnd = chunkOffset + best->second.size;
+
+  // Split off the alignment padding at the front (stays free) and whatever
+  // is left after the allocation.
+  if (bestOffset > chunkOffset) {
+    best->second.size = bestOffset - chunkOffset;
+  } else {
+    block.chunks.erase(best);
+  }
+
+  block.chunks[bestOffset] = {size, false, kind};
+
+  if (bestOffset + size < chunkEnd) {
+    block.chunks[bestOffset + size] = {chunkEnd - (bestOffset + size), true,
+                                       kind};
+  }
+
+  outOffset = bestOffset;
+  return true;
+}
+
+static void FreeFreeList(MemoryBlock &block, VkDeviceSize offset) {
+  auto it = block.chunks.find(offset);
+  if (it == block.chunks.end() || it->second.free) {
+    throw std::runtime_error("Freeing an allocation that is not in use");
+  }
+
+  it->second.free = true;
+
+  // Merge with the following chunk
+  auto next = std::next(it);
+  if (next != block.chunks.end() && next->second.free) {
+    it->second.size += next->second.size;
+    block.chunks.erase(next);
+  }
+
+  // Merge with the preceding chunk
+  if (it != block.chunks.begin()) {
+    auto prev = std::prev(it);
+    if (prev->second.free) {
+      prev->second.size += it->second.size;
+      block.chunks.erase(it);
+    }
+  }
+}
+
+static bool AllocateLinear(MemoryBlock &block, VkDeviceSize size,
+                           VkDeviceSize alignment, ResourceKind kind,
+                           VkDeviceSize granularity, VkDeviceSize &outOffset) {
+  VkDeviceSize offset = AlignUp(block.head, alignment);
+
+  if (block.liveCount > 0 && block.lastKind != kind) {
+    offset = AlignUp(offset, granularity);
+  }
+
+  if (offset + size > block.size) {
+    return false;
+  }
+
+  block.head = offset + size;
+  block.lastKind = kind;
+  outOffset = offset;
+  return true;
+}
+
+Allocation GpuAllocator::Allocate(const VkMemoryRequirements &requirements,
+                                  VkMemoryPropertyFlags properties,
+                                  ResourceKind kind,
+                                  AllocationStrategy strategy) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  Allocation allocation;
+  allocation.memoryType =
+      FindMemoryType(requirements.memoryTypeBits, properties);
+  allocation.size = requirements.size;
+
+  VkDeviceSize blockSize = GetBlockSize(allocation.memoryType);
+  auto &typeStats = stats.memoryTypes[allocation.memoryType];
+
+  // Big resources would waste most of a block, give them their own memory
+  if (requirements.size > blockSize / 2) {
+    allocation.memory = AllocateDeviceMemory(
+        allocation.memoryType, requirements.size, &allocation.mapped);
+    allocation.offset = 0;
+    dedicated[allocation.memory] = allocation;
+  } else {
+    VkDeviceSize offset = 0;
+    MemoryBlock *target = nullptr;
+
+    for (auto &block : blocks[allocation.memoryType]) {
+      if (block->strategy != strategy) {
+        continue;
+      }
+
+      bool fits = strategy == AllocationStrategy::Linear
+                      ? AllocateLinear(*block, requirements.size,
+                                       requirements.alignment, kind,
+                                       bufferImageGranularity, offset)
+                      : AllocateFreeList(*block, requirements.size,
+                                         requirements.alignment, kind,
+                                         bufferImageGranularity, offset);
+      if (fits) {
+        target = block.get();
+        break;
+      }
+    }
+
+    if (target == nullptr) {
+      target = CreateBlock(allocation.memoryType, blockSize, strategy);
+
+      bool fits = strategy == AllocationStrategy::Linear
+                      ? AllocateLinear(*target, requirements.size,
+                                       requirements.alignment, kind,
+                                       bufferImageGranularity, offset)
+                      : AllocateFreeList(*target, requirements.size,
+                                         requirements.alignment, kind,
+                                         bufferImageGranularity, offset);
+      if (!fits) {
+        throw std::runtime_error("Allocation does not fit in a new block");
+      }
+    }
+
+    target->liveCount++;
+    target->usedBytes += requirements.size;
+
+    allocation.memory = target->memory;
+    allocation.offset = offset;
+    allocation.block = target;
+    allocation.mapped =
+        target->mapped ? static_cast<char *>(target->mapped) + offset : nullptr;
+  }
+
+  typeStats.allocationCount++;
+  typeStats.usedBytes += allocation.size;
+  stats.total.allocationCount++;
+  stats.total.usedBytes += allocation.size;
+
+  return allocation;
+}
+
+void GpuAllocator::Free(Allocation &allocation) {
+  if (!allocation.IsValid()) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto &typeStats = stats.memoryTypes[allocation.memoryType];
+  typeStats.allocationCount--;
+  typeStats.usedBytes -= allocation.size;
+  stats.total.allocationCount--;
+  stats.total.usedBytes -= allocation.size;
+
+  if (allocation.block == nullptr) {
+    dedicated.erase(allocation.memory);
+    vkFreeMemory(device, allocation.memory, hostCallbacks);
+
+    typeStats.blockCount--;
+    typeStats.reservedBytes -= allocation.size;
+    stats.total.blockCount--;
+    stats.total.reservedBytes -= allocation.size;
+  } else {
+    MemoryBlock *block = allocation.block;
+    block->liveCount--;
+    block->usedBytes -= allocation.size;
+
+    if (block->strategy == AllocationStrategy::Linear) {
+      // Everything in the block is dead, start again from the beginning
+      if (block->liveCount == 0) {
+        block->head = 0;
+      }
+    } else {
+      FreeFreeList(*block, allocation.offset);
+    }
+
+    // Hold on to one empty block per memory type and strategy so allocation
+    // patterns that bounce around a block boundary don't thrash the driver.
+    if (block->liveCount == 0) {
+      for (auto &other : blocks[block->memoryType]) {
+        if (other.get() != block && other->liveCount == 0 &&
+            other->strategy == block->strategy) {
+          DestroyBlock(block);
+          break;
+        }
+      }
+    }
+  }
+
+  allocation = {};
+}
+
+AllocatorStats GpuAllocator::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+} // namespace MiniEngine
@@ -1,5 +1,8 @@
 #include <iterator>
 #include <miniengine/app.h>
+#include <miniengine/host_memory.h>
+#include <miniengine/logging.h>
+#include <miniengine/simd.h>
 
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
@@ -8,34 +11,93 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_vulkan.h>
 
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <bit>
+#include <cmath>
 #include <fstream>
 #include <map>
 #include <set>
+#include <thread>
 
 namespace MiniEngine {
-App::App() {
-  spdlog::trace("App::App()");
+// What the scene can be tinted with, picked in the UI. The first is what
+// sprites use.
+static const Material SCENE_MATERIALS[] = {
+    {glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)},
+    {glm::vec4(1.0f, 0.7f, 0.4f, 1.0f)},
+    {glm::vec4(0.5f, 0.7f, 1.0f, 1.0f)},
+    {glm::vec4(0.6f, 1.0f, 0.6f, 1.0f)},
+};
+
+static const char *PresentModeName(VkPresentModeKHR mode) {
+  switch (mode) {
+  case VK_PRESENT_MODE_IMMEDIATE_KHR:
+    return "immediate";
+  case VK_PRESENT_MODE_MAILBOX_KHR:
+    return "mailbox";
+  case VK_PRESENT_MODE_FIFO_KHR:
+    return "fifo";
+  case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+    return "fifo_relaxed";
+  default:
+    return "unknown";
+  }
+}
+
+// The scene's pipeline, adding its colour to what is already there
+static PipelineDesc AdditiveVariant(PipelineDesc desc) {
+  desc.blendEnable = true;
+  desc.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+  desc.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+  return desc;
+}
+
+App::App(const AppConfig &config) : config(config) {
+  SPDLOG_TRACE("App::App()");
   this->startTime = std::chrono::high_resolution_clock::now();
+
+  // Nothing would ever close a headless run
+  if (config.headless) {
+    this->config.benchmark = true;
+  }
+
+  if (this->config.benchmark) {
+    // By default enough per-object draws that recording dominates the frame
+    drawMode = config.benchmarkDrawMode;
+    instanceCount = std::clamp(config.benchmarkInstances, 1u, MAX_INSTANCES);
+    spriteCount = std::min(config.benchmarkSprites, SPRITE_MAX_QUADS);
+  }
+
+  framesInFlight =
+      std::clamp(config.pacing.framesInFlight, 1u, MAX_FRAMES_IN_FLIGHT);
 }
 
 App::~App() {
-  spdlog::trace("App::~App()");
+  SPDLOG_TRACE("App::~App()");
   App::Cleanup();
 }
 
 void App::Run() {
-  spdlog::trace("App::Run()");
+  SPDLOG_TRACE("App::Run()");
 
-  InitWindow();
-  InitVulkan();
-  SetupImGui();
+  // Everything after this may hand work to the worker threads
+  jobs.Init(config.workerThreads);
+  spdlog::info("Job scheduler running on {} threads", jobs.GetThreadCount());
+  spdlog::info("Batch kernels using {}",
+               GetSimdLevelName(GetSimdLevel()));
+
+  Init();
+  if (!config.headless) {
+    SetupImGui();
+  }
   MainLoop();
 }
 
 void App::InitWindow() {
-  spdlog::trace("App::InitWindow()");
+  SPDLOG_TRACE("App::InitWindow()");
 
   if (glfwInit() == GLFW_FALSE) {
     throw std::runtime_error("Failed to initialize GLFW");
@@ -51,31 +113,144 @@ void App::InitWindow() {
 
   glfwSetFramebufferSizeCallback(window, FramebufferResizeCallback);
 
+  // Any input wakes an on-demand loop. ImGui chains these when it installs
+  // its own, so they have to be set first.
+  glfwSetKeyCallback(window, [](GLFWwindow *window, int, int, int, int) {
+    MarkInput(window);
+  });
+  glfwSetCharCallback(window, [](GLFWwindow *window, unsigned int) {
+    MarkInput(window);
+  });
+  glfwSetMouseButtonCallback(window, [](GLFWwindow *window, int, int, int) {
+    MarkInput(window);
+  });
+  glfwSetCursorPosCallback(window, [](GLFWwindow *window, double, double) {
+    MarkInput(window);
+  });
+  glfwSetScrollCallback(window, [](GLFWwindow *window, double, double) {
+    MarkInput(window);
+  });
+  glfwSetCursorEnterCallback(
+      window, [](GLFWwindow *window, int) { MarkInput(window); });
+  glfwSetWindowFocusCallback(
+      window, [](GLFWwindow *window, int) { MarkInput(window); });
+  // The window was uncovered and needs drawing again
+  glfwSetWindowRefreshCallback(window, MarkInput);
+
   glfwSetWindowUserPointer(window, this);
 }
 
-void App::InitVulkan() {
-  spdlog::trace("App::InitVulkan()");
-
-  CreateInstance();
-  SetupDebugMessenger();
-  CreateSurface();
-  PickPhysicalDevice();
-  CreateLogicalDevice();
-  CreateSwapchain();
-  CreateImageViews();
-  CreateRenderPass();
-  CreateGraphicsPipeline();
-  CreateFramebuffers();
-  CreateCommandPool();
-  CreateVertexBuffer();
-  CreateIndexBuffer();
-  CreateCommandBuffers();
-  CreateSyncObjects();
+void App::Init() {
+  SPDLOG_TRACE("App::Init()");
+
+  // What each step needs done first. Anything calling GLFW stays on the main
+  // thread, the rest runs wherever there is a free thread: the package,
+  // shaders (glslc, if they are out of date) and scene mesh load while the
+  // device is created, and the pipelines compile while the swapchain is.
+  // Steps that share something that isn't thread safe (the bindless heap, or
+  // the transfer queue's submissions) are ordered by their dependencies.
+  using Step = InitGraph::Step;
+  constexpr JobAffinity main = JobAffinity::MainThread;
+
+  Step window = startup.Add(
+      "Window",
+      [&] {
+        if (!config.headless) {
+          InitWindow();
+        }
+      },
+      {}, main);
+  Step vulkan = startup.Add(
+      "Instance",
+      [&] {
+        CreateInstance();
+        SetupDebugMessenger();
+        CreateSurface();
+      },
+      {window}, main);
+  Step device = startup.Add(
+      "Device",
+      [&] {
+        PickPhysicalDevice();
+        CreateLogicalDevice();
+        CreateAllocator();
+        CreateUploadEngine();
+      },
+      {vulkan});
+
+  Step package = startup.Add("Package", [&] { OpenPackage(); });
+  Step shaders =
+      startup.Add("Shaders", [&] { CreateShaderManager(); }, {package});
+  Step mesh = startup.Add("Scene mesh", [&] { LoadSceneMesh(); }, {package});
+
+  Step frameResources = startup.Add(
+      "Frame resources",
+      [&] {
+        CreateProfiler();
+        CreateBindlessHeap();
+        CreateUniformRing();
+        CreateRenderGraph();
+        CreateStagingRing();
+        CreateCommandPool();
+        CreateParallelRecorder();
+        CreateCommandBuffers();
+        CreateSyncObjects();
+        for (uint32_t i = 0; i < framesInFlight; i++) {
+          frameArenas[i].Init(FRAME_SCRATCH_SIZE);
+        }
+      },
+      {device});
+  Step cache =
+      startup.Add("Pipeline cache", [&] { CreatePipelineCache(); }, {device});
+
+  // GLFW gives the swapchain its size. The format is picked first so the
+  // pipelines don't have to wait for the rest of it.
+  Step format = startup.Add(
+      "Surface format", [&] { ChooseSwapchainFormat(); }, {device});
+  Step backbuffers = startup.Add(
+      "Swapchain",
+      [&] {
+        CreateSwapchain();
+        CreateImageViews();
+      },
+      {format}, main);
+  Step pipelines = startup.Add(
+      "Pipelines",
+      [&] {
+        CreateRenderPass();
+        CreateGraphicsPipeline();
+      },
+      {format, cache, shaders, frameResources});
+
+  // Everything here shares the bindless heap and queues its uploads in order
+  Step buffers = startup.Add(
+      "Scene buffers",
+      [&] {
+        CreateVertexBuffer();
+        CreateIndexBuffer();
+        CreateInstanceBuffer();
+        CreateIndirectBuffer();
+        CreateCullingBuffers();
+        CreateMaterialBuffer();
+        CreateSpriteBatch();
+        CreateBenchmarkUploadBuffer();
+      },
+      {mesh, frameResources});
+  // The instances are laid out for the swapchain's aspect, and the upload
+  // fills the bounds the culling buffers hold
+  startup.Add(
+      "Instances", [&] { UploadInstances(instanceCount); },
+      {buffers, backbuffers});
+  startup.Add("Culling", [&] { CreateCuller(); }, {buffers, pipelines});
+  startup.Add(
+      "Textures", [&] { CreateTextureStreamer(); }, {package, device});
+
+  startup.Run(jobs);
+  startup.Log();
 }
 
 void App::CreateInstance() {
-  spdlog::trace("App::CreateInstance()");
+  SPDLOG_TRACE("App::CreateInstance()");
 
   if (enableValidationLayers && !CheckValidationLayerSupport()) {
     throw std::runtime_error("Validation layers requested, but not available!");
@@ -87,7 +262,9 @@ void App::CreateInstance() {
   appInfo.applicationVersion = VK_MAKE_VERSION(0, 0, 1);
   appInfo.pEngineName = "MiniEngine";
   appInfo.engineVersion = VK_MAKE_VERSION(0, 0, 1);
-  appInfo.apiVersion = VK_API_VERSION_1_0;
+  // The highest version used, not a requirement: timeline semaphores need
+  // 1.2, and a 1.3 device's dynamic rendering is used if it has it
+  appInfo.apiVersion = VK_API_VERSION_1_3;
 
   VkInstanceCreateInfo createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -109,9 +286,9 @@ void App::CreateInstance() {
     vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount,
                                            availableExtensions.data());
 
-    spdlog::info("Available instance extensions:");
-    for (const auto &ext : availableExtensions) {
-      spdlog::info("  {}", ext.extensionName);
+    SPDLOG_DEBUG("Available instance extensions:");
+    for ([[maybe_unused]] const auto &ext : availableExtensions) {
+      SPDLOG_DEBUG("  {}", ext.extensionName);
     }
 
     for (const auto &ext : requiredExtensions) {
@@ -164,13 +341,13 @@ void App::CreateInstance() {
     createInfo.pNext = nullptr;
   }
 
-  if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
+  if (vkCreateInstance(&createInfo, hostCallbacks, &instance) != VK_SUCCESS) {
     throw std::runtime_error("Failed to create instance");
   }
 }
 
 void App::SetupDebugMessenger() {
-  spdlog::trace("App::SetupDebugMessenger()");
+  SPDLOG_TRACE("App::SetupDebugMessenger()");
 
   if (!enableValidationLayers) {
     return;
@@ -179,16 +356,20 @@ void App::SetupDebugMessenger() {
   VkDebugUtilsMessengerCreateInfoEXT createInfo = {};
   PopulateDebugMessengerCreateInfo(createInfo);
 
-  if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr,
+  if (CreateDebugUtilsMessengerEXT(instance, &createInfo, hostCallbacks,
                                    &debugMessenger) != VK_SUCCESS) {
     throw std::runtime_error("Failed to set up debug messenger");
   }
 }
 
 void App::CreateSurface() {
-  spdlog::trace("App::CreateSurface()");
+  SPDLOG_TRACE("App::CreateSurface()");
+
+  if (config.headless) {
+    return; // Nothing to present to
+  }
 
-  if (glfwCreateWindowSurface(instance, window, nullptr, &surface) !=
+  if (glfwCreateWindowSurface(instance, window, hostCallbacks, &surface) !=
       VK_SUCCESS) {
     throw std::runtime_error("Failed to create window surface");
   }
@@ -196,7 +377,7 @@ void App::CreateSurface() {
 
 void App::PopulateDebugMessengerCreateInfo(
     VkDebugUtilsMessengerCreateInfoEXT &createInfo) {
-  spdlog::trace("App::PopulateDebugMessengerCreateInfo()");
+  SPDLOG_TRACE("App::PopulateDebugMessengerCreateInfo()");
 
   createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
@@ -210,7 +391,7 @@ void App::PopulateDebugMessengerCreateInfo(
 }
 
 void App::PickPhysicalDevice() {
-  spdlog::trace("App::PickPhysicalDevice()");
+  SPDLOG_TRACE("App::PickPhysicalDevice()");
 
   physicalDevice = VK_NULL_HANDLE;
 
@@ -247,6 +428,11 @@ void App::PickPhysicalDevice() {
     spdlog::info("Selected device: {}", deviceProperties.deviceName);
 
     this->extensionsSupported = CheckDeviceExtensionSupport(physicalDevice);
+
+    vulkan13 = !config.legacyRendering && SupportsVulkan13(physicalDevice);
+    spdlog::info("Rendering with {}",
+                 vulkan13 ? "dynamic rendering and synchronization2"
+                          : "render passes");
   } else {
     throw std::runtime_error("Failed to find a suitable GPU");
   }
@@ -257,39 +443,95 @@ void App::PickPhysicalDevice() {
 }
 
 void App::CreateLogicalDevice() {
-  spdlog::trace("App::CreateLogicalDevice()");
+  SPDLOG_TRACE("App::CreateLogicalDevice()");
 
   QueueFamilyIndices indices = FindQueueFamilies(physicalDevice);
+  this->queueFamilies = indices;
+
+  // How many queues we need from each family, the transfer queue may be a
+  // second queue in the graphics family
+  std::map<uint32_t, uint32_t> queueCounts;
+  queueCounts[indices.graphicsFamily.value()] = 1;
+  queueCounts[indices.presentFamily.value()] =
+      std::max(queueCounts[indices.presentFamily.value()], 1u);
+  queueCounts[indices.transferFamily.value()] =
+      std::max(queueCounts[indices.transferFamily.value()],
+               indices.transferQueueIndex + 1);
 
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-  std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(),
-                                            indices.presentFamily.value()};
 
-  float queuePriority = 1.0f;
-  for (uint32_t queueFamily : uniqueQueueFamilies) {
+  float queuePriorities[] = {1.0f, 1.0f};
+  for (auto [queueFamily, queueCount] : queueCounts) {
     VkDeviceQueueCreateInfo queueCreateInfo = {};
     queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
     queueCreateInfo.queueFamilyIndex = queueFamily;
-    queueCreateInfo.queueCount = 1;
-    queueCreateInfo.pQueuePriorities = &queuePriority;
+    queueCreateInfo.queueCount = queueCount;
+    queueCreateInfo.pQueuePriorities = queuePriorities;
     queueCreateInfos.push_back(queueCreateInfo);
   }
 
-  VkPhysicalDeviceFeatures deviceFeatures = {};
+  // Features beyond Vulkan 1.0 are enabled through a pNext chain, so all of
+  // them go in VkPhysicalDeviceFeatures2 instead of pEnabledFeatures
+  VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+  vulkan12Features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_12_FEATURES;
+  VkPhysicalDeviceFeatures2 deviceFeatures = {};
+  deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  deviceFeatures.pNext = &vulkan12Features;
+
+  // Only chained in when there is a 1.3 device to give it to
+  VkPhysicalDeviceVulkan13Features vulkan13Features = {};
+  vulkan13Features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_13_FEATURES;
+  vulkan13Features.dynamicRendering = VK_TRUE;
+  vulkan13Features.synchronization2 = VK_TRUE;
+
+  // Find out what the optional features we can make use of are, then only
+  // enable those and the ones we require
+  vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures);
+  drawIndirectCountSupported = vulkan12Features.drawIndirectCount;
+  VkBool32 multiDrawIndirect = deviceFeatures.features.multiDrawIndirect;
+  // Whichever block compressed formats the GPU has, so packaged textures can
+  // stay compressed in memory
+  VkPhysicalDeviceFeatures supported = deviceFeatures.features;
+
+  vulkan12Features = {};
+  vulkan12Features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_12_FEATURES;
+  vulkan12Features.timelineSemaphore = VK_TRUE; // Used by the upload engine
+  vulkan12Features.drawIndirectCount = drawIndirectCountSupported;
+  // What the bindless heap needs, checked in RateDeviceSuitability
+  vulkan12Features.runtimeDescriptorArray = VK_TRUE;
+  vulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+  vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+  vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+  if (vulkan13) {
+    vulkan12Features.pNext = &vulkan13Features;
+  }
+
+  deviceFeatures.features = {};
+  deviceFeatures.features.multiDrawIndirect = multiDrawIndirect;
+  deviceFeatures.features.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+  deviceFeatures.features.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+  deviceFeatures.features.textureCompressionBC = supported.textureCompressionBC;
+  deviceFeatures.features.textureCompressionETC2 =
+      supported.textureCompressionETC2;
+  deviceFeatures.features.textureCompressionASTC_LDR =
+      supported.textureCompressionASTC_LDR;
 
   VkDeviceCreateInfo createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  createInfo.pNext = &deviceFeatures;
 
   createInfo.queueCreateInfoCount =
       static_cast<uint32_t>(queueCreateInfos.size());
   createInfo.pQueueCreateInfos = queueCreateInfos.data();
-  createInfo.queueCreateInfoCount = 1;
 
-  createInfo.pEnabledFeatures = &deviceFeatures;
+  createInfo.pEnabledFeatures = nullptr; // Given in deviceFeatures instead
 
-  createInfo.enabledExtensionCount =
-      static_cast<uint32_t>(deviceExtensions.size());
-  createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+  std::vector<const char *> extensions = GetDeviceExtensions();
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+  createInfo.ppEnabledExtensionNames = extensions.data();
   if (enableValidationLayers) {
     createInfo.enabledLayerCount =
         static_cast<uint32_t>(validationLayers.size());
@@ -298,7 +540,7 @@ void App::CreateLogicalDevice() {
     createInfo.enabledLayerCount = 0;
   }
 
-  if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) !=
+  if (vkCreateDevice(physicalDevice, &createInfo, hostCallbacks, &device) !=
       VK_SUCCESS) {
     throw std::runtime_error("Failed to create logical device");
   }
@@ -307,19 +549,76 @@ void App::CreateLogicalDevice() {
 
   vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
   vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+  vkGetDeviceQueue(device, indices.transferFamily.value(),
+                   indices.transferQueueIndex, &transferQueue);
+
+  if (indices.transferFamily != indices.graphicsFamily) {
+    spdlog::info("Using dedicated transfer queue family {}",
+                 indices.transferFamily.value());
+  }
+}
+
+void App::CreateAllocator() {
+  SPDLOG_TRACE("App::CreateAllocator()");
+
+  allocator.Init(physicalDevice, device, hostCallbacks);
+}
+
+void App::CreateUploadEngine() {
+  SPDLOG_TRACE("App::CreateUploadEngine()");
+
+  uploadEngine.Init(device, allocator, queueFamilies.transferFamily.value(),
+                    transferQueue, hostCallbacks);
+}
+
+void App::ChooseSwapchainFormat() {
+  SPDLOG_TRACE("App::ChooseSwapchainFormat()");
+
+  if (config.headless) {
+    swapchainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+  } else {
+    App::SwapchainSupportDetails swapChainSupport =
+        QuerySwapchainSupport(physicalDevice);
+    VkSurfaceFormatKHR surfaceFormat =
+        ChooseSwapSurfaceFormat(swapChainSupport.formats);
+    swapchainImageFormat = surfaceFormat.format;
+    swapchainColorSpace = surfaceFormat.colorSpace;
+  }
+
+  // The scene's own image has the swapchain's format, so scaling it up is a
+  // blit from that format to itself
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, swapchainImageFormat,
+                                      &formatProperties);
+  VkFormatFeatureFlags features = formatProperties.optimalTilingFeatures;
+  blitSupported = (features & VK_FORMAT_FEATURE_BLIT_SRC_BIT) &&
+                  (features & VK_FORMAT_FEATURE_BLIT_DST_BIT);
+  blitFilter = (features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)
+                   ? VK_FILTER_LINEAR
+                   : VK_FILTER_NEAREST;
+
+  supportedSamples =
+      allocator.GetDeviceProperties().limits.framebufferColorSampleCounts;
 }
 
 void App::CreateSwapchain() {
+  if (config.headless) {
+    CreateOffscreenTargets();
+    return;
+  }
+
   App::SwapchainSupportDetails swapChainSupport =
       QuerySwapchainSupport(physicalDevice);
 
-  VkSurfaceFormatKHR surfaceFormat =
-      ChooseSwapSurfaceFormat(swapChainSupport.formats);
-  VkPresentModeKHR presentMode =
-      ChooseSwapPresentMode(swapChainSupport.presentModes);
+  presentMode = ChooseSwapPresentMode(swapChainSupport.presentModes);
   VkExtent2D extent = ChooseSwapExtent(swapChainSupport.capabilities);
 
-  uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+  // More images let the CPU run further ahead when presenting is the
+  // bottleneck (FIFO in particular), at the cost of latency
+  uint32_t imageCount = config.pacing.swapchainImages > 0
+                            ? config.pacing.swapchainImages
+                            : swapChainSupport.capabilities.minImageCount + 1;
+  imageCount = std::max(imageCount, swapChainSupport.capabilities.minImageCount);
   if (swapChainSupport.capabilities.maxImageCount > 0 &&
       imageCount > swapChainSupport.capabilities.maxImageCount) {
     imageCount = swapChainSupport.capabilities.maxImageCount;
@@ -330,12 +629,20 @@ void App::CreateSwapchain() {
   createInfo.surface = surface;
 
   createInfo.minImageCount = imageCount;
-  createInfo.imageFormat = surfaceFormat.format;
-  createInfo.imageColorSpace = surfaceFormat.colorSpace;
+  // Chosen once, the pipelines and render pass are built for it
+  createInfo.imageFormat = swapchainImageFormat;
+  createInfo.imageColorSpace = swapchainColorSpace;
   createInfo.imageExtent = extent;
   createInfo.imageArrayLayers = 1;
   createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
+  // To blit the scene into when it is drawn at a lower resolution
+  swapchainTransferDst = swapChainSupport.capabilities.supportedUsageFlags &
+                         VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  if (swapchainTransferDst) {
+    createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  }
+
   QueueFamilyIndices indices = FindQueueFamilies(physicalDevice);
   uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(),
                                    indices.presentFamily.value()};
@@ -357,9 +664,14 @@ void App::CreateSwapchain() {
   createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
   createInfo.presentMode = presentMode;
   createInfo.clipped = VK_TRUE;
-  createInfo.oldSwapchain = VK_NULL_HANDLE;
 
-  if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapchain) !=
+  // Lets the old swapchain's images that are already queued still be
+  // presented, and the driver reuse its resources
+  createInfo.oldSwapchain = retiredSwapchains.empty()
+                                ? VK_NULL_HANDLE
+                                : retiredSwapchains.back().swapchain;
+
+  if (vkCreateSwapchainKHR(device, &createInfo, hostCallbacks, &swapchain) !=
       VK_SUCCESS) {
     throw std::runtime_error("Failed to create swap chain");
   }
@@ -369,8 +681,56 @@ void App::CreateSwapchain() {
   vkGetSwapchainImagesKHR(device, swapchain, &imageCount,
                           swapchainImages.data());
 
-  swapchainImageFormat = surfaceFormat.format;
   swapchainExtent = extent;
+
+  spdlog::info("Swapchain: {} images, present mode {}", imageCount,
+               PresentModeName(presentMode));
+}
+
+void App::CreateOffscreenTargets() {
+  SPDLOG_TRACE("App::CreateOffscreenTargets()");
+
+  // Stands in for the swapchain, one image per frame in flight so a frame
+  // never renders into an image the GPU is still working on
+  swapchainExtent = {config.headlessWidth, config.headlessHeight};
+  swapchainTransferDst = true;
+
+  swapchainImages.resize(framesInFlight);
+  offscreenAllocations.resize(framesInFlight);
+
+  for (size_t i = 0; i < swapchainImages.size(); i++) {
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = swapchainImageFormat;
+    imageInfo.extent = {swapchainExtent.width, swapchainExtent.height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    // Transfer source so the result could be read back, and destination for
+    // the scene's blit at lower resolutions
+    imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                      VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                      VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    if (vkCreateImage(device, &imageInfo, hostCallbacks, &swapchainImages[i]) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("Failed to create offscreen image");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(device, swapchainImages[i], &memRequirements);
+
+    offscreenAllocations[i] =
+        allocator.Allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                           ResourceKind::Optimal);
+    vkBindImageMemory(device, swapchainImages[i],
+                      offscreenAllocations[i].memory,
+                      offscreenAllocations[i].offset);
+  }
 }
 
 void App::CreateImageViews() {
@@ -392,7 +752,7 @@ void App::CreateImageViews() {
     createInfo.subresourceRange.baseArrayLayer = 0;
     createInfo.subresourceRange.layerCount = 1;
 
-    if (vkCreateImageView(device, &createInfo, nullptr,
+    if (vkCreateImageView(device, &createInfo, hostCallbacks,
                           &swapchainImageViews[i]) != VK_SUCCESS) {
       throw std::runtime_error("Failed to create image views");
     }
@@ -400,433 +760,641 @@ void App::CreateImageViews() {
 }
 
 void App::CreateGraphicsPipeline() {
-  spdlog::trace("App::CreateGraphicsPipeline()");
-
-  auto vertShaderCode = this->ReadFile("demo/shaders/vert.spv");
-  auto fragShaderCode = this->ReadFile("demo/shaders/frag.spv");
-
-  VkShaderModule vertShaderModule = CreateShaderModule(vertShaderCode);
-  VkShaderModule fragShaderModule = CreateShaderModule(fragShaderCode);
-
-  // Creation of shaders creation info is almost identical between stages
-  // (vertex, fragment, etc.). We can use a lambda to reduce code duplication.
-  auto createShader =
-      [](VkShaderStageFlagBits stage,
-         VkShaderModule module) -> VkPipelineShaderStageCreateInfo {
-    VkPipelineShaderStageCreateInfo createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    createInfo.stage = stage;
-    createInfo.module = module;
-    createInfo.pName = "main";
-    return createInfo;
-  };
-
-  VkPipelineShaderStageCreateInfo vertShaderStageInfo =
-      createShader(VK_SHADER_STAGE_VERTEX_BIT, vertShaderModule);
-
-  VkPipelineShaderStageCreateInfo fragShaderStageInfo =
-      createShader(VK_SHADER_STAGE_FRAGMENT_BIT, fragShaderModule);
-
-  VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo,
-                                                    fragShaderStageInfo};
-
-  // Tell Vulkan we want to make use of dynamic states so we can modify
-  // viewport and scissor dynamically.
-  std::vector<VkDynamicState> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT,
-                                               VK_DYNAMIC_STATE_SCISSOR};
-
-  VkPipelineDynamicStateCreateInfo dynamicState = {};
-  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-  dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
-  dynamicState.pDynamicStates = dynamicStates.data();
-
-  auto bindingDescription = Vertex::GetBindingDescription();
-  auto attributeDescriptions = Vertex::GetAttributeDescriptions();
-
-  // Vertex input is similar to a VAO in OpenGL. It describes the format of
-  // the vertex data that will be passed to the vertex shader.
-  // Only here it is in the form of a struct that is passed to the pipeline.
-  // It is also done in an immutable way, so it cannot be changed after the
-  // pipeline has been created.
-  VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-  vertexInputInfo.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-  vertexInputInfo.vertexBindingDescriptionCount = 1;
-  vertexInputInfo.vertexAttributeDescriptionCount =
-      static_cast<uint32_t>(attributeDescriptions.size());
-  vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-  vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
-
-  // A binding description specifies the rate at which data is loaded from
-  // memory throughout the vertices. The rate can be per vertex or per
-  // instance. It is like stride and glVertexAttribPointer in OpenGL.
-  // A vertex attribute description specifies the format of the vertex data
-  // that will be passed to the vertex shader. It specifies the binding
-  // location, format, offset and whether the data is per vertex or per
-  // instance. It is like glVertexAttribPointer in OpenGL.
-
-  // Input assembly describes what kind of geometry will be drawn from the
-  // vertices and if primitive restart (allows for breaking up lines and
-  // triangles in the strip topology by using a special index value) is enabled.
-  // The topology is the type of primitive that will be drawn.
-  // It can be point lists, line lists, line strips, triangle lists, triangle
-  // strips or a list of patches.
-  VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-  inputAssembly.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-  inputAssembly.primitiveRestartEnable = VK_FALSE; // We don't need this for now
-
-  // Viewport and scissor are part of the viewport state and describe the
-  // region of the framebuffer that the output will be rendered to.
-  // The scissor test will discard fragments that are outside the scissor
-  // rectangle, this can be used for example to only render to a subsection of
-  // the framebuffer which can be useful for things like mini-maps.
-  VkViewport viewport = {};
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = static_cast<float>(swapchainExtent.width);
-  viewport.height = static_cast<float>(swapchainExtent.height);
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-
-  VkRect2D scissor = {};
-  scissor.offset = {0, 0};
-  scissor.extent = swapchainExtent;
-
-  VkPipelineViewportStateCreateInfo viewportState = {};
-  viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-  viewportState.viewportCount = 1;
-  viewportState.pViewports = &viewport;
-  viewportState.scissorCount = 1; // If we were doing something like a minimap
-                                  // we could set this to 2 and have a second
-                                  // scissor rectangle.
-  viewportState.pScissors = &scissor;
-
-  // Rasterizer takes the geometry that is shaped by the vertices from the
-  // vertex shader and turns it into fragments to be colored by the fragment
-  // shader. It also performs depth testing, face culling and the scissor test.
-  // The depthClampEnable field allows fragments beyond the near and far planes
-  // to be clamped rather than discarded.
-  VkPipelineRasterizationStateCreateInfo rasterizer = {};
-  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-  rasterizer.depthClampEnable = VK_FALSE; // Discard fragments beyond near/far
-  rasterizer.rasterizerDiscardEnable = VK_FALSE; // Whether to discard data with
-                                                 // no output to framebuffer
-  rasterizer.polygonMode =
-      VK_POLYGON_MODE_FILL;    // Fill mode (like the pen tool in GIMP/PS) any
-                               // other mode will require enabling a GPU feature
-  rasterizer.lineWidth = 1.0f; // Line width in fragments
-
-  // Similar to `glEnable(GL_CULL_FACE)` and `glCullFace(GL_BACK)`
-  rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;    // Cull back faces
-  rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE; // Clockwise winding order
-
-  // Depth bias is used for shadow mapping and other effects that require
-  // offsetting depth values, we won't be using it.
-  rasterizer.depthBiasEnable = VK_FALSE;
-  rasterizer.depthBiasConstantFactor = 0.0f; // Optional
-  rasterizer.depthBiasClamp = 0.0f;          // Optional
-  rasterizer.depthBiasSlopeFactor = 0.0f;    // Optional
-
-  // Multisampling is a way to smooth out the edges of rendered objects, it is
-  // especially useful at lower resolutions. It works by combining the
-  // fragment shader output of multiple polygons that rasterize to the same
-  // pixel.
-  // It's similar to `glEnable(GL_MULTISAMPLE)` in OpenGL and creating a
-  // multisample framebuffer in OpenGL.
-  VkPipelineMultisampleStateCreateInfo multisampling = {};
-  multisampling.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-  multisampling.sampleShadingEnable = VK_FALSE;
-  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-  multisampling.minSampleShading = 1.0f;          // Optional
-  multisampling.pSampleMask = nullptr;            // Optional
-  multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
-  multisampling.alphaToOneEnable = VK_FALSE;      // Optional
-
-  // Color blending is used to combine the color output of the fragment shader
-  // with the color that is already in the framebuffer. It is used to implement
-  // transparency.
-  // It's similar to `glEnable(GL_BLEND)` in OpenGL.
-  VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-  colorBlendAttachment.colorWriteMask =
-      VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-  colorBlendAttachment.blendEnable = VK_FALSE;
-  colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;  // Optional
-  colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-  colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;             // Optional
-  colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;  // Optional
-  colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-  colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;             // Optional
-
-  // The color blending is controlled per attached framebuffer and there can
-  // be multiple. This struct is used to specify global color blending settings.
-  // It's similar to `glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA)` in
-  // OpenGL.
-  VkPipelineColorBlendStateCreateInfo colorBlending = {};
-  colorBlending.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-  colorBlending.logicOpEnable = VK_FALSE;
-  colorBlending.logicOp = VK_LOGIC_OP_COPY; // Optional
-  colorBlending.attachmentCount = 1;
-  colorBlending.pAttachments = &colorBlendAttachment;
-  colorBlending.blendConstants[0] = 0.0f; // Optional
-  colorBlending.blendConstants[1] = 0.0f; // Optional
-  colorBlending.blendConstants[2] = 0.0f; // Optional
-  colorBlending.blendConstants[3] = 0.0f; // Optional
+  SPDLOG_TRACE("App::CreateGraphicsPipeline()");
 
   // Pipeline layout is used to specify uniform values in the shaders
   // Vulkan is strict about how shaders interface with the outside world
   // and requires that you specify in advance what types of resources the
-  // shaders will use.
+  // shaders will use. Here that is the bindless heap and the frame's
+  // uniforms, plus the indices into the heap and the transform each draw
+  // pushes.
+  VkDescriptorSetLayout setLayouts[] = {bindless.GetSetLayout(),
+                                        uniforms.GetSetLayout()};
+  VkPushConstantRange pushConstantRanges[] = {
+      BindlessHeap::GetPushConstantRange(), GetObjectPushConstantRange()};
+
   VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
   pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  pipelineLayoutInfo.setLayoutCount = 0;            // Optional
-  pipelineLayoutInfo.pSetLayouts = nullptr;         // Optional
-  pipelineLayoutInfo.pushConstantRangeCount = 0;    // Optional
-  pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
+  pipelineLayoutInfo.setLayoutCount = 2;
+  pipelineLayoutInfo.pSetLayouts = setLayouts;
+  pipelineLayoutInfo.pushConstantRangeCount = 2;
+  pipelineLayoutInfo.pPushConstantRanges = pushConstantRanges;
 
-  if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr,
+  if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, hostCallbacks,
                              &pipelineLayout) != VK_SUCCESS) {
     throw std::runtime_error("Failed to create pipeline layout");
   }
 
-  // Pipeline creation info is similar to the other creation info structs
-  // in Vulkan. It is used to specify the shader stages, vertex input,
-  // input assembly, viewport, rasterizer, multisampling, color blending
-  // and pipeline layout.
-  VkGraphicsPipelineCreateInfo pipelineInfo = {};
-  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-  pipelineInfo.stageCount = 2; // We have two shader stages, vertex and fragment
-  pipelineInfo.pStages = shaderStages;
-  pipelineInfo.pVertexInputState = &vertexInputInfo;
-  pipelineInfo.pInputAssemblyState = &inputAssembly;
-  pipelineInfo.pViewportState = &viewportState;
-  pipelineInfo.pRasterizationState = &rasterizer;
-  pipelineInfo.pMultisampleState = &multisampling;
-  pipelineInfo.pColorBlendState = &colorBlending;
-  pipelineInfo.pDynamicState = &dynamicState; // Optional
-  pipelineInfo.layout = pipelineLayout;
-  pipelineInfo.renderPass = renderPass;
-  pipelineInfo.subpass = 0;
-  pipelineInfo.basePipelineHandle =
-      VK_NULL_HANDLE; // Optional (this is deriving from a previous pipeline,
-                      // e.g. for resizes)
-
-  if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
-                                nullptr, &pipeline) != VK_SUCCESS) {
-    throw std::runtime_error("Failed to create graphics pipeline");
-  }
-
-  // Similar to OpenGL, we can delete the shader modules after the pipeline has
-  // been created.
-  vkDestroyShaderModule(device, vertShaderModule, nullptr);
-  vkDestroyShaderModule(device, fragShaderModule, nullptr);
+  pipelines.Init(device, pipelineCache, jobs, hostCallbacks);
+  pipelines.SetPackage(&package);
+
+  // The description of the pipeline, the registry turns it into the actual
+  // VkPipeline (see PipelineRegistry::Compile for what each part does)
+  sceneDesc.vertexShader = "demo/shaders/vert.spv";
+  sceneDesc.fragmentShader = "demo/shaders/frag.spv";
+
+  // Binding 0 advances per vertex, binding 1 per instance
+  AddVertexStream<Vertex>(sceneDesc, 0, VK_VERTEX_INPUT_RATE_VERTEX);
+  AddVertexStream<InstanceData>(sceneDesc, 1, VK_VERTEX_INPUT_RATE_INSTANCE);
+
+  // Similar to `glEnable(GL_CULL_FACE)` and `glCullFace(GL_BACK)`
+  sceneDesc.cullMode = VK_CULL_MODE_BACK_BIT;    // Cull back faces
+  sceneDesc.frontFace = VK_FRONT_FACE_CLOCKWISE; // Clockwise winding order
+
+  sceneDesc.layout = pipelineLayout;
+  sceneDesc.colorFormats = {swapchainImageFormat};
+
+  // Drawn with the MSAA it was started with from the first frame. A
+  // pipeline can't stand in for one with another sample count, so switching
+  // later waits for the new one (see SetSampleCount).
+  activeSamples = ChooseSampleCount(config.resolution.msaaSamples);
+  pendingSamples = activeSamples;
+  sceneDesc.samples = activeSamples;
+  sceneDesc.renderPass = GetCompatibleRenderPass(activeSamples);
+
+  // Built straight away, every other variant falls back to it while it
+  // compiles
+  defaultPipeline = pipelines.Build(sceneDesc);
+  scenePipeline = defaultPipeline;
 }
 
 void App::CreateRenderPass() {
-  spdlog::trace("App::CreateRenderPass()");
+  SPDLOG_TRACE("App::CreateRenderPass()");
 
-  VkAttachmentDescription colorAttachment =
-      {}; // An attachment is a description of the framebuffer
-  colorAttachment.format =
-      swapchainImageFormat; // The format of the color attachment is the same as
-                            // the swap chain images
-  colorAttachment.samples =
-      VK_SAMPLE_COUNT_1_BIT; // Number of samples to write for multisampling
+  renderPass = GetCompatibleRenderPass(VK_SAMPLE_COUNT_1_BIT);
+}
 
-  // TODO: When we render more, we can use this to clear the framebuffer
+VkRenderPass App::GetCompatibleRenderPass(VkSampleCountFlagBits samples) {
+  // Pipelines and ImGui are built for the attachment formats alone
+  if (vulkan13) {
+    return VK_NULL_HANDLE;
+  }
+
+  VkRenderPass &cached = samples == VK_SAMPLE_COUNT_1_BIT
+                             ? renderPass
+                             : msaaRenderPasses[std::countr_zero(
+                                   static_cast<uint32_t>(samples))];
+  if (cached != VK_NULL_HANDLE) {
+    return cached;
+  }
+
+  // Frames are drawn in render passes the render graph makes (see
+  // RecordCommandBuffer). This one is only what pipelines and ImGui are
+  // built against, which works with any render pass compatible with it: the
+  // same attachment formats and sample counts, and no dependencies, since the
+  // graph's barriers take their place. The load and store ops and layouts are
+  // the ones the graph picks for the scene pass. A render pass with one
+  // subpass is compatible whatever it resolves into, so there is no resolve
+  // attachment here.
+  VkAttachmentDescription colorAttachment = {};
+  colorAttachment.format = swapchainImageFormat;
+  colorAttachment.samples = samples;
   colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
   colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
-  // We don't care about the previous contents of the framebuffer as we're
-  // rendering over it with the exact same data, so we can use
-  // VK_ATTACHMENT_LOAD_OP_DONT_CARE to tell Vulkan that we don't care about
-  // the previous contents.
-  /*colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;*/
-  /*colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;*/
-
-  // Stencil buffer settings
-  colorAttachment.initialLayout =
-      VK_IMAGE_LAYOUT_UNDEFINED; // Similar to DONT_CARE
-  colorAttachment.finalLayout =
-      VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; // Transition to this layout when the
-                                       // render pass finishes
-
-  // A colour attachment reference is used to attach the color attachment to the
-  // render pass The attachment reference is used to specify which attachment to
-  // use for each subpass A subpass is a part of the render pass that can be
-  // used for post-processing effects such as blurring, tone mapping, etc. We
-  // only have one subpass for now, but we could have more if we wanted to do
-  // more complex rendering For example, we could have a subpass for
-  // post-processing effects We could also use subpasses for deferred rendering
   VkAttachmentReference colorAttachmentRef = {};
-  colorAttachmentRef.attachment =
-      0; // The index of the attachment in the attachment descriptions array,
-         // it's our first and only attachment
-  colorAttachmentRef.layout =
-      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL; // The layout the attachment
-                                                // will have during the subpass
-
-  // Subpasses are like stages in the rendering pipeline
-  // They can read from and write to framebuffers
-  // They can also read from the output of other subpasses
+  colorAttachmentRef.attachment = 0;
+  colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
   VkSubpassDescription subpass = {};
-  subpass.pipelineBindPoint =
-      VK_PIPELINE_BIND_POINT_GRAPHICS; // The type of pipeline this subpass is
-                                       // for
-  subpass.colorAttachmentCount = 1;    // The number of colour attachments
-  subpass.pColorAttachments =
-      &colorAttachmentRef; // The colour attachments to use, this is always
-                           // required
-
-  // Render passes can have dependencies on other render passes
-  // This is useful for synchronising access to resources between render passes
-  // For example, we could have a render pass that writes to a texture
-  // And another render pass that reads from that texture
-  // We would need to create a dependency between the two render passes
-  // This is done using a subpass dependency
-  VkSubpassDependency dependency = {};
-  dependency.srcSubpass = VK_SUBPASS_EXTERNAL; // The index of the subpass that
-                                               // writes to the resource
-  dependency.dstSubpass = 0; // The index of the subpass that reads from the
-                             // resource (our subpass)
-
-  dependency.srcStageMask =
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT; // The stage of the source
-                                                     // subpass
-  dependency.srcAccessMask = 0; // The access mask of the source subpass, we
-                                // don't need to wait on anything
-  dependency.dstStageMask =
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT; // The stage of the
-                                                     // destination subpass
-  dependency.dstAccessMask =
-      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT; // The access mask of the
-                                            // destination subpass
-
-  // A render pass is a collection of attachments, subpasses and dependencies
-  // It describes how the attachments are used over the course of the subpasses
-  // It also describes the dependencies between the subpasses
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &colorAttachmentRef;
+
   VkRenderPassCreateInfo renderPassInfo = {};
   renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-  renderPassInfo.attachmentCount = 1;             // The number of attachments
-  renderPassInfo.pAttachments = &colorAttachment; // The attachments
-  renderPassInfo.subpassCount = 1;                // The number of subpasses
-  renderPassInfo.pSubpasses = &subpass;           // The subpasses
-  renderPassInfo.dependencyCount = 1;             // The number of dependencies
-  renderPassInfo.pDependencies = &dependency;     // The dependencies
-
-  if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) !=
+  renderPassInfo.attachmentCount = 1;
+  renderPassInfo.pAttachments = &colorAttachment;
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpass;
+
+  if (vkCreateRenderPass(device, &renderPassInfo, hostCallbacks, &cached) !=
       VK_SUCCESS) {
     throw std::runtime_error("Failed to create render pass");
   }
+  return cached;
 }
 
-void App::CreateFramebuffers() {
-  swapchainFramebuffers.resize(swapchainImageViews.size());
+void App::CreateCommandPool() {
+  SPDLOG_TRACE("App::CreateCommandPool()");
 
-  for (size_t i = 0; i < swapchainImageViews.size(); i++) {
-    VkImageView attachments[] = {swapchainImageViews[i]};
+  // Not FindQueueFamilies, which queries the surface the swapchain may be
+  // being created for on another thread
+  VkCommandPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  poolInfo.queueFamilyIndex = queueFamilies.graphicsFamily.value();
 
-    VkFramebufferCreateInfo framebufferInfo{};
-    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    framebufferInfo.renderPass = renderPass;
-    framebufferInfo.attachmentCount = 1;
-    framebufferInfo.pAttachments = attachments;
-    framebufferInfo.width = swapchainExtent.width;
-    framebufferInfo.height = swapchainExtent.height;
-    framebufferInfo.layers = 1;
+  if (vkCreateCommandPool(device, &poolInfo, hostCallbacks, &commandPool) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to create command pool");
+  }
+}
 
-    if (vkCreateFramebuffer(device, &framebufferInfo, nullptr,
-                            &swapchainFramebuffers[i]) != VK_SUCCESS) {
-      throw std::runtime_error("failed to create framebuffer!");
-    }
+void App::OpenPackage() {
+  if (config.packagePath.empty()) {
+    return;
   }
+
+  SPDLOG_TRACE("App::OpenPackage()");
+
+  package.Open(config.packagePath);
 }
 
-void App::CreateCommandPool() {
-  spdlog::trace("App::CreateCommandPool()");
+void App::CreatePipelineCache() {
+  SPDLOG_TRACE("App::CreatePipelineCache()");
 
-  QueueFamilyIndices queueFamilyIndices = FindQueueFamilies(physicalDevice);
+  pipelineCache.Init(device, allocator.GetDeviceProperties(),
+                     PIPELINE_CACHE_PATH, hostCallbacks);
+}
 
-  VkCommandPoolCreateInfo poolInfo = {};
-  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-  poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+void App::CreateShaderManager() {
+  SPDLOG_TRACE("App::CreateShaderManager()");
 
-  if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) !=
-      VK_SUCCESS) {
-    throw std::runtime_error("Failed to create command pool");
+  shaders.Init(jobs, SHADER_CACHE_DIRECTORY);
+
+  // Packaged shaders are what ships, there is no source to watch
+  if (package.IsOpen()) {
+    return;
   }
+
+  // Compiled now if the SPIR-V is out of date, so the pipelines created next
+  // always match the GLSL
+  shaders.Watch("demo/shaders/vert.glsl", "demo/shaders/vert.spv", "vertex");
+  shaders.Watch("demo/shaders/frag.glsl", "demo/shaders/frag.spv",
+                "fragment");
+  shaders.Watch("demo/shaders/cull.glsl", "demo/shaders/cull.spv", "compute");
 }
 
-void App::CreateVertexBuffer() {
-  spdlog::trace("App::CreateVertexBuffers()");
+void App::CreateProfiler() {
+  SPDLOG_TRACE("App::CreateProfiler()");
 
-  // Create a staging buffer to copy the vertex data to
-  VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+  // Timestamps are optional, a family with no valid bits can't write them
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           families.data());
 
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               stagingBuffer, stagingBufferMemory);
+  const VkPhysicalDeviceLimits &limits =
+      allocator.GetDeviceProperties().limits;
+  bool gpuTimestamps =
+      families[queueFamilies.graphicsFamily.value()].timestampValidBits > 0 &&
+      limits.timestampPeriod > 0.0f;
 
-  // Copy the vertex data to the staging buffer
-  void *data;
-  vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-  memcpy(data, vertices.data(), (size_t)bufferSize);
-  vkUnmapMemory(device, stagingBufferMemory);
+  if (!gpuTimestamps) {
+    spdlog::warn("GPU timestamps are not supported, only timing the CPU");
+  }
+
+  profiler.Init(device, framesInFlight, limits.timestampPeriod, gpuTimestamps,
+                hostCallbacks);
+}
+
+void App::CreateBindlessHeap() {
+  SPDLOG_TRACE("App::CreateBindlessHeap()");
+
+  bindless.Init(physicalDevice, device, framesInFlight, hostCallbacks);
+}
+
+void App::CreateUniformRing() {
+  SPDLOG_TRACE("App::CreateUniformRing()");
+
+  uniforms.Init(device, allocator, framesInFlight, sizeof(FrameUniforms),
+                UNIFORM_BLOCKS_PER_FRAME, hostCallbacks);
+}
+
+void App::CreateRenderGraph() {
+  SPDLOG_TRACE("App::CreateRenderGraph()");
+
+  graph.Init(device, allocator, vulkan13, hostCallbacks);
+}
+
+void App::CreateParallelRecorder() {
+  SPDLOG_TRACE("App::CreateParallelRecorder()");
+
+  recorder.Init(device, jobs, queueFamilies.graphicsFamily.value(),
+                framesInFlight, hostCallbacks);
+}
+
+void App::LoadSceneMesh() {
+  SPDLOG_TRACE("App::LoadSceneMesh()");
+
+  // Packed meshes were optimised when they were packed
+  AssetView asset = package.Find(SCENE_MESH_ASSET);
+  if (asset.IsValid()) {
+    MeshView mesh = AssetPackage::GetMesh(asset);
+    if (mesh.vertexStride != sizeof(Vertex) || mesh.indexCount == 0) {
+      throw std::runtime_error("Packaged scene mesh is empty or has the wrong "
+                               "vertex size");
+    }
+
+    package.Prefetch(asset);
+    sceneVertexBytes = mesh.vertices;
+    sceneIndexBytes = mesh.indices;
+    sceneIndices.type = mesh.indexType;
+    sceneIndices.count = mesh.indexCount;
+    scenePackaged = true;
+
+    spdlog::info("Scene mesh: {} vertices, {} {}-bit indices from the package",
+                 mesh.vertexCount, mesh.indexCount,
+                 mesh.indexType == VK_INDEX_TYPE_UINT16 ? 16 : 32);
+    return;
+  }
+
+  sceneMesh.vertices.assign(vertices.begin(), vertices.end());
+  sceneMesh.indices.assign(indices.begin(), indices.end());
+
+  // Triangles reordered for the post-transform cache, then vertices for
+  // fetch locality. Done once on load so it costs nothing per frame.
+  MeshStats stats = OptimizeMesh(sceneMesh);
+  sceneIndices = PackIndices(sceneMesh.indices, sceneMesh.vertices.size());
+  sceneVertexBytes = std::as_bytes(std::span(sceneMesh.vertices));
+  sceneIndexBytes = std::as_bytes(std::span(sceneIndices.bytes));
+
+  spdlog::info("Scene mesh: {} vertices, {} {}-bit indices, ACMR {:.3f} -> "
+               "{:.3f}",
+               sceneMesh.vertices.size(), sceneIndices.count,
+               sceneIndices.type == VK_INDEX_TYPE_UINT16 ? 16 : 32,
+               stats.acmrBefore, stats.acmrAfter);
+}
+
+void App::CreateVertexBuffer() {
+  SPDLOG_TRACE("App::CreateVertexBuffers()");
+
+  VkDeviceSize bufferSize = sceneVertexBytes.size();
 
   // Create the vertex buffer
   CreateBuffer(
       bufferSize,
       VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
-
-  // Copy the data from the staging buffer to the vertex buffer
-  CopyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer,
+      vertexBufferAllocation);
 
-  // Clean up the staging buffer
-  vkDestroyBuffer(device, stagingBuffer, nullptr);
-  vkFreeMemory(device, stagingBufferMemory, nullptr);
+  // The upload engine stages the data and copies it on the transfer queue,
+  // the first frame waits on the ticket rather than us blocking here
+  geometryUpload = uploadEngine.Enqueue(vertexBuffer, 0,
+                                        sceneVertexBytes.data(), bufferSize);
 }
 
 void App::CreateIndexBuffer() {
-  spdlog::trace("App::CreateIndexBuffer()");
+  SPDLOG_TRACE("App::CreateIndexBuffer()");
+
+  VkDeviceSize bufferSize = sceneIndexBytes.size();
+
+  CreateBuffer(
+      bufferSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferAllocation);
+
+  geometryUpload = uploadEngine.Enqueue(indexBuffer, 0,
+                                        sceneIndexBytes.data(), bufferSize);
+}
+
+void App::CreateInstanceBuffer() {
+  SPDLOG_TRACE("App::CreateInstanceBuffer()");
 
-  VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+  // Storage usage too so a compute pass can read (and cull) the instances
+  CreateBuffer(sizeof(InstanceData) * MAX_INSTANCES,
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                   VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, instanceBuffer,
+               instanceBufferAllocation);
 
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+  CreateBuffer(sizeof(InstanceData) * MAX_INSTANCES * framesInFlight,
+               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               stagingBuffer, stagingBufferMemory);
+               entityInstanceBuffer, entityInstanceBufferAllocation);
+}
+
+void App::CreateCullingBuffers() {
+  SPDLOG_TRACE("App::CreateCullingBuffers()");
+
+  CreateBuffer(sizeof(glm::vec4) * MAX_INSTANCES,
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, boundsBuffer,
+               boundsBufferAllocation);
+
+  // Only ever written by the compute pass, so no transfer usage (and no
+  // concurrent sharing) needed
+  CreateBuffer(sizeof(InstanceData) * MAX_INSTANCES,
+               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, visibleInstanceBuffer,
+               visibleInstanceBufferAllocation);
+
+  // Reset with vkCmdUpdateBuffer every frame, which is a transfer
+  CreateBuffer(sizeof(VkDrawIndexedIndirectCommand),
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                   VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, culledIndirectBuffer,
+               culledIndirectBufferAllocation);
+
+  CreateBuffer(sizeof(uint32_t),
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                   VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, culledDrawCountBuffer,
+               culledDrawCountBufferAllocation);
+}
+
+void App::CreateCuller() {
+  SPDLOG_TRACE("App::CreateCuller()");
+
+  culler.Init(device, pipelines, pipelineCache, "demo/shaders/cull.spv",
+              hostCallbacks);
+
+  CullBuffers buffers = {};
+  buffers.instances = instanceBuffer;
+  buffers.bounds = boundsBuffer;
+  buffers.visibleInstances = visibleInstanceBuffer;
+  buffers.commands = culledIndirectBuffer;
+  buffers.drawCount = culledDrawCountBuffer;
+  culler.SetBuffers(buffers);
+}
+
+void App::CreateIndirectBuffer() {
+  SPDLOG_TRACE("App::CreateIndirectBuffer()");
+
+  CreateBuffer(sizeof(VkDrawIndexedIndirectCommand) * MAX_INDIRECT_DRAWS,
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                   VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indirectBuffer,
+               indirectBufferAllocation);
+
+  CreateBuffer(sizeof(uint32_t),
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                   VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, drawCountBuffer,
+               drawCountBufferAllocation);
+}
+
+void App::UploadInstances(uint32_t count) {
+  SPDLOG_TRACE("App::UploadInstances({})", count);
+
+  // As square a grid as we can get across the screen, with a single entity
+  // filling it exactly like the non-instanced quad did
+  uint32_t columns =
+      static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(count))));
+  uint32_t rows = (count + columns - 1) / columns;
+  float cellWidth = 2.0f / columns;
+  float cellHeight = 2.0f / rows;
+
+  world.Clear();
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t column = i % columns;
+    uint32_t row = i / columns;
+
+    // Every entity is the same size, a quad scaled to its cell
+    Transform2D transform = {};
+    transform.position = {-1.0f + (column + 0.5f) * cellWidth,
+                          -1.0f + (row + 0.5f) * cellHeight};
+    transform.scale = {cellWidth, cellHeight};
+
+    // Tint each one by where it is so they can be told apart
+    Tint tint = {count == 1 ? glm::vec4(1.0f)
+                            : glm::vec4(0.5f + 0.5f * column / columns,
+                                        0.5f + 0.5f * row / rows, 1.0f,
+                                        1.0f)};
+
+    // A third of them spin, each a bit faster than the last and every other
+    // one the other way
+    if (i % 3 == 0) {
+      float speed = 0.5f + 0.25f * static_cast<float>(i / 3 % 7);
+      world.Create(transform, tint, Spin{i / 3 % 2 ? -speed : speed});
+    } else {
+      world.Create(transform, tint);
+    }
+  }
+
+  std::vector<InstanceData> instances(count);
+  std::vector<glm::vec4> bounds(count);
+  ExtractInstances(instances.data(), bounds.data());
+
+  // Every instance shares the one mesh, so one command draws all of them.
+  // Other meshes would each get their own command in the same buffer.
+  VkDrawIndexedIndirectCommand command = {};
+  command.indexCount = sceneIndices.count;
+  command.instanceCount = count;
+  command.firstIndex = 0;
+  command.vertexOffset = 0;
+  command.firstInstance = 0;
+
+  uint32_t drawCount = 1;
+
+  uploadEngine.Enqueue(instanceBuffer, 0, instances.data(),
+                       sizeof(InstanceData) * count);
+  uploadEngine.Enqueue(boundsBuffer, 0, bounds.data(),
+                       sizeof(glm::vec4) * count);
+  uploadEngine.Enqueue(indirectBuffer, 0, &command, sizeof(command));
+  geometryUpload = uploadEngine.Enqueue(drawCountBuffer, 0, &drawCount,
+                                        sizeof(drawCount));
+
+  instanceCount = count;
+  instanceSliderCount = count;
+}
+
+void App::ExtractInstances(InstanceData *instances, glm::vec4 *bounds) {
+  // Entities turn in a space with square units, like GetSceneTransform, so
+  // they don't shear on a stretched window
+  float aspect = static_cast<float>(swapchainExtent.width) /
+                 static_cast<float>(std::max(swapchainExtent.height, 1u));
+
+  world.ParallelEach<const Transform2D, const Tint>(
+      jobs, [&](uint32_t first, uint32_t count, const Transform2D *transforms,
+                const Tint *tints) {
+        for (uint32_t i = 0; i < count; i++) {
+          const Transform2D &t = transforms[i];
+          float c = std::cos(t.rotation);
+          float s = std::sin(t.rotation);
+
+          // Translation * rotation * scale, written out. Each instance is
+          // written whole and in order, which suits write-combined memory.
+          InstanceData instance;
+          instance.transform = glm::mat4(
+              glm::vec4(c * t.scale.x, aspect * s * t.scale.x, 0.0f, 0.0f),
+              glm::vec4(-s * t.scale.y / aspect, c * t.scale.y, 0.0f, 0.0f),
+              glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
+              glm::vec4(t.position, 0.0f, 1.0f));
+          instance.colour = tints[i].colour;
+          instances[first + i] = instance;
+
+          // Half the quad's diagonal, whichever way it is turned
+          if (bounds) {
+            bounds[first + i] =
+                glm::vec4(t.position, 0.0f, 0.5f * glm::length(t.scale));
+          }
+        }
+      });
+}
+
+void App::UpdateEntities() {
+  // GPU culling reads the uploaded instances and bounds, so it draws the
+  // entities as they were created
+  entitiesExtracted = animateEntities && drawMode != DrawMode::GpuCulled;
+  if (!entitiesExtracted) {
+    return;
+  }
+
+  ProfileScope scope(profiler, "Entities");
+
+  float deltaTime = frameDeltaTime;
+  world.ParallelEach<Transform2D, const Spin>(
+      jobs, [deltaTime](uint32_t, uint32_t count, Transform2D *transforms,
+                        const Spin *spins) {
+        for (uint32_t i = 0; i < count; i++) {
+          transforms[i].rotation =
+              std::fmod(transforms[i].rotation + spins[i].speed * deltaTime,
+                        glm::two_pi<float>());
+        }
+      });
+
+  // The fence has signalled, so the GPU is done with this frame's region
+  entityInstanceOffset = sizeof(InstanceData) * MAX_INSTANCES *
+                         static_cast<VkDeviceSize>(currentFrame);
+  ExtractInstances(reinterpret_cast<InstanceData *>(
+                       static_cast<std::byte *>(
+                           entityInstanceBufferAllocation.mapped) +
+                       entityInstanceOffset),
+                   nullptr);
+}
+
+void App::CreateMaterialBuffer() {
+  SPDLOG_TRACE("App::CreateMaterialBuffer()");
+
+  CreateBuffer(sizeof(SCENE_MATERIALS),
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, materialBuffer,
+               materialBufferAllocation);
+
+  // Waited on with the geometry, see CreateSpriteBatch
+  uploadEngine.Enqueue(materialBuffer, 0, SCENE_MATERIALS,
+                       sizeof(SCENE_MATERIALS));
+
+  materialBufferSlot = bindless.AddBuffer(materialBuffer);
+}
+
+void App::CreateSpriteBatch() {
+  SPDLOG_TRACE("App::CreateSpriteBatch()");
 
-  void *data;
-  vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-  memcpy(data, indices.data(), (size_t)bufferSize);
-  vkUnmapMemory(device, stagingBufferMemory);
+  std::vector<uint32_t> spriteIndices =
+      SpriteBatch::BuildIndices(SPRITE_MAX_QUADS);
+  VkDeviceSize bufferSize = sizeof(uint32_t) * spriteIndices.size();
 
   CreateBuffer(
       bufferSize,
       VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, spriteIndexBuffer,
+      spriteIndexBufferAllocation);
+
+  // Queued after the rest of the geometry, so waiting on this covers it all
+  geometryUpload = uploadEngine.Enqueue(spriteIndexBuffer, 0,
+                                        spriteIndices.data(), bufferSize);
+
+  sprites.Init(device, allocator, framesInFlight, SPRITE_MAX_QUADS,
+               spriteIndexBuffer, hostCallbacks);
+}
+
+void App::CreateBenchmarkUploadBuffer() {
+  SPDLOG_TRACE("App::CreateBenchmarkUploadBuffer()");
+
+  uint32_t uploadsPerFrame = config.benchmarkUploadsPerFrame;
+  if (!config.benchmark || uploadsPerFrame == 0) {
+    return;
+  }
+
+  // Has to fit in a frame's region of the staging ring, along with anything
+  // else uploaded that frame
+  VkDeviceSize frameBytes =
+      static_cast<VkDeviceSize>(uploadsPerFrame) * config.benchmarkUploadSize;
+  if (frameBytes > STAGING_RING_FRAME_SIZE) {
+    throw std::runtime_error("Benchmark uploads don't fit in the staging ring");
+  }
+
+  // Nothing reads it, it only has to be somewhere for the copies to land
+  CreateBuffer(frameBytes,
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                   VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, benchmarkUploadBuffer,
+               benchmarkUploadBufferAllocation);
+
+  benchmarkUploadData.resize(config.benchmarkUploadSize);
+  for (size_t i = 0; i < benchmarkUploadData.size(); i++) {
+    benchmarkUploadData[i] = static_cast<uint8_t>(i);
+  }
+}
+
+void App::CreateStagingRing() {
+  SPDLOG_TRACE("App::CreateStagingRing()");
+
+  stagingRing.Init(device, allocator, framesInFlight, STAGING_RING_FRAME_SIZE,
+                   hostCallbacks);
+}
+
+void App::CreateTextureStreamer() {
+  SPDLOG_TRACE("App::CreateTextureStreamer()");
+
+  textures.Init(physicalDevice, device, allocator, framesInFlight,
+                VkDeviceSize(config.textureBudgetMiB) * 1024 * 1024,
+                hostCallbacks);
+
+  if (package.IsOpen()) {
+    for (std::string_view name : package.GetNames(AssetType::Texture)) {
+      TextureHandle handle = textures.Load(package, name);
+      if (handle.IsValid()) {
+        textureHandles.push_back(handle);
+      }
+    }
+  }
+
+  for (const std::string &path : config.texturePaths) {
+    textureHandles.push_back(textures.LoadFile(path));
+  }
 
-  CopyBuffer(stagingBuffer, indexBuffer, bufferSize);
+  // Slots are handed out once each texture has a view, see UpdateTextureSlots
+  textureSlots.assign(textureHandles.size(), BINDLESS_NONE);
+  textureGenerations.assign(textureHandles.size(), 0);
+}
+
+void App::UpdateTextureSlots() {
+  for (size_t i = 0; i < textureHandles.size(); i++) {
+    uint32_t generation = textures.GetGeneration(textureHandles[i]);
+    if (generation == textureGenerations[i]) {
+      continue;
+    }
+
+    VkImageView view = textures.GetView(textureHandles[i]);
+    if (textureSlots[i] == BINDLESS_NONE) {
+      textureSlots[i] = bindless.AddTexture(view, textures.GetSampler());
+    } else {
+      bindless.SetTexture(textureSlots[i], view, textures.GetSampler());
+    }
+    textureGenerations[i] = generation;
+  }
+}
 
-  vkDestroyBuffer(device, stagingBuffer, nullptr);
-  vkFreeMemory(device, stagingBufferMemory, nullptr);
+uint32_t App::GetTextureSlot(int texture) const {
+  if (texture < 0 || static_cast<size_t>(texture) >= textureSlots.size()) {
+    return BINDLESS_NONE;
+  }
+  return textureSlots[texture];
 }
 
 void App::CreateCommandBuffers() {
-  spdlog::trace("App::CreateCommandBuffer()");
+  SPDLOG_TRACE("App::CreateCommandBuffer()");
 
-  commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  commandBuffers.resize(framesInFlight);
 
   VkCommandBufferAllocateInfo allocInfo = {};
   allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -841,11 +1409,12 @@ void App::CreateCommandBuffers() {
 }
 
 void App::CreateSyncObjects() {
-  spdlog::trace("App::CreateSyncObjects()");
+  SPDLOG_TRACE("App::CreateSyncObjects()");
 
-  imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-  renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-  inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+  imageAvailableSemaphores.resize(framesInFlight);
+  renderFinishedSemaphores.resize(framesInFlight);
+  inFlightFences.resize(framesInFlight);
+  frameSerials.assign(framesInFlight, 0);
 
   VkSemaphoreCreateInfo semaphoreInfo = {};
   semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -856,13 +1425,13 @@ void App::CreateSyncObjects() {
                                     // wait on it immediately
   fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+  for (size_t i = 0; i < framesInFlight; i++) {
     // Create the semaphores and fences
-    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+    if (vkCreateSemaphore(device, &semaphoreInfo, hostCallbacks,
                           &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-        vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+        vkCreateSemaphore(device, &semaphoreInfo, hostCallbacks,
                           &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-        vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) !=
+        vkCreateFence(device, &fenceInfo, hostCallbacks, &inFlightFences[i]) !=
             VK_SUCCESS) {
       throw std::runtime_error("failed to create semaphores!");
     }
@@ -870,36 +1439,90 @@ void App::CreateSyncObjects() {
 }
 
 void App::CleanupSwapchain() {
-  for (auto framebuffer : swapchainFramebuffers) {
-    vkDestroyFramebuffer(device, framebuffer, nullptr);
-  }
+  // Only called once the device is idle, so everything can go now
+  RetireSwapchain();
+  framesCompleted = framesSubmitted;
+  CollectRetiredSwapchains();
+}
+
+void App::RetireSwapchain() {
+  RetiredSwapchain retired;
+  retired.swapchain = swapchain;
+  // The graph's framebuffers for these views go with them
+  for (VkImageView view : swapchainImageViews) {
+    graph.ReleaseView(view, framesSubmitted);
+  }
+  retired.imageViews = std::move(swapchainImageViews);
+  if (config.headless) {
+    retired.images = std::move(swapchainImages);
+    retired.allocations = std::move(offscreenAllocations);
+  }
+  // Every frame submitted so far may be rendering to or presenting one of
+  // its images
+  retired.lastFrame = framesSubmitted;
+  retiredSwapchains.push_back(std::move(retired));
+
+  swapchain = VK_NULL_HANDLE;
+  swapchainImages.clear();
+  swapchainImageViews.clear();
+  offscreenAllocations.clear();
+}
+
+void App::CollectRetiredSwapchains() {
+  // Retired in order, so the oldest are at the front
+  size_t collected = 0;
+  for (auto &retired : retiredSwapchains) {
+    if (retired.lastFrame > framesCompleted) {
+      break;
+    }
+
+    for (auto &imageView : retired.imageViews) {
+      vkDestroyImageView(device, imageView, hostCallbacks);
+    }
+
+    for (size_t i = 0; i < retired.images.size(); i++) {
+      vkDestroyImage(device, retired.images[i], hostCallbacks);
+      allocator.Free(retired.allocations[i]);
+    }
+
+    // The frame's fence signalling means the wait on its render finished
+    // semaphore has been satisfied, which is as close to knowing the
+    // presentation is done as core Vulkan gets
+    if (retired.swapchain != VK_NULL_HANDLE) {
+      vkDestroySwapchainKHR(device, retired.swapchain, hostCallbacks);
+    }
 
-  for (auto &imageView : swapchainImageViews) {
-    vkDestroyImageView(device, imageView, nullptr);
+    collected++;
   }
 
-  vkDestroySwapchainKHR(device, swapchain, nullptr);
+  retiredSwapchains.erase(retiredSwapchains.begin(),
+                          retiredSwapchains.begin() + collected);
 }
 
 void App::RecreateSwapchain() {
-  int width = 0, height = 0;
-  glfwGetFramebufferSize(window, &width, &height);
-  while (width == 0 || height == 0) {
+  if (!config.headless) {
+    // Minimised, there's nothing to render to until the window comes back
+    int width = 0, height = 0;
     glfwGetFramebufferSize(window, &width, &height);
-    glfwWaitEvents();
+    while (width == 0 || height == 0) {
+      glfwGetFramebufferSize(window, &width, &height);
+      glfwWaitEvents();
+    }
   }
 
-  vkDeviceWaitIdle(device);
-
-  CleanupSwapchain();
+  // Nothing here waits for the GPU. Frames still in flight keep their old
+  // images and views, which are destroyed once those frames have completed (see
+  // CollectRetiredSwapchains).
+  RetireSwapchain();
 
   CreateSwapchain();
   CreateImageViews();
-  CreateFramebuffers();
+
+  resizePending = false;
 }
 
 void App::SetupImGui() {
-  spdlog::trace("App::SetupImGui()");
+  SPDLOG_TRACE("App::SetupImGui()");
   // TODO: Is this oversized?
   VkDescriptorPoolSize poolSizes[] = {
       {VK_DESCRIPTOR_TYPE_SAMPLER, 1000},
@@ -921,12 +1544,17 @@ void App::SetupImGui() {
   poolInfo.pPoolSizes = poolSizes;
   poolInfo.maxSets = 1000;
 
-  if (vkCreateDescriptorPool(device, &poolInfo, nullptr,
+  if (vkCreateDescriptorPool(device, &poolInfo, hostCallbacks,
                              &imguiDescriptorPool) != VK_SUCCESS) {
     throw std::runtime_error("Failed to create descriptor pool");
   }
 
+  // Through the counted operator new, so the UI shows up in the per-frame
+  // heap allocations like everything else
   IMGUI_CHECKVERSION();
+  ImGui::SetAllocatorFunctions(
+      [](size_t size, void *) { return ::operator new(size); },
+      [](void *memory, void *) { ::operator delete(memory); });
   ImGui::CreateContext();
 
   ImGuiStyle &style = ImGui::GetStyle();
@@ -959,67 +1587,383 @@ void App::SetupImGui() {
   initInfo.Device = device;
   initInfo.Queue = graphicsQueue;
   initInfo.DescriptorPool = imguiDescriptorPool;
-  initInfo.MinImageCount = MAX_FRAMES_IN_FLIGHT;
+  initInfo.MinImageCount = std::max(framesInFlight, 2u); // ImGui needs 2
   initInfo.ImageCount = static_cast<uint32_t>(swapchainImages.size());
   initInfo.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
   initInfo.RenderPass = renderPass;
-  initInfo.Allocator = nullptr;
+  initInfo.Allocator = hostCallbacks;
+
+  // Without a render pass to build against it needs the formats
+  if (vulkan13) {
+    initInfo.UseDynamicRendering = true;
+    initInfo.PipelineRenderingCreateInfo.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+    initInfo.PipelineRenderingCreateInfo.colorAttachmentCount = 1;
+    initInfo.PipelineRenderingCreateInfo.pColorAttachmentFormats =
+        &swapchainImageFormat;
+  }
 
   ImGui_ImplVulkan_Init(&initInfo);
 }
 
-void App::DrawFrame() {
-  static uint32_t currentFrame = 0;
-
-  auto &inFlightFence = inFlightFences[currentFrame];
-  auto &imageAvailableSemaphore = imageAvailableSemaphores[currentFrame];
-  auto &renderFinishedSemaphore = renderFinishedSemaphores[currentFrame];
-  auto &commandBuffer = commandBuffers[currentFrame];
-
+void App::WaitForFrame() {
   // Wait for the fence to signal that the frame is finished
   // This is important because we don't want to start drawing a new frame
   // while the previous one is still in flight
   // As long as our update logic is before this function, it will not be blocked
   // by this function meaning if our drawing takes 1ms, we can still update
   // using the remaining 15ms of the frame
-  vkWaitForFences(device, 1, &inFlightFence, VK_TRUE, UINT64_MAX);
+  auto waitStart = std::chrono::high_resolution_clock::now();
+  vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE,
+                  UINT64_MAX);
+  auto waitEnd = std::chrono::high_resolution_clock::now();
+
+  // Everything since the last frame started, the whole loop included
+  uint64_t heapAllocations = GetHeapAllocationCount();
+  frameHeapAllocations = heapAllocations - lastHeapAllocationCount;
+  lastHeapAllocationCount = heapAllocations;
+
+  // Nothing from this frame's last use can still be reading it
+  frameArenas[currentFrame].Reset();
+
+  // Frames complete in the order they were submitted
+  framesCompleted = std::max(framesCompleted, frameSerials[currentFrame]);
+  CollectRetiredSwapchains();
+
+  // The fence has signalled so this frame's timestamps from last time round
+  // can be read without waiting. The frame starts with the wait, which is
+  // recorded once it has begun so it isn't charged to the last one.
+  profiler.BeginFrame(currentFrame, waitStart);
+  profiler.AddCpuEvent("Wait for GPU", waitStart, waitEnd);
+}
 
-  // Acquire an image from the swap chainm, using a semaphore not a fence!
-  uint32_t imageIndex;
-  auto res = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX,
-                                   imageAvailableSemaphore, VK_NULL_HANDLE,
-                                   &imageIndex);
+VkSampleCountFlagBits App::ChooseSampleCount(uint32_t requested) const {
+  VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+  for (uint32_t count = 2; count <= std::min(requested, 64u); count *= 2) {
+    if (supportedSamples & count) {
+      samples = static_cast<VkSampleCountFlagBits>(count);
+    }
+  }
+  return samples;
+}
 
-  if (res == VK_ERROR_OUT_OF_DATE_KHR) {
-    RecreateSwapchain();
-    return;
-  } else if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR) {
-    throw std::runtime_error("Failed to acquire swap chain image");
+void App::SetSampleCount(VkSampleCountFlagBits samples) {
+  pendingSamples = samples;
+  pendingDesc = sceneDesc;
+  pendingDesc.samples = samples;
+  pendingDesc.renderPass = GetCompatibleRenderPass(samples);
+
+  // Nothing is ever drawn with the fallback, the switch waits until the
+  // pipeline is ready. Going back to a count used before finds it already
+  // there.
+  pendingDefault = pipelines.Request(pendingDesc, defaultPipeline);
+  if (additiveBlending) {
+    pipelines.Request(AdditiveVariant(pendingDesc), pendingDefault);
   }
+}
 
-  // Now that we know the surface is up to date, we can reset the fence
-  vkResetFences(device, 1, &inFlightFence); // Reset the fence to unsignaled
+void App::SelectScenePipeline() {
+  // A variant that isn't ready yet draws with the default pipeline until
+  // its background compile finishes
+  scenePipeline =
+      additiveBlending
+          ? pipelines.Request(AdditiveVariant(sceneDesc), defaultPipeline)
+          : defaultPipeline;
+}
 
-  // Reset the command buffer to the initial state
-  vkResetCommandBuffer(commandBuffer, 0);
+void App::UpdateRenderResolution() {
+  // Frames already submitted keep the pipelines they were recorded with,
+  // which the registry holds on to
+  if (pendingSamples != activeSamples && pipelines.IsReady(pendingDefault)) {
+    activeSamples = pendingSamples;
+    sceneDesc = pendingDesc;
+    defaultPipeline = pendingDefault;
+    SelectScenePipeline();
+    spdlog::info("Drawing with {}x MSAA",
+                 static_cast<uint32_t>(activeSamples));
+  }
+
+  // Without a blit there is no way to get a smaller image onto the screen
+  const RenderResolution &resolution = config.resolution;
+  float minScale = std::clamp(resolution.minScale, RENDER_SCALE_STEP, 1.0f);
+  float scale = 1.0f;
+  if (blitSupported && swapchainTransferDst) {
+    scale = resolution.scale;
+
+    uint64_t frame = 0;
+    double sceneMs = 0.0;
+    double frameMs = 0.0;
+    if (resolution.targetGpuMs <= 0.0) {
+      dynamicScale = scale;
+    } else if (profiler.GetLatestGpuFrame("Render pass", frame, sceneMs,
+                                          frameMs) &&
+               frame >= renderScaleFrame && sceneMs > 0.0) {
+      renderScaleFrame = frame + 1;
+      sceneGpuMs = sceneMs;
+      frameGpuMs = frameMs;
+
+      // Only the scene pass gets cheaper at a lower resolution, the rest
+      // (culling, the blit, the UI) comes out of the target first. What is
+      // left goes with the pixels drawn, the square of the scale.
+      double budget = std::max(resolution.targetGpuMs - (frameMs - sceneMs),
+                               resolution.targetGpuMs * 0.1);
+      float wanted =
+          renderScale * static_cast<float>(std::sqrt(budget / sceneMs));
+      dynamicScale += (wanted - dynamicScale) * RENDER_SCALE_RESPONSE;
+      dynamicScale = std::clamp(dynamicScale, minScale, 1.0f);
+    }
 
-  // Begin the command buffer recording
-  RecordCommandBuffer(commandBuffer, imageIndex);
+    if (resolution.targetGpuMs > 0.0) {
+      scale = std::round(dynamicScale / RENDER_SCALE_STEP) * RENDER_SCALE_STEP;
+      scale = std::max(scale, minScale);
+    }
+    scale = std::clamp(scale, RENDER_SCALE_STEP, 1.0f);
+  }
 
-  // Submit the command buffer to the graphics queue
-  VkSubmitInfo submitInfo = {};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  VkExtent2D extent = {
+      std::max(static_cast<uint32_t>(swapchainExtent.width * scale), 1u),
+      std::max(static_cast<uint32_t>(swapchainExtent.height * scale), 1u)};
+  if (extent.width != renderExtent.width ||
+      extent.height != renderExtent.height) {
+    // What is in flight was drawn at the old extent
+    renderScaleFrame = profiler.GetCurrentFrame();
+  }
+  renderExtent = extent;
+  renderScale = scale;
+}
 
-  // Tell the submition info to wait for the
-  VkSemaphore waitSemaphores[] = {imageAvailableSemaphore};
-  VkPipelineStageFlags waitStages[] = {
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  submitInfo.waitSemaphoreCount =
-      sizeof(waitSemaphores) / sizeof(waitSemaphores[0]);
-  submitInfo.pWaitSemaphores = waitSemaphores;
-  submitInfo.pWaitDstStageMask = waitStages;
+void App::ReloadShaders() {
+  // Pipelines replaced by earlier reloads, once no frame can still use them
+  pipelines.CollectRetired(framesCompleted);
 
-  // Inform the submit info of the command buffer
+  // Benchmarks measure the shaders they started with
+  if (config.benchmark) {
+    return;
+  }
+
+  for (const std::string &path : shaders.Poll()) {
+    if (pipelines.Reload(path) == 0) {
+      // The culler's compute pipeline isn't in the registry
+      spdlog::warn("{} changed, restart to use it", path);
+    }
+  }
+
+  // Everything recorded from here on draws with the rebuilt pipelines, the
+  // frames already submitted keep the old ones until they finish
+  uint32_t applied = pipelines.ApplyReloads(framesSubmitted);
+  if (applied > 0) {
+    spdlog::info("Reloaded {} pipelines", applied);
+  }
+}
+
+void App::LimitFrameRate() {
+  ProfileScope scope(profiler, "Frame limiter");
+
+  using Clock = std::chrono::high_resolution_clock;
+  auto period = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / config.pacing.frameRateLimit));
+
+  // After a long frame start counting again from now, rather than rushing
+  // through frames to catch up
+  auto now = Clock::now();
+  if (nextFrameDeadline + period < now) {
+    nextFrameDeadline = now;
+  }
+
+  // Sleeping is only accurate to a millisecond or so, spin for the rest
+  std::this_thread::sleep_until(nextFrameDeadline -
+                                std::chrono::milliseconds(1));
+  while (Clock::now() < nextFrameDeadline) {
+    std::this_thread::yield();
+  }
+
+  nextFrameDeadline += period;
+}
+
+bool App::WaitForRedraw() {
+  ProfileScope scope(profiler, "Wait for events");
+
+  using Clock = std::chrono::high_resolution_clock;
+  auto period = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(
+          1.0 / std::max(config.pacing.idleFrameRate, 1.0)));
+  auto waitStart = Clock::now();
+
+  glfwPollEvents();
+  while (!glfwWindowShouldClose(window)) {
+    // Input is drawn straight away, the frames after it too
+    if (inputReceived) {
+      inputReceived = false;
+      inputFrames = ON_DEMAND_SETTLE_FRAMES;
+    }
+    if (inputFrames > 0) {
+      inputFrames--;
+      break;
+    }
+
+    // Everything else at the idle rate at most
+    auto now = Clock::now();
+    if (now >= nextIdleFrame) {
+      nextIdleFrame = now + period;
+
+      // Nothing else would notice a shader being saved
+      ReloadShaders();
+      if (NeedsRedraw()) {
+        idleFrames = ON_DEMAND_SETTLE_FRAMES;
+        break;
+      }
+      if (idleFrames > 0) {
+        idleFrames--;
+        break;
+      }
+    }
+
+    glfwWaitEventsTimeout(
+        std::chrono::duration<double>(nextIdleFrame - now).count());
+  }
+
+  idleSeconds +=
+      std::chrono::duration<double>(Clock::now() - waitStart).count();
+  return !glfwWindowShouldClose(window);
+}
+
+bool App::NeedsRedraw() {
+  // Anything that moves on its own
+  if (animateScene || animateEntities || spriteCount > 0) {
+    return true;
+  }
+  if (framebufferResized || resizePending) {
+    return true;
+  }
+  // The text cursor blinks
+  if (ImGui::GetIO().WantTextInput) {
+    return true;
+  }
+
+  // Background work, which shows up in the frame after it lands. A new
+  // sample count is only switched to between frames.
+  if (uploadEngine.GetStats().batchesInFlight > 0 ||
+      pipelines.GetStats().pending > 0 || pendingSamples != activeSamples) {
+    return true;
+  }
+
+  // Streaming is still going if it did anything since last time
+  TextureStats textureStats = textures.GetStats();
+  uint64_t textureProgress =
+      textureStats.mipsStreamed + textureStats.mipsEvicted;
+  bool streamed = textureProgress != lastTextureProgress;
+  lastTextureProgress = textureProgress;
+  return streamed;
+}
+
+void App::DrawFrame() {
+  auto &inFlightFence = inFlightFences[currentFrame];
+  auto &imageAvailableSemaphore = imageAvailableSemaphores[currentFrame];
+  auto &renderFinishedSemaphore = renderFinishedSemaphores[currentFrame];
+  auto &commandBuffer = commandBuffers[currentFrame];
+
+  // With a late latch the main loop has already waited, before polling input
+  if (!config.pacing.lateLatch) {
+    WaitForFrame();
+  }
+
+  // Acquire an image from the swap chainm, using a semaphore not a fence!
+  // Headless runs have an image per frame in flight and nothing to wait on.
+  uint32_t imageIndex = currentFrame;
+  VkResult res = VK_SUCCESS;
+  if (!config.headless) {
+    ProfileScope scope(profiler, "Acquire");
+    res = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX,
+                                imageAvailableSemaphore, VK_NULL_HANDLE,
+                                &imageIndex);
+  }
+
+  if (res == VK_ERROR_OUT_OF_DATE_KHR) {
+    RecreateSwapchain();
+    return;
+  } else if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR) {
+    throw std::runtime_error("Failed to acquire swap chain image");
+  }
+
+  // Now that we know the surface is up to date, we can reset the fence
+  vkResetFences(device, 1, &inFlightFence); // Reset the fence to unsignaled
+
+  // Latency is measured from when the input this frame uses was read
+  profiler.SetInputTime(inputTime);
+
+  ReloadShaders();
+  UpdateRenderResolution();
+
+  // The fence has signalled, so this frame's staging region is free again
+  stagingRing.BeginFrame(currentFrame);
+  textures.BeginFrame(currentFrame, framesCompleted);
+  bindless.BeginFrame(currentFrame);
+  graph.BeginFrame(framesCompleted);
+  sprites.BeginFrame(currentFrame);
+  recorder.BeginFrame(currentFrame);
+  uniforms.BeginFrame(currentFrame);
+
+  // A few bytes straight into mapped memory, read where they are
+  UpdateUniforms();
+  UpdateEntities();
+
+  // Benchmarks streaming data every frame, flushed with everything else
+  for (uint32_t i = 0; i < config.benchmarkUploadsPerFrame; i++) {
+    stagingRing.Upload(benchmarkUploadBuffer,
+                       static_cast<VkDeviceSize>(i) * config.benchmarkUploadSize,
+                       benchmarkUploadData.data(), benchmarkUploadData.size());
+  }
+
+  // Reset the command buffer to the initial state
+  vkResetCommandBuffer(commandBuffer, 0);
+
+  // Begin the command buffer recording
+  {
+    ProfileScope scope(profiler, "Record");
+    auto recordStart = std::chrono::high_resolution_clock::now();
+    RecordCommandBuffer(commandBuffer, imageIndex);
+    recordMs += std::chrono::duration<double, std::milli>(
+                    std::chrono::high_resolution_clock::now() - recordStart)
+                    .count();
+  }
+
+  // Kick off everything queued for streaming since last frame (including
+  // while recording) as one batch and recycle the staging memory of batches
+  // that have landed. Here because the transfer queue may be the graphics
+  // queue, which only this thread submits to.
+  uploadEngine.Submit();
+  uploadEngine.Collect();
+
+  // Submit the command buffer to the graphics queue
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+  // Tell the submition info to wait for the image and for the geometry to
+  // have been uploaded (this is a no-op once the upload has completed, but
+  // it is what makes the transfer queue's writes visible to us)
+  VkSemaphore waitSemaphores[] = {imageAvailableSemaphore,
+                                  uploadEngine.GetSemaphore()};
+  VkPipelineStageFlags waitStages[] = {
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT};
+  // Headless frames skip the image available semaphore, there isn't one
+  uint32_t firstWait = config.headless ? 1 : 0;
+  submitInfo.waitSemaphoreCount =
+      sizeof(waitSemaphores) / sizeof(waitSemaphores[0]) - firstWait;
+  submitInfo.pWaitSemaphores = waitSemaphores + firstWait;
+  submitInfo.pWaitDstStageMask = waitStages + firstWait;
+
+  // Binary semaphores ignore their value
+  uint64_t waitValues[] = {0, geometryUpload.value};
+
+  VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.waitSemaphoreValueCount = submitInfo.waitSemaphoreCount;
+  timelineInfo.pWaitSemaphoreValues = waitValues + firstWait;
+  submitInfo.pNext = &timelineInfo;
+
+  // Inform the submit info of the command buffer
   submitInfo.commandBufferCount = 1;
   submitInfo.pCommandBuffers = &commandBuffer;
 
@@ -1027,13 +1971,57 @@ void App::DrawFrame() {
   // has finished
   VkSemaphore signalSemaphores[] = {renderFinishedSemaphore};
   submitInfo.signalSemaphoreCount =
-      sizeof(signalSemaphores) / sizeof(signalSemaphores[0]);
+      config.headless ? 0
+                      : sizeof(signalSemaphores) / sizeof(signalSemaphores[0]);
   submitInfo.pSignalSemaphores = signalSemaphores;
 
+  // The same with synchronization2, where each semaphore carries its own
+  // stages and timeline value. The legacy stage bits mean the same in both.
+  VkSemaphoreSubmitInfo waitInfos[2] = {};
+  for (uint32_t i = 0; i < 2; i++) {
+    waitInfos[i].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+    waitInfos[i].semaphore = waitSemaphores[i];
+    waitInfos[i].value = waitValues[i];
+    waitInfos[i].stageMask = waitStages[i];
+  }
+
+  // Presentation needs everything done, including the graph's transition
+  // to the present layout
+  VkSemaphoreSubmitInfo signalInfo = {};
+  signalInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+  signalInfo.semaphore = renderFinishedSemaphore;
+  signalInfo.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+
+  VkCommandBufferSubmitInfo commandBufferInfo = {};
+  commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+  commandBufferInfo.commandBuffer = commandBuffer;
+
+  VkSubmitInfo2 submitInfo2 = {};
+  submitInfo2.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+  submitInfo2.waitSemaphoreInfoCount = submitInfo.waitSemaphoreCount;
+  submitInfo2.pWaitSemaphoreInfos = waitInfos + firstWait;
+  submitInfo2.commandBufferInfoCount = 1;
+  submitInfo2.pCommandBufferInfos = &commandBufferInfo;
+  submitInfo2.signalSemaphoreInfoCount = submitInfo.signalSemaphoreCount;
+  submitInfo2.pSignalSemaphoreInfos = &signalInfo;
+
   // Submit the command buffer to the graphics queue
-  if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFence) !=
-      VK_SUCCESS) {
-    throw std::runtime_error("Failed to submit draw command buffer");
+  {
+    ProfileScope scope(profiler, "Submit");
+    VkResult result =
+        vulkan13 ? vkQueueSubmit2(graphicsQueue, 1, &submitInfo2, inFlightFence)
+                 : vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFence);
+    if (result != VK_SUCCESS) {
+      throw std::runtime_error("Failed to submit draw command buffer");
+    }
+  }
+
+  frameSerials[currentFrame] = ++framesSubmitted;
+
+  if (config.headless) {
+    // The finished image simply stays where it is
+    currentFrame = (currentFrame + 1) % framesInFlight;
+    return;
   }
 
   // Present the image to the swap chain
@@ -1052,87 +2040,319 @@ void App::DrawFrame() {
   presentInfo.pImageIndices = &imageIndex;
   presentInfo.pResults = nullptr; // Optional
 
-  res = vkQueuePresentKHR(presentQueue, &presentInfo);
+  {
+    ProfileScope scope(profiler, "Present");
+    res = vkQueuePresentKHR(presentQueue, &presentInfo);
+  }
+
+  if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR &&
+      res != VK_ERROR_OUT_OF_DATE_KHR) {
+    throw std::runtime_error("failed to present swap chain image!");
+  }
 
-  if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR ||
-      framebufferResized) {
+  // Dragging the window edge sends a resize every frame, rather than making
+  // a new swapchain for each one keep presenting to the current one (which
+  // gets scaled) until the size settles
+  auto now = std::chrono::high_resolution_clock::now();
+  if (framebufferResized || res == VK_SUBOPTIMAL_KHR) {
+    if (!resizePending) {
+      resizePending = true;
+      resizeFirstEvent = now;
+    }
+    if (framebufferResized) {
+      resizeLastEvent = now;
+    }
     framebufferResized = false;
+  }
+
+  if (res == VK_ERROR_OUT_OF_DATE_KHR) {
+    // Can't be presented to at all any more
     RecreateSwapchain();
-  } else if (res != VK_SUCCESS) {
-    throw std::runtime_error("failed to present swap chain image!");
+  } else if (resizePending) {
+    double sinceLast =
+        std::chrono::duration<double, std::milli>(now - resizeLastEvent)
+            .count();
+    double sinceFirst =
+        std::chrono::duration<double, std::milli>(now - resizeFirstEvent)
+            .count();
+    if (sinceLast >= RESIZE_DEBOUNCE_MS || sinceFirst >= RESIZE_MAX_DELAY_MS) {
+      RecreateSwapchain();
+    }
   }
 
-  currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+  framesDrawn++;
+  currentFrame = (currentFrame + 1) % framesInFlight;
 }
 
 void App::MainLoop() {
-  spdlog::trace("App::MainLoop() after {}ms",
-                std::chrono::duration_cast<std::chrono::milliseconds>(
-                    std::chrono::high_resolution_clock::now() - startTime)
-                    .count());
+  // Startup time, and how much of it the pipeline cache saved us
+  SPDLOG_TRACE(
+      "App::MainLoop() after {}ms (pipeline cache {}, pipelines built in "
+      "{:.2f}ms, {:.2f}ms saved)",
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::high_resolution_clock::now() - startTime)
+          .count(),
+      pipelineCache.IsWarm() ? "hit" : "miss", pipelineCache.GetBuildMs(),
+      pipelineCache.IsWarm()
+          ? pipelineCache.GetColdBuildMs() - pipelineCache.GetBuildMs()
+          : 0.0);
+
+  uint32_t frames = 0;
+  auto benchmarkStart = std::chrono::high_resolution_clock::now();
+  auto frameStart = benchmarkStart;
+
+  // Reserved up front so the loop itself doesn't allocate
+  std::vector<double> frameTimes;
+  if (config.benchmark) {
+    frameTimes.reserve(config.benchmarkFrames);
+  }
+
+  // Only count what is streamed while the benchmark runs, not the initial
+  // geometry
+  uint64_t uploadedBefore = stagingRing.GetBytesUploaded() +
+                            uploadEngine.GetStats().bytesUploaded;
+  // From the end of the warm-up, less whatever recreating allocated
+  uint64_t heapBefore = 0;
+
+  while (config.headless || !glfwWindowShouldClose(window)) {
+    if (config.pacing.onDemand && !config.benchmark && !WaitForRedraw()) {
+      break;
+    }
+
+    if (config.pacing.frameRateLimit > 0.0) {
+      LimitFrameRate();
+    }
+
+    // Waiting here rather than in DrawFrame means the input polled below is
+    // as fresh as possible when the frame is recorded
+    if (config.pacing.lateLatch) {
+      WaitForFrame();
+    }
+
+    if (!config.headless) {
+      ProfileScope scope(profiler, "Poll events");
+      glfwPollEvents();
+    }
+    inputTime = std::chrono::high_resolution_clock::now();
+
+    // Work other threads need done on this one (e.g. GLFW calls)
+    jobs.RunMainThreadJobs();
 
-  while (!glfwWindowShouldClose(window)) {
-    glfwPollEvents();
     DrawFrame();
+
+    if (firstFrameMs == 0.0) {
+      firstFrameMs = std::chrono::duration<double, std::milli>(
+                         std::chrono::high_resolution_clock::now() - startTime)
+                         .count();
+      spdlog::info("First frame after {:.1f} ms", firstFrameMs);
+    }
+
+    if (!config.benchmark) {
+      continue;
+    }
+
+    auto frameEnd = std::chrono::high_resolution_clock::now();
+    frameTimes.push_back(
+        std::chrono::duration<double, std::milli>(frameEnd - frameStart)
+            .count());
+    frameStart = frameEnd;
+
+    if (++frames == BENCHMARK_WARMUP_FRAMES) {
+      heapBefore = GetHeapAllocationCount();
+    }
+    if (frames == config.benchmarkFrames) {
+      break;
+    }
+
+    // Stresses everything that depends on the swapchain's size and images
+    if (config.benchmarkRecreateInterval > 0 &&
+        frames % config.benchmarkRecreateInterval == 0) {
+      auto recreateStart = std::chrono::high_resolution_clock::now();
+      uint64_t heapRecreate = GetHeapAllocationCount();
+      RecreateSwapchain();
+      heapBefore += GetHeapAllocationCount() - heapRecreate;
+      frameStart = std::chrono::high_resolution_clock::now();
+      recreateMs +=
+          std::chrono::duration<double, std::milli>(frameStart - recreateStart)
+              .count();
+      recreates++;
+    }
   }
 
   // Wait for the device to finish before cleaning up
   vkDeviceWaitIdle(device);
+
+  if (config.benchmark) {
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::high_resolution_clock::now() -
+                         benchmarkStart)
+                         .count();
+
+    uint64_t uploaded = stagingRing.GetBytesUploaded() +
+                        uploadEngine.GetStats().bytesUploaded - uploadedBefore;
+    benchmarkResults.uploadMiBPerSecond =
+        seconds > 0.0 ? uploaded / (1024.0 * 1024.0) / seconds : 0.0;
+    benchmarkResults.latency = profiler.GetLatencyPercentiles();
+    if (frames > BENCHMARK_WARMUP_FRAMES) {
+      benchmarkResults.heapAllocationsPerFrame =
+          double(GetHeapAllocationCount() - heapBefore) /
+          (frames - BENCHMARK_WARMUP_FRAMES);
+    }
+
+    ReportBenchmark(frames, seconds, frameTimes);
+  }
+}
+
+void App::ReportBenchmark(uint32_t frames, double seconds,
+                          std::vector<double> &frameTimes) {
+  SPDLOG_TRACE("App::ReportBenchmark()");
+
+  if (frames == 0) {
+    return;
+  }
+
+  benchmarkResults.frames = frames;
+  benchmarkResults.seconds = seconds;
+  benchmarkResults.recordMean = recordMs / frames;
+  benchmarkResults.recreates = recreates;
+  benchmarkResults.recreateMean = recreates > 0 ? recreateMs / recreates : 0.0;
+
+  double totalMs = 0.0;
+  for (double ms : frameTimes) {
+    totalMs += ms;
+  }
+  benchmarkResults.frameMean = totalMs / frameTimes.size();
+  benchmarkResults.frame = ComputePercentiles(std::move(frameTimes));
+
+  spdlog::info("Benchmark: {} frames of {} instances in {:.2f}s ({:.2f}ms "
+               "per frame)",
+               frames, instanceCount, seconds, seconds * 1000.0 / frames);
+
+  auto stats = recorder.GetStats();
+  for (size_t i = 0; i < stats.size(); i++) {
+    spdlog::info("  {} {}: {:.3f}ms recording per frame, {} command buffers",
+                 i + 1 == stats.size() ? "Main thread" : "Worker", i,
+                 stats[i].totalMs / frames, stats[i].commandBuffers);
+  }
+
+  const ProfilePercentiles &frame = benchmarkResults.frame;
+  spdlog::info("  Frames: p50 {:.3f}ms, p95 {:.3f}ms, p99 {:.3f}ms, max "
+               "{:.3f}ms",
+               frame.p50, frame.p95, frame.p99, frame.max);
+  spdlog::info("  Recording: {:.3f}ms per frame", benchmarkResults.recordMean);
+  spdlog::info("  Uploads: {:.2f} MiB/s", benchmarkResults.uploadMiBPerSecond);
+  spdlog::info("  Latency ({} frames in flight{}): p50 {:.3f}ms, p99 "
+               "{:.3f}ms",
+               framesInFlight, config.pacing.lateLatch ? ", late latch" : "",
+               benchmarkResults.latency.p50, benchmarkResults.latency.p99);
+  spdlog::info("  Heap allocations: {:.2f} per frame after {} frames",
+               benchmarkResults.heapAllocationsPerFrame,
+               BENCHMARK_WARMUP_FRAMES);
+  if (recreates > 0) {
+    spdlog::info("  Recreated the swapchain {} times, {:.3f}ms each",
+                 recreates, benchmarkResults.recreateMean);
+  }
 }
 
 void App::Cleanup() {
-  spdlog::trace("App::Cleanup()");
+  SPDLOG_TRACE("App::Cleanup()");
 
-  CleanupSwapchain();
+  // Let jobs still running finish before tearing down anything they may use
+  jobs.Destroy();
 
-  // Cleanup ImGui
-  ImGui_ImplVulkan_Shutdown();
-  ImGui_ImplGlfw_Shutdown();
-  ImGui::DestroyContext();
+  CleanupSwapchain();
 
   // TODO: Is this the correct way to clean up the descriptor pool?
-  vkWaitForFences(device, MAX_FRAMES_IN_FLIGHT, inFlightFences.data(), VK_TRUE,
+  vkWaitForFences(device, framesInFlight, inFlightFences.data(), VK_TRUE,
                   UINT64_MAX); // Wait for the fences to signal that the frame
                                // is finished, this is important because we
                                // don't want to wipe out the descriptor pool
                                // while ImGui is still using it
-  vkDestroyDescriptorPool(device, imguiDescriptorPool, nullptr);
+
+  // Cleanup ImGui
+  if (!config.headless) {
+    ImGui_ImplVulkan_Shutdown();
+    ImGui_ImplGlfw_Shutdown();
+    ImGui::DestroyContext();
+
+    vkDestroyDescriptorPool(device, imguiDescriptorPool, hostCallbacks);
+  }
+
+  // Waits for any uploads still in flight
+  uploadEngine.Destroy();
+
+  DestroyBuffer(instanceBuffer, instanceBufferAllocation);
+  DestroyBuffer(entityInstanceBuffer, entityInstanceBufferAllocation);
+  DestroyBuffer(indirectBuffer, indirectBufferAllocation);
+  DestroyBuffer(drawCountBuffer, drawCountBufferAllocation);
+  DestroyBuffer(materialBuffer, materialBufferAllocation);
+  DestroyBuffer(boundsBuffer, boundsBufferAllocation);
+  DestroyBuffer(visibleInstanceBuffer, visibleInstanceBufferAllocation);
+  DestroyBuffer(culledIndirectBuffer, culledIndirectBufferAllocation);
+  DestroyBuffer(culledDrawCountBuffer, culledDrawCountBufferAllocation);
+  DestroyBuffer(spriteIndexBuffer, spriteIndexBufferAllocation);
+  if (benchmarkUploadBuffer != VK_NULL_HANDLE) {
+    DestroyBuffer(benchmarkUploadBuffer, benchmarkUploadBufferAllocation);
+  }
 
   // Clean up the vertex buffer and memory
-  vkDestroyBuffer(device, vertexBuffer, nullptr);
-  vkFreeMemory(device, vertexBufferMemory, nullptr);
+  DestroyBuffer(vertexBuffer, vertexBufferAllocation);
 
   // Clean up the index buffer and memory
-  vkDestroyBuffer(device, indexBuffer, nullptr);
-  vkFreeMemory(device, indexBufferMemory, nullptr);
+  DestroyBuffer(indexBuffer, indexBufferAllocation);
+
+  stagingRing.Destroy();
+  textures.Destroy();
+  sprites.Destroy();
+  uniforms.Destroy();
+  graph.Destroy();
+
+  // All buffers are gone, so this releases every block back to the driver
+  allocator.Destroy();
 
-  vkDestroyCommandPool(device, commandPool, nullptr);
-  vkDestroyPipeline(device, pipeline, nullptr);
-  vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-  vkDestroyRenderPass(device, renderPass, nullptr);
+  recorder.Destroy();
+  vkDestroyCommandPool(device, commandPool, hostCallbacks);
+  culler.Destroy();
+  shaders.Destroy();
+  pipelines.Destroy();
+  package.Close();
+  vkDestroyPipelineLayout(device, pipelineLayout, hostCallbacks);
+  bindless.Destroy();
 
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
-    vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-    vkDestroyFence(device, inFlightFences[i], nullptr);
+  // Writes everything compiled this run back to disk for the next one
+  pipelineCache.Destroy();
+  profiler.Destroy();
+  vkDestroyRenderPass(device, renderPass, hostCallbacks);
+  for (VkRenderPass msaaRenderPass : msaaRenderPasses) {
+    vkDestroyRenderPass(device, msaaRenderPass, hostCallbacks);
   }
 
-  vkDestroyDevice(device, nullptr);
+  for (size_t i = 0; i < framesInFlight; i++) {
+    vkDestroySemaphore(device, renderFinishedSemaphores[i], hostCallbacks);
+    vkDestroySemaphore(device, imageAvailableSemaphores[i], hostCallbacks);
+    vkDestroyFence(device, inFlightFences[i], hostCallbacks);
+  }
+
+  vkDestroyDevice(device, hostCallbacks);
 
   if (enableValidationLayers) {
-    DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+    DestroyDebugUtilsMessengerEXT(instance, debugMessenger, hostCallbacks);
   }
 
-  vkDestroySurfaceKHR(instance, surface, nullptr);
+  if (surface != VK_NULL_HANDLE) {
+    vkDestroySurfaceKHR(instance, surface, hostCallbacks);
+  }
 
-  vkDestroyInstance(instance, nullptr);
+  vkDestroyInstance(instance, hostCallbacks);
 
-  glfwDestroyWindow(window);
-  glfwTerminate();
+  if (window != nullptr) {
+    glfwDestroyWindow(window);
+    glfwTerminate();
+  }
 }
 
 bool App::CheckValidationLayerSupport() {
-  spdlog::trace("App::CheckValidationLayerSupport()");
+  SPDLOG_TRACE("App::CheckValidationLayerSupport()");
   uint32_t layerCount;
   vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
 
@@ -1158,13 +2378,17 @@ bool App::CheckValidationLayerSupport() {
 }
 
 std::vector<const char *> App::GetRequiredExtensions() {
-  spdlog::trace("App::GetRequiredExtensions()");
-  uint32_t glfwExtensionCount = 0;
-  const char **glfwExtensions =
-      glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+  SPDLOG_TRACE("App::GetRequiredExtensions()");
+
+  std::vector<const char *> extensions;
 
-  std::vector<const char *> extensions(glfwExtensions,
-                                       glfwExtensions + glfwExtensionCount);
+  // GLFW's are the surface extensions, not needed without a window
+  if (!config.headless) {
+    uint32_t glfwExtensionCount = 0;
+    const char **glfwExtensions =
+        glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+  }
 
   if (enableValidationLayers) {
     extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -1181,7 +2405,20 @@ DebugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
 
   (void)pUserData;
 
-  static auto logger = spdlog::stdout_color_mt("validation");
+  static auto logger = GetValidationLogger();
+
+  // Something wrong every frame would otherwise be thousands of these a
+  // second, each formatted on whichever thread made the call
+  uint64_t count;
+  if (!FilterValidationMessage(pCallbackData->messageIdNumber,
+                               pCallbackData->pMessage, count)) {
+    return VK_FALSE;
+  }
+  const char *message = pCallbackData->pMessage;
+  std::string repeated;
+  if (count > 1) {
+    repeated = fmt::format(" ({} times)", count);
+  }
 
   auto messageTypeStr = "Unknown";
   switch (messageType) {
@@ -1200,16 +2437,16 @@ DebugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
 
   switch (messageSeverity) {
   case VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT:
-    logger->trace("[{}] {}", messageTypeStr, pCallbackData->pMessage);
+    logger->trace("[{}] {}{}", messageTypeStr, message, repeated);
     break;
   case VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT:
-    logger->info("[{}] {}", messageTypeStr, pCallbackData->pMessage);
+    logger->info("[{}] {}{}", messageTypeStr, message, repeated);
     break;
   case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT:
-    logger->warn("[{}] {}", messageTypeStr, pCallbackData->pMessage);
+    logger->warn("[{}] {}{}", messageTypeStr, message, repeated);
     break;
   case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT:
-    logger->error("[{}] {}", messageTypeStr, pCallbackData->pMessage);
+    logger->error("[{}] {}{}", messageTypeStr, message, repeated);
     break;
   case VK_DEBUG_UTILS_MESSAGE_SEVERITY_FLAG_BITS_MAX_ENUM_EXT:
     break;
@@ -1225,6 +2462,11 @@ void FramebufferResizeCallback(GLFWwindow *window, int width, int height) {
   app->framebufferResized = true;
 }
 
+void MarkInput(GLFWwindow *window) {
+  auto app = reinterpret_cast<App *>(glfwGetWindowUserPointer(window));
+  app->inputReceived = true;
+}
+
 VkResult App::CreateDebugUtilsMessengerEXT(
     VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT *pCreateInfo,
     const VkAllocationCallbacks *pAllocator,
@@ -1267,14 +2509,53 @@ int App::RateDeviceSuitability(VkPhysicalDevice device) {
     return 0; // No geometry shader support
   }
 
+  // Timeline semaphores are core in 1.2 but still an optional feature
+  VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+  vulkan12Features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_12_FEATURES;
+
+  VkPhysicalDeviceFeatures2 deviceFeatures2 = {};
+  deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  deviceFeatures2.pNext = &vulkan12Features;
+
+  if (deviceProperties.apiVersion < VK_API_VERSION_1_2) {
+    return 0; // No Vulkan 1.2
+  }
+
+  vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
+  if (!vulkan12Features.timelineSemaphore) {
+    return 0; // No timeline semaphores
+  }
+
+  // Descriptor indexing is core in 1.2 too, but the parts the bindless heap
+  // uses are optional
+  if (!vulkan12Features.runtimeDescriptorArray ||
+      !vulkan12Features.descriptorBindingPartiallyBound ||
+      !vulkan12Features.descriptorBindingSampledImageUpdateAfterBind ||
+      !vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind ||
+      !deviceFeatures.shaderSampledImageArrayDynamicIndexing ||
+      !deviceFeatures.shaderStorageBufferArrayDynamicIndexing) {
+    return 0; // No bindless descriptors
+  }
+
   if (!FindQueueFamilies(device).IsComplete()) {
     return 0; // No graphics queue family
   }
 
+  // Not required, but a device that has it saves rebuilding framebuffers
+  // and gets finer grained barriers
+  if (SupportsVulkan13(device)) {
+    score += 100;
+  }
+
   if (!CheckDeviceExtensionSupport(device)) {
     return 0; // Missing required extensions
   }
 
+  if (config.headless) {
+    return score; // Never presents, so the swapchain doesn't matter
+  }
+
   bool swapChainAdequate = false;
   SwapchainSupportDetails swapchainSupport = QuerySwapchainSupport(device);
   swapChainAdequate = !swapchainSupport.formats.empty() &&
@@ -1287,6 +2568,28 @@ int App::RateDeviceSuitability(VkPhysicalDevice device) {
   return score;
 }
 
+bool App::SupportsVulkan13(VkPhysicalDevice device) {
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(device, &deviceProperties);
+  if (deviceProperties.apiVersion < VK_API_VERSION_1_3) {
+    return false;
+  }
+
+  // Both are required by 1.3, checked anyway in case of a driver that
+  // reports the version without them
+  VkPhysicalDeviceVulkan13Features vulkan13Features = {};
+  vulkan13Features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_13_FEATURES;
+
+  VkPhysicalDeviceFeatures2 deviceFeatures = {};
+  deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  deviceFeatures.pNext = &vulkan13Features;
+  vkGetPhysicalDeviceFeatures2(device, &deviceFeatures);
+
+  return vulkan13Features.dynamicRendering &&
+         vulkan13Features.synchronization2;
+}
+
 bool App::CheckDeviceExtensionSupport(VkPhysicalDevice device) {
   uint32_t extensionCount;
   vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
@@ -1296,8 +2599,9 @@ bool App::CheckDeviceExtensionSupport(VkPhysicalDevice device) {
   vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
                                        availableExtensions.data());
 
-  std::set<std::string> requiredExtensions(deviceExtensions.begin(),
-                                           deviceExtensions.end());
+  std::vector<const char *> extensions = GetDeviceExtensions();
+  std::set<std::string> requiredExtensions(extensions.begin(),
+                                           extensions.end());
 
   for (const auto &extension : availableExtensions) {
     requiredExtensions.erase(extension.extensionName);
@@ -1316,26 +2620,46 @@ App::QueueFamilyIndices App::FindQueueFamilies(VkPhysicalDevice device) {
   vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
                                            queueFamilies.data());
 
-  VkBool32 presentSupport = false;
-  vkGetPhysicalDeviceSurfaceSupportKHR(device, 0, surface, &presentSupport);
-
   int i = 0;
   for (const auto &queueFamily : queueFamilies) {
-    if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+    if (!indices.graphicsFamily.has_value() &&
+        (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
       indices.graphicsFamily = i;
     }
 
-    if (presentSupport) {
+    // Headless runs never present, just keep it to the graphics family
+    VkBool32 presentSupport =
+        config.headless && (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT);
+    if (surface != VK_NULL_HANDLE) {
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+    }
+
+    if (!indices.presentFamily.has_value() && presentSupport) {
       indices.presentFamily = i;
     }
 
-    if (indices.IsComplete()) {
-      break;
+    // A family that can only transfer is usually the GPU's copy engine, which
+    // runs alongside graphics work instead of competing with it
+    if (!indices.transferFamily.has_value() &&
+        (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+        !(queueFamily.queueFlags &
+          (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+      indices.transferFamily = i;
     }
 
     i++;
   }
 
+  // Failing that, share the graphics family but use a queue of our own if it
+  // has one spare (every graphics family supports transfers)
+  if (!indices.transferFamily.has_value() &&
+      indices.graphicsFamily.has_value()) {
+    indices.transferFamily = indices.graphicsFamily;
+    if (queueFamilies[indices.graphicsFamily.value()].queueCount > 1) {
+      indices.transferQueueIndex = 1;
+    }
+  }
+
   return indices;
 }
 
@@ -1368,6 +2692,14 @@ App::QuerySwapchainSupport(VkPhysicalDevice device) {
   return details;
 }
 
+std::vector<const char *> App::GetDeviceExtensions() {
+  if (config.headless) {
+    return {};
+  }
+
+  return deviceExtensions;
+}
+
 VkSurfaceFormatKHR App::ChooseSwapSurfaceFormat(
     const std::vector<VkSurfaceFormatKHR> &availableFormats) {
   for (const auto &availableFormat : availableFormats) {
@@ -1382,12 +2714,20 @@ VkSurfaceFormatKHR App::ChooseSwapSurfaceFormat(
 
 VkPresentModeKHR App::ChooseSwapPresentMode(
     const std::vector<VkPresentModeKHR> &availablePresentModes) {
+  // IMMEDIATE: no waiting at all, lowest latency but tears
+  // MAILBOX: replaces the queued image, low latency without tearing
+  // FIFO: waits for vblank, back pressure caps us at the refresh rate
+  // FIFO_RELAXED: like FIFO but tears rather than waits when late
   for (const auto &availablePresentMode : availablePresentModes) {
-    if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
+    if (availablePresentMode == config.pacing.presentMode) {
       return availablePresentMode;
     }
   }
 
+  spdlog::warn("Present mode {} is not supported, using fifo",
+               PresentModeName(config.pacing.presentMode));
+
+  // The only mode that is always supported
   return VK_PRESENT_MODE_FIFO_KHR;
 }
 
@@ -1412,47 +2752,6 @@ VkExtent2D App::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities) {
   }
 }
 
-std::vector<char> App::ReadFile(const std::string &filename) {
-  spdlog::trace("App::ReadFile({})", filename);
-
-  std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-  if (!file.is_open()) {
-    throw std::runtime_error("Failed to open file: " + filename);
-  }
-
-  size_t fileSize = static_cast<size_t>(file.tellg());
-  std::vector<char> buffer(fileSize);
-
-  file.seekg(0);
-  file.read(buffer.data(), fileSize);
-
-  file.close();
-
-  return buffer;
-}
-
-// Shader modules in Vulkan do not seem to care what stage of the pipeline
-// that they are.
-VkShaderModule App::CreateShaderModule(const std::vector<char> &code) {
-  VkShaderModuleCreateInfo createInfo = {};
-  createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  createInfo.codeSize = code.size();
-  createInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
-
-  VkShaderModule shaderModule;
-  if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) !=
-      VK_SUCCESS) {
-    // It doesn't matter if the error is generic as the error should've come out
-    // at compile time of the shader (either external to the engine entirely
-    // or somewhere else in the engine).
-    throw std::runtime_error("Failed to create shader module");
-  }
-
-  return shaderModule;
-}
-
-// NOTE: This function also starts a new render pass
 void App::RecordCommandBuffer(VkCommandBuffer commandBuffer,
                               uint32_t imageIndex) {
   VkCommandBufferBeginInfo beginInfo = {};
@@ -1466,53 +2765,246 @@ void App::RecordCommandBuffer(VkCommandBuffer commandBuffer,
     throw std::runtime_error("Failed to begin recording command buffer");
   }
 
-  VkRenderPassBeginInfo renderPassInfo = {};
-  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-  renderPassInfo.renderPass = renderPass;
-  renderPassInfo.framebuffer =
-      swapchainFramebuffers[imageIndex]; // This will usually be 0 in our case,
-                                         // as we only have one framebuffer
-  renderPassInfo.renderArea.offset = {0, 0}; // Start at the top left corner
-  renderPassInfo.renderArea.extent =
-      swapchainExtent; // The size of the framebuffer (window size which is the
-                       // swapchain extent)S
+  // Query resets have to happen outside the render pass
+  profiler.BeginGpuFrame(commandBuffer);
+
+  // The UI is built before the render pass begins, edits it makes to the
+  // vertex data have to be copied before the draw that uses them and copies
+  // are not allowed inside a render pass.
+  if (!config.headless) {
+    BuildImGui();
+  }
+
+  // The frame as a render graph, which places the barriers between the
+  // passes and picks the render pass's load and store ops. Nothing reads
+  // the backbuffer until it is presented (or copied out when headless), so
+  // its old contents never matter.
+  RenderGraphImage backbuffer = graph.ImportImage(
+      swapchainImages[imageIndex], swapchainImageViews[imageIndex],
+      swapchainImageFormat, swapchainExtent, VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                      : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+  // The staging ring and the streamer order their copies against the draws
+  // themselves
+  graph
+      .AddPass("Uploads", RenderPassType::Transfer,
+               [&](const RenderPassContext &context) {
+                 stagingRing.Flush(context.commandBuffer);
+                 textures.Record(context.commandBuffer, framesSubmitted + 1);
+
+                 // Streaming may have replaced views, the heap follows
+                 // before any draw that could read them is recorded
+                 UpdateTextureSlots();
+               })
+      .SetSideEffects();
+
+  // Culling is a compute pass, so it has to come before the render pass too.
+  // The frustum is the camera's, shrunk by cullFrustumSize and taken back
+  // through the scene's transform to where the bounds are.
+  bool culled = drawMode == DrawMode::GpuCulled;
+  RenderGraphBuffer visibleInstances, culledIndirect, culledDrawCount;
+  if (culled) {
+    visibleInstances = graph.ImportBuffer(visibleInstanceBuffer);
+    culledIndirect = graph.ImportBuffer(culledIndirectBuffer);
+    culledDrawCount = graph.ImportBuffer(culledDrawCountBuffer);
+
+    // The reset of the command and count is a transfer
+    VkPipelineStageFlags cullStages = VK_PIPELINE_STAGE_TRANSFER_BIT |
+                                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    VkAccessFlags cullAccess =
+        VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    graph
+        .AddPass("Culling", RenderPassType::Compute,
+                 [&](const RenderPassContext &context) {
+                   glm::mat4 viewProjection =
+                       glm::scale(glm::mat4(1.0f),
+                                  glm::vec3(1.0f / cullFrustumSize,
+                                            1.0f / cullFrustumSize, 1.0f)) *
+                       GetViewProjection() * GetSceneTransform();
+                   culler.Record(context.commandBuffer, viewProjection,
+                                 instanceCount, sceneIndices.count);
+                 })
+        .ReadBuffer(graph.ImportBuffer(instanceBuffer),
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT)
+        .ReadBuffer(graph.ImportBuffer(boundsBuffer),
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT)
+        .WriteBuffer(visibleInstances, cullStages, cullAccess)
+        .WriteBuffer(culledIndirect, cullStages, cullAccess)
+        .WriteBuffer(culledDrawCount, cullStages, cullAccess);
+  }
+
+  // At the swapchain's resolution and without MSAA the scene is drawn
+  // straight into the backbuffer. Otherwise it is drawn into an image of its
+  // own, multisampled and resolved and/or smaller and blitted up, and the UI
+  // goes on top afterwards: its pipelines are single sampled, and it stays
+  // sharp at any render scale.
+  bool scaled = renderExtent.width != swapchainExtent.width ||
+                renderExtent.height != swapchainExtent.height;
+  bool multisampled = activeSamples != VK_SAMPLE_COUNT_1_BIT;
+  uiInScenePass = !scaled && !multisampled;
+
+  // What the scene ends up in, and what it is drawn into
+  RenderGraphImage sceneTarget = backbuffer;
+  if (scaled) {
+    TransientImageDesc targetDesc;
+    targetDesc.format = swapchainImageFormat;
+    targetDesc.extent = renderExtent;
+    sceneTarget = graph.CreateImage(targetDesc);
+  }
+  RenderGraphImage sceneColor = sceneTarget;
+  if (multisampled) {
+    TransientImageDesc colorDesc;
+    colorDesc.format = swapchainImageFormat;
+    colorDesc.extent = renderExtent;
+    colorDesc.samples = activeSamples;
+    sceneColor = graph.CreateImage(colorDesc);
+  }
+
+  // Everything inside the render pass is recorded into secondary command
+  // buffers, the primary only executes them
+  RenderPassBuilder scene = graph.AddPass(
+      "Render pass", RenderPassType::Graphics,
+      [&](const RenderPassContext &context) { RecordRenderPass(context); });
+  scene
+      .WriteColor(sceneColor, &clearColor,
+                  multisampled ? sceneTarget : RenderGraphImage{})
+      .UseSecondaries();
+  if (culled) {
+    scene.ReadBuffer(visibleInstances, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                     VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+    scene.ReadBuffer(culledIndirect, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                     VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+    scene.ReadBuffer(culledDrawCount, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                     VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+  }
+
+  // Filtered (when the format allows it) from the render extent to the
+  // swapchain's
+  if (scaled) {
+    graph
+        .AddPass("Upscale", RenderPassType::Transfer,
+                 [this, sceneTarget, backbuffer](
+                     const RenderPassContext &context) {
+                   VkImageBlit blit = {};
+                   blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                   blit.srcSubresource.layerCount = 1;
+                   blit.srcOffsets[1] = {
+                       static_cast<int32_t>(renderExtent.width),
+                       static_cast<int32_t>(renderExtent.height), 1};
+                   blit.dstSubresource = blit.srcSubresource;
+                   blit.dstOffsets[1] = {
+                       static_cast<int32_t>(swapchainExtent.width),
+                       static_cast<int32_t>(swapchainExtent.height), 1};
+
+                   vkCmdBlitImage(context.commandBuffer,
+                                  graph.GetImage(sceneTarget),
+                                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                  graph.GetImage(backbuffer),
+                                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                                  &blit, blitFilter);
+                 })
+        .ReadImage(sceneTarget, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_TRANSFER_READ_BIT)
+        .WriteImage(backbuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    VK_PIPELINE_STAGE_2_BLIT_BIT,
+                    VK_ACCESS_TRANSFER_WRITE_BIT);
+  }
+
+  // Loads what the scene left in the backbuffer. Recorded inline, the pass's
+  // own GPU scope is the UI's.
+  if (!config.headless && !uiInScenePass) {
+    graph
+        .AddPass("ImGui", RenderPassType::Graphics,
+                 [](const RenderPassContext &context) {
+                   ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(),
+                                                   context.commandBuffer);
+                 })
+        .WriteColor(backbuffer);
+  }
+
+  graph.Compile();
+  graph.Execute(commandBuffer, framesSubmitted + 1, &profiler);
 
-  renderPassInfo.clearValueCount = 1;        // We only have one clear value
-  renderPassInfo.pClearValues = &clearColor; // The clear value
-
-  vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
-                       VK_SUBPASS_CONTENTS_INLINE);
-
-  // Bind the graphics pipeline
-  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-
-  // New viewport and scissor
-  VkViewport viewport = {};
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = static_cast<float>(swapchainExtent.width);
-  viewport.height = static_cast<float>(swapchainExtent.height);
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-
-  VkRect2D scissor = {};
-  scissor.offset = {0, 0};
-  scissor.extent = swapchainExtent;
-  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-
-  // Bind the vertex buffer
-  VkBuffer vertexBuffers[] = {vertexBuffer};
-  VkDeviceSize offsets[] = {0};
-  vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-
-  // Bind the index buffer
-  vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to record command buffer");
+  }
+}
 
-  // Draw the vertices
-  vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0,
-                   0, 0);
+void App::RecordRenderPass(const RenderPassContext &context) {
+  // Resolved once so every chunk uses the same pipeline, even if a variant
+  // finishes compiling halfway through recording
+  framePipeline = pipelines.Get(scenePipeline);
+
+  // Sorted and written out before any recording starts, the sprites'
+  // secondary only reads the result
+  SubmitSprites();
+  sprites.Prepare();
+
+  // The render pass and framebuffer, or with dynamic rendering the formats
+  const VkCommandBufferInheritanceInfo &inheritanceInfo = *context.inheritance;
+
+  // Only per instance draws are worth splitting up, the other modes are a
+  // single command. Several chunks per thread keeps them all busy even when
+  // some chunks take longer than others.
+  uint32_t chunkCount = 1;
+  uint32_t chunkSize = instanceCount;
+  if (drawMode == DrawMode::PerInstance) {
+    chunkSize = std::max(
+        (instanceCount + recorder.GetThreadCount() * 4 - 1) /
+            (recorder.GetThreadCount() * 4),
+        256u);
+    chunkCount = (instanceCount + chunkSize - 1) / chunkSize;
+  }
+
+  // Captured by value, few enough bytes that the recorder's std::function
+  // doesn't have to allocate for them
+  const std::vector<VkCommandBuffer> &chunks = recorder.Record(
+      inheritanceInfo, chunkCount,
+      [this, chunkSize](VkCommandBuffer secondary, uint32_t chunk) {
+        uint32_t first = chunk * chunkSize;
+        ProfileScope scope(profiler, "Record scene chunk");
+        RecordScene(secondary, first,
+                    std::min(chunkSize, instanceCount - first));
+      });
+
+  ScratchVector<VkCommandBuffer> secondaries(frameArenas[currentFrame]);
+  secondaries.reserve(chunks.size() + 2);
+  secondaries.assign(chunks.begin(), chunks.end());
+
+  // Sprites are 2D overlays, so they go over the scene
+  if (sprites.GetDrawCount() > 0) {
+    secondaries.push_back(recorder.RecordOnCaller(
+        inheritanceInfo, [this, &context](VkCommandBuffer secondary) {
+          uint32_t scope = profiler.BeginGpuScope(secondary, "Sprites");
+          sprites.Record(secondary, context.extent, bindless, uniforms,
+                         overlayUniforms, pipelineLayout, materialBufferSlot);
+          profiler.EndGpuScope(secondary, scope);
+        }));
+  }
+
+  // The UI goes last so it draws on top of the scene. A primary can only
+  // execute commands while a render pass using secondaries is active, so the
+  // UI's timestamps are written from inside its own secondary.
+  if (!config.headless && uiInScenePass) {
+    secondaries.push_back(recorder.RecordOnCaller(
+        inheritanceInfo, [this](VkCommandBuffer secondary) {
+          uint32_t scope = profiler.BeginGpuScope(secondary, "ImGui");
+          ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), secondary);
+          profiler.EndGpuScope(secondary, scope);
+        }));
+  }
+
+  vkCmdExecuteCommands(context.commandBuffer,
+                       static_cast<uint32_t>(secondaries.size()),
+                       secondaries.data());
+}
 
+void App::BuildImGui() {
   ImGui_ImplVulkan_NewFrame();
   ImGui_ImplGlfw_NewFrame();
   ImGui::NewFrame();
@@ -1524,7 +3016,12 @@ void App::RecordCommandBuffer(VkCommandBuffer commandBuffer,
   ImGui::ColorEdit3("Clear Color", &clearColor.color.float32[0]);
 
   ImGui::SeparatorText("Vertex Data");
-  static Vertex vertices[] = {
+  // Edited as floats and only packed into Vertex for the upload
+  struct EditableVertex {
+    glm::vec2 pos;
+    glm::vec3 colour;
+  };
+  static EditableVertex vertices[] = {
       {{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
       {{0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
       {{0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
@@ -1532,148 +3029,576 @@ void App::RecordCommandBuffer(VkCommandBuffer commandBuffer,
   };
 
   bool modified = false;
-  static auto modWrap = [&](std::function<bool()> f) {
+  auto modWrap = [&](auto &&f) {
     if (f()) {
       modified = true;
     }
   };
 
-  for (auto &vert : vertices) {
-    ImGui::PushID(&vert);
-    modWrap([&]() { return ImGui::DragFloat("X", &vert.pos.x, 0.01f); });
-    modWrap([&]() { return ImGui::DragFloat("Y", &vert.pos.y, 0.01f); });
-    modWrap([&]() {
-      return ImGui::ColorEdit3("Color", glm::value_ptr(vert.colour));
-    });
-    ImGui::Separator();
-    ImGui::PopID();
+  // A packaged mesh has its own vertices, in whatever order packing left
+  // them, so there is nothing here to edit
+  if (scenePackaged) {
+    ImGui::TextDisabled("The scene mesh comes from the package");
+  } else {
+    for (auto &vert : vertices) {
+      ImGui::PushID(&vert);
+      modWrap([&]() { return ImGui::DragFloat("X", &vert.pos.x, 0.01f); });
+      modWrap([&]() { return ImGui::DragFloat("Y", &vert.pos.y, 0.01f); });
+      modWrap([&]() {
+        return ImGui::ColorEdit3("Color", glm::value_ptr(vert.colour));
+      });
+      ImGui::Separator();
+      ImGui::PopID();
+    }
   }
 
   if (modified) {
-    // Create a staging buffer to copy the vertex data to
-    VkDeviceSize bufferSize = sizeof(vertices);
+    // Goes through this frame's region of the staging ring, the copy itself is
+    // recorded below so nothing here waits on the GPU
+    std::array<Vertex, 4> packed;
+    for (size_t i = 0; i < packed.size(); i++) {
+      packed[i] = Vertex::Make(vertices[i].pos, vertices[i].colour);
+    }
+    stagingRing.Upload(vertexBuffer, 0, packed.data(),
+                       std::min(sizeof(packed), sceneVertexBytes.size()));
+  }
+
+  ImGui::SeparatorText("Instancing");
+  {
+    int count = static_cast<int>(instanceSliderCount);
+    ImGui::SliderInt("Instances", &count, 1, MAX_INSTANCES, "%d",
+                     ImGuiSliderFlags_Logarithmic);
+    instanceSliderCount = static_cast<uint32_t>(count);
+
+    // Only re-upload once the edit is finished, until then everything keeps
+    // drawing the instances that are there. The other frames in flight
+    // may still be drawing from the buffers the transfer queue is about to
+    // overwrite, so wait for them first (ours has already been waited on).
+    if (ImGui::IsItemDeactivatedAfterEdit()) {
+      for (uint32_t i = 0; i < framesInFlight; i++) {
+        if (i != currentFrame) {
+          vkWaitForFences(device, 1, &inFlightFences[i], VK_TRUE, UINT64_MAX);
+        }
+      }
+
+      UploadInstances(instanceSliderCount);
+    }
+
+    // Spinning entities are extracted every frame and drawn from host
+    // memory, not spinning ones are drawn as they were uploaded
+    ImGui::Checkbox("Animate entities", &animateEntities);
+    WorldStats worldStats = world.GetStats();
+    ImGui::Text("%u entities, %u archetypes, %u chunks", worldStats.entities,
+                worldStats.archetypes, worldStats.chunks);
+
+    const char *drawModes[] = {"Indirect", "Instanced", "Per instance",
+                               "GPU culled"};
+    int mode = static_cast<int>(drawMode);
+    ImGui::Combo("Draw mode", &mode, drawModes,
+                 sizeof(drawModes) / sizeof(drawModes[0]));
+    drawMode = static_cast<DrawMode>(mode);
+    if (drawMode == DrawMode::GpuCulled) {
+      ImGui::SliderFloat("Frustum size", &cullFrustumSize, 0.05f, 1.0f);
+    }
+    ImGui::Text("Draw indirect count: %s",
+                drawIndirectCountSupported ? "yes" : "no");
+    ImGui::Text("Dynamic rendering: %s", vulkan13 ? "yes" : "no");
+  }
+
+  ImGui::SeparatorText("Camera");
+  {
+    // Neither touches the scene's buffers, only this frame's uniforms
+    ImGui::SliderFloat2("Position", &cameraPosition.x, -1.0f, 1.0f);
+    ImGui::SliderFloat("Zoom", &cameraZoom, 0.25f, 4.0f, "%.2f",
+                       ImGuiSliderFlags_Logarithmic);
+    ImGui::Checkbox("Spin scene", &animateScene);
+    if (ImGui::Button("Reset camera")) {
+      cameraPosition = glm::vec2(0.0f);
+      cameraZoom = 1.0f;
+      sceneAngle = 0.0f;
+    }
+    ImGui::Text("%u uniform blocks this frame, %.1f KiB written in total",
+                uniforms.GetFrameUsage(),
+                uniforms.GetBytesWritten() / 1024.0);
+  }
+
+  ImGui::SeparatorText("Sprites");
+  {
+    int count = static_cast<int>(spriteCount);
+    ImGui::SliderInt("Sprites", &count, 0, SPRITE_MAX_QUADS, "%d",
+                     ImGuiSliderFlags_Logarithmic);
+    spriteCount = static_cast<uint32_t>(std::max(count, 0));
+    // Last frame's, this frame's haven't been prepared yet
+    ImGui::Text("%u quads in %u draws", sprites.GetQuadCount(),
+                sprites.GetDrawCount());
+  }
+
+  ImGui::SeparatorText("Pipelines");
+  {
+    // Switching is instant, see SelectScenePipeline
+    if (ImGui::Checkbox("Additive blending", &additiveBlending)) {
+      SelectScenePipeline();
+    }
+
+    PipelineRegistryStats pipelineStats = pipelines.GetStats();
+    ImGui::Text("%u pipelines, %u compiling, %u failed",
+                pipelineStats.pipelines, pipelineStats.pending,
+                pipelineStats.failed);
+    ImGui::Text("%llu requests, %llu deduplicated",
+                (unsigned long long)pipelineStats.requests,
+                (unsigned long long)pipelineStats.deduplicated);
+
+    // Edit a file in demo/shaders and save it to see these move
+    ShaderStats shaderStats = shaders.GetStats();
+    ImGui::Text("Shaders: %u compiled, %u cached, %u failed",
+                shaderStats.compiles, shaderStats.cacheHits,
+                shaderStats.failures);
+    ImGui::Text("%u compiling, last took %.0f ms, %llu reloads",
+                shaderStats.pending, shaderStats.lastCompileMs,
+                (unsigned long long)pipelineStats.reloads);
+  }
+
+  ImGui::SeparatorText("Resolution");
+  {
+    RenderResolution &resolution = config.resolution;
+
+    bool dynamic = resolution.targetGpuMs > 0.0;
+    if (ImGui::Checkbox("Dynamic resolution", &dynamic)) {
+      // A 60 Hz frame to start with
+      resolution.targetGpuMs = dynamic ? 1000.0 / 60.0 : 0.0;
+    }
+    if (dynamic) {
+      float target = static_cast<float>(resolution.targetGpuMs);
+      if (ImGui::DragFloat("GPU target (ms)", &target, 0.1f, 0.5f, 100.0f,
+                           "%.1f")) {
+        resolution.targetGpuMs = std::max(target, 0.5f);
+      }
+      ImGui::SliderFloat("Minimum scale", &resolution.minScale,
+                         RENDER_SCALE_STEP, 1.0f, "%.2f");
+      ImGui::Text("GPU: %.2f ms scene, %.2f ms frame", sceneGpuMs,
+                  frameGpuMs);
+    } else {
+      ImGui::SliderFloat("Render scale", &resolution.scale, RENDER_SCALE_STEP,
+                         1.0f, "%.2f");
+    }
+    ImGui::Text("%ux%u (%.0f%%) of %ux%u", renderExtent.width,
+                renderExtent.height, renderScale * 100.0f,
+                swapchainExtent.width, swapchainExtent.height);
+    if (!blitSupported || !swapchainTransferDst) {
+      ImGui::Text("The swapchain can't be blitted to, scaling is off");
+    }
+
+    // Only the counts the device has
+    const char *sampleNames[7];
+    VkSampleCountFlagBits sampleCounts[7];
+    int sampleOptions = 0;
+    int selected = 0;
+    for (uint32_t count = 1; count <= 64; count *= 2) {
+      if (count == 1 || (supportedSamples & count)) {
+        static const char *names[] = {"Off", "2x",  "4x", "8x",
+                                      "16x", "32x", "64x"};
+        if (count == pendingSamples) {
+          selected = sampleOptions;
+        }
+        sampleNames[sampleOptions] = names[std::countr_zero(count)];
+        sampleCounts[sampleOptions] = static_cast<VkSampleCountFlagBits>(count);
+        sampleOptions++;
+      }
+    }
+    if (ImGui::Combo("MSAA", &selected, sampleNames, sampleOptions)) {
+      SetSampleCount(sampleCounts[selected]);
+    }
+    if (pendingSamples != activeSamples) {
+      ImGui::Text("Compiling for %ux, drawing with %ux",
+                  static_cast<uint32_t>(pendingSamples),
+                  static_cast<uint32_t>(activeSamples));
+    }
+  }
+
+  ImGui::SeparatorText("Textures");
+  {
+    TextureStats textureStats = textures.GetStats();
+    ImGui::Text("%u textures, %u fully resident", textureStats.textures,
+                textureStats.fullyResident);
+    ImGui::Text("Resident: %.1f / %.1f MiB (%.1f MiB wanted)",
+                textureStats.residentBytes / (1024.0 * 1024.0),
+                textureStats.budgetBytes / (1024.0 * 1024.0),
+                textureStats.wantedBytes / (1024.0 * 1024.0));
+    ImGui::Text("%llu mips streamed (%.1f MiB), %llu evicted",
+                (unsigned long long)textureStats.mipsStreamed,
+                textureStats.bytesStreamed / (1024.0 * 1024.0),
+                (unsigned long long)textureStats.mipsEvicted);
+
+    int budgetMiB = static_cast<int>(config.textureBudgetMiB);
+    if (ImGui::SliderInt("Budget (MiB)", &budgetMiB, 1, 2048)) {
+      config.textureBudgetMiB = static_cast<uint32_t>(budgetMiB);
+      textures.SetBudget(VkDeviceSize(budgetMiB) * 1024 * 1024);
+    }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingBuffer, stagingBufferMemory);
+    // Both are push constants, switching them never touches a descriptor
+    ImGui::SliderInt("Scene texture", &sceneTexture, -1,
+                     static_cast<int>(textureHandles.size()) - 1);
+    ImGui::SliderInt("Scene material", &sceneMaterial, 0,
+                     static_cast<int>(std::size(SCENE_MATERIALS)) - 1);
 
-    // Copy the vertex data to the staging buffer
-    void *data;
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, vertices, (size_t)bufferSize);
-    vkUnmapMemory(device, stagingBufferMemory);
+    BindlessStats bindlessStats = bindless.GetStats();
+    ImGui::Text("Heap: %u / %u textures, %u / %u buffers, %llu writes",
+                bindlessStats.textures, bindlessStats.textureCapacity,
+                bindlessStats.buffers, bindlessStats.bufferCapacity,
+                (unsigned long long)bindlessStats.writes);
+  }
+
+  // Last frame's, this one's graph is built after the UI
+  ImGui::SeparatorText("Render graph");
+  {
+    RenderGraphStats graphStats = graph.GetStats();
+    ImGui::Text("Passes: %u (%u culled)", graphStats.passes,
+                graphStats.culledPasses);
+    ImGui::Text("Barriers: %u (%u image barriers)", graphStats.barriers,
+                graphStats.imageBarriers);
+    ImGui::Text("Transients: %u (%u lazy), %.1f / %.1f MiB aliased",
+                graphStats.transientImages, graphStats.lazyImages,
+                graphStats.aliasedBytes / (1024.0 * 1024.0),
+                graphStats.transientBytes / (1024.0 * 1024.0));
+    ImGui::Text("Cached: %u render passes, %u framebuffers",
+                graphStats.renderPasses, graphStats.framebuffers);
+  }
+
+  ImGui::SeparatorText("Memory");
+  {
+    AllocatorStats memoryStats = allocator.GetStats();
+    ImGui::Text("Blocks: %u (limit %u)", memoryStats.total.blockCount,
+                memoryStats.maxMemoryAllocationCount);
+    ImGui::Text("Allocations: %u", memoryStats.total.allocationCount);
+    ImGui::Text("Used: %.2f / %.2f MiB",
+                memoryStats.total.usedBytes / (1024.0 * 1024.0),
+                memoryStats.total.reservedBytes / (1024.0 * 1024.0));
+    ImGui::Text("Staging: %.1f / %.1f KiB",
+                stagingRing.GetFrameUsage() / 1024.0,
+                stagingRing.GetFrameCapacity() / 1024.0);
+
+    UploadStats uploadStats = uploadEngine.GetStats();
+    ImGui::Text("Streamed: %.2f MiB in %llu batches (%u in flight)",
+                uploadStats.bytesUploaded / (1024.0 * 1024.0),
+                (unsigned long long)uploadStats.batchesSubmitted,
+                uploadStats.batchesInFlight);
+  }
+
+  ImGui::SeparatorText("Host memory");
+  {
+    ImGui::Text("Heap allocations: %llu last frame, %llu in total",
+                (unsigned long long)frameHeapAllocations,
+                (unsigned long long)lastHeapAllocationCount);
+
+    const ScratchArena &arena = frameArenas[currentFrame];
+    ImGui::Text("Scratch: %.1f / %.1f KiB (peak %.1f KiB)",
+                arena.GetUsed() / 1024.0, arena.GetCapacity() / 1024.0,
+                arena.GetHighWater() / 1024.0);
+
+    HostAllocatorStats hostStats = hostAllocator.GetStats();
+    ImGui::Text("Vulkan: %llu live allocations, %.1f KiB (peak %.1f KiB)",
+                (unsigned long long)hostStats.liveAllocations,
+                hostStats.liveBytes / 1024.0, hostStats.peakBytes / 1024.0);
+    ImGui::Text("Vulkan pools: %.1f KiB, %llu allocations past them",
+                hostStats.pooledBytes / 1024.0,
+                (unsigned long long)hostStats.heapAllocations);
+  }
+
+  ImGui::SeparatorText("Recording");
+  {
+    // One at a time, copying them all would allocate every frame
+    uint32_t threadCount = recorder.GetThreadCount();
+    for (uint32_t i = 0; i < threadCount; i++) {
+      ImGui::Text("%s %u: %.3f ms", i + 1 == threadCount ? "Main" : "Worker",
+                  i, recorder.GetThreadStats(i).lastFrameMs);
+    }
+  }
 
-    // Copy the data from the staging buffer to the vertex buffer
-    CopyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+  ImGui::SeparatorText("Frame pacing");
+  {
+    ImGui::Text("%u frames in flight, %zu swapchain images", framesInFlight,
+                swapchainImages.size());
+
+    // Changing mode means a new swapchain, which happens after this frame
+    // has been presented
+    const char *presentModes[] = {"Immediate", "Mailbox", "FIFO",
+                                  "FIFO relaxed"};
+    int mode = static_cast<int>(presentMode);
+    if (ImGui::Combo("Present mode", &mode, presentModes,
+                     sizeof(presentModes) / sizeof(presentModes[0]))) {
+      config.pacing.presentMode = static_cast<VkPresentModeKHR>(mode);
+      framebufferResized = true;
+    }
+
+    float limit = static_cast<float>(config.pacing.frameRateLimit);
+    if (ImGui::DragFloat("FPS limit", &limit, 1.0f, 0.0f, 1000.0f,
+                         limit > 0.0f ? "%.0f" : "Off")) {
+      config.pacing.frameRateLimit = std::max(limit, 0.0f);
+    }
+    ImGui::Checkbox("Late latch", &config.pacing.lateLatch);
+
+    ImGui::Checkbox("On demand", &config.pacing.onDemand);
+    float idleLimit = static_cast<float>(config.pacing.idleFrameRate);
+    if (ImGui::DragFloat("Idle FPS limit", &idleLimit, 0.5f, 1.0f, 240.0f,
+                         "%.0f")) {
+      config.pacing.idleFrameRate = std::max(idleLimit, 1.0f);
+    }
+    ImGui::Text("%llu frames drawn, %.1f s idle",
+                (unsigned long long)framesDrawn, idleSeconds);
+  }
+
+  ImGui::SeparatorText("Startup");
+  {
+    ImGui::Text("Initialised in %.1f ms, first frame after %.1f ms",
+                startup.GetTotalMs(), firstFrameMs);
+    for (const InitPhase &phase : startup.GetPhases()) {
+      ImGui::Text("%s: %.1f ms at %.1f ms", phase.name.c_str(),
+                  phase.durationMs, phase.startMs);
+    }
+  }
 
-    // Clean up the staging buffer
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+  ImGui::SeparatorText("Profiler");
+  {
+    profiler.DrawImGui();
+    if (ImGui::Button("Export trace")) {
+      profiler.ExportChromeTrace("trace.json");
+    }
   }
 
   ImGui::End();
 
   ImGui::Render();
-  ImDrawData *drawData = ImGui::GetDrawData();
-  ImGui_ImplVulkan_RenderDrawData(drawData, commandBuffer);
+}
 
-  vkCmdEndRenderPass(commandBuffer);
+void App::UpdateUniforms() {
+  float time = std::chrono::duration<float>(
+                   std::chrono::high_resolution_clock::now() - startTime)
+                   .count();
+  frameDeltaTime = time - lastUniformTime;
+  lastUniformTime = time;
 
-  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-    throw std::runtime_error("Failed to record command buffer");
+  if (animateScene) {
+    sceneAngle =
+        std::fmod(sceneAngle + frameDeltaTime * 0.5f, glm::two_pi<float>());
   }
+
+  FrameUniforms frame;
+  frame.viewProjection = GetViewProjection();
+  frame.time = time;
+  frame.deltaTime = frameDeltaTime;
+  sceneUniforms = uniforms.Push(frame);
+
+  // Sprites are placed in clip space already
+  frame.viewProjection = glm::mat4(1.0f);
+  overlayUniforms = uniforms.Push(frame);
+}
+
+glm::mat4 App::GetViewProjection() const {
+  return glm::translate(
+      glm::scale(glm::mat4(1.0f), glm::vec3(cameraZoom, cameraZoom, 1.0f)),
+      glm::vec3(-cameraPosition, 0.0f));
 }
 
-uint32_t App::FindMemoryType(uint32_t typeFilter,
-                             VkMemoryPropertyFlags properties) {
-  VkPhysicalDeviceMemoryProperties memProperties;
-  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+glm::mat4 App::GetSceneTransform() const {
+  if (sceneAngle == 0.0f) {
+    return glm::mat4(1.0f);
+  }
+
+  // Clip space is stretched to the window, so the rotation is done in a
+  // space with square units to keep the scene from shearing as it turns
+  float aspect = static_cast<float>(swapchainExtent.width) /
+                 static_cast<float>(std::max(swapchainExtent.height, 1u));
+  return glm::scale(glm::mat4(1.0f), glm::vec3(1.0f / aspect, 1.0f, 1.0f)) *
+         glm::rotate(glm::mat4(1.0f), sceneAngle, glm::vec3(0.0f, 0.0f, 1.0f)) *
+         glm::scale(glm::mat4(1.0f), glm::vec3(aspect, 1.0f, 1.0f));
+}
 
-  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-    if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags &
-                                    properties) == properties) {
-      // The memory type is suitable for the buffer (it's in the type filter and
-      // has the required properties)
-      // We aren't concerned with the index of the memory type, just that it
-      // exists, we could check for whether it's the best memory type for the
-      // buffer, but we're not doing that here
-      return i;
+void App::SubmitSprites() {
+  if (spriteCount == 0) {
+    return;
+  }
+
+  float time = std::chrono::duration<float>(
+                   std::chrono::high_resolution_clock::now() - startTime)
+                   .count();
+
+  // The same grid as the instances, with each sprite a bit smaller than its
+  // cell and each column bobbing up and down out of step with the last
+  uint32_t columns = static_cast<uint32_t>(
+      std::ceil(std::sqrt(static_cast<float>(spriteCount))));
+  uint32_t rows = (spriteCount + columns - 1) / columns;
+  float cellWidth = 2.0f / columns;
+  float cellHeight = 2.0f / rows;
+  glm::vec2 halfSize = {cellWidth * 0.3f, cellHeight * 0.3f};
+
+  SpriteQuad quad = {};
+  quad.pipeline = framePipeline;
+
+  for (uint32_t i = 0; i < spriteCount; i++) {
+    uint32_t column = i % columns;
+    uint32_t row = i / columns;
+
+    glm::vec2 centre = {
+        -1.0f + (column + 0.5f) * cellWidth,
+        -1.0f + (row + 0.5f) * cellHeight +
+            std::sin(time * 2.0f + column * 0.2f) * cellHeight * 0.2f};
+
+    quad.min = centre - halfSize;
+    quad.max = centre + halfSize;
+    quad.colour = {1.0f - static_cast<float>(column) / columns,
+                   static_cast<float>(row) / rows, 0.5f};
+
+    if (!sprites.Submit(quad)) {
+      break;
     }
   }
+}
 
-  throw std::runtime_error("Failed to find suitable memory type");
+void App::RecordScene(VkCommandBuffer commandBuffer, uint32_t firstInstance,
+                      uint32_t count) {
+  // Secondary command buffers start with no state at all, not even what was
+  // bound in the primary
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                    framePipeline);
+
+  // One bind for the whole chunk, whatever it draws is picked by index
+  bindless.Bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                pipelineLayout);
+  uniforms.Bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+                1, sceneUniforms);
+
+  DrawConstants constants;
+  constants.materials = materialBufferSlot;
+  constants.material = static_cast<uint32_t>(sceneMaterial);
+  constants.texture = GetTextureSlot(sceneTexture);
+  VkPushConstantRange range = BindlessHeap::GetPushConstantRange();
+  vkCmdPushConstants(commandBuffer, pipelineLayout, range.stageFlags, 0,
+                     sizeof(constants), &constants);
+
+  // The scene is a single object, so every draw shares its transform
+  ObjectConstants object;
+  object.model = GetSceneTransform();
+  VkPushConstantRange objectRange = GetObjectPushConstantRange();
+  vkCmdPushConstants(commandBuffer, pipelineLayout, objectRange.stageFlags,
+                     objectRange.offset, sizeof(object), &object);
+
+  // New viewport and scissor
+  VkViewport viewport = {};
+  viewport.x = 0.0f;
+  viewport.y = 0.0f;
+  viewport.width = static_cast<float>(renderExtent.width);
+  viewport.height = static_cast<float>(renderExtent.height);
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+  VkRect2D scissor = {};
+  scissor.offset = {0, 0};
+  scissor.extent = renderExtent;
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+  // Bind the vertex buffer (binding 0) and the instance buffer (binding 1).
+  // Culled draws read the instances the culling pass kept instead, and
+  // animated entities this frame's extraction.
+  VkBuffer vertexBuffers[] = {vertexBuffer, instanceBuffer};
+  VkDeviceSize offsets[] = {0, 0};
+  if (drawMode == DrawMode::GpuCulled) {
+    vertexBuffers[1] = visibleInstanceBuffer;
+  } else if (entitiesExtracted) {
+    vertexBuffers[1] = entityInstanceBuffer;
+    offsets[1] = entityInstanceOffset;
+  }
+  vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+
+  // Bind the index buffer, 16 or 32 bit depending on the mesh
+  vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, sceneIndices.type);
+
+  uint32_t indexCount = sceneIndices.count;
+
+  switch (drawMode) {
+  case DrawMode::Indirect:
+    if (drawIndirectCountSupported) {
+      // Both the commands and how many of them there are come from GPU memory
+      vkCmdDrawIndexedIndirectCount(
+          commandBuffer, indirectBuffer, 0, drawCountBuffer, 0,
+          MAX_INDIRECT_DRAWS, sizeof(VkDrawIndexedIndirectCommand));
+    } else {
+      // The commands come from GPU memory but the count has to be known here
+      vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, 0, 1,
+                               sizeof(VkDrawIndexedIndirectCommand));
+    }
+    break;
+  case DrawMode::Instanced:
+    // Draw every instance directly, the CPU decides how many
+    vkCmdDrawIndexed(commandBuffer, indexCount, count, 0, 0, firstInstance);
+    break;
+  case DrawMode::PerInstance:
+    for (uint32_t i = firstInstance; i < firstInstance + count; i++) {
+      vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, i);
+    }
+    break;
+  case DrawMode::GpuCulled:
+    // Written by the culling pass this frame, the count is 0 when nothing
+    // survived. Without the count the command still draws nothing then, as
+    // its instance count is 0.
+    if (drawIndirectCountSupported) {
+      vkCmdDrawIndexedIndirectCount(commandBuffer, culledIndirectBuffer, 0,
+                                    culledDrawCountBuffer, 0, 1,
+                                    sizeof(VkDrawIndexedIndirectCommand));
+    } else {
+      vkCmdDrawIndexedIndirect(commandBuffer, culledIndirectBuffer, 0, 1,
+                               sizeof(VkDrawIndexedIndirectCommand));
+    }
+    break;
+  }
 }
 
 void App::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
                        VkMemoryPropertyFlags properties, VkBuffer &buffer,
-                       VkDeviceMemory &bufferMemory) {
+                       Allocation &bufferAllocation,
+                       AllocationStrategy strategy) {
   VkBufferCreateInfo bufferInfo = {};
   bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
   bufferInfo.size = size;
   bufferInfo.usage = usage;
   bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-  if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+  // Buffers filled by the upload engine are written on the transfer queue and
+  // read on the graphics queue, concurrent sharing saves us from having to
+  // transfer queue family ownership for every upload
+  uint32_t sharedFamilies[] = {queueFamilies.graphicsFamily.value(),
+                               queueFamilies.transferFamily.value()};
+  if ((usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT) &&
+      sharedFamilies[0] != sharedFamilies[1]) {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount = 2;
+    bufferInfo.pQueueFamilyIndices = sharedFamilies;
+  }
+
+  if (vkCreateBuffer(device, &bufferInfo, hostCallbacks, &buffer) !=
+      VK_SUCCESS) {
     throw std::runtime_error("Failed to create buffer");
   }
 
   VkMemoryRequirements memRequirements;
   vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-  VkMemoryAllocateInfo allocInfo = {};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex =
-      FindMemoryType(memRequirements.memoryTypeBits, properties);
-
-  if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) !=
-      VK_SUCCESS) {
-    throw std::runtime_error("Failed to allocate buffer memory");
-  }
+  // The allocator hands out a range of a larger block, rather than a whole
+  // VkDeviceMemory per buffer
+  bufferAllocation = allocator.Allocate(memRequirements, properties,
+                                        ResourceKind::Linear, strategy);
 
-  vkBindBufferMemory(device, buffer, bufferMemory, 0);
+  vkBindBufferMemory(device, buffer, bufferAllocation.memory,
+                     bufferAllocation.offset);
 }
 
-// NOTE: This function is blocking
-void App::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer,
-                     VkDeviceSize size) {
-
-  // We need a command buffer to copy the buffer, as this operation
-  // uses memory not accessible by the host, so the operation needs
-  // to happen on the GPU
-  VkCommandBufferAllocateInfo allocInfo = {};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandPool = commandPool;
-  allocInfo.commandBufferCount = 1;
-
-  VkCommandBuffer commandBuffer;
-  vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-
-  VkCommandBufferBeginInfo beginInfo = {};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-  vkBeginCommandBuffer(commandBuffer, &beginInfo); // Start recording
-
-  VkBufferCopy copyRegion = {};
-  copyRegion.size = size;
-  vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+void App::DestroyBuffer(VkBuffer &buffer, Allocation &bufferAllocation) {
+  // Any of them may have been imported into the graph
+  graph.ReleaseBuffer(buffer);
+  vkDestroyBuffer(device, buffer, hostCallbacks);
+  allocator.Free(bufferAllocation);
 
-  vkEndCommandBuffer(commandBuffer); // Finish recording
-
-  // Make the GPU do the work! (submit the command buffer)
-  VkSubmitInfo submitInfo = {};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &commandBuffer;
-
-  vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-  vkQueueWaitIdle(graphicsQueue); // Wait for the queue to finish
-
-  // don't leave your house messy
-  vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+  buffer = VK_NULL_HANDLE;
 }
+
 } // namespace MiniEngine
@@ -0,0 +1,254 @@
+#include <miniengine/bindless.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace MiniEngine {
+
+void BindlessHeap::Init(VkPhysicalDevice physicalDevice, VkDevice device,
+                        uint32_t frameCount,
+                        const VkAllocationCallbacks *hostCallbacks) {
+  SPDLOG_TRACE("BindlessHeap::Init({})", frameCount);
+
+  this->device = device;
+  this->hostCallbacks = hostCallbacks;
+
+  // Update after bind descriptors have limits of their own, which can be
+  // lower than BINDLESS_MAX_* on some devices
+  VkPhysicalDeviceVulkan12Properties vulkan12Properties = {};
+  vulkan12Properties.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_12_PROPERTIES;
+  VkPhysicalDeviceProperties2 properties = {};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties.pNext = &vulkan12Properties;
+  vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+  textureCapacity = std::min(
+      {BINDLESS_MAX_TEXTURES,
+       vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+       vulkan12Properties.maxDescriptorSetUpdateAfterBindSampledImages});
+  bufferCapacity = std::min(
+      {BINDLESS_MAX_BUFFERS,
+       vulkan12Properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+       vulkan12Properties.maxDescriptorSetUpdateAfterBindStorageBuffers});
+
+  VkDescriptorSetLayoutBinding bindings[2] = {};
+  bindings[0].binding = BINDLESS_TEXTURE_BINDING;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[0].descriptorCount = textureCapacity;
+  bindings[0].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS |
+                           VK_SHADER_STAGE_COMPUTE_BIT;
+  bindings[1].binding = BINDLESS_BUFFER_BINDING;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  bindings[1].descriptorCount = bufferCapacity;
+  bindings[1].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS |
+                           VK_SHADER_STAGE_COMPUTE_BIT;
+
+  // Slots nothing has been put in yet are fine as long as no shader reads
+  // them, and slots can be rewritten while the set is bound
+  VkDescriptorBindingFlags bindingFlags[2] = {};
+  for (VkDescriptorBindingFlags &flags : bindingFlags) {
+    flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
+  }
+
+  VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {};
+  bindingFlagsInfo.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+  bindingFlagsInfo.bindingCount = 2;
+  bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.pNext = &bindingFlagsInfo;
+  layoutInfo.flags =
+      VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+  layoutInfo.bindingCount = 2;
+  layoutInfo.pBindings = bindings;
+
+  if (vkCreateDescriptorSetLayout(device, &layoutInfo, hostCallbacks,
+                                  &setLayout) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create bindless descriptor set layout");
+  }
+
+  VkDescriptorPoolSize poolSizes[2] = {};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[0].descriptorCount = textureCapacity * frameCount;
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[1].descriptorCount = bufferCapacity * frameCount;
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+  poolInfo.maxSets = frameCount;
+  poolInfo.poolSizeCount = 2;
+  poolInfo.pPoolSizes = poolSizes;
+
+  if (vkCreateDescriptorPool(device, &poolInfo, hostCallbacks,
+                             &descriptorPool) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create bindless descriptor pool");
+  }
+
+  std::vector<VkDescriptorSetLayout> layouts(frameCount, setLayout);
+  sets.resize(frameCount);
+
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = frameCount;
+  allocInfo.pSetLayouts = layouts.data();
+
+  if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate bindless descriptor sets");
+  }
+
+  spdlog::info("Bindless heap: {} textures, {} buffers", textureCapacity,
+               bufferCapacity);
+}
+
+void BindlessHeap::Destroy() {
+  if (device == VK_NULL_HANDLE) {
+    return;
+  }
+
+  SPDLOG_TRACE("BindlessHeap::Destroy()");
+
+  // Frees the sets with it
+  vkDestroyDescriptorPool(device, descriptorPool, hostCallbacks);
+  vkDestroyDescriptorSetLayout(device, setLayout, hostCallbacks);
+  sets.clear();
+  pending.clear();
+
+  device = VK_NULL_HANDLE;
+}
+
+VkPushConstantRange BindlessHeap::GetPushConstantRange() {
+  VkPushConstantRange range = {};
+  range.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  range.offset = 0;
+  range.size = sizeof(DrawConstants);
+  return range;
+}
+
+uint32_t BindlessHeap::AddTexture(VkImageView view, VkSampler sampler) {
+  if (textureCount >= textureCapacity) {
+    spdlog::warn("Bindless heap is out of texture slots");
+    return BINDLESS_NONE;
+  }
+
+  uint32_t index = textureCount++;
+  SetTexture(index, view, sampler);
+  return index;
+}
+
+uint32_t BindlessHeap::AddBuffer(VkBuffer buffer, VkDeviceSize offset,
+                                 VkDeviceSize range) {
+  if (bufferCount >= bufferCapacity) {
+    spdlog::warn("Bindless heap is out of buffer slots");
+    return BINDLESS_NONE;
+  }
+
+  PendingWrite write = {};
+  write.binding = BINDLESS_BUFFER_BINDING;
+  write.index = bufferCount++;
+  write.buffer.buffer = buffer;
+  write.buffer.offset = offset;
+  write.buffer.range = range;
+  Write(write);
+  return write.index;
+}
+
+void BindlessHeap::SetTexture(uint32_t index, VkImageView view,
+                              VkSampler sampler) {
+  PendingWrite write = {};
+  write.binding = BINDLESS_TEXTURE_BINDING;
+  write.index = index;
+  write.image.sampler = sampler;
+  write.image.imageView = view;
+  write.image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  Write(write);
+}
+
+void BindlessHeap::Write(const PendingWrite &write) {
+  pending.push_back(write);
+  pending.back().setsLeft = (1u << sets.size()) - 1;
+
+  // Before the first frame nothing is in flight, afterwards only the set
+  // being recorded is safe to touch
+  if (!started) {
+    for (uint32_t set = 0; set < sets.size(); set++) {
+      Flush(set);
+    }
+  } else {
+    Flush(currentSet);
+  }
+}
+
+void BindlessHeap::BeginFrame(uint32_t frameIndex) {
+  currentSet = frameIndex;
+  started = true;
+  Flush(currentSet);
+}
+
+void BindlessHeap::Flush(uint32_t set) {
+  uint32_t bit = 1u << set;
+
+  writes.clear();
+  for (PendingWrite &write : pending) {
+    if (!(write.setsLeft & bit)) {
+      continue;
+    }
+
+    VkWriteDescriptorSet descriptorWrite = {};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = sets[set];
+    descriptorWrite.dstBinding = write.binding;
+    descriptorWrite.dstArrayElement = write.index;
+    descriptorWrite.descriptorCount = 1;
+    if (write.binding == BINDLESS_TEXTURE_BINDING) {
+      descriptorWrite.descriptorType =
+          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      descriptorWrite.pImageInfo = &write.image;
+    } else {
+      descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      descriptorWrite.pBufferInfo = &write.buffer;
+    }
+    writes.push_back(descriptorWrite);
+
+    write.setsLeft &= ~bit;
+  }
+
+  if (writes.empty()) {
+    return;
+  }
+
+  // In order, so a slot written twice ends up with the later one
+  vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()),
+                         writes.data(), 0, nullptr);
+  writeCount += writes.size();
+
+  std::erase_if(pending,
+                [](const PendingWrite &write) { return write.setsLeft == 0; });
+}
+
+void BindlessHeap::Bind(VkCommandBuffer commandBuffer,
+                        VkPipelineBindPoint bindPoint,
+                        VkPipelineLayout layout) const {
+  vkCmdBindDescriptorSets(commandBuffer, bindPoint, layout, 0, 1,
+                          &sets[currentSet], 0, nullptr);
+}
+
+BindlessStats BindlessHeap::GetStats() const {
+  BindlessStats stats;
+  stats.textures = textureCount;
+  stats.textureCapacity = textureCapacity;
+  stats.buffers = bufferCount;
+  stats.bufferCapacity = bufferCapacity;
+  stats.writes = writeCount;
+  return stats;
+}
+
+} // namespace MiniEngine
@@ -0,0 +1,229 @@
+#include <miniengine/culling.h>
+
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <stdexcept>
+
+namespace MiniEngine {
+
+// Bindings of cull.glsl, in order
+constexpr uint32_t CULL_BINDING_COUNT = 5;
+
+void GpuCuller::Init(VkDevice device, PipelineRegistry &pipelines,
+                     PipelineCache &cache, const std::string &shaderPath,
+                     const VkAllocationCallbacks *hostCallbacks) {
+  SPDLOG_TRACE("GpuCuller::Init({})", shaderPath);
+
+  this->device = device;
+  this->hostCallbacks = hostCallbacks;
+
+  // Every binding is a storage buffer only the compute stage sees
+  VkDescriptorSetLayoutBinding bindings[CULL_BINDING_COUNT] = {};
+  for (uint32_t i = 0; i < CULL_BINDING_COUNT; i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = CULL_BINDING_COUNT;
+  layoutInfo.pBindings = bindings;
+
+  if (vkCreateDescriptorSetLayout(device, &layoutInfo, hostCallbacks,
+                                  &setLayout) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create culling descriptor set layout");
+  }
+
+  // One set, it is only rewritten while nothing is in flight
+  VkDescriptorPoolSize poolSize = {};
+  poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSize.descriptorCount = CULL_BINDING_COUNT;
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+
+  if (vkCreateDescriptorPool(device, &poolInfo, hostCallbacks,
+                             &descriptorPool) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create culling descriptor pool");
+  }
+
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &setLayout;
+
+  if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate culling descriptor set");
+  }
+
+  // The frustum changes every frame and is small, so it goes in push
+  // constants rather than a buffer
+  VkPushConstantRange pushConstantRange = {};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(CullParams);
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &setLayout;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+  if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, hostCallbacks,
+                             &pipelineLayout) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create culling pipeline layout");
+  }
+
+  VkShaderModule shaderModule = pipelines.CreateShaderModule(shaderPath);
+
+  VkComputePipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = shaderModule;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = pipelineLayout;
+
+  // Compute pipelines go through the same on-disk cache as graphics ones.
+  // This runs during start up, before the registry compiles anything in the
+  // background, so the build time doesn't need the registry's lock.
+  auto start = std::chrono::high_resolution_clock::now();
+  VkResult result = vkCreateComputePipelines(
+      device, cache.GetHandle(), 1, &pipelineInfo, hostCallbacks, &pipeline);
+  cache.AddBuildTime(std::chrono::duration<double, std::milli>(
+                         std::chrono::high_resolution_clock::now() - start)
+                         .count());
+
+  vkDestroyShaderModule(device, shaderModule, hostCallbacks);
+
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create culling pipeline");
+  }
+}
+
+void GpuCuller::Destroy() {
+  if (device == VK_NULL_HANDLE) {
+    return;
+  }
+
+  SPDLOG_TRACE("GpuCuller::Destroy()");
+
+  vkDestroyPipeline(device, pipeline, hostCallbacks);
+  vkDestroyPipelineLayout(device, pipelineLayout, hostCallbacks);
+  // Frees the set along with it
+  vkDestroyDescriptorPool(device, descriptorPool, hostCallbacks);
+  vkDestroyDescriptorSetLayout(device, setLayout, hostCallbacks);
+
+  device = VK_NULL_HANDLE;
+}
+
+void GpuCuller::SetBuffers(const CullBuffers &buffers) {
+  SPDLOG_TRACE("GpuCuller::SetBuffers()");
+
+  commands = buffers.commands;
+  drawCount = buffers.drawCount;
+
+  // Same order as the bindings
+  VkBuffer targets[CULL_BINDING_COUNT] = {
+      buffers.instances, buffers.bounds, buffers.visibleInstances,
+      buffers.commands, buffers.drawCount};
+
+  VkDescriptorBufferInfo bufferInfos[CULL_BINDING_COUNT] = {};
+  VkWriteDescriptorSet writes[CULL_BINDING_COUNT] = {};
+  for (uint32_t i = 0; i < CULL_BINDING_COUNT; i++) {
+    bufferInfos[i].buffer = targets[i];
+    bufferInfos[i].offset = 0;
+    bufferInfos[i].range = VK_WHOLE_SIZE;
+
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].dstSet = descriptorSet;
+    writes[i].dstBinding = i;
+    writes[i].descriptorCount = 1;
+    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[i].pBufferInfo = &bufferInfos[i];
+  }
+
+  vkUpdateDescriptorSets(device, CULL_BINDING_COUNT, writes, 0, nullptr);
+}
+
+void GpuCuller::Record(VkCommandBuffer commandBuffer,
+                       const glm::mat4 &viewProjection, uint32_t instanceCount,
+                       uint32_t indexCount) {
+  // The shader counts the instances up from 0, and sets the draw count once
+  // anything is visible so an empty frame doesn't draw at all
+  VkDrawIndexedIndirectCommand command = {};
+  command.indexCount = indexCount;
+  command.instanceCount = 0;
+  command.firstIndex = 0;
+  command.vertexOffset = 0;
+  command.firstInstance = 0;
+
+  uint32_t zero = 0;
+
+  vkCmdUpdateBuffer(commandBuffer, commands, 0, sizeof(command), &command);
+  vkCmdUpdateBuffer(commandBuffer, drawCount, 0, sizeof(zero), &zero);
+
+  VkMemoryBarrier resetBarrier = {};
+  resetBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  resetBarrier.dstAccessMask =
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                       &resetBarrier, 0, nullptr, 0, nullptr);
+
+  CullParams params = {};
+  ExtractFrustumPlanes(viewProjection, params.planes);
+  params.instanceCount = instanceCount;
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+  vkCmdPushConstants(commandBuffer, pipelineLayout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+
+  // One invocation per instance, the shader skips the spare ones in the last
+  // workgroup
+  uint32_t groupCount =
+      (instanceCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE;
+  if (groupCount > 0) {
+    vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+  }
+
+}
+
+void GpuCuller::ExtractFrustumPlanes(const glm::mat4 &viewProjection,
+                                     glm::vec4 planes[6]) {
+  // glm is column major, so this is a row of the matrix
+  auto row = [&](int i) {
+    return glm::vec4(viewProjection[0][i], viewProjection[1][i],
+                     viewProjection[2][i], viewProjection[3][i]);
+  };
+
+  // A clip space point is inside when -w <= x <= w, -w <= y <= w and
+  // 0 <= z <= w, each of those is a plane
+  planes[0] = row(3) + row(0); // Left
+  planes[1] = row(3) - row(0); // Right
+  planes[2] = row(3) + row(1); // Top (Vulkan's y points down)
+  planes[3] = row(3) - row(1); // Bottom
+  planes[4] = row(2);          // Near
+  planes[5] = row(3) - row(2); // Far
+
+  // Normalised so the distance can be compared against a sphere's radius
+  for (int i = 0; i < 6; i++) {
+    planes[i] /= glm::length(glm::vec3(planes[i]));
+  }
+}
+
+} // namespace MiniEngine
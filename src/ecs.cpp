@@ -0,0 +1,214 @@
+#include <miniengine/ecs.h>
+
+#include <spdlog/spdlog.h>
+
+#include <atomic>
+#include <bit>
+#include <new>
+#include <stdexcept>
+
+namespace MiniEngine {
+
+namespace detail {
+uint32_t NextComponentId() {
+  static std::atomic<uint32_t> next = 0;
+  uint32_t id = next.fetch_add(1, std::memory_order_relaxed);
+  if (id >= ECS_MAX_COMPONENTS) {
+    throw std::runtime_error("Too many component types");
+  }
+  return id;
+}
+} // namespace detail
+
+static size_t AlignUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+World::~World() {
+  for (const std::unique_ptr<Archetype> &archetype : archetypes) {
+    for (Chunk &chunk : archetype->chunks) {
+      ::operator delete(chunk.data, std::align_val_t(ECS_CACHE_LINE));
+    }
+  }
+}
+
+void World::Destroy(Entity entity) {
+  if (!IsAlive(entity)) {
+    return;
+  }
+
+  Record &record = records[entity.index];
+  Unplace(record);
+  record.alive = false;
+  record.generation++;
+  freeIndices.push_back(entity.index);
+  entityCount--;
+}
+
+bool World::IsAlive(const Entity &entity) const {
+  return entity.index < records.size() &&
+         records[entity.index].alive &&
+         records[entity.index].generation == entity.generation;
+}
+
+void World::Clear() {
+  for (uint32_t i = 0; i < records.size(); i++) {
+    if (records[i].alive) {
+      records[i].alive = false;
+      records[i].generation++;
+      freeIndices.push_back(i);
+    }
+  }
+
+  for (const std::unique_ptr<Archetype> &archetype : archetypes) {
+    for (Chunk &chunk : archetype->chunks) {
+      chunk.count = 0;
+    }
+    archetype->count = 0;
+  }
+
+  entityCount = 0;
+}
+
+WorldStats World::GetStats() const {
+  WorldStats stats;
+  stats.entities = entityCount;
+  stats.archetypes = static_cast<uint32_t>(archetypes.size());
+  for (const std::unique_ptr<Archetype> &archetype : archetypes) {
+    stats.chunks += static_cast<uint32_t>(archetype->chunks.size());
+  }
+  return stats;
+}
+
+Entity World::NewEntity() {
+  uint32_t index;
+  if (!freeIndices.empty()) {
+    index = freeIndices.back();
+    freeIndices.pop_back();
+  } else {
+    index = static_cast<uint32_t>(records.size());
+    records.emplace_back();
+  }
+
+  records[index].alive = true;
+  entityCount++;
+  return {index, records[index].generation};
+}
+
+uint32_t World::GetArchetype(ComponentMask mask) {
+  auto found = archetypeIndices.find(mask);
+  if (found != archetypeIndices.end()) {
+    return found->second;
+  }
+
+  auto archetype = std::make_unique<Archetype>();
+  archetype->mask = mask;
+
+  // Every array can lose up to a cache line to alignment, the rest of the
+  // chunk is split between rows
+  size_t rowSize = sizeof(Entity);
+  for (ComponentMask bits = mask; bits; bits &= bits - 1) {
+    rowSize += components[std::countr_zero(bits)].size;
+  }
+  size_t arrays = std::popcount(mask) + 1;
+  archetype->capacity = static_cast<uint32_t>(
+      (ECS_CHUNK_SIZE - arrays * ECS_CACHE_LINE) / rowSize);
+  if (archetype->capacity == 0) {
+    throw std::runtime_error("Components don't fit in a chunk");
+  }
+
+  size_t offset = AlignUp(sizeof(Entity) * archetype->capacity,
+                          ECS_CACHE_LINE);
+  for (ComponentMask bits = mask; bits; bits &= bits - 1) {
+    uint32_t id = std::countr_zero(bits);
+    archetype->offsets[id] = static_cast<uint32_t>(offset);
+    offset = AlignUp(offset + components[id].size * archetype->capacity,
+                     ECS_CACHE_LINE);
+  }
+
+  uint32_t index = static_cast<uint32_t>(archetypes.size());
+  SPDLOG_TRACE("World::GetArchetype({:#x}) = {}, {} per chunk", mask, index,
+               archetype->capacity);
+
+  archetypes.push_back(std::move(archetype));
+  archetypeIndices[mask] = index;
+  return index;
+}
+
+void World::Place(Entity entity, uint32_t archetypeIndex) {
+  Archetype &archetype = *archetypes[archetypeIndex];
+
+  // Chunks past the last used one are kept when emptied, so cleared worlds
+  // refill without allocating
+  uint32_t chunkIndex = archetype.count / archetype.capacity;
+  if (chunkIndex == archetype.chunks.size()) {
+    Chunk chunk;
+    chunk.data = static_cast<std::byte *>(::operator new(
+        ECS_CHUNK_SIZE, std::align_val_t(ECS_CACHE_LINE)));
+    archetype.chunks.push_back(chunk);
+  }
+
+  Chunk &chunk = archetype.chunks[chunkIndex];
+  uint32_t row = chunk.count++;
+  archetype.count++;
+  reinterpret_cast<Entity *>(chunk.data)[row] = entity;
+
+  Record &record = records[entity.index];
+  record.archetype = archetypeIndex;
+  record.chunk = chunkIndex;
+  record.row = row;
+}
+
+void World::Unplace(const Record &record) {
+  Archetype &archetype = *archetypes[record.archetype];
+  uint32_t lastIndex = (archetype.count - 1) / archetype.capacity;
+  Chunk &last = archetype.chunks[lastIndex];
+  uint32_t lastRow = last.count - 1;
+
+  // The last row fills the hole, unless it is the hole
+  if (lastIndex != record.chunk || lastRow != record.row) {
+    Chunk &chunk = archetype.chunks[record.chunk];
+    Entity moved = reinterpret_cast<Entity *>(last.data)[lastRow];
+    reinterpret_cast<Entity *>(chunk.data)[record.row] = moved;
+
+    for (ComponentMask bits = archetype.mask; bits; bits &= bits - 1) {
+      uint32_t id = std::countr_zero(bits);
+      size_t size = components[id].size;
+      memcpy(chunk.data + archetype.offsets[id] + size * record.row,
+             last.data + archetype.offsets[id] + size * lastRow, size);
+    }
+
+    records[moved.index].chunk = record.chunk;
+    records[moved.index].row = record.row;
+  }
+
+  last.count--;
+  archetype.count--;
+}
+
+void World::Move(Entity entity, ComponentMask mask) {
+  Record old = records[entity.index];
+  uint32_t target = GetArchetype(mask);
+  if (target == old.archetype) {
+    return;
+  }
+
+  // GetArchetype may have grown the list, so the references are taken after
+  Place(entity, target);
+  const Record &record = records[entity.index];
+  Archetype &from = *archetypes[old.archetype];
+  Archetype &to = *archetypes[target];
+  Chunk &source = from.chunks[old.chunk];
+  Chunk &destination = to.chunks[record.chunk];
+
+  for (ComponentMask bits = from.mask & to.mask; bits; bits &= bits - 1) {
+    uint32_t id = std::countr_zero(bits);
+    size_t size = components[id].size;
+    memcpy(destination.data + to.offsets[id] + size * record.row,
+           source.data + from.offsets[id] + size * old.row, size);
+  }
+
+  Unplace(old);
+}
+
+} // namespace MiniEngine
@@ -0,0 +1,74 @@
+#include <miniengine/host_memory.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Kept apart from everything else that allocates, so none of the code using
+// new is inlined next to the delete that frees it with free()
+
+static std::atomic<uint64_t> heapAllocationCount = 0;
+
+// The replacements every other form of new and delete forwards to
+void *operator new(size_t size) {
+  heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  if (void *memory = std::malloc(size > 0 ? size : 1)) {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return ::operator new(size); }
+
+void *operator new(size_t size, std::align_val_t alignment) {
+  heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  size_t align = static_cast<size_t>(alignment);
+  // aligned_alloc wants a multiple of the alignment
+  size = (std::max<size_t>(size, 1) + align - 1) & ~(align - 1);
+#ifdef _MSC_VER
+  void *memory = _aligned_malloc(size, align);
+#else
+  void *memory = std::aligned_alloc(align, size);
+#endif
+  if (memory == nullptr) {
+    throw std::bad_alloc();
+  }
+  return memory;
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return ::operator new(size, alignment);
+}
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+void operator delete[](void *memory) noexcept { std::free(memory); }
+void operator delete(void *memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, size_t) noexcept { std::free(memory); }
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+#ifdef _MSC_VER
+  _aligned_free(memory);
+#else
+  std::free(memory);
+#endif
+}
+
+void operator delete[](void *memory, std::align_val_t alignment) noexcept {
+  ::operator delete(memory, alignment);
+}
+void operator delete(void *memory, size_t,
+                     std::align_val_t alignment) noexcept {
+  ::operator delete(memory, alignment);
+}
+void operator delete[](void *memory, size_t,
+                       std::align_val_t alignment) noexcept {
+  ::operator delete(memory, alignment);
+}
+
+namespace MiniEngine {
+
+uint64_t GetHeapAllocationCount() {
+  return heapAllocationCount.load(std::memory_order_relaxed);
+}
+
+} // namespace MiniEngine
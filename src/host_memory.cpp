@@ -0,0 +1,239 @@
+#include <miniengine/host_memory.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace MiniEngine {
+
+// Arena blocks start on a cache line
+constexpr size_t SCRATCH_BLOCK_ALIGNMENT = 64;
+
+ScratchArena::~ScratchArena() { Destroy(); }
+
+void ScratchArena::Init(size_t blockSize) {
+  SPDLOG_TRACE("ScratchArena::Init({})", blockSize);
+
+  this->blockSize = blockSize;
+  blocks.push_back({static_cast<std::byte *>(::operator new(
+                        blockSize, std::align_val_t(SCRATCH_BLOCK_ALIGNMENT))),
+                    blockSize});
+}
+
+void ScratchArena::Destroy() {
+  for (Block &block : blocks) {
+    ::operator delete(block.data, std::align_val_t(SCRATCH_BLOCK_ALIGNMENT));
+  }
+  blocks.clear();
+  current = head = usedBefore = 0;
+}
+
+void *ScratchArena::Allocate(size_t size, size_t alignment) {
+  while (true) {
+    // Aligned by address, alignments past the block's own need it
+    Block &block = blocks[current];
+    uintptr_t start = reinterpret_cast<uintptr_t>(block.data) + head;
+    size_t offset = ((start + alignment - 1) & ~(alignment - 1)) -
+                    reinterpret_cast<uintptr_t>(block.data);
+    if (offset + size <= block.size) {
+      head = offset + size;
+      return block.data + offset;
+    }
+
+    // The rest of this block is wasted until the next Reset
+    usedBefore += head;
+    head = 0;
+    current++;
+    if (current == blocks.size()) {
+      size_t newSize = std::max(blockSize, size + alignment);
+      SPDLOG_DEBUG("Scratch arena grown by {} bytes", newSize);
+      blocks.push_back(
+          {static_cast<std::byte *>(::operator new(
+               newSize, std::align_val_t(SCRATCH_BLOCK_ALIGNMENT))),
+           newSize});
+    }
+  }
+}
+
+void ScratchArena::Reset() {
+  highWater = std::max(highWater, GetUsed());
+  current = head = usedBefore = 0;
+}
+
+size_t ScratchArena::GetUsed() const { return usedBefore + head; }
+
+size_t ScratchArena::GetCapacity() const {
+  size_t capacity = 0;
+  for (const Block &block : blocks) {
+    capacity += block.size;
+  }
+  return capacity;
+}
+
+// The smallest pool's blocks, 1 << POOL_SHIFT bytes
+constexpr uint32_t POOL_SHIFT = 6;
+// Where pools and the heap put the first byte, and the chunks' alignment
+constexpr size_t POOL_ALIGNMENT = 16;
+
+HostAllocator::HostAllocator() {
+  callbacks.pUserData = this;
+  callbacks.pfnAllocation = AllocateCallback;
+  callbacks.pfnReallocation = ReallocateCallback;
+  callbacks.pfnFree = FreeCallback;
+}
+
+HostAllocator::~HostAllocator() {
+  if (stats.liveAllocations > 0) {
+    spdlog::warn("{} Vulkan host allocations ({} bytes) were never freed",
+                 stats.liveAllocations, stats.liveBytes);
+  }
+
+  for (std::byte *chunk : chunks) {
+    ::operator delete(chunk, std::align_val_t(POOL_ALIGNMENT));
+  }
+}
+
+HostAllocatorStats HostAllocator::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+void *VKAPI_CALL HostAllocator::AllocateCallback(
+    void *userData, size_t size, size_t alignment,
+    VkSystemAllocationScope scope) {
+  return static_cast<HostAllocator *>(userData)->Allocate(size, alignment,
+                                                          scope);
+}
+
+void *VKAPI_CALL HostAllocator::ReallocateCallback(
+    void *userData, void *original, size_t size, size_t alignment,
+    VkSystemAllocationScope scope) {
+  HostAllocator &allocator = *static_cast<HostAllocator *>(userData);
+  if (original == nullptr) {
+    return allocator.Allocate(size, alignment, scope);
+  }
+  if (size == 0) {
+    allocator.Free(original);
+    return nullptr;
+  }
+
+  // On failure the original has to be left as it was
+  size_t oldSize = GetHeader(original).size;
+  void *memory = allocator.Allocate(size, alignment, scope);
+  if (memory == nullptr) {
+    return nullptr;
+  }
+  memcpy(memory, original, std::min(oldSize, size));
+  allocator.Free(original);
+
+  {
+    std::lock_guard<std::mutex> lock(allocator.mutex);
+    allocator.stats.reallocations++;
+  }
+  return memory;
+}
+
+void VKAPI_CALL HostAllocator::FreeCallback(void *userData, void *memory) {
+  static_cast<HostAllocator *>(userData)->Free(memory);
+}
+
+HostAllocator::Header &HostAllocator::GetHeader(void *memory) {
+  return *reinterpret_cast<Header *>(static_cast<std::byte *>(memory) -
+                                     sizeof(Header));
+}
+
+void *HostAllocator::Allocate(size_t size, size_t alignment,
+                              VkSystemAllocationScope scope) {
+  if (size == 0) {
+    return nullptr;
+  }
+
+  // The header, then enough to reach the alignment from a 16 byte aligned
+  // start
+  alignment = std::max(alignment, POOL_ALIGNMENT);
+  size_t needed = sizeof(Header) + (alignment - POOL_ALIGNMENT) + size;
+
+  void *base = nullptr;
+  uint32_t sizeClass = UINT32_MAX;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (needed <= HOST_POOL_MAX_SIZE) {
+      sizeClass = std::max<uint32_t>(std::bit_width(needed - 1), POOL_SHIFT) -
+                  POOL_SHIFT;
+
+      if (freeBlocks[sizeClass] == nullptr) {
+        // A new chunk, split into blocks of this class
+        std::byte *chunk = static_cast<std::byte *>(::operator new(
+            HOST_POOL_CHUNK_SIZE, std::align_val_t(POOL_ALIGNMENT),
+            std::nothrow));
+        if (chunk == nullptr) {
+          return nullptr;
+        }
+        chunks.push_back(chunk);
+        stats.pooledBytes += HOST_POOL_CHUNK_SIZE;
+
+        size_t blockSize = size_t(1) << (sizeClass + POOL_SHIFT);
+        for (size_t offset = 0; offset + blockSize <= HOST_POOL_CHUNK_SIZE;
+             offset += blockSize) {
+          void *block = chunk + offset;
+          *static_cast<void **>(block) = freeBlocks[sizeClass];
+          freeBlocks[sizeClass] = block;
+        }
+      }
+
+      base = freeBlocks[sizeClass];
+      freeBlocks[sizeClass] = *static_cast<void **>(base);
+    } else {
+      base = ::operator new(needed, std::align_val_t(POOL_ALIGNMENT),
+                            std::nothrow);
+      if (base == nullptr) {
+        return nullptr;
+      }
+      stats.heapAllocations++;
+    }
+
+    stats.allocations++;
+    stats.liveAllocations++;
+    stats.liveBytes += size;
+    stats.peakBytes = std::max(stats.peakBytes, stats.liveBytes);
+    stats.scopeBytes[scope] += size;
+  }
+
+  uintptr_t start = reinterpret_cast<uintptr_t>(base) + sizeof(Header);
+  void *memory =
+      reinterpret_cast<void *>((start + alignment - 1) & ~(alignment - 1));
+
+  Header &header = GetHeader(memory);
+  header.base = base;
+  header.sizeClass = sizeClass;
+  header.scope = static_cast<uint32_t>(scope);
+  header.size = size;
+  return memory;
+}
+
+void HostAllocator::Free(void *memory) {
+  if (memory == nullptr) {
+    return;
+  }
+
+  Header header = GetHeader(memory);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  stats.frees++;
+  stats.liveAllocations--;
+  stats.liveBytes -= header.size;
+  stats.scopeBytes[header.scope] -= header.size;
+
+  if (header.sizeClass == UINT32_MAX) {
+    ::operator delete(header.base, std::align_val_t(POOL_ALIGNMENT));
+    return;
+  }
+
+  *static_cast<void **>(header.base) = freeBlocks[header.sizeClass];
+  freeBlocks[header.sizeClass] = header.base;
+}
+
+} // namespace MiniEngine
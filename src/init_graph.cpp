@@ -0,0 +1,120 @@
+#include <miniengine/init_graph.h>
+
+#include <spdlog/spdlog.h>
+
+#include <stdexcept>
+
+namespace MiniEngine {
+
+InitGraph::Step InitGraph::Add(std::string name,
+                               std::function<void()> function,
+                               std::initializer_list<Step> dependencies,
+                               JobAffinity affinity) {
+  Step step = static_cast<Step>(nodes.size());
+
+  Node &node = nodes.emplace_back();
+  node.function = std::move(function);
+  node.affinity = affinity;
+  for (Step dependency : dependencies) {
+    if (dependency >= step) {
+      throw std::runtime_error("Init steps have to be added after what they "
+                               "depend on");
+    }
+    nodes[dependency].dependents.push_back(step);
+    node.dependencies++;
+  }
+
+  InitPhase &phase = phases.emplace_back();
+  phase.name = std::move(name);
+  return step;
+}
+
+void InitGraph::Run(JobScheduler &jobs) {
+  SPDLOG_TRACE("InitGraph::Run() with {} steps", nodes.size());
+
+  this->jobs = &jobs;
+  start = std::chrono::high_resolution_clock::now();
+
+  for (Node &node : nodes) {
+    node.waiting.store(node.dependencies, std::memory_order_relaxed);
+  }
+  for (Step step = 0; step < nodes.size(); step++) {
+    if (nodes[step].dependencies == 0) {
+      Schedule(step);
+    }
+  }
+
+  // Runs the main thread steps as they become ready
+  jobs.Wait(counter);
+
+  totalMs = std::chrono::duration<double, std::milli>(
+                std::chrono::high_resolution_clock::now() - start)
+                .count();
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void InitGraph::Log() const {
+  double workMs = 0.0;
+  for (const InitPhase &phase : phases) {
+    workMs += phase.durationMs;
+    if (phase.skipped) {
+      spdlog::info("  {:<20} skipped", phase.name);
+      continue;
+    }
+    spdlog::info("  {:<20} {:>7.1f} ms, from {:>7.1f} ms on thread {}",
+                 phase.name, phase.durationMs, phase.startMs, phase.thread);
+  }
+
+  // More work than time is what ran in parallel
+  spdlog::info("Initialised in {:.1f} ms, {:.1f} ms of steps", totalMs,
+               workMs);
+}
+
+void InitGraph::Schedule(Step step) {
+  jobs->Schedule([this, step] { Execute(step); }, &counter,
+                 nodes[step].affinity);
+}
+
+void InitGraph::Execute(Step step) {
+  using Clock = std::chrono::high_resolution_clock;
+
+  Node &node = nodes[step];
+  InitPhase &phase = phases[step];
+
+  auto begin = Clock::now();
+  phase.startMs =
+      std::chrono::duration<double, std::milli>(begin - start).count();
+  phase.thread = jobs->GetThreadIndex();
+
+  if (failed.load(std::memory_order_acquire)) {
+    phase.skipped = true;
+  } else {
+    // The scheduler would only log it, it has to reach Run
+    try {
+      node.function();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(errorMutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+      failed.store(true, std::memory_order_release);
+    }
+  }
+
+  phase.durationMs =
+      std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+
+  // Scheduled before this job finishes, so the counter can't reach zero
+  // while there is still something to run
+  for (Step dependent : node.dependents) {
+    if (nodes[dependent].waiting.fetch_sub(1, std::memory_order_acq_rel) ==
+        1) {
+      Schedule(dependent);
+    }
+  }
+}
+
+} // namespace MiniEngine
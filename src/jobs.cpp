@@ -0,0 +1,265 @@
+#include <miniengine/jobs.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+
+namespace MiniEngine {
+
+// Which of the scheduler's threads this is, set as each thread starts
+static thread_local uint32_t threadIndex = UINT32_MAX;
+
+// How many jobs a queue has room for before it first grows
+constexpr size_t WORK_QUEUE_INITIAL_SIZE = 64;
+
+void JobScheduler::WorkQueue::PushBack(Job job) {
+  if (count == ring.size()) {
+    // Unrolled into a ring twice the size, oldest first
+    std::vector<Job> grown(std::max(ring.size() * 2, WORK_QUEUE_INITIAL_SIZE));
+    for (size_t i = 0; i < count; i++) {
+      grown[i] = std::move(ring[(head + i) & (ring.size() - 1)]);
+    }
+    ring.swap(grown);
+    head = 0;
+  }
+
+  ring[(head + count) & (ring.size() - 1)] = std::move(job);
+  count++;
+}
+
+JobScheduler::Job JobScheduler::WorkQueue::PopBack() {
+  count--;
+  return std::move(ring[(head + count) & (ring.size() - 1)]);
+}
+
+JobScheduler::Job JobScheduler::WorkQueue::PopFront() {
+  Job job = std::move(ring[head]);
+  head = (head + 1) & (ring.size() - 1);
+  count--;
+  return job;
+}
+
+void JobScheduler::Init(uint32_t workerCount) {
+  if (workerCount == 0) {
+    workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+  }
+
+  SPDLOG_TRACE("JobScheduler::Init({})", workerCount);
+
+  // The thread creating the scheduler is the main thread
+  threadIndex = workerCount;
+
+  for (uint32_t i = 0; i < workerCount + 1; i++) {
+    queues.push_back(std::make_unique<WorkQueue>());
+  }
+
+  for (uint32_t i = 0; i < workerCount; i++) {
+    workers.emplace_back(&JobScheduler::WorkerLoop, this, i);
+  }
+}
+
+void JobScheduler::Destroy() {
+  if (queues.empty()) {
+    return;
+  }
+
+  SPDLOG_TRACE("JobScheduler::Destroy()");
+
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    stopping = true;
+  }
+  wake.notify_all();
+
+  // Workers finish whatever is queued before they exit
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+
+  RunMainThreadJobs();
+  queues.clear();
+}
+
+uint32_t JobScheduler::GetThreadIndex() const {
+  // Threads the scheduler doesn't know about share the main thread's slot,
+  // they should not be recording per-thread state
+  return threadIndex == UINT32_MAX ? static_cast<uint32_t>(workers.size())
+                                   : threadIndex;
+}
+
+void JobScheduler::Schedule(std::function<void()> job, JobCounter *counter,
+                            JobAffinity affinity, JobCounter *dependency) {
+  if (counter != nullptr) {
+    counter->value.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  if (dependency != nullptr) {
+    std::lock_guard<std::mutex> lock(dependency->mutex);
+    if (!dependency->IsDone()) {
+      // Released by whichever job brings the dependency to zero
+      dependency->dependents.push_back({std::move(job), counter, affinity});
+      return;
+    }
+  }
+
+  Push({std::move(job), counter}, affinity);
+}
+
+void JobScheduler::ParallelFor(
+    uint32_t count, uint32_t batchSize,
+    const std::function<void(uint32_t begin, uint32_t end)> &job,
+    JobCounter &counter) {
+  batchSize = std::max(batchSize, 1u);
+
+  for (uint32_t begin = 0; begin < count; begin += batchSize) {
+    uint32_t end = std::min(begin + batchSize, count);
+    Schedule([=, &job] { job(begin, end); }, &counter);
+  }
+}
+
+void JobScheduler::Push(Job job, JobAffinity affinity) {
+  if (affinity == JobAffinity::MainThread) {
+    std::lock_guard<std::mutex> lock(mainThreadQueue.mutex);
+    mainThreadQueue.PushBack(std::move(job));
+    return;
+  }
+
+  // Counted before it is visible so a thief can never take the count below
+  // zero
+  queuedJobs.fetch_add(1, std::memory_order_release);
+
+  // Our own queue, so the job is likely to run on the thread that made it
+  WorkQueue &queue = *queues[GetThreadIndex()];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.PushBack(std::move(job));
+  }
+
+  {
+    // Taking the lock means a worker can't miss this between checking
+    // queuedJobs and going to sleep
+    std::lock_guard<std::mutex> lock(sleepMutex);
+  }
+  wake.notify_one();
+}
+
+bool JobScheduler::TryRunJob(uint32_t thread) {
+  Job job;
+  bool found = false;
+
+  // Newest first from our own queue
+  {
+    WorkQueue &queue = *queues[thread];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.IsEmpty()) {
+      job = queue.PopBack();
+      found = true;
+    }
+  }
+
+  // Oldest first from everyone else, starting with our neighbour so thieves
+  // spread out instead of all hitting the same queue
+  for (size_t i = 1; !found && i < queues.size(); i++) {
+    WorkQueue &queue = *queues[(thread + i) % queues.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.IsEmpty()) {
+      job = queue.PopFront();
+      found = true;
+    }
+  }
+
+  if (!found) {
+    return false;
+  }
+
+  queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+  Run(job);
+  return true;
+}
+
+void JobScheduler::Run(Job &job) {
+  try {
+    job.function();
+  } catch (const std::exception &e) {
+    // Jobs report their own errors, this just keeps the worker alive
+    spdlog::error("Job threw an exception: {}", e.what());
+  }
+
+  JobCounter *counter = job.counter;
+  if (counter == nullptr) {
+    return;
+  }
+
+  // Decremented under the lock, the waiter takes it too before returning so
+  // the counter can't be destroyed while we are still using it
+  std::vector<JobCounter::Dependent> dependents;
+  {
+    std::lock_guard<std::mutex> lock(counter->mutex);
+    if (counter->value.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+      return;
+    }
+
+    // That was the last job, release anything waiting on the counter
+    dependents.swap(counter->dependents);
+  }
+
+  for (auto &dependent : dependents) {
+    Push({std::move(dependent.job), dependent.counter}, dependent.affinity);
+  }
+}
+
+void JobScheduler::Wait(JobCounter &counter) {
+  uint32_t thread = GetThreadIndex();
+  bool mainThread = IsMainThread();
+
+  while (!counter.IsDone()) {
+    if (mainThread) {
+      RunMainThreadJobs();
+    }
+
+    if (!TryRunJob(thread)) {
+      // Whatever is left is already running elsewhere
+      std::this_thread::yield();
+    }
+  }
+
+  // Whoever finished the last job may still be holding this
+  std::lock_guard<std::mutex> lock(counter.mutex);
+}
+
+void JobScheduler::RunMainThreadJobs() {
+  while (true) {
+    Job job;
+    {
+      std::lock_guard<std::mutex> lock(mainThreadQueue.mutex);
+      if (mainThreadQueue.IsEmpty()) {
+        return;
+      }
+      job = mainThreadQueue.PopFront();
+    }
+
+    Run(job);
+  }
+}
+
+void JobScheduler::WorkerLoop(uint32_t thread) {
+  threadIndex = thread;
+
+  while (true) {
+    if (TryRunJob(thread)) {
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    wake.wait(lock, [this] {
+      return stopping || queuedJobs.load(std::memory_order_acquire) > 0;
+    });
+
+    if (stopping && queuedJobs.load(std::memory_order_acquire) == 0) {
+      return;
+    }
+  }
+}
+
+} // namespace MiniEngine
@@ -0,0 +1,98 @@
+#include <miniengine/logging.h>
+
+#include <spdlog/async.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include <chrono>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace MiniEngine {
+
+// How many times each validation message has been seen, by id
+static std::mutex validationMutex;
+static std::unordered_map<uint64_t, uint64_t> validationCounts;
+static std::chrono::steady_clock::time_point validationSecond;
+static uint32_t validationThisSecond = 0;
+static uint64_t validationSuppressed = 0;
+
+void InitLogging(spdlog::level::level_enum level) {
+  // One thread writes everything out, in the order it was logged
+  spdlog::init_thread_pool(LOG_QUEUE_SIZE, 1);
+
+  // Unnamed like the logger it replaces, so the output looks the same. It
+  // can't go through the registry, which already has the old one by that
+  // name.
+  auto logger = std::make_shared<spdlog::async_logger>(
+      "", std::make_shared<spdlog::sinks::stdout_color_sink_mt>(),
+      spdlog::thread_pool(), spdlog::async_overflow_policy::overrun_oldest);
+  auto validation =
+      spdlog::create_async_nb<spdlog::sinks::stdout_color_sink_mt>(
+          "validation");
+
+  // Errors usually come just before things go wrong, so they are flushed
+  // as soon as they are written rather than left in stdout's buffer
+  std::shared_ptr<spdlog::logger> loggers[] = {logger, validation};
+  for (auto &each : loggers) {
+    each->set_level(level);
+    each->flush_on(spdlog::level::err);
+  }
+
+  spdlog::set_default_logger(logger);
+  SPDLOG_TRACE("InitLogging({})", spdlog::level::to_string_view(level));
+}
+
+void ShutdownLogging() {
+  spdlog::level::level_enum level = spdlog::default_logger()->level();
+  spdlog::shutdown();
+
+  // Anything logged after this is written out before the call returns
+  auto logger = std::make_shared<spdlog::logger>(
+      "", std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
+  logger->set_level(level);
+  spdlog::set_default_logger(logger);
+}
+
+std::shared_ptr<spdlog::logger> GetValidationLogger() {
+  std::shared_ptr<spdlog::logger> logger = spdlog::get("validation");
+  if (logger == nullptr) {
+    logger = spdlog::stdout_color_mt("validation");
+  }
+  return logger;
+}
+
+bool FilterValidationMessage(int32_t messageId, const char *message,
+                             uint64_t &count) {
+  // Some messages (the loader's, say) have no id, those go by their text
+  uint64_t key = messageId != 0
+                     ? static_cast<uint32_t>(messageId)
+                     : std::hash<std::string_view>()(message) | (1ull << 32);
+
+  auto now = std::chrono::steady_clock::now();
+
+  std::lock_guard<std::mutex> lock(validationMutex);
+  count = ++validationCounts[key];
+
+  // The first few, then 4, 8, 16...
+  bool repeat = count > VALIDATION_REPEATS_LOGGED && (count & (count - 1)) != 0;
+
+  if (now - validationSecond >= std::chrono::seconds(1)) {
+    validationSecond = now;
+    validationThisSecond = 0;
+  }
+  if (repeat || validationThisSecond >= VALIDATION_MESSAGES_PER_SECOND) {
+    validationSuppressed++;
+    return false;
+  }
+
+  validationThisSecond++;
+  return true;
+}
+
+uint64_t GetSuppressedValidationCount() {
+  std::lock_guard<std::mutex> lock(validationMutex);
+  return validationSuppressed;
+}
+
+} // namespace MiniEngine
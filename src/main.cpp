@@ -1,22 +1,99 @@
 #include <miniengine/app.h>
+#include <miniengine/logging.h>
 
 #include <spdlog/spdlog.h>
 
-int main(void) {
-  spdlog::set_level(spdlog::level::trace);
+#include <cctype>
+#include <cstdlib>
+#include <string>
+
+int main(int argc, char **argv) {
+  MiniEngine::InitLogging(spdlog::level::trace);
+
+  MiniEngine::AppConfig config;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    if (arg == "--benchmark") {
+      config.benchmark = true;
+
+      // Optionally followed by the number of frames to run
+      if (i + 1 < argc && std::isdigit(argv[i + 1][0])) {
+        config.benchmarkFrames = std::strtoul(argv[++i], nullptr, 10);
+      }
+    } else if (arg == "--legacy-rendering") {
+      config.legacyRendering = true;
+    } else if (arg == "--threads" && i + 1 < argc) {
+      config.workerThreads = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--frames-in-flight" && i + 1 < argc) {
+      config.pacing.framesInFlight = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--present-mode" && i + 1 < argc) {
+      std::string mode = argv[++i];
+      if (mode == "immediate") {
+        config.pacing.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+      } else if (mode == "mailbox") {
+        config.pacing.presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+      } else if (mode == "fifo") {
+        config.pacing.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+      } else if (mode == "fifo_relaxed") {
+        config.pacing.presentMode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+      } else {
+        spdlog::warn("Unknown present mode {}, keeping mailbox", mode);
+      }
+    } else if (arg == "--swapchain-images" && i + 1 < argc) {
+      config.pacing.swapchainImages = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--fps-limit" && i + 1 < argc) {
+      config.pacing.frameRateLimit = std::strtod(argv[++i], nullptr);
+    } else if (arg == "--late-latch") {
+      config.pacing.lateLatch = true;
+    } else if (arg == "--on-demand") {
+      config.pacing.onDemand = true;
+    } else if (arg == "--idle-fps" && i + 1 < argc) {
+      config.pacing.idleFrameRate = std::strtod(argv[++i], nullptr);
+    } else if (arg == "--render-scale" && i + 1 < argc) {
+      config.resolution.scale = std::strtof(argv[++i], nullptr);
+    } else if (arg == "--dynamic-resolution" && i + 1 < argc) {
+      config.resolution.targetGpuMs = std::strtod(argv[++i], nullptr);
+    } else if (arg == "--min-render-scale" && i + 1 < argc) {
+      config.resolution.minScale = std::strtof(argv[++i], nullptr);
+    } else if (arg == "--msaa" && i + 1 < argc) {
+      config.resolution.msaaSamples = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--package" && i + 1 < argc) {
+      config.packagePath = argv[++i];
+    } else if (arg == "--texture" && i + 1 < argc) {
+      config.texturePaths.push_back(argv[++i]);
+    } else if (arg == "--texture-budget" && i + 1 < argc) {
+      config.textureBudgetMiB = std::strtoul(argv[++i], nullptr, 10);
+    } else {
+      spdlog::warn("Ignoring unknown argument {}", arg);
+    }
+  }
+
+  if (config.benchmark) {
+    // Per-function tracing would swamp the numbers
+    spdlog::set_level(spdlog::level::info);
+  }
 
   spdlog::info("Starting MiniEngine");
 
-  MiniEngine::App app;
+  // Destroyed before logging stops, Cleanup logs too
+  int result = EXIT_SUCCESS;
+  {
+    MiniEngine::App app(config);
 
-  try {
-    app.Run();
-  } catch (const std::exception &e) {
-    spdlog::error("Exception: {}", e.what());
-    return EXIT_FAILURE;
+    try {
+      app.Run();
+    } catch (const std::exception &e) {
+      spdlog::error("Exception: {}", e.what());
+      result = EXIT_FAILURE;
+    }
   }
 
-  spdlog::info("Shutting down MiniEngine");
+  if (result == EXIT_SUCCESS) {
+    spdlog::info("Shutting down MiniEngine");
+  }
+  MiniEngine::ShutdownLogging();
 
-  return EXIT_SUCCESS;
+  return result;
 }
@@ -0,0 +1,194 @@
+#include <miniengine/mesh.h>
+
+#include <spdlog/spdlog.h>
+
+#include <cstring>
+#include <stdexcept>
+
+namespace MiniEngine {
+
+VkIndexType ChooseIndexType(size_t vertexCount) {
+  return vertexCount <= 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
+
+IndexData PackIndices(const std::vector<uint32_t> &indices,
+                      size_t vertexCount) {
+  IndexData result;
+  result.type = ChooseIndexType(vertexCount);
+  result.count = static_cast<uint32_t>(indices.size());
+
+  if (result.type == VK_INDEX_TYPE_UINT32) {
+    result.bytes.resize(indices.size() * sizeof(uint32_t));
+    memcpy(result.bytes.data(), indices.data(), result.bytes.size());
+    return result;
+  }
+
+  // Half the size, and half the index fetch bandwidth
+  result.bytes.resize(indices.size() * sizeof(uint16_t));
+  uint16_t *out = reinterpret_cast<uint16_t *>(result.bytes.data());
+  for (size_t i = 0; i < indices.size(); i++) {
+    out[i] = static_cast<uint16_t>(indices[i]);
+  }
+  return result;
+}
+
+double ComputeACMR(const std::vector<uint32_t> &indices, size_t vertexCount,
+                   uint32_t cacheSize) {
+  if (indices.size() < 3) {
+    return 0.0;
+  }
+
+  // Which "time" each vertex entered the cache at, it is still in there if
+  // fewer than cacheSize misses have happened since
+  std::vector<uint64_t> cachedAt(vertexCount, 0);
+  uint64_t misses = 0;
+
+  for (uint32_t index : indices) {
+    if (index >= vertexCount) {
+      throw std::runtime_error("Mesh index out of range");
+    }
+    if (cachedAt[index] == 0 || misses - cachedAt[index] >= cacheSize) {
+      misses++;
+      cachedAt[index] = misses;
+    }
+  }
+
+  return static_cast<double>(misses) / (indices.size() / 3);
+}
+
+void OptimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount,
+                         uint32_t cacheSize) {
+  SPDLOG_TRACE("OptimizeVertexCache({}, {})", indices.size(), vertexCount);
+
+  // Anything after the last full triangle can't be drawn as part of a
+  // triangle list anyway
+  size_t triangleCount = indices.size() / 3;
+  indices.resize(triangleCount * 3);
+  if (triangleCount == 0 || vertexCount == 0) {
+    return;
+  }
+
+  // Every triangle each vertex is part of, packed into one array
+  std::vector<uint32_t> liveTriangles(vertexCount, 0);
+  for (uint32_t index : indices) {
+    if (index >= vertexCount) {
+      throw std::runtime_error("Mesh index out of range");
+    }
+    liveTriangles[index]++;
+  }
+
+  std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+  for (size_t i = 0; i < vertexCount; i++) {
+    adjacencyOffsets[i + 1] = adjacencyOffsets[i] + liveTriangles[i];
+  }
+
+  std::vector<uint32_t> adjacency(indices.size());
+  std::vector<uint32_t> fill(adjacencyOffsets.begin(),
+                             adjacencyOffsets.end() - 1);
+  for (size_t i = 0; i < indices.size(); i++) {
+    adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+  }
+
+  // Same scheme as ComputeACMR, starting past the cache size so nothing
+  // counts as cached to begin with
+  std::vector<uint32_t> cacheTime(vertexCount, 0);
+  uint32_t time = cacheSize + 1;
+
+  std::vector<bool> emitted(triangleCount, false);
+  std::vector<uint32_t> deadEnd; // Recently used vertices, most recent last
+  std::vector<uint32_t> candidates;
+  uint32_t cursor = 0; // Where to look for unemitted triangles from
+
+  std::vector<uint32_t> output;
+  output.reserve(indices.size());
+
+  // If vertex 0 has no triangles the dead end search below moves on
+  int64_t fanning = 0;
+  while (fanning >= 0) {
+    candidates.clear();
+
+    // Emit every triangle around the fanning vertex
+    for (uint32_t a = adjacencyOffsets[fanning];
+         a < adjacencyOffsets[fanning + 1]; a++) {
+      uint32_t triangle = adjacency[a];
+      if (emitted[triangle]) {
+        continue;
+      }
+      emitted[triangle] = true;
+
+      for (uint32_t corner = 0; corner < 3; corner++) {
+        uint32_t vertex = indices[triangle * 3 + corner];
+        output.push_back(vertex);
+        deadEnd.push_back(vertex);
+        candidates.push_back(vertex);
+        liveTriangles[vertex]--;
+
+        if (time - cacheTime[vertex] > cacheSize) {
+          cacheTime[vertex] = time;
+          time++;
+        }
+      }
+    }
+
+    // The next fan is around the candidate that will still be in the cache
+    // by the time its remaining triangles are emitted, and has been in there
+    // longest
+    fanning = -1;
+    int64_t best = -1;
+    for (uint32_t vertex : candidates) {
+      if (liveTriangles[vertex] == 0) {
+        continue;
+      }
+      int64_t priority = 0;
+      if (time - cacheTime[vertex] + 2 * liveTriangles[vertex] <= cacheSize) {
+        priority = time - cacheTime[vertex];
+      }
+      if (priority > best) {
+        best = priority;
+        fanning = vertex;
+      }
+    }
+
+    // Nowhere good to go, back up to a recently used vertex or failing that
+    // the next one in input order with triangles left
+    while (fanning < 0 && !deadEnd.empty()) {
+      uint32_t vertex = deadEnd.back();
+      deadEnd.pop_back();
+      if (liveTriangles[vertex] > 0) {
+        fanning = vertex;
+      }
+    }
+    while (fanning < 0 && cursor < vertexCount) {
+      if (liveTriangles[cursor] > 0) {
+        fanning = cursor;
+      }
+      cursor++;
+    }
+  }
+
+  indices = std::move(output);
+}
+
+std::vector<uint32_t> OptimizeVertexFetch(std::vector<uint32_t> &indices,
+                                          size_t vertexCount) {
+  SPDLOG_TRACE("OptimizeVertexFetch({}, {})", indices.size(), vertexCount);
+
+  std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+  std::vector<uint32_t> order;
+  order.reserve(vertexCount);
+
+  for (uint32_t &index : indices) {
+    if (index >= vertexCount) {
+      throw std::runtime_error("Mesh index out of range");
+    }
+    if (remap[index] == UINT32_MAX) {
+      remap[index] = static_cast<uint32_t>(order.size());
+      order.push_back(index);
+    }
+    index = remap[index];
+  }
+
+  return order;
+}
+
+} // namespace MiniEngine
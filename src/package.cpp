@@ -0,0 +1,455 @@
+#include <miniengine/package.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_set>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace MiniEngine {
+
+static uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// Pads `out` to the package alignment, then appends `data`. Returns where it
+// went.
+static uint64_t AppendAligned(std::vector<std::byte> &out,
+                              std::span<const std::byte> data) {
+  uint64_t offset = AlignUp(out.size(), PACKAGE_ALIGNMENT);
+  out.resize(offset + data.size());
+  if (!data.empty()) {
+    memcpy(out.data() + offset, data.data(), data.size());
+  }
+  return offset;
+}
+
+// Whether [offset, offset + length) is inside `size`, without overflowing
+static bool InRange(uint64_t offset, uint64_t length, uint64_t size) {
+  return offset <= size && length <= size - offset;
+}
+
+AssetPackage::~AssetPackage() { Close(); }
+
+void AssetPackage::Open(const std::string &path) {
+  SPDLOG_TRACE("AssetPackage::Open({})", path);
+
+  Close();
+
+  // The mapping keeps the file open, so the handles can go straight away
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING,
+                            FILE_FLAG_RANDOM_ACCESS, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error("Failed to open package: " + path);
+  }
+
+  LARGE_INTEGER fileSize;
+  GetFileSizeEx(file, &fileSize);
+  size = static_cast<size_t>(fileSize.QuadPart);
+
+  HANDLE mapping =
+      size > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr)
+               : nullptr;
+  CloseHandle(file);
+  if (mapping != nullptr) {
+    mapped = static_cast<const std::byte *>(
+        MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    CloseHandle(mapping);
+  }
+  if (mapped == nullptr) {
+    size = 0;
+    throw std::runtime_error("Failed to map package: " + path);
+  }
+#else
+  int file = open(path.c_str(), O_RDONLY);
+  if (file < 0) {
+    throw std::runtime_error("Failed to open package: " + path);
+  }
+
+  struct stat status;
+  void *view = MAP_FAILED;
+  if (fstat(file, &status) == 0 && status.st_size > 0) {
+    size = static_cast<size_t>(status.st_size);
+    view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+  }
+  close(file);
+  if (view == MAP_FAILED) {
+    size = 0;
+    throw std::runtime_error("Failed to map package: " + path);
+  }
+  mapped = static_cast<const std::byte *>(view);
+#endif
+
+  // Everything after this only reads the mapping, so a bad package fails
+  // here rather than when an asset is used
+  auto fail = [&](const char *reason) {
+    Close();
+    throw std::runtime_error("Invalid package " + path + ": " + reason);
+  };
+
+  if (size < sizeof(PackageHeader)) {
+    fail("too small");
+  }
+
+  PackageHeader header;
+  memcpy(&header, mapped, sizeof(header));
+  if (header.magic != PACKAGE_MAGIC) {
+    fail("not a package");
+  }
+  if (header.version != PACKAGE_VERSION) {
+    fail("unsupported version");
+  }
+  if (header.tocOffset % alignof(PackageEntry) != 0 ||
+      !InRange(header.tocOffset,
+               static_cast<uint64_t>(header.assetCount) * sizeof(PackageEntry),
+               size) ||
+      !InRange(header.namesOffset, header.namesSize, size)) {
+    fail("table of contents out of range");
+  }
+
+  entries = reinterpret_cast<const PackageEntry *>(mapped + header.tocOffset);
+  assetCount = header.assetCount;
+  names = reinterpret_cast<const char *>(mapped + header.namesOffset);
+
+  lookup.reserve(header.assetCount);
+  for (uint32_t i = 0; i < header.assetCount; i++) {
+    const PackageEntry &entry = entries[i];
+    if (entry.offset % PACKAGE_ALIGNMENT != 0 ||
+        !InRange(entry.offset, entry.size, size) ||
+        !InRange(entry.nameOffset, entry.nameLength, header.namesSize)) {
+      fail("asset out of range");
+    }
+
+    // Only one of them could ever be looked up
+    std::string_view name(names + entry.nameOffset, entry.nameLength);
+    if (!lookup.emplace(name, i).second) {
+      fail("duplicate asset name");
+    }
+  }
+
+  spdlog::info("Mapped package {}: {} assets, {:.1f} MiB", path,
+               header.assetCount, size / (1024.0 * 1024.0));
+}
+
+void AssetPackage::Close() {
+  if (mapped == nullptr) {
+    return;
+  }
+
+  SPDLOG_TRACE("AssetPackage::Close()");
+
+#ifdef _WIN32
+  UnmapViewOfFile(mapped);
+#else
+  munmap(const_cast<std::byte *>(mapped), size);
+#endif
+
+  lookup.clear();
+  entries = nullptr;
+  assetCount = 0;
+  names = nullptr;
+  mapped = nullptr;
+  size = 0;
+}
+
+AssetView AssetPackage::Find(std::string_view name) const {
+  auto it = lookup.find(name);
+  if (it == lookup.end()) {
+    return {};
+  }
+
+  const PackageEntry &entry = entries[it->second];
+
+  AssetView view;
+  view.type = entry.type;
+  view.data = {mapped + entry.offset, static_cast<size_t>(entry.size)};
+  return view;
+}
+
+MeshView AssetPackage::GetMesh(const AssetView &asset) {
+  PackedMeshHeader header;
+  if (asset.type != AssetType::Mesh || asset.data.size() < sizeof(header)) {
+    throw std::runtime_error("Asset is not a mesh");
+  }
+  memcpy(&header, asset.data.data(), sizeof(header));
+
+  if (header.indexType != VK_INDEX_TYPE_UINT16 &&
+      header.indexType != VK_INDEX_TYPE_UINT32) {
+    throw std::runtime_error("Mesh has an invalid index type");
+  }
+
+  uint64_t indexSize = header.indexType == VK_INDEX_TYPE_UINT16 ? 2 : 4;
+  uint64_t vertexBytes =
+      static_cast<uint64_t>(header.vertexCount) * header.vertexStride;
+  uint64_t indexBytes = static_cast<uint64_t>(header.indexCount) * indexSize;
+
+  if (!InRange(header.vertexOffset, vertexBytes, asset.data.size()) ||
+      !InRange(header.indexOffset, indexBytes, asset.data.size())) {
+    throw std::runtime_error("Mesh data out of range");
+  }
+
+  MeshView view;
+  view.vertexCount = header.vertexCount;
+  view.vertexStride = header.vertexStride;
+  view.indexCount = header.indexCount;
+  view.indexType = header.indexType;
+  view.vertices = asset.data.subspan(header.vertexOffset, vertexBytes);
+  view.indices = asset.data.subspan(header.indexOffset, indexBytes);
+
+  // The mapping has no alignment to speak of, so copied out one at a time
+  for (uint64_t offset = 0; offset < indexBytes; offset += indexSize) {
+    uint32_t index = 0;
+    if (indexSize == 2) {
+      uint16_t narrow;
+      memcpy(&narrow, view.indices.data() + offset, sizeof(narrow));
+      index = narrow;
+    } else {
+      memcpy(&index, view.indices.data() + offset, sizeof(index));
+    }
+    if (index >= header.vertexCount) {
+      throw std::runtime_error("Mesh index out of range");
+    }
+  }
+  return view;
+}
+
+TextureView AssetPackage::GetTexture(const AssetView &asset) {
+  PackedTextureHeader header;
+  if (asset.type != AssetType::Texture || asset.data.size() < sizeof(header)) {
+    throw std::runtime_error("Asset is not a texture");
+  }
+  memcpy(&header, asset.data.data(), sizeof(header));
+
+  if (header.mipLevels == 0 || header.mipLevels > PACKAGE_MAX_MIPS) {
+    throw std::runtime_error("Texture has an invalid mip count");
+  }
+
+  TextureView view;
+  view.width = header.width;
+  view.height = header.height;
+  view.format = header.format;
+  view.mipLevels = header.mipLevels;
+  for (uint32_t i = 0; i < header.mipLevels; i++) {
+    if (!InRange(header.mipOffsets[i], header.mipSizes[i],
+                 asset.data.size())) {
+      throw std::runtime_error("Texture data out of range");
+    }
+    view.mips[i] = asset.data.subspan(header.mipOffsets[i], header.mipSizes[i]);
+  }
+  return view;
+}
+
+void AssetPackage::Prefetch(const AssetView &asset) const {
+#ifdef _WIN32
+  // PrefetchVirtualMemory needs Windows 8 headers, the pages fault in as
+  // they are copied instead
+  (void)asset;
+#else
+  if (!asset.IsValid()) {
+    return;
+  }
+
+  // madvise wants a page aligned start
+  size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t start = static_cast<size_t>(asset.data.data() - mapped);
+  size_t alignedStart = start / pageSize * pageSize;
+  madvise(const_cast<std::byte *>(mapped) + alignedStart,
+          start + asset.data.size() - alignedStart, MADV_WILLNEED);
+#endif
+}
+
+uint32_t AssetPackage::GetAssetCount() const { return assetCount; }
+
+std::vector<std::string_view> AssetPackage::GetNames(AssetType type) const {
+  std::vector<std::string_view> found;
+  for (uint32_t i = 0; i < assetCount; i++) {
+    const PackageEntry &entry = entries[i];
+    if (entry.type == type) {
+      found.emplace_back(names + entry.nameOffset, entry.nameLength);
+    }
+  }
+  return found;
+}
+
+void PackageWriter::Add(const std::string &name, AssetType type,
+                        std::span<const std::byte> data) {
+  PendingAsset asset;
+  asset.name = name;
+  asset.type = type;
+  asset.data.assign(data.begin(), data.end());
+  assets.push_back(std::move(asset));
+}
+
+void PackageWriter::AddMesh(const std::string &name,
+                            std::span<const std::byte> vertices,
+                            uint32_t vertexCount, uint32_t vertexStride,
+                            const IndexData &indices) {
+  PackedMeshHeader header = {};
+  header.vertexCount = vertexCount;
+  header.vertexStride = vertexStride;
+  header.indexCount = indices.count;
+  header.indexType = indices.type;
+
+  std::vector<std::byte> data(sizeof(header));
+  header.vertexOffset = AppendAligned(data, vertices);
+  header.indexOffset =
+      AppendAligned(data, std::as_bytes(std::span(indices.bytes)));
+  memcpy(data.data(), &header, sizeof(header));
+
+  PendingAsset asset;
+  asset.name = name;
+  asset.type = AssetType::Mesh;
+  asset.data = std::move(data);
+  assets.push_back(std::move(asset));
+}
+
+void PackageWriter::AddTexture(const std::string &name, uint32_t width,
+                               uint32_t height, const uint8_t *pixels) {
+  PackedTextureHeader header = {};
+  header.width = width;
+  header.height = height;
+  header.format = VK_FORMAT_R8G8B8A8_SRGB;
+
+  std::vector<std::byte> data(sizeof(header));
+
+  std::vector<uint8_t> mip(pixels, pixels + static_cast<size_t>(width) *
+                                                height * 4);
+  uint32_t mipWidth = width;
+  uint32_t mipHeight = height;
+  for (uint32_t level = 0; level < PACKAGE_MAX_MIPS; level++) {
+    header.mipOffsets[level] =
+        AppendAligned(data, std::as_bytes(std::span(mip)));
+    header.mipSizes[level] = mip.size();
+    header.mipLevels = level + 1;
+
+    if (mipWidth == 1 && mipHeight == 1) {
+      break;
+    }
+
+    // Averages each 2x2 block (or 2x1 at an edge). It averages the sRGB
+    // values, which darkens the smaller mips a little, but it is cheap.
+    uint32_t nextWidth = std::max(mipWidth / 2, 1u);
+    uint32_t nextHeight = std::max(mipHeight / 2, 1u);
+    std::vector<uint8_t> next(static_cast<size_t>(nextWidth) * nextHeight * 4);
+    for (uint32_t y = 0; y < nextHeight; y++) {
+      for (uint32_t x = 0; x < nextWidth; x++) {
+        uint32_t x0 = std::min(x * 2, mipWidth - 1);
+        uint32_t x1 = std::min(x * 2 + 1, mipWidth - 1);
+        uint32_t y0 = std::min(y * 2, mipHeight - 1);
+        uint32_t y1 = std::min(y * 2 + 1, mipHeight - 1);
+        for (uint32_t c = 0; c < 4; c++) {
+          auto at = [&](uint32_t px, uint32_t py) {
+            return static_cast<uint32_t>(
+                mip[(static_cast<size_t>(py) * mipWidth + px) * 4 + c]);
+          };
+          next[(static_cast<size_t>(y) * nextWidth + x) * 4 + c] =
+              static_cast<uint8_t>(
+                  (at(x0, y0) + at(x1, y0) + at(x0, y1) + at(x1, y1) + 2) / 4);
+        }
+      }
+    }
+
+    mip = std::move(next);
+    mipWidth = nextWidth;
+    mipHeight = nextHeight;
+  }
+
+  memcpy(data.data(), &header, sizeof(header));
+
+  PendingAsset asset;
+  asset.name = name;
+  asset.type = AssetType::Texture;
+  asset.data = std::move(data);
+  assets.push_back(std::move(asset));
+}
+
+void PackageWriter::AddTexture(
+    const std::string &name, VkFormat format, uint32_t width, uint32_t height,
+    std::span<const std::span<const std::byte>> mips) {
+  if (mips.empty() || mips.size() > PACKAGE_MAX_MIPS) {
+    throw std::runtime_error("Texture " + name + " has an invalid mip count");
+  }
+
+  PackedTextureHeader header = {};
+  header.width = width;
+  header.height = height;
+  header.format = format;
+  header.mipLevels = static_cast<uint32_t>(mips.size());
+
+  std::vector<std::byte> data(sizeof(header));
+  for (size_t level = 0; level < mips.size(); level++) {
+    header.mipOffsets[level] = AppendAligned(data, mips[level]);
+    header.mipSizes[level] = mips[level].size();
+  }
+  memcpy(data.data(), &header, sizeof(header));
+
+  PendingAsset asset;
+  asset.name = name;
+  asset.type = AssetType::Texture;
+  asset.data = std::move(data);
+  assets.push_back(std::move(asset));
+}
+
+void PackageWriter::Write(const std::string &path) const {
+  SPDLOG_TRACE("PackageWriter::Write({})", path);
+
+  // AssetPackage::Open rejects a package with a name in it twice
+  std::unordered_set<std::string_view> seen;
+  for (const PendingAsset &asset : assets) {
+    if (!seen.insert(asset.name).second) {
+      throw std::runtime_error("Asset " + asset.name + " was added twice");
+    }
+  }
+
+  // Header, then every asset aligned, then the table of contents and names
+  std::vector<std::byte> file(sizeof(PackageHeader));
+  std::vector<PackageEntry> toc;
+  std::string names;
+
+  for (const PendingAsset &asset : assets) {
+    PackageEntry entry = {};
+    entry.offset = AppendAligned(file, asset.data);
+    entry.size = asset.data.size();
+    entry.nameOffset = static_cast<uint32_t>(names.size());
+    entry.nameLength = static_cast<uint32_t>(asset.name.size());
+    entry.type = asset.type;
+    toc.push_back(entry);
+    names += asset.name;
+  }
+
+  PackageHeader header = {};
+  header.magic = PACKAGE_MAGIC;
+  header.version = PACKAGE_VERSION;
+  header.assetCount = static_cast<uint32_t>(toc.size());
+  header.tocOffset = AppendAligned(file, std::as_bytes(std::span(toc)));
+  header.namesOffset = AppendAligned(file, std::as_bytes(std::span(names)));
+  header.namesSize = names.size();
+  memcpy(file.data(), &header, sizeof(header));
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char *>(file.data()),
+            static_cast<std::streamsize>(file.size()));
+  if (!out) {
+    throw std::runtime_error("Failed to write package: " + path);
+  }
+
+  spdlog::info("Wrote package {}: {} assets, {:.1f} MiB", path, toc.size(),
+               file.size() / (1024.0 * 1024.0));
+}
+
+} // namespace MiniEngine
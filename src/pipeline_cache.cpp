@@ -0,0 +1,151 @@
+#include <miniengine/pipeline_cache.h>
+
+#include <spdlog/spdlog.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace MiniEngine {
+
+// Our own header in front of the driver's data, the driver's header is then
+// checked on its own
+struct PipelineCacheFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t dataSize;
+  double coldBuildMs;
+};
+
+constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x4350454d; // "MEPC"
+constexpr uint32_t PIPELINE_CACHE_VERSION = 1;
+
+void PipelineCache::Init(VkDevice device,
+                         const VkPhysicalDeviceProperties &properties,
+                         const std::string &path,
+                         const VkAllocationCallbacks *hostCallbacks) {
+  SPDLOG_TRACE("PipelineCache::Init({})", path);
+
+  this->device = device;
+  this->hostCallbacks = hostCallbacks;
+  this->properties = properties;
+  this->path = path;
+
+  std::string data;
+
+  std::ifstream file(path, std::ios::binary);
+  if (file.is_open()) {
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string bytes = contents.str();
+
+    PipelineCacheFileHeader header = {};
+    if (bytes.size() >= sizeof(header)) {
+      memcpy(&header, bytes.data(), sizeof(header));
+    }
+
+    if (header.magic == PIPELINE_CACHE_MAGIC &&
+        header.version == PIPELINE_CACHE_VERSION &&
+        header.dataSize == bytes.size() - sizeof(header)) {
+      data = bytes.substr(sizeof(header));
+      coldBuildMs = header.coldBuildMs;
+    }
+
+    if (!Validate(data)) {
+      spdlog::warn("Pipeline cache {} is stale or corrupt, ignoring it", path);
+      data.clear();
+      coldBuildMs = 0.0;
+    }
+  }
+
+  warm = !data.empty();
+
+  VkPipelineCacheCreateInfo createInfo = {};
+  createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  createInfo.initialDataSize = data.size();
+  createInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+  if (vkCreatePipelineCache(device, &createInfo, hostCallbacks, &cache) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to create pipeline cache");
+  }
+}
+
+bool PipelineCache::Validate(const std::string &data) const {
+  // Drivers are meant to reject data that isn't theirs but not all of them do,
+  // and handing them another GPU's cache has crashed drivers in the past
+  VkPipelineCacheHeaderVersionOne header = {};
+  if (data.size() < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+
+  return header.headerSize >= sizeof(header) &&
+         header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+         header.vendorID == properties.vendorID &&
+         header.deviceID == properties.deviceID &&
+         memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID,
+                VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::Save() {
+  SPDLOG_TRACE("PipelineCache::Save()");
+
+  size_t size = 0;
+  vkGetPipelineCacheData(device, cache, &size, nullptr);
+
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(device, cache, &size, data.data()) !=
+      VK_SUCCESS) {
+    spdlog::warn("Failed to read back the pipeline cache");
+    return;
+  }
+
+  PipelineCacheFileHeader header = {};
+  header.magic = PIPELINE_CACHE_MAGIC;
+  header.version = PIPELINE_CACHE_VERSION;
+  header.dataSize = size;
+  // A warm run says nothing about how long compiling takes
+  header.coldBuildMs = warm ? coldBuildMs : buildMs;
+
+  // Written next to the real file then renamed over it, so a crash halfway
+  // through can't leave a truncated cache behind. std::filesystem::rename
+  // replaces the old file in one step on Windows too, where std::rename
+  // refuses to.
+  std::string tempPath = path + ".tmp";
+  {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      spdlog::warn("Failed to open {} for writing", tempPath);
+      return;
+    }
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(data.data(), static_cast<std::streamsize>(size));
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tempPath, path, error);
+  if (error) {
+    spdlog::warn("Failed to replace {}: {}", path, error.message());
+    std::filesystem::remove(tempPath, error);
+  }
+}
+
+void PipelineCache::Destroy() {
+  if (cache == VK_NULL_HANDLE) {
+    return;
+  }
+
+  SPDLOG_TRACE("PipelineCache::Destroy()");
+
+  Save();
+
+  vkDestroyPipelineCache(device, cache, hostCallbacks);
+  cache = VK_NULL_HANDLE;
+}
+
+} // namespace MiniEngine
@@ -0,0 +1,561 @@
+#include <miniengine/pipeline_registry.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace MiniEngine {
+
+// FNV-1a, fast and good enough to tell pipeline descriptions apart
+static void HashBytes(uint64_t &hash, const void *data, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+}
+
+template <typename T> static void HashValue(uint64_t &hash, const T &value) {
+  HashBytes(hash, &value, sizeof(value));
+}
+
+uint64_t PipelineDesc::Hash() const {
+  uint64_t hash = 0xcbf29ce484222325ull;
+
+  HashBytes(hash, vertexShader.data(), vertexShader.size() + 1);
+  HashBytes(hash, fragmentShader.data(), fragmentShader.size() + 1);
+
+  // Field by field, the structs may have padding in them
+  HashValue(hash, bindings.size());
+  for (auto &binding : bindings) {
+    HashValue(hash, binding.binding);
+    HashValue(hash, binding.stride);
+    HashValue(hash, binding.inputRate);
+  }
+  HashValue(hash, attributes.size());
+  for (auto &attribute : attributes) {
+    HashValue(hash, attribute.location);
+    HashValue(hash, attribute.binding);
+    HashValue(hash, attribute.format);
+    HashValue(hash, attribute.offset);
+  }
+  HashValue(hash, topology);
+
+  HashValue(hash, polygonMode);
+  HashValue(hash, cullMode);
+  HashValue(hash, frontFace);
+
+  HashValue(hash, blendEnable);
+  if (blendEnable) {
+    HashValue(hash, srcColorBlendFactor);
+    HashValue(hash, dstColorBlendFactor);
+    HashValue(hash, colorBlendOp);
+    HashValue(hash, srcAlphaBlendFactor);
+    HashValue(hash, dstAlphaBlendFactor);
+    HashValue(hash, alphaBlendOp);
+  }
+
+  HashValue(hash, layout);
+
+  HashValue(hash, subpass);
+  HashValue(hash, colorFormats.size());
+  for (auto format : colorFormats) {
+    HashValue(hash, format);
+  }
+  HashValue(hash, samples);
+
+  return hash;
+}
+
+bool PipelineDesc::operator==(const PipelineDesc &other) const {
+  auto sameBindings = [](const VkVertexInputBindingDescription &a,
+                         const VkVertexInputBindingDescription &b) {
+    return a.binding == b.binding && a.stride == b.stride &&
+           a.inputRate == b.inputRate;
+  };
+  auto sameAttributes = [](const VkVertexInputAttributeDescription &a,
+                           const VkVertexInputAttributeDescription &b) {
+    return a.location == b.location && a.binding == b.binding &&
+           a.format == b.format && a.offset == b.offset;
+  };
+
+  bool sameBlend =
+      blendEnable == other.blendEnable &&
+      (!blendEnable ||
+       (srcColorBlendFactor == other.srcColorBlendFactor &&
+        dstColorBlendFactor == other.dstColorBlendFactor &&
+        colorBlendOp == other.colorBlendOp &&
+        srcAlphaBlendFactor == other.srcAlphaBlendFactor &&
+        dstAlphaBlendFactor == other.dstAlphaBlendFactor &&
+        alphaBlendOp == other.alphaBlendOp));
+
+  return vertexShader == other.vertexShader &&
+         fragmentShader == other.fragmentShader &&
+         std::equal(bindings.begin(), bindings.end(), other.bindings.begin(),
+                    other.bindings.end(), sameBindings) &&
+         std::equal(attributes.begin(), attributes.end(),
+                    other.attributes.begin(), other.attributes.end(),
+                    sameAttributes) &&
+         topology == other.topology && polygonMode == other.polygonMode &&
+         cullMode == other.cullMode && frontFace == other.frontFace &&
+         sameBlend && layout == other.layout && subpass == other.subpass &&
+         colorFormats == other.colorFormats && samples == other.samples;
+}
+
+void PipelineRegistry::Init(VkDevice device, PipelineCache &cache,
+                            JobScheduler &jobs,
+                            const VkAllocationCallbacks *hostCallbacks) {
+  SPDLOG_TRACE("PipelineRegistry::Init()");
+
+  this->device = device;
+  this->hostCallbacks = hostCallbacks;
+  this->cache = &cache;
+  this->jobs = &jobs;
+}
+
+void PipelineRegistry::Destroy() {
+  if (device == VK_NULL_HANDLE) {
+    return;
+  }
+
+  SPDLOG_TRACE("PipelineRegistry::Destroy()");
+
+  jobs->Wait(compiles);
+
+  for (auto &[hash, entry] : entries) {
+    if (entry->pipeline != VK_NULL_HANDLE) {
+      vkDestroyPipeline(device, entry->pipeline, hostCallbacks);
+    }
+    if (entry->reloaded != VK_NULL_HANDLE) {
+      vkDestroyPipeline(device, entry->reloaded, hostCallbacks);
+    }
+  }
+  entries.clear();
+
+  for (const RetiredPipeline &old : retired) {
+    vkDestroyPipeline(device, old.pipeline, hostCallbacks);
+  }
+  retired.clear();
+
+  device = VK_NULL_HANDLE;
+}
+
+PipelineEntry *PipelineRegistry::FindOrAdd(const PipelineDesc &desc,
+                                           PipelineEntry *fallback,
+                                           bool &created) {
+  uint64_t hash = desc.Hash();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  stats.requests++;
+
+  auto it = entries.find(hash);
+  if (it != entries.end()) {
+    if (!(it->second->desc == desc)) {
+      // Vanishingly unlikely with 64 bits, but we would rather know
+      throw std::runtime_error("Pipeline description hash collision");
+    }
+
+    stats.deduplicated++;
+    created = false;
+    return it->second.get();
+  }
+
+  auto entry = std::make_unique<PipelineEntry>();
+  entry->desc = desc;
+  entry->fallback = fallback;
+
+  PipelineEntry *result = entry.get();
+  entries.emplace(hash, std::move(entry));
+  stats.pipelines++;
+
+  created = true;
+  return result;
+}
+
+PipelineHandle PipelineRegistry::Build(const PipelineDesc &desc) {
+  bool created;
+  PipelineEntry *entry = FindOrAdd(desc, nullptr, created);
+
+  if (created) {
+    try {
+      entry->pipeline = Compile(desc);
+    } catch (...) {
+      entry->failed = true;
+      throw;
+    }
+  } else if (entry->pipeline == VK_NULL_HANDLE && !entry->failed) {
+    // Somebody requested it earlier and it is still compiling
+    jobs->Wait(compiles);
+  }
+
+  if (entry->failed) {
+    throw std::runtime_error("Failed to create graphics pipeline");
+  }
+
+  PipelineHandle handle;
+  handle.entry = entry;
+  return handle;
+}
+
+PipelineHandle PipelineRegistry::Request(const PipelineDesc &desc,
+                                         PipelineHandle fallback) {
+  bool created;
+  PipelineEntry *entry = FindOrAdd(desc, fallback.entry, created);
+
+  if (created) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stats.pending++;
+    }
+
+    jobs->Schedule(
+        [this, entry] {
+          try {
+            entry->pipeline = Compile(entry->desc);
+          } catch (const std::exception &e) {
+            spdlog::error("Pipeline {:016x} failed to compile: {}",
+                          entry->desc.Hash(), e.what());
+            entry->failed = true;
+          }
+
+          std::lock_guard<std::mutex> lock(mutex);
+          stats.pending--;
+          if (entry->failed) {
+            stats.failed++;
+          }
+        },
+        &compiles);
+  }
+
+  PipelineHandle handle;
+  handle.entry = entry;
+  return handle;
+}
+
+VkPipeline PipelineRegistry::Get(PipelineHandle handle) const {
+  // Walk down the fallbacks until we find one that is ready
+  for (PipelineEntry *entry = handle.entry; entry != nullptr;
+       entry = entry->fallback) {
+    VkPipeline pipeline = entry->pipeline.load(std::memory_order_acquire);
+    if (pipeline != VK_NULL_HANDLE) {
+      return pipeline;
+    }
+  }
+
+  return VK_NULL_HANDLE;
+}
+
+bool PipelineRegistry::IsReady(PipelineHandle handle) const {
+  return handle.entry != nullptr &&
+         handle.entry->pipeline.load(std::memory_order_acquire) !=
+             VK_NULL_HANDLE;
+}
+
+uint32_t PipelineRegistry::Reload(const std::string &shaderPath) {
+  SPDLOG_TRACE("PipelineRegistry::Reload({})", shaderPath);
+
+  std::vector<PipelineEntry *> matches;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &[hash, entry] : entries) {
+      if (entry->desc.vertexShader != shaderPath &&
+          entry->desc.fragmentShader != shaderPath) {
+        continue;
+      }
+
+      // Ones still on their first compile will load the new SPIR-V anyway
+      if (entry->pipeline == VK_NULL_HANDLE && !entry->failed) {
+        continue;
+      }
+      matches.push_back(entry.get());
+    }
+    stats.pending += static_cast<uint32_t>(matches.size());
+  }
+
+  for (PipelineEntry *entry : matches) {
+    jobs->Schedule(
+        [this, entry] {
+          try {
+            VkPipeline pipeline = Compile(entry->desc);
+
+            // Nothing has drawn with a rebuild that hasn't been applied, so
+            // one replaced by a newer rebuild can go straight away
+            VkPipeline unused = entry->reloaded.exchange(pipeline);
+            if (unused != VK_NULL_HANDLE) {
+              vkDestroyPipeline(device, unused, hostCallbacks);
+            } else {
+              reloadsReady++;
+            }
+          } catch (const std::exception &e) {
+            spdlog::error("Pipeline {:016x} failed to reload, keeping the old "
+                          "one: {}",
+                          entry->desc.Hash(), e.what());
+          }
+
+          std::lock_guard<std::mutex> lock(mutex);
+          stats.pending--;
+        },
+        &compiles);
+  }
+
+  return static_cast<uint32_t>(matches.size());
+}
+
+uint32_t PipelineRegistry::ApplyReloads(uint64_t frame) {
+  // A rebuild finishing while we look is either picked up now or counted
+  // again for next time
+  if (reloadsReady.exchange(0, std::memory_order_acquire) == 0) {
+    return 0;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  uint32_t applied = 0;
+  for (auto &[hash, entry] : entries) {
+    VkPipeline pipeline = entry->reloaded.exchange(VK_NULL_HANDLE);
+    if (pipeline == VK_NULL_HANDLE) {
+      continue;
+    }
+
+    VkPipeline old = entry->pipeline.exchange(pipeline);
+    if (old != VK_NULL_HANDLE) {
+      retired.push_back({old, frame});
+    }
+
+    // Fixing the shader fixes a pipeline that failed the first time
+    if (entry->failed.exchange(false)) {
+      stats.failed--;
+    }
+    applied++;
+  }
+
+  stats.reloads += applied;
+  return applied;
+}
+
+void PipelineRegistry::CollectRetired(uint64_t completedFrame) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  std::erase_if(retired, [&](const RetiredPipeline &old) {
+    if (old.lastFrame > completedFrame) {
+      return false;
+    }
+    vkDestroyPipeline(device, old.pipeline, hostCallbacks);
+    return true;
+  });
+}
+
+PipelineRegistryStats PipelineRegistry::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+// Shader modules in Vulkan do not seem to care what stage of the pipeline
+// that they are.
+VkShaderModule PipelineRegistry::CreateShaderModule(const std::string &path) {
+  VkShaderModuleCreateInfo createInfo = {};
+  createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+
+  // Packaged SPIR-V is aligned, so the driver can read it straight out of the
+  // mapping
+  AssetView asset = package != nullptr ? package->Find(path) : AssetView{};
+  std::vector<char> code;
+  if (asset.IsValid() && asset.type == AssetType::Shader) {
+    createInfo.codeSize = asset.data.size();
+    createInfo.pCode = reinterpret_cast<const uint32_t *>(asset.data.data());
+  } else {
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+
+    if (!file.is_open()) {
+      throw std::runtime_error("Failed to open file: " + path);
+    }
+
+    size_t fileSize = static_cast<size_t>(file.tellg());
+    code.resize(fileSize);
+
+    file.seekg(0);
+    file.read(code.data(), fileSize);
+
+    createInfo.codeSize = code.size();
+    createInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
+  }
+
+  VkShaderModule shaderModule;
+  if (vkCreateShaderModule(device, &createInfo, hostCallbacks, &shaderModule) !=
+      VK_SUCCESS) {
+    // It doesn't matter if the error is generic as the error should've come out
+    // at compile time of the shader (either external to the engine entirely
+    // or somewhere else in the engine).
+    throw std::runtime_error("Failed to create shader module");
+  }
+
+  return shaderModule;
+}
+
+VkPipeline PipelineRegistry::Compile(const PipelineDesc &desc) {
+  SPDLOG_TRACE("PipelineRegistry::Compile({:016x})", desc.Hash());
+
+  VkShaderModule vertShaderModule = CreateShaderModule(desc.vertexShader);
+  VkShaderModule fragShaderModule = VK_NULL_HANDLE;
+  try {
+    fragShaderModule = CreateShaderModule(desc.fragmentShader);
+  } catch (...) {
+    vkDestroyShaderModule(device, vertShaderModule, hostCallbacks);
+    throw;
+  }
+
+  // Creation of shaders creation info is almost identical between stages
+  // (vertex, fragment, etc.). We can use a lambda to reduce code duplication.
+  auto createShader =
+      [](VkShaderStageFlagBits stage,
+         VkShaderModule module) -> VkPipelineShaderStageCreateInfo {
+    VkPipelineShaderStageCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    createInfo.stage = stage;
+    createInfo.module = module;
+    createInfo.pName = "main";
+    return createInfo;
+  };
+
+  VkPipelineShaderStageCreateInfo shaderStages[] = {
+      createShader(VK_SHADER_STAGE_VERTEX_BIT, vertShaderModule),
+      createShader(VK_SHADER_STAGE_FRAGMENT_BIT, fragShaderModule)};
+
+  // Tell Vulkan we want to make use of dynamic states so we can modify
+  // viewport and scissor dynamically.
+  VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT,
+                                    VK_DYNAMIC_STATE_SCISSOR};
+
+  VkPipelineDynamicStateCreateInfo dynamicState = {};
+  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamicState.dynamicStateCount =
+      sizeof(dynamicStates) / sizeof(dynamicStates[0]);
+  dynamicState.pDynamicStates = dynamicStates;
+
+  // Vertex input is similar to a VAO in OpenGL. It describes the format of
+  // the vertex data that will be passed to the vertex shader.
+  VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+  vertexInputInfo.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertexInputInfo.vertexBindingDescriptionCount =
+      static_cast<uint32_t>(desc.bindings.size());
+  vertexInputInfo.pVertexBindingDescriptions = desc.bindings.data();
+  vertexInputInfo.vertexAttributeDescriptionCount =
+      static_cast<uint32_t>(desc.attributes.size());
+  vertexInputInfo.pVertexAttributeDescriptions = desc.attributes.data();
+
+  VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+  inputAssembly.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  inputAssembly.topology = desc.topology;
+  inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+  // Both are dynamic, only the counts matter here
+  VkPipelineViewportStateCreateInfo viewportState = {};
+  viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewportState.viewportCount = 1;
+  viewportState.scissorCount = 1;
+
+  VkPipelineRasterizationStateCreateInfo rasterizer = {};
+  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizer.depthClampEnable = VK_FALSE;
+  rasterizer.rasterizerDiscardEnable = VK_FALSE;
+  rasterizer.polygonMode = desc.polygonMode;
+  rasterizer.lineWidth = 1.0f;
+  rasterizer.cullMode = desc.cullMode;
+  rasterizer.frontFace = desc.frontFace;
+  rasterizer.depthBiasEnable = VK_FALSE;
+
+  VkPipelineMultisampleStateCreateInfo multisampling = {};
+  multisampling.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisampling.sampleShadingEnable = VK_FALSE;
+  multisampling.rasterizationSamples = desc.samples;
+  multisampling.minSampleShading = 1.0f;
+
+  // The same blending for every colour attachment
+  VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+  colorBlendAttachment.colorWriteMask =
+      VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  colorBlendAttachment.blendEnable = desc.blendEnable;
+  colorBlendAttachment.srcColorBlendFactor = desc.srcColorBlendFactor;
+  colorBlendAttachment.dstColorBlendFactor = desc.dstColorBlendFactor;
+  colorBlendAttachment.colorBlendOp = desc.colorBlendOp;
+  colorBlendAttachment.srcAlphaBlendFactor = desc.srcAlphaBlendFactor;
+  colorBlendAttachment.dstAlphaBlendFactor = desc.dstAlphaBlendFactor;
+  colorBlendAttachment.alphaBlendOp = desc.alphaBlendOp;
+
+  std::vector<VkPipelineColorBlendAttachmentState> colorBlendAttachments(
+      desc.colorFormats.size(), colorBlendAttachment);
+
+  VkPipelineColorBlendStateCreateInfo colorBlending = {};
+  colorBlending.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  colorBlending.logicOpEnable = VK_FALSE;
+  colorBlending.logicOp = VK_LOGIC_OP_COPY;
+  colorBlending.attachmentCount =
+      static_cast<uint32_t>(colorBlendAttachments.size());
+  colorBlending.pAttachments = colorBlendAttachments.data();
+
+  VkGraphicsPipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineInfo.stageCount = 2; // We have two shader stages, vertex and fragment
+  pipelineInfo.pStages = shaderStages;
+  pipelineInfo.pVertexInputState = &vertexInputInfo;
+  pipelineInfo.pInputAssemblyState = &inputAssembly;
+  pipelineInfo.pViewportState = &viewportState;
+  pipelineInfo.pRasterizationState = &rasterizer;
+  pipelineInfo.pMultisampleState = &multisampling;
+  pipelineInfo.pColorBlendState = &colorBlending;
+  pipelineInfo.pDynamicState = &dynamicState;
+  pipelineInfo.layout = desc.layout;
+  pipelineInfo.renderPass = desc.renderPass;
+  pipelineInfo.subpass = desc.subpass;
+
+  // Without a render pass it is for dynamic rendering, which only needs
+  // the attachment formats
+  VkPipelineRenderingCreateInfo renderingInfo = {};
+  renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+  renderingInfo.colorAttachmentCount =
+      static_cast<uint32_t>(desc.colorFormats.size());
+  renderingInfo.pColorAttachmentFormats = desc.colorFormats.data();
+  if (desc.renderPass == VK_NULL_HANDLE) {
+    pipelineInfo.pNext = &renderingInfo;
+  }
+
+  // The cache lets the driver skip compiling anything it has seen before,
+  // including in previous runs. It is internally synchronised so every
+  // worker can use it at once.
+  auto buildStart = std::chrono::high_resolution_clock::now();
+
+  VkPipeline pipeline;
+  VkResult result = vkCreateGraphicsPipelines(
+      device, cache->GetHandle(), 1, &pipelineInfo, hostCallbacks, &pipeline);
+
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::high_resolution_clock::now() - buildStart)
+                  .count();
+
+  // Similar to OpenGL, we can delete the shader modules after the pipeline has
+  // been created.
+  vkDestroyShaderModule(device, vertShaderModule, hostCallbacks);
+  vkDestroyShaderModule(device, fragShaderModule, hostCallbacks);
+
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create graphics pipeline");
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    cache->AddBuildTime(ms);
+  }
+
+  return pipeline;
+}
+
+} // namespace MiniEngine
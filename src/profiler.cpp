@@ -0,0 +1,417 @@
+#include <miniengine/profiler.h>
+
+#include <spdlog/spdlog.h>
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace MiniEngine {
+
+// Chrome traces want a thread id per event, these are just handed out in the
+// order threads first record something
+static std::atomic<uint32_t> nextThreadNumber = 0;
+static thread_local uint32_t threadNumber = UINT32_MAX;
+
+// Not a real thread, the GPU's events go on a lane of their own
+constexpr uint32_t GPU_THREAD = 1000;
+
+static uint32_t GetThreadNumber() {
+  if (threadNumber == UINT32_MAX) {
+    threadNumber = nextThreadNumber.fetch_add(1);
+  }
+  return threadNumber;
+}
+
+ProfilePercentiles ComputePercentiles(std::vector<double> values) {
+  return ComputePercentiles(std::span<double>(values));
+}
+
+ProfilePercentiles ComputePercentiles(std::span<double> values) {
+  ProfilePercentiles result;
+  if (values.empty()) {
+    return result;
+  }
+
+  std::sort(values.begin(), values.end());
+  auto at = [&](double p) {
+    return values[std::min(values.size() - 1,
+                           static_cast<size_t>(p * values.size()))];
+  };
+
+  result.p50 = at(0.50);
+  result.p95 = at(0.95);
+  result.p99 = at(0.99);
+  result.max = values.back();
+  return result;
+}
+
+void Profiler::Init(VkDevice device, uint32_t frameCount, float timestampPeriod,
+                    bool gpuTimestamps,
+                    const VkAllocationCallbacks *hostCallbacks) {
+  SPDLOG_TRACE("Profiler::Init({}, {})", frameCount, gpuTimestamps);
+
+  this->device = device;
+  this->hostCallbacks = hostCallbacks;
+  this->timestampPeriod = timestampPeriod;
+  this->gpuTimestamps = gpuTimestamps;
+  this->epoch = std::chrono::high_resolution_clock::now();
+
+  frameTimes.assign(PROFILER_HISTORY, 0.0f);
+  history.resize(PROFILER_HISTORY);
+  percentileValues.reserve(PROFILER_HISTORY * PROFILER_MAX_GPU_SCOPES);
+
+  // Main thread first so it is thread 0 in traces
+  GetThreadNumber();
+
+  for (uint32_t i = 0; i < frameCount; i++) {
+    auto slot = std::make_unique<FrameSlot>();
+
+    if (gpuTimestamps) {
+      VkQueryPoolCreateInfo poolInfo = {};
+      poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+      poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+      poolInfo.queryCount = PROFILER_MAX_GPU_SCOPES * 2;
+
+      if (vkCreateQueryPool(device, &poolInfo, hostCallbacks,
+                            &slot->queryPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create timestamp query pool");
+      }
+    }
+
+    slots.push_back(std::move(slot));
+  }
+}
+
+void Profiler::Destroy() {
+  if (device == VK_NULL_HANDLE) {
+    return;
+  }
+
+  SPDLOG_TRACE("Profiler::Destroy()");
+
+  for (auto &slot : slots) {
+    if (slot->queryPool != VK_NULL_HANDLE) {
+      vkDestroyQueryPool(device, slot->queryPool, hostCallbacks);
+    }
+  }
+  slots.clear();
+
+  device = VK_NULL_HANDLE;
+}
+
+double
+Profiler::ToMs(std::chrono::high_resolution_clock::time_point time) const {
+  return std::chrono::duration<double, std::milli>(time - epoch).count();
+}
+
+void Profiler::BeginFrame(
+    uint32_t frameIndex, std::chrono::high_resolution_clock::time_point start) {
+  double now = ToMs(std::chrono::high_resolution_clock::now());
+  double startMs = ToMs(start);
+
+  // Close off the frame before this one
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (frameNumber > 0) {
+      current.cpuMs = startMs - current.startMs;
+
+      frameTimes[frameTimesOffset] = static_cast<float>(current.cpuMs);
+      frameTimesOffset = (frameTimesOffset + 1) % PROFILER_HISTORY;
+
+      // Over the oldest frame once the ring is full
+      uint32_t slot = (historyStart + historyCount) % PROFILER_HISTORY;
+      if (historyCount < PROFILER_HISTORY) {
+        historyCount++;
+      } else {
+        historyStart = (historyStart + 1) % PROFILER_HISTORY;
+      }
+      std::swap(history[slot], current);
+    }
+
+    current.frame = frameNumber;
+    current.startMs = startMs;
+    current.cpuMs = 0.0;
+    current.latencyMs = 0.0;
+    current.cpuEvents.clear();
+    current.gpuEvents.clear();
+  }
+
+  // Everything the slot was last used for has finished, so whatever it
+  // measured can be filled in
+  currentSlot = slots[frameIndex].get();
+  if (ProfileFrame *frame = FindFrame(currentSlot->frame)) {
+    if (currentSlot->inputMs > 0.0) {
+      frame->latencyMs = now - currentSlot->inputMs;
+    }
+    ReadGpuResults(*currentSlot, *frame);
+  }
+
+  currentSlot->frame = frameNumber;
+  currentSlot->submitMs = now;
+  currentSlot->inputMs = 0.0;
+  currentSlot->scopeCount = 0;
+
+  frameNumber++;
+}
+
+void Profiler::SetInputTime(
+    std::chrono::high_resolution_clock::time_point time) {
+  currentSlot->inputMs = ToMs(time);
+}
+
+ProfileFrame *Profiler::FindFrame(uint64_t frame) {
+  // Almost always one of the last few
+  for (uint32_t i = historyCount; i-- > 0;) {
+    ProfileFrame &found = history[(historyStart + i) % PROFILER_HISTORY];
+    if (found.frame == frame) {
+      return &found;
+    }
+  }
+  return nullptr;
+}
+
+void Profiler::ReadGpuResults(FrameSlot &slot, ProfileFrame &frame) {
+  uint32_t scopeCount = slot.scopeCount;
+  if (!gpuTimestamps || scopeCount == 0) {
+    return;
+  }
+
+  // The fence for this slot has signalled so the results are there already,
+  // no WAIT_BIT needed
+  uint64_t timestamps[PROFILER_MAX_GPU_SCOPES * 2];
+  VkResult result = vkGetQueryPoolResults(
+      device, slot.queryPool, 0, scopeCount * 2, sizeof(timestamps),
+      timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+  if (result != VK_SUCCESS) {
+    return;
+  }
+
+  // GPU time has nothing to do with CPU time, so line the first timestamp up
+  // with when the frame started recording. Good enough to see overlap.
+  uint64_t base = timestamps[0];
+  for (uint32_t i = 0; i < scopeCount; i++) {
+    base = std::min(base, timestamps[i * 2]);
+  }
+
+  auto toMs = [&](uint64_t ticks) { return ticks * timestampPeriod / 1e6; };
+
+  for (uint32_t i = 0; i < scopeCount; i++) {
+    uint64_t begin = timestamps[i * 2];
+    uint64_t end = timestamps[i * 2 + 1];
+
+    ProfileEvent event;
+    event.name = slot.scopeNames[i];
+    event.thread = GPU_THREAD;
+    event.startMs = slot.submitMs + toMs(begin - base);
+    event.durationMs = end > begin ? toMs(end - begin) : 0.0;
+    frame.gpuEvents.push_back(event);
+  }
+}
+
+void Profiler::BeginGpuFrame(VkCommandBuffer commandBuffer) {
+  if (!gpuTimestamps) {
+    return;
+  }
+
+  vkCmdResetQueryPool(commandBuffer, currentSlot->queryPool, 0,
+                      PROFILER_MAX_GPU_SCOPES * 2);
+}
+
+uint32_t Profiler::BeginGpuScope(VkCommandBuffer commandBuffer,
+                                 const char *name) {
+  if (!gpuTimestamps) {
+    return UINT32_MAX;
+  }
+
+  uint32_t scope = currentSlot->scopeCount.fetch_add(1);
+  if (scope >= PROFILER_MAX_GPU_SCOPES) {
+    currentSlot->scopeCount = PROFILER_MAX_GPU_SCOPES;
+    return UINT32_MAX;
+  }
+
+  currentSlot->scopeNames[scope] = name;
+
+  // Top of pipe, written as soon as the GPU gets to this point
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      currentSlot->queryPool, scope * 2);
+  return scope;
+}
+
+void Profiler::EndGpuScope(VkCommandBuffer commandBuffer, uint32_t scope) {
+  if (scope == UINT32_MAX) {
+    return;
+  }
+
+  // Bottom of pipe, written once everything before it has finished
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      currentSlot->queryPool, scope * 2 + 1);
+}
+
+void Profiler::AddCpuEvent(
+    const char *name, std::chrono::high_resolution_clock::time_point start,
+    std::chrono::high_resolution_clock::time_point end) {
+  ProfileEvent event;
+  event.name = name;
+  event.thread = GetThreadNumber();
+  event.startMs = ToMs(start);
+  event.durationMs = std::chrono::duration<double, std::milli>(end - start)
+                         .count();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  current.cpuEvents.push_back(event);
+}
+
+bool Profiler::GetLatestGpuFrame(const char *name, uint64_t &frame,
+                                 double &scopeMs, double &frameMs) const {
+  for (uint32_t i = historyCount; i-- > 0;) {
+    const ProfileFrame &candidate = GetHistoryFrame(i);
+    if (candidate.gpuEvents.empty()) {
+      continue;
+    }
+
+    double start = candidate.gpuEvents[0].startMs;
+    double end = start;
+    scopeMs = 0.0;
+    for (auto &event : candidate.gpuEvents) {
+      start = std::min(start, event.startMs);
+      end = std::max(end, event.startMs + event.durationMs);
+      if (strcmp(event.name, name) == 0) {
+        scopeMs += event.durationMs;
+      }
+    }
+
+    frame = candidate.frame;
+    frameMs = end - start;
+    return true;
+  }
+  return false;
+}
+
+ProfilePercentiles Profiler::GetCpuFramePercentiles() const {
+  percentileValues.clear();
+  for (uint32_t i = 0; i < historyCount; i++) {
+    percentileValues.push_back(GetHistoryFrame(i).cpuMs);
+  }
+  return ComputePercentiles(std::span<double>(percentileValues));
+}
+
+ProfilePercentiles Profiler::GetLatencyPercentiles() const {
+  percentileValues.clear();
+  for (uint32_t i = 0; i < historyCount; i++) {
+    const ProfileFrame &frame = GetHistoryFrame(i);
+    if (frame.latencyMs > 0.0) {
+      percentileValues.push_back(frame.latencyMs);
+    }
+  }
+  return ComputePercentiles(std::span<double>(percentileValues));
+}
+
+ProfilePercentiles Profiler::GetGpuPercentiles(const char *name) const {
+  percentileValues.clear();
+  for (uint32_t i = 0; i < historyCount; i++) {
+    for (auto &event : GetHistoryFrame(i).gpuEvents) {
+      if (strcmp(event.name, name) == 0) {
+        percentileValues.push_back(event.durationMs);
+      }
+    }
+  }
+  return ComputePercentiles(std::span<double>(percentileValues));
+}
+
+bool Profiler::ExportChromeTrace(const std::string &path) const {
+  SPDLOG_TRACE("Profiler::ExportChromeTrace({})", path);
+
+  std::ofstream file(path, std::ios::trunc);
+  if (!file.is_open()) {
+    spdlog::error("Failed to open {} for writing", path);
+    return false;
+  }
+
+  // Complete ("X") events take microseconds
+  bool first = true;
+  auto writeEvent = [&](const ProfileEvent &event) {
+    file << (first ? "\n" : ",\n") << R"({"name":")" << event.name
+         << R"(","ph":"X","pid":0,"tid":)" << event.thread
+         << R"(,"ts":)" << event.startMs * 1000.0
+         << R"(,"dur":)" << event.durationMs * 1000.0 << "}";
+    first = false;
+  };
+
+  file << R"({"displayTimeUnit":"ms","traceEvents":[)";
+  file << "\n" << R"({"name":"thread_name","ph":"M","pid":0,"tid":)"
+       << GPU_THREAD << R"(,"args":{"name":"GPU"}})";
+  first = false;
+
+  for (uint32_t i = 0; i < historyCount; i++) {
+    const ProfileFrame &frame = GetHistoryFrame(i);
+    writeEvent({"Frame", 0, frame.startMs, frame.cpuMs});
+    for (auto &event : frame.cpuEvents) {
+      writeEvent(event);
+    }
+    for (auto &event : frame.gpuEvents) {
+      writeEvent(event);
+    }
+  }
+
+  file << "\n]}\n";
+
+  spdlog::info("Wrote {} frames of profiling to {}", historyCount, path);
+  return true;
+}
+
+void Profiler::DrawImGui() {
+  ProfilePercentiles cpu = GetCpuFramePercentiles();
+
+  char overlay[64];
+  snprintf(overlay, sizeof(overlay), "p50 %.2fms p99 %.2fms", cpu.p50,
+           cpu.p99);
+  ImGui::PlotLines("Frame", frameTimes.data(),
+                   static_cast<int>(frameTimes.size()),
+                   static_cast<int>(frameTimesOffset), overlay, 0.0f,
+                   static_cast<float>(std::max(cpu.max, 1.0)),
+                   ImVec2(0, 60));
+  ImGui::Text("CPU p50 %.2f p95 %.2f p99 %.2f max %.2f ms", cpu.p50, cpu.p95,
+              cpu.p99, cpu.max);
+
+  ProfilePercentiles latency = GetLatencyPercentiles();
+  ImGui::Text("Latency p50 %.2f p99 %.2f ms (input to GPU done)", latency.p50,
+              latency.p99);
+
+  if (historyCount == 0) {
+    return;
+  }
+
+  // The last complete frame's scopes
+  const ProfileFrame &last = GetHistoryFrame(historyCount - 1);
+  for (auto &event : last.cpuEvents) {
+    ImGui::Text("  %s: %.3f ms", event.name, event.durationMs);
+  }
+
+  if (!gpuTimestamps) {
+    ImGui::Text("GPU timestamps not supported");
+    return;
+  }
+
+  // GPU results arrive late, so look for the newest frame that has them
+  for (uint32_t i = historyCount; i-- > 0;) {
+    const ProfileFrame &frame = GetHistoryFrame(i);
+    if (frame.gpuEvents.empty()) {
+      continue;
+    }
+
+    for (auto &event : frame.gpuEvents) {
+      ProfilePercentiles gpu = GetGpuPercentiles(event.name);
+      ImGui::Text("  GPU %s: %.3f ms (p95 %.3f)", event.name,
+                  event.durationMs, gpu.p95);
+    }
+    break;
+  }
+}
+
+} // namespace MiniEngine
@@ -0,0 +1,211 @@
+#include <miniengine/recording.h>
+
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <stdexcept>
+
+namespace MiniEngine {
+
+void ParallelRecorder::Init(VkDevice device, JobScheduler &jobs,
+                            uint32_t queueFamily, uint32_t frameCount,
+                            const VkAllocationCallbacks *hostCallbacks) {
+  SPDLOG_TRACE("ParallelRecorder::Init({})", frameCount);
+
+  this->device = device;
+  this->hostCallbacks = hostCallbacks;
+  this->jobs = &jobs;
+
+  threads.resize(jobs.GetThreadCount());
+  for (auto &thread : threads) {
+    thread.frames.resize(frameCount);
+
+    for (auto &frame : thread.frames) {
+      // No RESET_COMMAND_BUFFER flag, buffers are only ever reset along with
+      // the whole pool which is much cheaper than resetting them one by one
+      VkCommandPoolCreateInfo poolInfo = {};
+      poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+      poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+      poolInfo.queueFamilyIndex = queueFamily;
+
+      if (vkCreateCommandPool(device, &poolInfo, hostCallbacks, &frame.pool) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("Failed to create recording command pool");
+      }
+    }
+  }
+}
+
+void ParallelRecorder::Destroy() {
+  if (device == VK_NULL_HANDLE) {
+    return;
+  }
+
+  SPDLOG_TRACE("ParallelRecorder::Destroy()");
+
+  // Destroying a pool frees every command buffer allocated from it
+  for (auto &thread : threads) {
+    for (auto &frame : thread.frames) {
+      vkDestroyCommandPool(device, frame.pool, hostCallbacks);
+    }
+  }
+  threads.clear();
+
+  device = VK_NULL_HANDLE;
+}
+
+void ParallelRecorder::BeginFrame(uint32_t frameIndex) {
+  this->frameIndex = frameIndex;
+
+  for (auto &thread : threads) {
+    ThreadPool &frame = thread.frames[frameIndex];
+    vkResetCommandPool(device, frame.pool, 0);
+    frame.used = 0;
+
+    thread.stats.lastFrameMs = 0.0;
+  }
+}
+
+VkCommandBuffer
+ParallelRecorder::BeginSecondary(uint32_t thread,
+                                 const VkCommandBufferInheritanceInfo &info) {
+  ThreadPool &frame = threads[thread].frames[frameIndex];
+
+  if (frame.used == frame.buffers.size()) {
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = frame.pool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("Failed to allocate secondary command buffer");
+    }
+    frame.buffers.push_back(commandBuffer);
+  }
+
+  VkCommandBuffer commandBuffer = frame.buffers[frame.used++];
+
+  // Secondary buffers executed inside a render pass have to say which one
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                    VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+  beginInfo.pInheritanceInfo = &info;
+
+  if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to begin secondary command buffer");
+  }
+
+  return commandBuffer;
+}
+
+const std::vector<VkCommandBuffer> &
+ParallelRecorder::Record(const VkCommandBufferInheritanceInfo &inheritance,
+                         uint32_t chunkCount, const RecordFunction &record) {
+  results.assign(chunkCount, VK_NULL_HANDLE);
+  error = nullptr;
+
+  // A single chunk is not worth handing to another thread
+  if (chunkCount == 1) {
+    RecordChunk(inheritance, record, 0);
+  } else {
+    // Read from here rather than captured, which keeps each job small
+    // enough for std::function to store without allocating
+    currentInheritance = &inheritance;
+    currentRecord = &record;
+
+    JobCounter counter;
+    for (uint32_t chunk = 0; chunk < chunkCount; chunk++) {
+      jobs->Schedule(
+          [this, chunk] {
+            RecordChunk(*currentInheritance, *currentRecord, chunk);
+          },
+          &counter);
+    }
+    jobs->Wait(counter);
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  return results;
+}
+
+VkCommandBuffer ParallelRecorder::RecordOnCaller(
+    const VkCommandBufferInheritanceInfo &inheritance,
+    const std::function<void(VkCommandBuffer)> &record) {
+  uint32_t thread = jobs->GetThreadIndex();
+  RecorderThreadStats &stats = threads[thread].stats;
+  auto start = std::chrono::high_resolution_clock::now();
+
+  VkCommandBuffer commandBuffer = BeginSecondary(thread, inheritance);
+  record(commandBuffer);
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to record secondary command buffer");
+  }
+
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::high_resolution_clock::now() - start)
+                  .count();
+  stats.lastFrameMs += ms;
+  stats.totalMs += ms;
+  stats.commandBuffers++;
+
+  return commandBuffer;
+}
+
+void ParallelRecorder::RecordChunk(
+    const VkCommandBufferInheritanceInfo &inheritance,
+    const RecordFunction &record, uint32_t chunk) {
+  // Whichever thread runs the job records with that thread's own pool
+  uint32_t thread = jobs->GetThreadIndex();
+  RecorderThreadStats &stats = threads[thread].stats;
+  auto start = std::chrono::high_resolution_clock::now();
+
+  try {
+    VkCommandBuffer commandBuffer = BeginSecondary(thread, inheritance);
+    record(commandBuffer, chunk);
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to record secondary command buffer");
+    }
+
+    results[chunk] = commandBuffer;
+    stats.commandBuffers++;
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(errorMutex);
+    if (!error) {
+      error = std::current_exception();
+    }
+  }
+
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::high_resolution_clock::now() - start)
+                  .count();
+  stats.lastFrameMs += ms;
+  stats.totalMs += ms;
+}
+
+const RecorderThreadStats &
+ParallelRecorder::GetThreadStats(uint32_t thread) const {
+  return threads[thread].stats;
+}
+
+std::vector<RecorderThreadStats> ParallelRecorder::GetStats() const {
+  std::vector<RecorderThreadStats> stats;
+  for (auto &thread : threads) {
+    stats.push_back(thread.stats);
+  }
+  return stats;
+}
+
+void ParallelRecorder::ResetStats() {
+  for (auto &thread : threads) {
+    thread.stats = {};
+  }
+}
+
+} // namespace MiniEngine
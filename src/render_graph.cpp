@@ -0,0 +1,1280 @@
+#include <miniengine/render_graph.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <string>
+
+namespace MiniEngine {
+
+static bool IsDepthFormat(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_D16_UNORM:
+  case VK_FORMAT_D32_SFLOAT:
+  case VK_FORMAT_D24_UNORM_S8_UINT:
+  case VK_FORMAT_D32_SFLOAT_S8_UINT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static VkImageAspectFlags GetAspect(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_D16_UNORM:
+  case VK_FORMAT_D32_SFLOAT:
+    return VK_IMAGE_ASPECT_DEPTH_BIT;
+  case VK_FORMAT_D24_UNORM_S8_UINT:
+  case VK_FORMAT_D32_SFLOAT_S8_UINT:
+    return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+  default:
+    return VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+}
+
+static bool SameAttachment(const VkAttachmentDescription &a,
+                           const VkAttachmentDescription &b) {
+  return a.format == b.format && a.samples == b.samples &&
+         a.loadOp == b.loadOp && a.storeOp == b.storeOp &&
+         a.initialLayout == b.initialLayout && a.finalLayout == b.finalLayout;
+}
+
+// synchronization2 split some stages and accesses up, each part is within
+// the Vulkan 1.0 one it came from
+static VkPipelineStageFlags ToLegacyStages(VkPipelineStageFlags2 stages) {
+  VkPipelineStageFlags legacy = static_cast<VkPipelineStageFlags>(
+      stages & 0xffffffffu);
+  if (stages & (VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_BLIT_BIT |
+                VK_PIPELINE_STAGE_2_RESOLVE_BIT |
+                VK_PIPELINE_STAGE_2_CLEAR_BIT)) {
+    legacy |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+  }
+  if (stages & (VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT |
+                VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT)) {
+    legacy |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+  }
+  if (stages & VK_PIPELINE_STAGE_2_PRE_RASTERIZATION_SHADERS_BIT) {
+    legacy |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+              VK_PIPELINE_STAGE_TESSELLATION_CONTROL_SHADER_BIT |
+              VK_PIPELINE_STAGE_TESSELLATION_EVALUATION_SHADER_BIT |
+              VK_PIPELINE_STAGE_GEOMETRY_SHADER_BIT;
+  }
+  return legacy;
+}
+
+static VkAccessFlags ToLegacyAccess(VkAccessFlags2 access) {
+  VkAccessFlags legacy = static_cast<VkAccessFlags>(access & 0xffffffffu);
+  if (access & (VK_ACCESS_2_SHADER_SAMPLED_READ_BIT |
+                VK_ACCESS_2_SHADER_STORAGE_READ_BIT)) {
+    legacy |= VK_ACCESS_SHADER_READ_BIT;
+  }
+  if (access & VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT) {
+    legacy |= VK_ACCESS_SHADER_WRITE_BIT;
+  }
+  return legacy;
+}
+
+RenderPassBuilder &RenderPassBuilder::WriteColor(RenderGraphImage image,
+                                                 const VkClearValue *clear,
+                                                 RenderGraphImage resolve) {
+  RenderGraph::Use use = {};
+  use.kind = RenderGraph::UseKind::Color;
+  use.resource = image.index;
+  use.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  use.stages = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+  use.access = VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT |
+               VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+  use.write = true;
+  if (clear != nullptr) {
+    use.clear = true;
+    use.clearValue = *clear;
+  }
+  graph.AddUse(pass, use);
+
+  if (resolve.IsValid()) {
+    // Every texel is overwritten, so what was there never matters
+    RenderGraph::Use resolveUse = use;
+    resolveUse.kind = RenderGraph::UseKind::Resolve;
+    resolveUse.resource = resolve.index;
+    resolveUse.access = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+    resolveUse.clear = false;
+    graph.AddUse(pass, resolveUse);
+  }
+  return *this;
+}
+
+RenderPassBuilder &RenderPassBuilder::WriteDepth(RenderGraphImage image,
+                                                 const VkClearValue *clear) {
+  RenderGraph::Use use = {};
+  use.kind = RenderGraph::UseKind::Depth;
+  use.resource = image.index;
+  use.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  use.stages = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+               VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+  use.access = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+               VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  use.write = true;
+  if (clear != nullptr) {
+    use.clear = true;
+    use.clearValue = *clear;
+  }
+  graph.AddUse(pass, use);
+  return *this;
+}
+
+RenderPassBuilder &
+RenderPassBuilder::ReadTexture(RenderGraphImage image,
+                               VkPipelineStageFlags2 stages) {
+  return ReadImage(image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, stages,
+                   VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+}
+
+RenderPassBuilder &RenderPassBuilder::ReadImage(RenderGraphImage image,
+                                                VkImageLayout layout,
+                                                VkPipelineStageFlags2 stages,
+                                                VkAccessFlags2 access) {
+  RenderGraph::Use use = {};
+  use.kind = RenderGraph::UseKind::Image;
+  use.resource = image.index;
+  use.layout = layout;
+  use.stages = stages;
+  use.access = access;
+  graph.AddUse(pass, use);
+  return *this;
+}
+
+RenderPassBuilder &RenderPassBuilder::WriteImage(RenderGraphImage image,
+                                                 VkImageLayout layout,
+                                                 VkPipelineStageFlags2 stages,
+                                                 VkAccessFlags2 access) {
+  RenderGraph::Use use = {};
+  use.kind = RenderGraph::UseKind::Image;
+  use.resource = image.index;
+  use.layout = layout;
+  use.stages = stages;
+  use.access = access;
+  use.write = true;
+  graph.AddUse(pass, use);
+  return *this;
+}
+
+RenderPassBuilder &RenderPassBuilder::ReadBuffer(RenderGraphBuffer buffer,
+                                                 VkPipelineStageFlags2 stages,
+                                                 VkAccessFlags2 access) {
+  RenderGraph::Use use = {};
+  use.kind = RenderGraph::UseKind::Buffer;
+  use.resource = buffer.index;
+  use.stages = stages;
+  use.access = access;
+  graph.AddUse(pass, use);
+  return *this;
+}
+
+RenderPassBuilder &RenderPassBuilder::WriteBuffer(RenderGraphBuffer buffer,
+                                                  VkPipelineStageFlags2 stages,
+                                                  VkAccessFlags2 access) {
+  RenderGraph::Use use = {};
+  use.kind = RenderGraph::UseKind::Buffer;
+  use.resource = buffer.index;
+  use.stages = stages;
+  use.access = access;
+  use.write = true;
+  graph.AddUse(pass, use);
+  return *this;
+}
+
+RenderPassBuilder &RenderPassBuilder::SetSideEffects() {
+  graph.passes[pass].sideEffects = true;
+  return *this;
+}
+
+RenderPassBuilder &RenderPassBuilder::UseSecondaries() {
+  graph.passes[pass].secondaries = true;
+  return *this;
+}
+
+void RenderGraph::Init(VkDevice device, GpuAllocator &allocator, bool vulkan13,
+                       const VkAllocationCallbacks *hostCallbacks) {
+  SPDLOG_TRACE("RenderGraph::Init({})", vulkan13);
+
+  this->device = device;
+  this->hostCallbacks = hostCallbacks;
+  this->allocator = &allocator;
+  this->vulkan13 = vulkan13;
+
+  // Tiled GPUs have lazily allocated memory, desktop ones usually don't
+  const VkPhysicalDeviceMemoryProperties &memoryProperties =
+      allocator.GetMemoryProperties();
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+    if (memoryProperties.memoryTypes[i].propertyFlags &
+        VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) {
+      lazyMemory = true;
+    }
+  }
+}
+
+void RenderGraph::Destroy() {
+  if (device == VK_NULL_HANDLE) {
+    return;
+  }
+
+  SPDLOG_TRACE("RenderGraph::Destroy()");
+
+  // Only called once the device is idle, so everything retired can go too
+  RetireTransients();
+  for (CachedFramebuffer &cached : framebuffers) {
+    vkDestroyFramebuffer(device, cached.framebuffer, hostCallbacks);
+  }
+  framebuffers.clear();
+  BeginFrame(UINT64_MAX);
+
+  for (CachedRenderPass &cached : renderPasses) {
+    vkDestroyRenderPass(device, cached.renderPass, hostCallbacks);
+  }
+  renderPasses.clear();
+  bufferStates.clear();
+
+  device = VK_NULL_HANDLE;
+}
+
+void RenderGraph::BeginFrame(uint64_t completedFrame) {
+  std::erase_if(retired, [&](RetiredObject &old) {
+    if (old.lastFrame > completedFrame) {
+      return false;
+    }
+    if (old.framebuffer != VK_NULL_HANDLE) {
+      vkDestroyFramebuffer(device, old.framebuffer, hostCallbacks);
+    }
+    if (old.view != VK_NULL_HANDLE) {
+      vkDestroyImageView(device, old.view, hostCallbacks);
+    }
+    if (old.image != VK_NULL_HANDLE) {
+      vkDestroyImage(device, old.image, hostCallbacks);
+    }
+    if (old.allocation.IsValid()) {
+      allocator->Free(old.allocation);
+    }
+    return true;
+  });
+
+  // Framebuffers for views that went away without ReleaseView, or for a
+  // shape the graph no longer has
+  std::erase_if(framebuffers, [&](CachedFramebuffer &cached) {
+    if (cached.lastFrame + RENDER_GRAPH_FRAMEBUFFER_IDLE_FRAMES > frame ||
+        cached.lastFrame > completedFrame) {
+      return false;
+    }
+    vkDestroyFramebuffer(device, cached.framebuffer, hostCallbacks);
+    return true;
+  });
+
+  passes.clear();
+  uses.clear();
+  images.clear();
+  buffers.clear();
+}
+
+RenderGraphImage RenderGraph::ImportImage(
+    VkImage image, VkImageView view, VkFormat format, VkExtent2D extent,
+    VkImageLayout initialLayout, VkPipelineStageFlags2 stages,
+    VkImageLayout finalLayout, VkSampleCountFlagBits samples) {
+  Image imported;
+  imported.image = image;
+  imported.view = view;
+  imported.format = format;
+  imported.extent = extent;
+  imported.samples = samples;
+  imported.aspect = GetAspect(format);
+  imported.imported = true;
+  imported.importLayout = initialLayout;
+  imported.importStages = stages;
+  imported.finalLayout = finalLayout;
+
+  images.push_back(imported);
+  return {static_cast<uint32_t>(images.size() - 1)};
+}
+
+RenderGraphImage RenderGraph::CreateImage(const TransientImageDesc &desc) {
+  Image transient;
+  transient.format = desc.format;
+  transient.extent = desc.extent;
+  transient.samples = desc.samples;
+  transient.aspect = GetAspect(desc.format);
+  transient.desc = desc;
+
+  images.push_back(transient);
+  return {static_cast<uint32_t>(images.size() - 1)};
+}
+
+RenderGraphBuffer RenderGraph::ImportBuffer(VkBuffer buffer) {
+  Buffer imported;
+  imported.buffer = buffer;
+  for (auto &[known, state] : bufferStates) {
+    if (known == buffer) {
+      imported.state = state;
+    }
+  }
+
+  buffers.push_back(imported);
+  return {static_cast<uint32_t>(buffers.size() - 1)};
+}
+
+RenderPassBuilder RenderGraph::AddPass(const char *name, RenderPassType type,
+                                       RenderPassFunction record) {
+  Pass pass;
+  pass.name = name;
+  pass.type = type;
+  pass.record = std::move(record);
+  pass.firstUse = static_cast<uint32_t>(uses.size());
+
+  passes.push_back(std::move(pass));
+  return RenderPassBuilder(*this, static_cast<uint32_t>(passes.size() - 1));
+}
+
+void RenderGraph::AddUse(uint32_t pass, const Use &use) {
+  // Each pass's uses are kept together, so they have to be declared before
+  // the next pass is added
+  Pass &owner = passes[pass];
+  if (owner.firstUse + owner.useCount != uses.size()) {
+    throw std::runtime_error(
+        "Failed to add a use to render pass " + std::string(owner.name) +
+        ", another pass has been added since");
+  }
+
+  uses.push_back(use);
+  owner.useCount++;
+}
+
+void RenderGraph::Cull() {
+  // Every image and then every buffer. Imported ones are seen by whatever
+  // runs after the graph, so their last contents always matter.
+  size_t imageCount = images.size();
+  needed.assign(imageCount + buffers.size(), 0);
+  for (size_t i = 0; i < imageCount; i++) {
+    needed[i] = images[i].imported;
+  }
+  std::fill(needed.begin() + imageCount, needed.end(), 1);
+
+  auto slot = [&](const Use &use) {
+    return use.kind == UseKind::Buffer ? imageCount + use.resource
+                                       : use.resource;
+  };
+
+  // Backwards, a pass is alive if something alive (or outside the graph)
+  // reads what it writes
+  for (size_t p = passes.size(); p-- > 0;) {
+    Pass &pass = passes[p];
+    std::span<const Use> passUses(uses.data() + pass.firstUse, pass.useCount);
+
+    pass.alive = pass.sideEffects;
+    for (const Use &use : passUses) {
+      if (use.write && needed[slot(use)]) {
+        pass.alive = true;
+      }
+    }
+
+    if (!pass.alive) {
+      stats.culledPasses++;
+      continue;
+    }
+
+    // A cleared or resolved attachment doesn't depend on what came before,
+    // anything else that is written might only be written in part
+    for (const Use &use : passUses) {
+      if (use.clear || use.kind == UseKind::Resolve) {
+        needed[slot(use)] = 0;
+      }
+    }
+    for (const Use &use : passUses) {
+      if (!use.write ||
+          (!use.clear && use.kind != UseKind::Resolve)) {
+        needed[slot(use)] = 1;
+      }
+    }
+  }
+}
+
+void RenderGraph::Compile() {
+  stats.passes = static_cast<uint32_t>(passes.size());
+  stats.culledPasses = 0;
+
+  Cull();
+
+  // Lifetimes and usage, from the passes that survived
+  for (uint32_t p = 0; p < passes.size(); p++) {
+    if (!passes[p].alive) {
+      continue;
+    }
+
+    for (uint32_t u = 0; u < passes[p].useCount; u++) {
+      const Use &use = uses[passes[p].firstUse + u];
+      if (use.kind == UseKind::Buffer) {
+        continue;
+      }
+
+      Image &image = images[use.resource];
+      image.firstPass = std::min(image.firstPass, p);
+      image.lastPass = std::max(image.lastPass, p);
+
+      switch (use.kind) {
+      case UseKind::Color:
+      case UseKind::Resolve:
+        image.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        break;
+      case UseKind::Depth:
+        image.usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        break;
+      default:
+        image.attachmentOnly = false;
+        if (use.layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+          image.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+        } else if (use.layout == VK_IMAGE_LAYOUT_GENERAL) {
+          image.usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+        } else if (use.layout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
+          image.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        } else if (use.layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+          image.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        }
+        break;
+      }
+    }
+  }
+
+  PlaceTransients();
+
+  // Forwards, tracking which images hold anything worth loading
+  for (Image &image : images) {
+    image.hasContents =
+        image.imported && image.importLayout != VK_IMAGE_LAYOUT_UNDEFINED;
+  }
+
+  for (uint32_t p = 0; p < passes.size(); p++) {
+    Pass &pass = passes[p];
+    if (!pass.alive) {
+      continue;
+    }
+
+    for (uint32_t u = 0; u < pass.useCount; u++) {
+      Use &use = uses[pass.firstUse + u];
+      if (use.kind == UseKind::Buffer) {
+        continue;
+      }
+
+      Image &image = images[use.resource];
+      use.discard = !image.hasContents || use.clear ||
+                    use.kind == UseKind::Resolve;
+    }
+
+    if (pass.type == RenderPassType::Graphics) {
+      PrepareAttachments(p);
+    }
+
+    for (uint32_t u = 0; u < pass.useCount; u++) {
+      const Use &use = uses[pass.firstUse + u];
+      if (use.kind != UseKind::Buffer && use.write) {
+        images[use.resource].hasContents = true;
+      }
+    }
+  }
+}
+
+void RenderGraph::PlaceTransients() {
+  // What this frame wants, in the order the images were created
+  wantedImages.clear();
+  for (Image &image : images) {
+    if (image.imported || image.firstPass == UINT32_MAX) {
+      continue; // Imported, or only used by culled passes
+    }
+
+    PhysicalImage wanted = {};
+    wanted.desc = image.desc;
+    wanted.usage = image.usage | image.desc.usage;
+    // Never leaving a single render pass means it is never stored either,
+    // so a tiled GPU can keep it in tile memory and never back it
+    wanted.lazy = lazyMemory && image.attachmentOnly &&
+                  image.firstPass == image.lastPass;
+    if (wanted.lazy) {
+      wanted.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    }
+    wanted.lazyWanted = wanted.lazy;
+    wanted.firstPass = image.firstPass;
+    wanted.lastPass = image.lastPass;
+    wantedImages.push_back(wanted);
+  }
+
+  auto same = [](const PhysicalImage &a, const PhysicalImage &b) {
+    return a.desc.format == b.desc.format &&
+           a.desc.extent.width == b.desc.extent.width &&
+           a.desc.extent.height == b.desc.extent.height &&
+           a.desc.samples == b.desc.samples && a.usage == b.usage &&
+           a.lazyWanted == b.lazyWanted && a.firstPass == b.firstPass &&
+           a.lastPass == b.lastPass;
+  };
+
+  bool unchanged = wantedImages.size() == physicalImages.size();
+  for (size_t i = 0; unchanged && i < wantedImages.size(); i++) {
+    unchanged = same(wantedImages[i], physicalImages[i]);
+  }
+
+  if (!unchanged) {
+    RetireTransients();
+
+    // Created first, the memory needs every image's requirements
+    std::vector<VkMemoryRequirements> requirements(wantedImages.size());
+    for (size_t i = 0; i < wantedImages.size(); i++) {
+      PhysicalImage &physical = wantedImages[i];
+
+      VkImageCreateInfo imageInfo = {};
+      imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+      imageInfo.imageType = VK_IMAGE_TYPE_2D;
+      imageInfo.format = physical.desc.format;
+      imageInfo.extent = {physical.desc.extent.width,
+                          physical.desc.extent.height, 1};
+      imageInfo.mipLevels = 1;
+      imageInfo.arrayLayers = 1;
+      imageInfo.samples = physical.desc.samples;
+      imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+      imageInfo.usage = physical.usage;
+      imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+      imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+      if (vkCreateImage(device, &imageInfo, hostCallbacks, &physical.image) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("Failed to create transient image");
+      }
+      vkGetImageMemoryRequirements(device, physical.image, &requirements[i]);
+
+      // It may turn out there is no lazily allocated type it can use
+      const VkPhysicalDeviceMemoryProperties &memoryProperties =
+          allocator->GetMemoryProperties();
+      bool lazyType = false;
+      for (uint32_t type = 0; type < memoryProperties.memoryTypeCount;
+           type++) {
+        if ((requirements[i].memoryTypeBits & (1u << type)) &&
+            (memoryProperties.memoryTypes[type].propertyFlags &
+             VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) {
+          lazyType = true;
+        }
+      }
+      physical.lazy = physical.lazy && lazyType;
+    }
+
+    // Greedy by first use: an image goes in the first slot whose images are
+    // all done before it starts and that has a memory type it can use
+    std::vector<uint32_t> order(wantedImages.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return wantedImages[a].firstPass < wantedImages[b].firstPass;
+    });
+
+    struct SlotPlan {
+      VkMemoryRequirements requirements;
+      uint32_t lastPass;
+      bool lazy;
+    };
+    std::vector<SlotPlan> plans;
+
+    for (uint32_t i : order) {
+      PhysicalImage &physical = wantedImages[i];
+      const VkMemoryRequirements &needs = requirements[i];
+
+      physical.slot = UINT32_MAX;
+      if (!physical.lazy) {
+        for (uint32_t s = 0; s < plans.size(); s++) {
+          SlotPlan &plan = plans[s];
+          if (!plan.lazy && plan.lastPass < physical.firstPass &&
+              (plan.requirements.memoryTypeBits & needs.memoryTypeBits)) {
+            plan.requirements.size =
+                std::max(plan.requirements.size, needs.size);
+            plan.requirements.alignment =
+                std::max(plan.requirements.alignment, needs.alignment);
+            plan.requirements.memoryTypeBits &= needs.memoryTypeBits;
+            plan.lastPass = physical.lastPass;
+            physical.slot = s;
+            break;
+          }
+        }
+      }
+
+      if (physical.slot == UINT32_MAX) {
+        physical.slot = static_cast<uint32_t>(plans.size());
+        plans.push_back({needs, physical.lastPass, physical.lazy});
+      }
+    }
+
+    stats.transientBytes = 0;
+    stats.aliasedBytes = 0;
+    stats.lazyImages = 0;
+    for (size_t i = 0; i < wantedImages.size(); i++) {
+      stats.transientBytes += requirements[i].size;
+      stats.lazyImages += wantedImages[i].lazy;
+    }
+
+    for (SlotPlan &plan : plans) {
+      MemorySlot slot;
+      slot.allocation = allocator->Allocate(
+          plan.requirements,
+          plan.lazy ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT
+                    : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+          ResourceKind::Optimal);
+      if (!plan.lazy) {
+        stats.aliasedBytes += plan.requirements.size;
+      }
+      memorySlots.push_back(slot);
+    }
+
+    for (PhysicalImage &physical : wantedImages) {
+      const Allocation &allocation = memorySlots[physical.slot].allocation;
+      vkBindImageMemory(device, physical.image, allocation.memory,
+                        allocation.offset);
+
+      VkImageViewCreateInfo viewInfo = {};
+      viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+      viewInfo.image = physical.image;
+      viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+      viewInfo.format = physical.desc.format;
+      viewInfo.subresourceRange.aspectMask = GetAspect(physical.desc.format);
+      viewInfo.subresourceRange.levelCount = 1;
+      viewInfo.subresourceRange.layerCount = 1;
+
+      if (vkCreateImageView(device, &viewInfo, hostCallbacks, &physical.view) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("Failed to create transient image view");
+      }
+    }
+
+    physicalImages = wantedImages;
+    stats.transientImages = static_cast<uint32_t>(physicalImages.size());
+
+    spdlog::info("Render graph: {} transient images in {} allocations "
+                 "({:.1f} of {:.1f} MiB), {} lazily allocated",
+                 physicalImages.size(), memorySlots.size(),
+                 stats.aliasedBytes / (1024.0 * 1024.0),
+                 stats.transientBytes / (1024.0 * 1024.0), stats.lazyImages);
+  }
+
+  // In the same order as wantedImages was built
+  uint32_t next = 0;
+  for (Image &image : images) {
+    if (image.imported || image.firstPass == UINT32_MAX) {
+      continue;
+    }
+    const PhysicalImage &physical = physicalImages[next];
+    image.physical = next++;
+    image.image = physical.image;
+    image.view = physical.view;
+  }
+}
+
+void RenderGraph::RetireTransients() {
+  for (PhysicalImage &physical : physicalImages) {
+    RetiredObject old;
+    old.image = physical.image;
+    old.view = physical.view;
+    old.lastFrame = frame;
+    retired.push_back(old);
+  }
+  for (MemorySlot &slot : memorySlots) {
+    RetiredObject old;
+    old.allocation = slot.allocation;
+    old.lastFrame = frame;
+    retired.push_back(old);
+  }
+  physicalImages.clear();
+  memorySlots.clear();
+}
+
+VkRenderPass RenderGraph::GetRenderPass(const CachedRenderPass &key) {
+  uint32_t attachmentCount =
+      key.colorCount + key.resolveCount + (key.depth ? 1 : 0);
+
+  for (const CachedRenderPass &cached : renderPasses) {
+    if (cached.colorCount != key.colorCount ||
+        cached.resolveCount != key.resolveCount || cached.depth != key.depth) {
+      continue;
+    }
+    bool same = true;
+    for (uint32_t i = 0; same && i < attachmentCount; i++) {
+      same = SameAttachment(cached.attachments[i], key.attachments[i]);
+    }
+    if (same) {
+      return cached.renderPass;
+    }
+  }
+
+  // Colour attachments, then their resolves, then depth. Each one starts
+  // and ends in the layout the subpass uses, the graph's own barriers do
+  // every transition.
+  VkAttachmentReference colorRefs[RENDER_GRAPH_MAX_ATTACHMENTS] = {};
+  VkAttachmentReference resolveRefs[RENDER_GRAPH_MAX_ATTACHMENTS] = {};
+  VkAttachmentReference depthRef = {};
+  for (uint32_t i = 0; i < key.colorCount; i++) {
+    colorRefs[i] = {i, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+    // A resolve for every colour attachment or none at all
+    resolveRefs[i] = {key.resolveCount > 0 ? key.colorCount + i
+                                           : VK_ATTACHMENT_UNUSED,
+                      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+  }
+  if (key.depth) {
+    depthRef = {key.colorCount + key.resolveCount,
+                VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+  }
+
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = key.colorCount;
+  subpass.pColorAttachments = colorRefs;
+  subpass.pResolveAttachments = key.resolveCount > 0 ? resolveRefs : nullptr;
+  subpass.pDepthStencilAttachment = key.depth ? &depthRef : nullptr;
+
+  VkRenderPassCreateInfo renderPassInfo = {};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderPassInfo.attachmentCount = attachmentCount;
+  renderPassInfo.pAttachments = key.attachments;
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpass;
+
+  CachedRenderPass cached = key;
+  if (vkCreateRenderPass(device, &renderPassInfo, hostCallbacks,
+                         &cached.renderPass) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create render graph render pass");
+  }
+
+  renderPasses.push_back(cached);
+  stats.renderPasses = static_cast<uint32_t>(renderPasses.size());
+  return cached.renderPass;
+}
+
+uint32_t RenderGraph::GetFramebuffer(VkRenderPass renderPass,
+                                     const VkImageView *views,
+                                     uint32_t viewCount, VkExtent2D extent) {
+  for (uint32_t i = 0; i < framebuffers.size(); i++) {
+    const CachedFramebuffer &cached = framebuffers[i];
+    if (cached.renderPass == renderPass && cached.viewCount == viewCount &&
+        cached.extent.width == extent.width &&
+        cached.extent.height == extent.height &&
+        std::equal(views, views + viewCount, cached.views)) {
+      return i;
+    }
+  }
+
+  CachedFramebuffer cached = {};
+  cached.renderPass = renderPass;
+  std::copy(views, views + viewCount, cached.views);
+  cached.viewCount = viewCount;
+  cached.extent = extent;
+
+  VkFramebufferCreateInfo framebufferInfo = {};
+  framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebufferInfo.renderPass = renderPass;
+  framebufferInfo.attachmentCount = viewCount;
+  framebufferInfo.pAttachments = views;
+  framebufferInfo.width = extent.width;
+  framebufferInfo.height = extent.height;
+  framebufferInfo.layers = 1;
+
+  if (vkCreateFramebuffer(device, &framebufferInfo, hostCallbacks,
+                          &cached.framebuffer) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create render graph framebuffer");
+  }
+
+  framebuffers.push_back(cached);
+  return static_cast<uint32_t>(framebuffers.size() - 1);
+}
+
+VkAttachmentLoadOp RenderGraph::GetLoadOp(const Use &use) const {
+  // Loaded only when an earlier pass left something in it
+  if (use.clear) {
+    return VK_ATTACHMENT_LOAD_OP_CLEAR;
+  }
+  return use.discard ? VK_ATTACHMENT_LOAD_OP_DONT_CARE
+                     : VK_ATTACHMENT_LOAD_OP_LOAD;
+}
+
+VkAttachmentStoreOp RenderGraph::GetStoreOp(const Use &use,
+                                            uint32_t pass) const {
+  // Stored only when a later pass or whatever comes after the graph can see
+  // it
+  const Image &image = images[use.resource];
+  return image.imported || image.lastPass > pass
+             ? VK_ATTACHMENT_STORE_OP_STORE
+             : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+}
+
+void RenderGraph::PrepareAttachments(uint32_t p) {
+  Pass &pass = passes[p];
+  std::span<const Use> passUses(uses.data() + pass.firstUse, pass.useCount);
+
+  // Gathered by kind so they come out in the render pass's order
+  const Use *colors[RENDER_GRAPH_MAX_ATTACHMENTS];
+  const Use *resolves[RENDER_GRAPH_MAX_ATTACHMENTS];
+  const Use *depth = nullptr;
+  uint32_t colorCount = 0, resolveCount = 0;
+  for (const Use &use : passUses) {
+    if ((use.kind == UseKind::Color || use.kind == UseKind::Resolve) &&
+        colorCount + resolveCount == RENDER_GRAPH_MAX_ATTACHMENTS) {
+      throw std::runtime_error("Render pass " + std::string(pass.name) +
+                               " has too many attachments");
+    }
+
+    if (use.kind == UseKind::Color) {
+      colors[colorCount++] = &use;
+    } else if (use.kind == UseKind::Resolve) {
+      resolves[resolveCount++] = &use;
+    } else if (use.kind == UseKind::Depth) {
+      depth = &use;
+    }
+  }
+
+  if (resolveCount != 0 && resolveCount != colorCount) {
+    throw std::runtime_error("Render pass " + std::string(pass.name) +
+                             " resolves only some of its attachments");
+  }
+
+  const Use *first = colorCount > 0 ? colors[0] : depth;
+  if (first == nullptr) {
+    throw std::runtime_error("Render pass " + std::string(pass.name) +
+                             " has no attachments");
+  }
+  pass.extent = images[first->resource].extent;
+  pass.samples = images[first->resource].samples;
+
+  pass.colorCount = colorCount;
+  pass.hasDepth = depth != nullptr;
+  pass.depthFormat =
+      depth != nullptr ? images[depth->resource].format : VK_FORMAT_UNDEFINED;
+  for (uint32_t i = 0; i < colorCount; i++) {
+    pass.colorFormats[i] = images[colors[i]->resource].format;
+  }
+
+  if (vulkan13) {
+    // Resolves are part of the colour attachment they resolve, and the
+    // clear values are too
+    auto attachment = [&](const Use &use) {
+      VkRenderingAttachmentInfo info = {};
+      info.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+      info.imageView = images[use.resource].view;
+      info.imageLayout = use.layout;
+      info.loadOp = GetLoadOp(use);
+      info.storeOp = GetStoreOp(use, p);
+      info.clearValue = use.clearValue;
+      return info;
+    };
+
+    for (uint32_t i = 0; i < colorCount; i++) {
+      pass.colors[i] = attachment(*colors[i]);
+      if (resolveCount > 0) {
+        pass.colors[i].resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+        pass.colors[i].resolveImageView = images[resolves[i]->resource].view;
+        pass.colors[i].resolveImageLayout = resolves[i]->layout;
+      }
+    }
+    if (depth != nullptr) {
+      pass.depth = attachment(*depth);
+    }
+    return;
+  }
+
+  CachedRenderPass key = {};
+  key.colorCount = colorCount;
+  key.resolveCount = resolveCount;
+  key.depth = depth != nullptr;
+
+  VkImageView views[RENDER_GRAPH_MAX_ATTACHMENTS];
+  uint32_t viewCount = 0;
+  pass.clearCount = 0;
+
+  auto add = [&](const Use &use) {
+    const Image &image = images[use.resource];
+
+    VkAttachmentDescription &attachment = key.attachments[viewCount];
+    attachment.format = image.format;
+    attachment.samples = image.samples;
+    attachment.loadOp = GetLoadOp(use);
+    attachment.storeOp = GetStoreOp(use, p);
+    attachment.stencilLoadOp = IsDepthFormat(image.format)
+                                   ? attachment.loadOp
+                                   : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachment.stencilStoreOp = IsDepthFormat(image.format)
+                                    ? attachment.storeOp
+                                    : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachment.initialLayout = use.layout;
+    attachment.finalLayout = use.layout;
+
+    pass.clears[viewCount] = use.clearValue;
+    if (use.clear) {
+      pass.clearCount = viewCount + 1;
+    }
+    views[viewCount++] = image.view;
+  };
+
+  for (uint32_t i = 0; i < colorCount; i++) {
+    add(*colors[i]);
+  }
+  for (uint32_t i = 0; i < resolveCount; i++) {
+    add(*resolves[i]);
+  }
+  if (depth != nullptr) {
+    if (viewCount == RENDER_GRAPH_MAX_ATTACHMENTS) {
+      throw std::runtime_error("Render pass " + std::string(pass.name) +
+                               " has too many attachments");
+    }
+    add(*depth);
+  }
+
+  pass.renderPass = GetRenderPass(key);
+  pass.framebuffer =
+      GetFramebuffer(pass.renderPass, views, viewCount, pass.extent);
+}
+
+void RenderGraph::Transition(const Use &use, ResourceState &state,
+                             VkImage image, VkImageAspectFlags aspect,
+                             VkBuffer buffer, MemorySlot *slot) {
+  VkPipelineStageFlags2 srcStages = VK_PIPELINE_STAGE_2_NONE;
+  VkAccessFlags2 srcAccess = VK_ACCESS_2_NONE;
+  VkImageLayout oldLayout = state.layout;
+  bool layoutChange = image != VK_NULL_HANDLE && state.layout != use.layout;
+  bool barrier = false;
+
+  if (use.discard && image != VK_NULL_HANDLE) {
+    // The old contents are thrown away, but whatever last used the memory
+    // (this image last frame, or another image aliasing it) has to be done
+    srcStages = slot != nullptr ? slot->stages
+                                : state.writeStages | state.readStages;
+    srcAccess = slot != nullptr ? slot->access : state.writeAccess;
+    oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier = true;
+  } else if (use.write || layoutChange) {
+    // After a write, every write has to land first. After a read, the
+    // reads only have to have happened.
+    srcStages = state.writeStages | state.readStages;
+    srcAccess = state.writeAccess;
+    barrier = srcStages != 0 || layoutChange;
+  } else if (state.writeStages != 0 &&
+             ((use.stages & ~state.visibleStages) ||
+              (use.access & ~state.visibleAccess))) {
+    // A read of something these stages haven't seen written yet
+    srcStages = state.writeStages;
+    srcAccess = state.writeAccess;
+    barrier = true;
+  }
+
+  if (barrier && image != VK_NULL_HANDLE) {
+    VkImageMemoryBarrier2 imageBarrier = {};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    imageBarrier.srcStageMask = srcStages;
+    imageBarrier.srcAccessMask = srcAccess;
+    imageBarrier.dstStageMask = use.stages;
+    imageBarrier.dstAccessMask = use.access;
+    imageBarrier.oldLayout = oldLayout;
+    imageBarrier.newLayout = use.layout;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = image;
+    imageBarrier.subresourceRange.aspectMask = aspect;
+    imageBarrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    imageBarrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+    imageBarriers.push_back(imageBarrier);
+  } else if (barrier) {
+    VkBufferMemoryBarrier2 bufferBarrier = {};
+    bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+    bufferBarrier.srcStageMask = srcStages;
+    bufferBarrier.srcAccessMask = srcAccess;
+    bufferBarrier.dstStageMask = use.stages;
+    bufferBarrier.dstAccessMask = use.access;
+    bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.buffer = buffer;
+    bufferBarrier.offset = 0;
+    bufferBarrier.size = VK_WHOLE_SIZE;
+    bufferBarriers.push_back(bufferBarrier);
+  }
+
+  if (use.write) {
+    state.writeStages = use.stages;
+    state.writeAccess = use.access;
+    state.readStages = 0;
+    state.visibleStages = use.stages;
+    state.visibleAccess = use.access;
+  } else {
+    state.readStages |= use.stages;
+    if (barrier) {
+      state.visibleStages |= use.stages;
+      state.visibleAccess |= use.access;
+    }
+  }
+  if (image != VK_NULL_HANDLE) {
+    state.layout = use.layout;
+  }
+
+  if (slot != nullptr) {
+    if (use.discard) {
+      slot->stages = use.stages;
+      slot->access = use.write ? use.access : 0;
+    } else {
+      slot->stages |= use.stages;
+      slot->access |= use.write ? use.access : 0;
+    }
+  }
+}
+
+void RenderGraph::FlushBarriers(VkCommandBuffer commandBuffer) {
+  if (imageBarriers.empty() && bufferBarriers.empty()) {
+    return;
+  }
+
+  stats.barriers++;
+  stats.imageBarriers += static_cast<uint32_t>(imageBarriers.size());
+
+  if (vulkan13) {
+    VkDependencyInfo dependencyInfo = {};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.bufferMemoryBarrierCount =
+        static_cast<uint32_t>(bufferBarriers.size());
+    dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+    dependencyInfo.imageMemoryBarrierCount =
+        static_cast<uint32_t>(imageBarriers.size());
+    dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+    imageBarriers.clear();
+    bufferBarriers.clear();
+    return;
+  }
+
+  // One set of stages for the lot, and buffers share a global barrier,
+  // which is as cheap as any
+  VkPipelineStageFlags srcStages = 0;
+  VkPipelineStageFlags dstStages = 0;
+  VkMemoryBarrier memoryBarrier = {};
+  memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+
+  for (const VkBufferMemoryBarrier2 &barrier : bufferBarriers) {
+    srcStages |= ToLegacyStages(barrier.srcStageMask);
+    dstStages |= ToLegacyStages(barrier.dstStageMask);
+    memoryBarrier.srcAccessMask |= ToLegacyAccess(barrier.srcAccessMask);
+    memoryBarrier.dstAccessMask |= ToLegacyAccess(barrier.dstAccessMask);
+  }
+
+  legacyImageBarriers.clear();
+  for (const VkImageMemoryBarrier2 &barrier : imageBarriers) {
+    srcStages |= ToLegacyStages(barrier.srcStageMask);
+    dstStages |= ToLegacyStages(barrier.dstStageMask);
+
+    VkImageMemoryBarrier legacy = {};
+    legacy.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    legacy.srcAccessMask = ToLegacyAccess(barrier.srcAccessMask);
+    legacy.dstAccessMask = ToLegacyAccess(barrier.dstAccessMask);
+    legacy.oldLayout = barrier.oldLayout;
+    legacy.newLayout = barrier.newLayout;
+    legacy.srcQueueFamilyIndex = barrier.srcQueueFamilyIndex;
+    legacy.dstQueueFamilyIndex = barrier.dstQueueFamilyIndex;
+    legacy.image = barrier.image;
+    legacy.subresourceRange = barrier.subresourceRange;
+    legacyImageBarriers.push_back(legacy);
+  }
+
+  // Without synchronization2 there is no NONE stage, waiting on nothing
+  // (a first use) is the top of the pipe and nothing waiting is the bottom
+  if (srcStages == 0) {
+    srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+  }
+  if (dstStages == 0) {
+    dstStages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+  }
+
+  vkCmdPipelineBarrier(
+      commandBuffer, srcStages, dstStages, 0, bufferBarriers.empty() ? 0 : 1,
+      &memoryBarrier, 0, nullptr,
+      static_cast<uint32_t>(legacyImageBarriers.size()),
+      legacyImageBarriers.data());
+
+  imageBarriers.clear();
+  bufferBarriers.clear();
+}
+
+void RenderGraph::Execute(VkCommandBuffer commandBuffer, uint64_t frame,
+                          Profiler *profiler) {
+  this->frame = frame;
+  stats.barriers = 0;
+  stats.imageBarriers = 0;
+
+  // Where everything starts this frame. Transient images start empty, an
+  // imported one waits on the stages it was handed over from.
+  for (Image &image : images) {
+    image.state = {};
+    if (image.imported) {
+      image.state.layout = image.importLayout;
+      image.state.writeStages = image.importStages;
+    }
+  }
+
+  for (Pass &pass : passes) {
+    if (!pass.alive) {
+      continue;
+    }
+
+    for (uint32_t u = 0; u < pass.useCount; u++) {
+      const Use &use = uses[pass.firstUse + u];
+      if (use.kind == UseKind::Buffer) {
+        Buffer &buffer = buffers[use.resource];
+        Transition(use, buffer.state, VK_NULL_HANDLE, 0, buffer.buffer,
+                   nullptr);
+      } else {
+        Image &image = images[use.resource];
+        MemorySlot *slot =
+            image.imported
+                ? nullptr
+                : &memorySlots[physicalImages[image.physical].slot];
+        Transition(use, image.state, image.image, image.aspect,
+                   VK_NULL_HANDLE, slot);
+      }
+    }
+    FlushBarriers(commandBuffer);
+
+    uint32_t scope = profiler != nullptr
+                         ? profiler->BeginGpuScope(commandBuffer, pass.name)
+                         : UINT32_MAX;
+
+    RenderPassContext context;
+    context.commandBuffer = commandBuffer;
+
+    if (pass.type == RenderPassType::Graphics) {
+      context.extent = pass.extent;
+      context.inheritance = &pass.inheritance;
+
+      pass.inheritance = {};
+      pass.inheritance.sType =
+          VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+      pass.inheritance.subpass = 0;
+
+      VkSubpassContents contents =
+          pass.secondaries ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                           : VK_SUBPASS_CONTENTS_INLINE;
+
+      if (vulkan13) {
+        pass.renderingInheritance = {};
+        pass.renderingInheritance.sType =
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+        pass.renderingInheritance.colorAttachmentCount = pass.colorCount;
+        pass.renderingInheritance.pColorAttachmentFormats = pass.colorFormats;
+        pass.renderingInheritance.depthAttachmentFormat = pass.depthFormat;
+        pass.renderingInheritance.rasterizationSamples = pass.samples;
+        pass.inheritance.pNext = &pass.renderingInheritance;
+
+        VkRenderingInfo renderingInfo = {};
+        renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+        renderingInfo.flags =
+            pass.secondaries
+                ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT
+                : 0;
+        renderingInfo.renderArea.offset = {0, 0};
+        renderingInfo.renderArea.extent = pass.extent;
+        renderingInfo.layerCount = 1;
+        renderingInfo.colorAttachmentCount = pass.colorCount;
+        renderingInfo.pColorAttachments = pass.colors;
+        renderingInfo.pDepthAttachment = pass.hasDepth ? &pass.depth : nullptr;
+        vkCmdBeginRendering(commandBuffer, &renderingInfo);
+      } else {
+        CachedFramebuffer &cached = framebuffers[pass.framebuffer];
+        cached.lastFrame = frame;
+
+        context.renderPass = pass.renderPass;
+        context.framebuffer = cached.framebuffer;
+        pass.inheritance.renderPass = pass.renderPass;
+        pass.inheritance.framebuffer = cached.framebuffer;
+
+        VkRenderPassBeginInfo renderPassInfo = {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = pass.renderPass;
+        renderPassInfo.framebuffer = cached.framebuffer;
+        renderPassInfo.renderArea.offset = {0, 0};
+        renderPassInfo.renderArea.extent = pass.extent;
+        renderPassInfo.clearValueCount = pass.clearCount;
+        renderPassInfo.pClearValues = pass.clears;
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, contents);
+      }
+    }
+
+    pass.record(context);
+
+    if (pass.type == RenderPassType::Graphics) {
+      if (vulkan13) {
+        vkCmdEndRendering(commandBuffer);
+      } else {
+        vkCmdEndRenderPass(commandBuffer);
+      }
+    }
+
+    if (profiler != nullptr) {
+      profiler->EndGpuScope(commandBuffer, scope);
+    }
+  }
+
+  // Hand imported images over in the layout whatever is next expects. What
+  // comes next waits on its own semaphore, so nothing here waits.
+  for (Image &image : images) {
+    if (!image.imported || image.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED ||
+        image.finalLayout == image.state.layout) {
+      continue;
+    }
+
+    Use use = {};
+    use.layout = image.finalLayout;
+    use.stages = VK_PIPELINE_STAGE_2_NONE;
+    Transition(use, image.state, image.image, image.aspect, VK_NULL_HANDLE,
+               nullptr);
+  }
+  FlushBarriers(commandBuffer);
+
+  // Kept for the next frame's first uses
+  for (const Buffer &buffer : buffers) {
+    auto known = std::find_if(
+        bufferStates.begin(), bufferStates.end(),
+        [&](const auto &entry) { return entry.first == buffer.buffer; });
+    if (known != bufferStates.end()) {
+      known->second = buffer.state;
+    } else {
+      bufferStates.emplace_back(buffer.buffer, buffer.state);
+    }
+  }
+}
+
+void RenderGraph::ReleaseView(VkImageView view, uint64_t lastFrame) {
+  std::erase_if(framebuffers, [&](CachedFramebuffer &cached) {
+    if (std::find(cached.views, cached.views + cached.viewCount, view) ==
+        cached.views + cached.viewCount) {
+      return false;
+    }
+
+    RetiredObject old;
+    old.framebuffer = cached.framebuffer;
+    old.lastFrame = std::max(lastFrame, cached.lastFrame);
+    retired.push_back(old);
+    return true;
+  });
+}
+
+void RenderGraph::ReleaseBuffer(VkBuffer buffer) {
+  std::erase_if(bufferStates,
+                [&](const auto &entry) { return entry.first == buffer; });
+}
+
+VkImageView RenderGraph::GetView(RenderGraphImage image) const {
+  return images[image.index].view;
+}
+
+VkImage RenderGraph::GetImage(RenderGraphImage image) const {
+  return images[image.index].image;
+}
+
+RenderGraphStats RenderGraph::GetStats() const {
+  RenderGraphStats result = stats;
+  result.framebuffers = static_cast<uint32_t>(framebuffers.size());
+  return result;
+}
+
+} // namespace MiniEngine
@@ -0,0 +1,251 @@
+#include <miniengine/shaders.h>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+namespace MiniEngine {
+
+// FNV-1a, like the pipeline registry. Only has to tell versions of the same
+// few files apart.
+static uint64_t HashString(uint64_t hash, const std::string &data) {
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+void ShaderManager::Init(JobScheduler &jobs,
+                         const std::string &cacheDirectory) {
+  SPDLOG_TRACE("ShaderManager::Init({})", cacheDirectory);
+
+  this->jobs = &jobs;
+  this->cacheDirectory = cacheDirectory;
+  this->lastPoll = std::chrono::high_resolution_clock::now();
+
+  std::error_code error;
+  std::filesystem::create_directories(cacheDirectory, error);
+  if (error) {
+    spdlog::warn("Failed to create shader cache {}: {}", cacheDirectory,
+                 error.message());
+  }
+}
+
+void ShaderManager::Destroy() {
+  if (jobs == nullptr) {
+    return;
+  }
+
+  SPDLOG_TRACE("ShaderManager::Destroy()");
+
+  jobs->Wait(compiles);
+  sources.clear();
+
+  jobs = nullptr;
+}
+
+std::string ShaderManager::GetCachePath(uint64_t hash) const {
+  return fmt::format("{}/{:016x}.spv", cacheDirectory, hash);
+}
+
+bool ShaderManager::HashSource(const Source &source, uint64_t &hash) const {
+  std::ifstream file(source.glslPath, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  std::string contents((std::istreambuf_iterator<char>(file)),
+                       std::istreambuf_iterator<char>());
+
+  // The same source compiled as another stage is another module
+  hash = HashString(HashString(0xcbf29ce484222325ull, source.stage), contents);
+  return true;
+}
+
+bool ShaderManager::Compile(const Source &source, uint64_t hash) {
+  SPDLOG_TRACE("ShaderManager::Compile({})", source.glslPath);
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  // glslc writes into the cache under a temporary name, so a failed or
+  // interrupted compile never leaves a broken entry behind
+  std::string output = GetCachePath(hash);
+  std::string temporary = output + ".tmp";
+  std::string command =
+      fmt::format("glslc -fshader-stage={} \"{}\" -o \"{}\" 2>&1",
+                  source.stage, source.glslPath, temporary);
+
+  std::FILE *pipe = popen(command.c_str(), "r");
+  if (pipe == nullptr) {
+    spdlog::error("Failed to run glslc for {}", source.glslPath);
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.failures++;
+    return false;
+  }
+
+  std::string log;
+  char buffer[256];
+  while (std::fgets(buffer, sizeof(buffer), pipe) != nullptr) {
+    log += buffer;
+  }
+  int status = pclose(pipe);
+
+  std::error_code error;
+  if (status == 0) {
+    std::filesystem::rename(temporary, output, error);
+  }
+
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::high_resolution_clock::now() - start)
+                  .count();
+
+  if (status != 0 || error) {
+    spdlog::error("Failed to compile {}:\n{}", source.glslPath, log);
+    std::filesystem::remove(temporary, error);
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.failures++;
+    return false;
+  }
+
+  spdlog::info("Compiled {} in {:.0f} ms", source.glslPath, ms);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  stats.compiles++;
+  stats.lastCompileMs = ms;
+  return true;
+}
+
+bool ShaderManager::Install(const Source &source, uint64_t hash) {
+  // The hash check and the copy happen together, so a compile of an older
+  // version finishing late can't overwrite a newer one
+  std::lock_guard<std::mutex> lock(installMutex);
+  if (source.hash != hash) {
+    return false;
+  }
+
+  std::error_code error;
+  std::string temporary = source.spirvPath + ".tmp";
+  std::filesystem::copy_file(GetCachePath(hash), temporary,
+                             std::filesystem::copy_options::overwrite_existing,
+                             error);
+  if (!error) {
+    std::filesystem::rename(temporary, source.spirvPath, error);
+  }
+
+  if (error) {
+    spdlog::error("Failed to write {}: {}", source.spirvPath, error.message());
+    return false;
+  }
+  return true;
+}
+
+void ShaderManager::Watch(const std::string &glslPath,
+                          const std::string &spirvPath,
+                          const std::string &stage) {
+  SPDLOG_TRACE("ShaderManager::Watch({}, {})", glslPath, spirvPath);
+
+  Source &source = sources.emplace_back();
+  source.glslPath = glslPath;
+  source.glslFile = glslPath;
+  source.spirvPath = spirvPath;
+  source.stage = stage;
+
+  std::error_code error;
+  source.lastWrite = std::filesystem::last_write_time(glslPath, error);
+
+  uint64_t hash;
+  if (!HashSource(source, hash)) {
+    spdlog::warn("Failed to read {}, using {} as it is", glslPath, spirvPath);
+    return;
+  }
+  source.hash = hash;
+
+  if (std::filesystem::exists(GetCachePath(hash), error)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.cacheHits++;
+  } else if (!Compile(source, hash)) {
+    spdlog::warn("Using {} as it is", spirvPath);
+    return;
+  }
+
+  Install(source, hash);
+}
+
+const std::vector<std::string> &ShaderManager::Poll() {
+  updated.clear();
+  {
+    // Whatever background compiles installed since last time
+    std::lock_guard<std::mutex> lock(mutex);
+    updated.swap(finished);
+  }
+
+  auto now = std::chrono::high_resolution_clock::now();
+  if (std::chrono::duration<double, std::milli>(now - lastPoll).count() <
+      SHADER_POLL_MS) {
+    return updated;
+  }
+  lastPoll = now;
+
+  for (Source &source : sources) {
+    std::error_code error;
+    auto lastWrite = std::filesystem::last_write_time(source.glslFile, error);
+    if (error || lastWrite == source.lastWrite) {
+      continue;
+    }
+    source.lastWrite = lastWrite;
+
+    // Saving without changing anything doesn't need a reload
+    uint64_t hash;
+    if (!HashSource(source, hash) || hash == source.hash) {
+      continue;
+    }
+    source.hash = hash;
+
+    // Going back to a version that has been compiled before is instant
+    if (std::filesystem::exists(GetCachePath(hash), error)) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.cacheHits++;
+      }
+      if (Install(source, hash)) {
+        updated.push_back(source.spirvPath);
+      }
+      continue;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stats.pending++;
+    }
+
+    jobs->Schedule(
+        [this, &source, hash] {
+          bool installed = Compile(source, hash) && Install(source, hash);
+
+          std::lock_guard<std::mutex> lock(mutex);
+          stats.pending--;
+          if (installed) {
+            finished.push_back(source.spirvPath);
+          }
+        },
+        &compiles);
+  }
+
+  return updated;
+}
+
+ShaderStats ShaderManager::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+} // namespace MiniEngine
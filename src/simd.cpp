@@ -0,0 +1,656 @@
+#include <miniengine/simd.h>
+
+#include <atomic>
+#include <bit>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MINIENGINE_SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define MINIENGINE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// AVX2 is only enabled for the functions that use it, so the rest of the
+// engine still runs on CPUs without it. MSVC doesn't need to be told.
+#if defined(__GNUC__) || defined(__clang__)
+#define MINIENGINE_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define MINIENGINE_TARGET_AVX2
+#endif
+
+namespace MiniEngine {
+
+// The kernels read matrices as 16 floats, a column at a time
+static_assert(sizeof(glm::mat4) == 16 * sizeof(float));
+static_assert(sizeof(glm::vec4) == 4 * sizeof(float));
+
+struct SimdKernels {
+  void (*multiplyMatrices)(const glm::mat4 *, const glm::mat4 *, glm::mat4 *,
+                           uint32_t);
+  void (*composeHierarchy)(const uint32_t *, const glm::mat4 *, glm::mat4 *,
+                           uint32_t);
+  void (*transformAabbs)(const glm::mat4 &, const AabbArrays &,
+                         const AabbArrays &, uint32_t);
+  uint32_t (*cullSpheres)(const glm::vec4 *, const SphereArrays &, uint8_t *,
+                          uint32_t);
+};
+
+static const float *Floats(const void *pointer) {
+  return static_cast<const float *>(pointer);
+}
+
+static float *Floats(void *pointer) { return static_cast<float *>(pointer); }
+
+// For handing the last few elements a wide kernel can't fill a register
+// with over to the scalar one
+static AabbArrays Advance(const AabbArrays &boxes, uint32_t count) {
+  return {boxes.centerX + count, boxes.centerY + count,
+          boxes.centerZ + count, boxes.extentX + count,
+          boxes.extentY + count, boxes.extentZ + count};
+}
+
+static SphereArrays Advance(const SphereArrays &spheres, uint32_t count) {
+  return {spheres.centerX + count, spheres.centerY + count,
+          spheres.centerZ + count, spheres.radius + count};
+}
+
+// Scalar, through glm
+
+static void MultiplyMatricesScalar(const glm::mat4 *a, const glm::mat4 *b,
+                                   glm::mat4 *out, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    out[i] = a[i] * b[i];
+  }
+}
+
+static void ComposeHierarchyScalar(const uint32_t *parents,
+                                   const glm::mat4 *locals, glm::mat4 *worlds,
+                                   uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    worlds[i] = parents[i] == UINT32_MAX ? locals[i]
+                                         : worlds[parents[i]] * locals[i];
+  }
+}
+
+static void TransformAabbsScalar(const glm::mat4 &transform,
+                                 const AabbArrays &in, const AabbArrays &out,
+                                 uint32_t count) {
+  // The extent along each axis is the sum of what every input axis
+  // contributes to it, whichever way round it ends up
+  glm::vec3 axisX = glm::abs(glm::vec3(transform[0]));
+  glm::vec3 axisY = glm::abs(glm::vec3(transform[1]));
+  glm::vec3 axisZ = glm::abs(glm::vec3(transform[2]));
+
+  for (uint32_t i = 0; i < count; i++) {
+    glm::vec3 center =
+        glm::vec3(transform * glm::vec4(in.centerX[i], in.centerY[i],
+                                        in.centerZ[i], 1.0f));
+    glm::vec3 extent = axisX * in.extentX[i] + axisY * in.extentY[i] +
+                       axisZ * in.extentZ[i];
+
+    out.centerX[i] = center.x;
+    out.centerY[i] = center.y;
+    out.centerZ[i] = center.z;
+    out.extentX[i] = extent.x;
+    out.extentY[i] = extent.y;
+    out.extentZ[i] = extent.z;
+  }
+}
+
+static uint32_t CullSpheresScalar(const glm::vec4 *planes,
+                                  const SphereArrays &spheres,
+                                  uint8_t *visible, uint32_t count) {
+  uint32_t visibleCount = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    glm::vec3 center = {spheres.centerX[i], spheres.centerY[i],
+                        spheres.centerZ[i]};
+
+    // Outside if the whole sphere is behind any one plane
+    bool inside = true;
+    for (int p = 0; p < 6 && inside; p++) {
+      inside = glm::dot(glm::vec3(planes[p]), center) + planes[p].w >=
+               -spheres.radius[i];
+    }
+
+    visible[i] = inside;
+    visibleCount += inside;
+  }
+  return visibleCount;
+}
+
+static const SimdKernels scalarKernels = {
+    MultiplyMatricesScalar, ComposeHierarchyScalar, TransformAabbsScalar,
+    CullSpheresScalar};
+
+#if defined(MINIENGINE_SIMD_X86)
+
+// SSE2, a column per register
+
+// A column of a * b, the columns of a weighted by the column of b
+static inline __m128 MultiplyColumnSse2(__m128 a0, __m128 a1, __m128 a2,
+                                        __m128 a3, const float *column) {
+  __m128 result = _mm_mul_ps(a0, _mm_set1_ps(column[0]));
+  result = _mm_add_ps(result, _mm_mul_ps(a1, _mm_set1_ps(column[1])));
+  result = _mm_add_ps(result, _mm_mul_ps(a2, _mm_set1_ps(column[2])));
+  return _mm_add_ps(result, _mm_mul_ps(a3, _mm_set1_ps(column[3])));
+}
+
+static inline void MultiplyMatrixSse2(const float *a, const float *b,
+                                      float *out) {
+  // Loaded before anything is written, so `out` can be `a`. A column of b is
+  // read before the same column of out is written, so it can be `b` too.
+  __m128 a0 = _mm_loadu_ps(a);
+  __m128 a1 = _mm_loadu_ps(a + 4);
+  __m128 a2 = _mm_loadu_ps(a + 8);
+  __m128 a3 = _mm_loadu_ps(a + 12);
+  for (int column = 0; column < 4; column++) {
+    _mm_storeu_ps(out + column * 4,
+                  MultiplyColumnSse2(a0, a1, a2, a3, b + column * 4));
+  }
+}
+
+static void MultiplyMatricesSse2(const glm::mat4 *a, const glm::mat4 *b,
+                                 glm::mat4 *out, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    MultiplyMatrixSse2(Floats(&a[i]), Floats(&b[i]), Floats(&out[i]));
+  }
+}
+
+static void ComposeHierarchySse2(const uint32_t *parents,
+                                 const glm::mat4 *locals, glm::mat4 *worlds,
+                                 uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (parents[i] == UINT32_MAX) {
+      worlds[i] = locals[i];
+    } else {
+      MultiplyMatrixSse2(Floats(&worlds[parents[i]]), Floats(&locals[i]),
+                         Floats(&worlds[i]));
+    }
+  }
+}
+
+// Four boxes at a time
+static void TransformAabbsSse2(const glm::mat4 &transform,
+                               const AabbArrays &in, const AabbArrays &out,
+                               uint32_t count) {
+  const float *m = Floats(&transform);
+  __m128 signMask = _mm_set1_ps(-0.0f);
+  __m128 row[3][4];
+  __m128 absolute[3][3];
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 4; c++) {
+      row[r][c] = _mm_set1_ps(m[c * 4 + r]);
+      if (c < 3) {
+        absolute[r][c] = _mm_andnot_ps(signMask, row[r][c]);
+      }
+    }
+  }
+
+  const float *centers[3] = {in.centerX, in.centerY, in.centerZ};
+  const float *extents[3] = {in.extentX, in.extentY, in.extentZ};
+  float *outCenters[3] = {out.centerX, out.centerY, out.centerZ};
+  float *outExtents[3] = {out.extentX, out.extentY, out.extentZ};
+
+  uint32_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 center[3], extent[3];
+    for (int axis = 0; axis < 3; axis++) {
+      center[axis] = _mm_loadu_ps(centers[axis] + i);
+      extent[axis] = _mm_loadu_ps(extents[axis] + i);
+    }
+
+    for (int r = 0; r < 3; r++) {
+      __m128 c = _mm_add_ps(_mm_mul_ps(row[r][0], center[0]), row[r][3]);
+      c = _mm_add_ps(c, _mm_mul_ps(row[r][1], center[1]));
+      c = _mm_add_ps(c, _mm_mul_ps(row[r][2], center[2]));
+      __m128 e = _mm_mul_ps(absolute[r][0], extent[0]);
+      e = _mm_add_ps(e, _mm_mul_ps(absolute[r][1], extent[1]));
+      e = _mm_add_ps(e, _mm_mul_ps(absolute[r][2], extent[2]));
+      _mm_storeu_ps(outCenters[r] + i, c);
+      _mm_storeu_ps(outExtents[r] + i, e);
+    }
+  }
+
+  TransformAabbsScalar(transform, Advance(in, i), Advance(out, i), count - i);
+}
+
+static uint32_t CullSpheresSse2(const glm::vec4 *planes,
+                                const SphereArrays &spheres, uint8_t *visible,
+                                uint32_t count) {
+  __m128 plane[6][4];
+  for (int p = 0; p < 6; p++) {
+    for (int c = 0; c < 4; c++) {
+      plane[p][c] = _mm_set1_ps(planes[p][c]);
+    }
+  }
+
+  uint32_t visibleCount = 0;
+  uint32_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_loadu_ps(spheres.centerX + i);
+    __m128 y = _mm_loadu_ps(spheres.centerY + i);
+    __m128 z = _mm_loadu_ps(spheres.centerZ + i);
+    __m128 negativeRadius =
+        _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(spheres.radius + i));
+
+    // Every lane tests every plane, there is no early out
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int p = 0; p < 6; p++) {
+      __m128 distance = _mm_add_ps(_mm_mul_ps(plane[p][0], x), plane[p][3]);
+      distance = _mm_add_ps(distance, _mm_mul_ps(plane[p][1], y));
+      distance = _mm_add_ps(distance, _mm_mul_ps(plane[p][2], z));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+    }
+
+    int bits = _mm_movemask_ps(inside);
+    for (int lane = 0; lane < 4; lane++) {
+      visible[i + lane] = (bits >> lane) & 1;
+    }
+    visibleCount += std::popcount(static_cast<uint32_t>(bits));
+  }
+
+  return visibleCount + CullSpheresScalar(planes, Advance(spheres, i),
+                                          visible + i, count - i);
+}
+
+static const SimdKernels sse2Kernels = {
+    MultiplyMatricesSse2, ComposeHierarchySse2, TransformAabbsSse2,
+    CullSpheresSse2};
+
+// AVX2 with FMA, two columns or eight elements per register
+
+MINIENGINE_TARGET_AVX2
+static inline void MultiplyMatrixAvx2(const float *a, const float *b,
+                                      float *out) {
+  // Each column of a in both halves
+  __m256 a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a));
+  __m256 a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 4));
+  __m256 a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 8));
+  __m256 a3 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 12));
+  __m256 b01 = _mm256_loadu_ps(b);
+  __m256 b23 = _mm256_loadu_ps(b + 8);
+
+  // Within each half, broadcasts one element of that half's column of b
+  __m256 out01 = _mm256_mul_ps(a0, _mm256_permute_ps(b01, 0x00));
+  out01 = _mm256_fmadd_ps(a1, _mm256_permute_ps(b01, 0x55), out01);
+  out01 = _mm256_fmadd_ps(a2, _mm256_permute_ps(b01, 0xaa), out01);
+  out01 = _mm256_fmadd_ps(a3, _mm256_permute_ps(b01, 0xff), out01);
+  __m256 out23 = _mm256_mul_ps(a0, _mm256_permute_ps(b23, 0x00));
+  out23 = _mm256_fmadd_ps(a1, _mm256_permute_ps(b23, 0x55), out23);
+  out23 = _mm256_fmadd_ps(a2, _mm256_permute_ps(b23, 0xaa), out23);
+  out23 = _mm256_fmadd_ps(a3, _mm256_permute_ps(b23, 0xff), out23);
+
+  _mm256_storeu_ps(out, out01);
+  _mm256_storeu_ps(out + 8, out23);
+}
+
+MINIENGINE_TARGET_AVX2
+static void MultiplyMatricesAvx2(const glm::mat4 *a, const glm::mat4 *b,
+                                 glm::mat4 *out, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    MultiplyMatrixAvx2(Floats(&a[i]), Floats(&b[i]), Floats(&out[i]));
+  }
+}
+
+MINIENGINE_TARGET_AVX2
+static void ComposeHierarchyAvx2(const uint32_t *parents,
+                                 const glm::mat4 *locals, glm::mat4 *worlds,
+                                 uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (parents[i] == UINT32_MAX) {
+      worlds[i] = locals[i];
+    } else {
+      MultiplyMatrixAvx2(Floats(&worlds[parents[i]]), Floats(&locals[i]),
+                         Floats(&worlds[i]));
+    }
+  }
+}
+
+MINIENGINE_TARGET_AVX2
+static void TransformAabbsAvx2(const glm::mat4 &transform,
+                               const AabbArrays &in, const AabbArrays &out,
+                               uint32_t count) {
+  const float *m = Floats(&transform);
+  __m256 signMask = _mm256_set1_ps(-0.0f);
+  __m256 row[3][4];
+  __m256 absolute[3][3];
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 4; c++) {
+      row[r][c] = _mm256_set1_ps(m[c * 4 + r]);
+      if (c < 3) {
+        absolute[r][c] = _mm256_andnot_ps(signMask, row[r][c]);
+      }
+    }
+  }
+
+  const float *centers[3] = {in.centerX, in.centerY, in.centerZ};
+  const float *extents[3] = {in.extentX, in.extentY, in.extentZ};
+  float *outCenters[3] = {out.centerX, out.centerY, out.centerZ};
+  float *outExtents[3] = {out.extentX, out.extentY, out.extentZ};
+
+  uint32_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 center[3], extent[3];
+    for (int axis = 0; axis < 3; axis++) {
+      center[axis] = _mm256_loadu_ps(centers[axis] + i);
+      extent[axis] = _mm256_loadu_ps(extents[axis] + i);
+    }
+
+    for (int r = 0; r < 3; r++) {
+      __m256 c = _mm256_fmadd_ps(row[r][0], center[0], row[r][3]);
+      c = _mm256_fmadd_ps(row[r][1], center[1], c);
+      c = _mm256_fmadd_ps(row[r][2], center[2], c);
+      __m256 e = _mm256_mul_ps(absolute[r][0], extent[0]);
+      e = _mm256_fmadd_ps(absolute[r][1], extent[1], e);
+      e = _mm256_fmadd_ps(absolute[r][2], extent[2], e);
+      _mm256_storeu_ps(outCenters[r] + i, c);
+      _mm256_storeu_ps(outExtents[r] + i, e);
+    }
+  }
+
+  TransformAabbsSse2(transform, Advance(in, i), Advance(out, i), count - i);
+}
+
+MINIENGINE_TARGET_AVX2
+static uint32_t CullSpheresAvx2(const glm::vec4 *planes,
+                                const SphereArrays &spheres, uint8_t *visible,
+                                uint32_t count) {
+  __m256 plane[6][4];
+  for (int p = 0; p < 6; p++) {
+    for (int c = 0; c < 4; c++) {
+      plane[p][c] = _mm256_set1_ps(planes[p][c]);
+    }
+  }
+
+  uint32_t visibleCount = 0;
+  uint32_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 x = _mm256_loadu_ps(spheres.centerX + i);
+    __m256 y = _mm256_loadu_ps(spheres.centerY + i);
+    __m256 z = _mm256_loadu_ps(spheres.centerZ + i);
+    __m256 negativeRadius =
+        _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(spheres.radius + i));
+
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int p = 0; p < 6; p++) {
+      __m256 distance = _mm256_fmadd_ps(plane[p][0], x, plane[p][3]);
+      distance = _mm256_fmadd_ps(plane[p][1], y, distance);
+      distance = _mm256_fmadd_ps(plane[p][2], z, distance);
+      inside = _mm256_and_ps(
+          inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+    }
+
+    uint32_t bits = static_cast<uint32_t>(_mm256_movemask_ps(inside));
+    for (int lane = 0; lane < 8; lane++) {
+      visible[i + lane] = (bits >> lane) & 1;
+    }
+    visibleCount += std::popcount(bits);
+  }
+
+  return visibleCount + CullSpheresSse2(planes, Advance(spheres, i),
+                                        visible + i, count - i);
+}
+
+static const SimdKernels avx2Kernels = {
+    MultiplyMatricesAvx2, ComposeHierarchyAvx2, TransformAabbsAvx2,
+    CullSpheresAvx2};
+
+#elif defined(MINIENGINE_SIMD_NEON)
+
+// NEON, a column or four elements per register
+
+static inline void MultiplyMatrixNeon(const float *a, const float *b,
+                                      float *out) {
+  float32x4_t a0 = vld1q_f32(a);
+  float32x4_t a1 = vld1q_f32(a + 4);
+  float32x4_t a2 = vld1q_f32(a + 8);
+  float32x4_t a3 = vld1q_f32(a + 12);
+  for (int column = 0; column < 4; column++) {
+    float32x4_t bColumn = vld1q_f32(b + column * 4);
+    float32x4_t result = vmulq_laneq_f32(a0, bColumn, 0);
+    result = vfmaq_laneq_f32(result, a1, bColumn, 1);
+    result = vfmaq_laneq_f32(result, a2, bColumn, 2);
+    result = vfmaq_laneq_f32(result, a3, bColumn, 3);
+    vst1q_f32(out + column * 4, result);
+  }
+}
+
+static void MultiplyMatricesNeon(const glm::mat4 *a, const glm::mat4 *b,
+                                 glm::mat4 *out, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    MultiplyMatrixNeon(Floats(&a[i]), Floats(&b[i]), Floats(&out[i]));
+  }
+}
+
+static void ComposeHierarchyNeon(const uint32_t *parents,
+                                 const glm::mat4 *locals, glm::mat4 *worlds,
+                                 uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (parents[i] == UINT32_MAX) {
+      worlds[i] = locals[i];
+    } else {
+      MultiplyMatrixNeon(Floats(&worlds[parents[i]]), Floats(&locals[i]),
+                         Floats(&worlds[i]));
+    }
+  }
+}
+
+static void TransformAabbsNeon(const glm::mat4 &transform,
+                               const AabbArrays &in, const AabbArrays &out,
+                               uint32_t count) {
+  const float *m = Floats(&transform);
+  float32x4_t row[3][4];
+  float32x4_t absolute[3][3];
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 4; c++) {
+      row[r][c] = vdupq_n_f32(m[c * 4 + r]);
+      if (c < 3) {
+        absolute[r][c] = vabsq_f32(row[r][c]);
+      }
+    }
+  }
+
+  const float *centers[3] = {in.centerX, in.centerY, in.centerZ};
+  const float *extents[3] = {in.extentX, in.extentY, in.extentZ};
+  float *outCenters[3] = {out.centerX, out.centerY, out.centerZ};
+  float *outExtents[3] = {out.extentX, out.extentY, out.extentZ};
+
+  uint32_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    float32x4_t center[3], extent[3];
+    for (int axis = 0; axis < 3; axis++) {
+      center[axis] = vld1q_f32(centers[axis] + i);
+      extent[axis] = vld1q_f32(extents[axis] + i);
+    }
+
+    for (int r = 0; r < 3; r++) {
+      float32x4_t c = vfmaq_f32(row[r][3], row[r][0], center[0]);
+      c = vfmaq_f32(c, row[r][1], center[1]);
+      c = vfmaq_f32(c, row[r][2], center[2]);
+      float32x4_t e = vmulq_f32(absolute[r][0], extent[0]);
+      e = vfmaq_f32(e, absolute[r][1], extent[1]);
+      e = vfmaq_f32(e, absolute[r][2], extent[2]);
+      vst1q_f32(outCenters[r] + i, c);
+      vst1q_f32(outExtents[r] + i, e);
+    }
+  }
+
+  TransformAabbsScalar(transform, Advance(in, i), Advance(out, i), count - i);
+}
+
+static uint32_t CullSpheresNeon(const glm::vec4 *planes,
+                                const SphereArrays &spheres, uint8_t *visible,
+                                uint32_t count) {
+  float32x4_t plane[6][4];
+  for (int p = 0; p < 6; p++) {
+    for (int c = 0; c < 4; c++) {
+      plane[p][c] = vdupq_n_f32(planes[p][c]);
+    }
+  }
+
+  // Each lane's bit, so a horizontal add turns a mask into a bitfield
+  const uint32_t laneBitValues[4] = {1, 2, 4, 8};
+  uint32x4_t laneBits = vld1q_u32(laneBitValues);
+
+  uint32_t visibleCount = 0;
+  uint32_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    float32x4_t x = vld1q_f32(spheres.centerX + i);
+    float32x4_t y = vld1q_f32(spheres.centerY + i);
+    float32x4_t z = vld1q_f32(spheres.centerZ + i);
+    float32x4_t negativeRadius = vnegq_f32(vld1q_f32(spheres.radius + i));
+
+    uint32x4_t inside = vdupq_n_u32(UINT32_MAX);
+    for (int p = 0; p < 6; p++) {
+      float32x4_t distance = vfmaq_f32(plane[p][3], plane[p][0], x);
+      distance = vfmaq_f32(distance, plane[p][1], y);
+      distance = vfmaq_f32(distance, plane[p][2], z);
+      inside = vandq_u32(inside, vcgeq_f32(distance, negativeRadius));
+    }
+
+    uint32_t bits = vaddvq_u32(vandq_u32(inside, laneBits));
+    for (int lane = 0; lane < 4; lane++) {
+      visible[i + lane] = (bits >> lane) & 1;
+    }
+    visibleCount += vaddvq_u32(vshrq_n_u32(inside, 31));
+  }
+
+  return visibleCount + CullSpheresScalar(planes, Advance(spheres, i),
+                                          visible + i, count - i);
+}
+
+static const SimdKernels neonKernels = {
+    MultiplyMatricesNeon, ComposeHierarchyNeon, TransformAabbsNeon,
+    CullSpheresNeon};
+
+#endif
+
+static SimdLevel DetectSimdLevel() {
+#if defined(MINIENGINE_SIMD_X86)
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return SimdLevel::Avx2;
+  }
+#elif defined(_MSC_VER)
+  // AVX2 and FMA on the CPU, and the OS saving the YMM registers
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] >= 7) {
+    __cpuid(info, 1);
+    bool fma = (info[2] & (1 << 12)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+    if (fma && osxsave && avx2 && (_xgetbv(0) & 6) == 6) {
+      return SimdLevel::Avx2;
+    }
+  }
+#endif
+  return SimdLevel::Sse2;
+#elif defined(MINIENGINE_SIMD_NEON)
+  return SimdLevel::Neon;
+#else
+  return SimdLevel::Scalar;
+#endif
+}
+
+static const SimdKernels &GetKernelsFor(SimdLevel level) {
+  switch (level) {
+#if defined(MINIENGINE_SIMD_X86)
+  case SimdLevel::Sse2:
+    return sse2Kernels;
+  case SimdLevel::Avx2:
+    return avx2Kernels;
+#elif defined(MINIENGINE_SIMD_NEON)
+  case SimdLevel::Neon:
+    return neonKernels;
+#endif
+  default:
+    return scalarKernels;
+  }
+}
+
+static bool IsSupported(SimdLevel level) {
+  SimdLevel supported = GetSupportedSimdLevel();
+  switch (level) {
+  case SimdLevel::Scalar:
+    return true;
+  case SimdLevel::Sse2:
+    return supported == SimdLevel::Sse2 || supported == SimdLevel::Avx2;
+  default:
+    return level == supported;
+  }
+}
+
+// Null until the first kernel call or SetSimdLevel
+static std::atomic<SimdLevel> currentLevel = SimdLevel::Scalar;
+static std::atomic<const SimdKernels *> currentKernels = nullptr;
+
+static const SimdKernels &GetKernels() {
+  const SimdKernels *kernels = currentKernels.load(std::memory_order_acquire);
+  if (!kernels) {
+    SetSimdLevel(GetSupportedSimdLevel());
+    kernels = currentKernels.load(std::memory_order_acquire);
+  }
+  return *kernels;
+}
+
+SimdLevel GetSupportedSimdLevel() {
+  static const SimdLevel level = DetectSimdLevel();
+  return level;
+}
+
+SimdLevel GetSimdLevel() {
+  GetKernels();
+  return currentLevel.load(std::memory_order_relaxed);
+}
+
+void SetSimdLevel(SimdLevel level) {
+  if (!IsSupported(level)) {
+    level = GetSupportedSimdLevel();
+  }
+  currentLevel.store(level, std::memory_order_relaxed);
+  currentKernels.store(&GetKernelsFor(level), std::memory_order_release);
+}
+
+const char *GetSimdLevelName(SimdLevel level) {
+  switch (level) {
+  case SimdLevel::Scalar:
+    return "scalar";
+  case SimdLevel::Sse2:
+    return "SSE2";
+  case SimdLevel::Avx2:
+    return "AVX2";
+  case SimdLevel::Neon:
+    return "NEON";
+  }
+  return "unknown";
+}
+
+void MultiplyMatrices(const glm::mat4 *a, const glm::mat4 *b, glm::mat4 *out,
+                      uint32_t count) {
+  GetKernels().multiplyMatrices(a, b, out, count);
+}
+
+void ComposeHierarchy(const uint32_t *parents, const glm::mat4 *locals,
+                      glm::mat4 *worlds, uint32_t count) {
+  GetKernels().composeHierarchy(parents, locals, worlds, count);
+}
+
+void TransformAabbs(const glm::mat4 &transform, const AabbArrays &in,
+                    const AabbArrays &out, uint32_t count) {
+  GetKernels().transformAabbs(transform, in, out, count);
+}
+
+uint32_t CullSpheres(const glm::vec4 planes[6], const SphereArrays &spheres,
+                     uint8_t *visible, uint32_t count) {
+  return GetKernels().cullSpheres(planes, spheres, visible, count);
+}
+
+} // namespace MiniEngine
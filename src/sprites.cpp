@@ -0,0 +1,232 @@
+#include <miniengine/sprites.h>
+
+#include <miniengine/app.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace MiniEngine {
+
+constexpr uint32_t SPRITE_VERTICES = 4;
+constexpr uint32_t SPRITE_INDICES = 6;
+
+void SpriteBatch::Init(VkDevice device, GpuAllocator &allocator,
+                       uint32_t frameCount, uint32_t maxQuads,
+                       VkBuffer indexBuffer,
+                       const VkAllocationCallbacks *hostCallbacks) {
+  SPDLOG_TRACE("SpriteBatch::Init({}, {})", frameCount, maxQuads);
+
+  this->device = device;
+  this->hostCallbacks = hostCallbacks;
+  this->allocator = &allocator;
+  this->maxQuads = maxQuads;
+  this->indexBuffer = indexBuffer;
+
+  VkDeviceSize frameSize =
+      static_cast<VkDeviceSize>(maxQuads) * SPRITE_VERTICES * sizeof(Vertex);
+  instanceOffset = frameSize * frameCount;
+
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = instanceOffset + sizeof(InstanceData);
+  bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer(device, &bufferInfo, hostCallbacks, &buffer) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to create sprite vertex buffer");
+  }
+
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+  // The GPU reads the vertices straight out of host memory. They are only
+  // read once per frame, so that is cheaper than staging them.
+  allocation = allocator.Allocate(memRequirements,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+  vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+
+  // Sprites are already in clip space, so the instance they are all drawn
+  // with leaves them as they are
+  InstanceData instance = {};
+  instance.transform = glm::mat4(1.0f);
+  instance.colour = glm::vec4(1.0f);
+  memcpy(static_cast<char *>(allocation.mapped) + instanceOffset, &instance,
+         sizeof(instance));
+
+  quads.reserve(maxQuads);
+  keys.reserve(maxQuads);
+}
+
+void SpriteBatch::Destroy() {
+  if (buffer == VK_NULL_HANDLE) {
+    return;
+  }
+
+  SPDLOG_TRACE("SpriteBatch::Destroy()");
+
+  vkDestroyBuffer(device, buffer, hostCallbacks);
+  allocator->Free(allocation);
+
+  buffer = VK_NULL_HANDLE;
+}
+
+std::vector<uint32_t> SpriteBatch::BuildIndices(uint32_t maxQuads) {
+  std::vector<uint32_t> result(static_cast<size_t>(maxQuads) * SPRITE_INDICES);
+  for (uint32_t i = 0; i < maxQuads; i++) {
+    uint32_t base = i * SPRITE_VERTICES;
+    uint32_t *quad = &result[static_cast<size_t>(i) * SPRITE_INDICES];
+    quad[0] = base + 0;
+    quad[1] = base + 1;
+    quad[2] = base + 2;
+    quad[3] = base + 2;
+    quad[4] = base + 3;
+    quad[5] = base + 0;
+  }
+  return result;
+}
+
+void SpriteBatch::BeginFrame(uint32_t frameIndex) {
+  frameBase = static_cast<VkDeviceSize>(frameIndex) * maxQuads *
+              SPRITE_VERTICES * sizeof(Vertex);
+  quads.clear();
+  draws.clear();
+}
+
+bool SpriteBatch::Submit(const SpriteQuad &quad) {
+  if (quads.size() >= maxQuads) {
+    return false;
+  }
+
+  quads.push_back(quad);
+  return true;
+}
+
+void SpriteBatch::Prepare() {
+  draws.clear();
+  if (quads.empty()) {
+    return;
+  }
+
+  // There are only ever a handful of pipelines, a linear search beats a map
+  pipelineSlots.clear();
+  auto slotOf = [&](VkPipeline pipeline) {
+    for (size_t i = 0; i < pipelineSlots.size(); i++) {
+      if (pipelineSlots[i] == pipeline) {
+        return static_cast<uint64_t>(i);
+      }
+    }
+    pipelineSlots.push_back(pipeline);
+    return static_cast<uint64_t>(pipelineSlots.size() - 1);
+  };
+
+  // The submission index in the low bits keeps the sort stable
+  keys.resize(quads.size());
+  for (size_t i = 0; i < quads.size(); i++) {
+    keys[i] = static_cast<uint64_t>(quads[i].layer) << 48 |
+              (slotOf(quads[i].pipeline) & 0xffff) << 32 |
+              static_cast<uint64_t>(i);
+  }
+
+  // Most frames submit in draw order already
+  if (!std::is_sorted(keys.begin(), keys.end())) {
+    std::sort(keys.begin(), keys.end());
+  }
+
+  Vertex *vertices = reinterpret_cast<Vertex *>(
+      static_cast<char *>(allocation.mapped) + frameBase);
+
+  for (uint32_t i = 0; i < keys.size(); i++) {
+    const SpriteQuad &quad = quads[keys[i] & 0xffffffff];
+
+    // Each corner shares its coordinates with two others, so only four
+    // halves are converted per quad
+    uint16_t minX = FloatToHalf(quad.min.x);
+    uint16_t minY = FloatToHalf(quad.min.y);
+    uint16_t maxX = FloatToHalf(quad.max.x);
+    uint16_t maxY = FloatToHalf(quad.max.y);
+    UNorm8x4 colour = PackUNorm8x4(quad.colour);
+
+    // Same corners and winding as the demo quad
+    Vertex *out = vertices + static_cast<size_t>(i) * SPRITE_VERTICES;
+    out[0] = {{minX, minY}, colour};
+    out[1] = {{maxX, minY}, colour};
+    out[2] = {{maxX, maxY}, colour};
+    out[3] = {{minX, maxY}, colour};
+
+    if (draws.empty() || draws.back().pipeline != quad.pipeline ||
+        draws.back().material != quad.material ||
+        draws.back().texture != quad.texture) {
+      draws.push_back({quad.pipeline, quad.material, quad.texture, i, 0});
+    }
+    draws.back().quadCount++;
+  }
+}
+
+void SpriteBatch::Record(VkCommandBuffer commandBuffer, VkExtent2D extent,
+                         const BindlessHeap &heap, const UniformRing &uniforms,
+                         uint32_t frameUniforms, VkPipelineLayout layout,
+                         uint32_t materials) const {
+  if (draws.empty()) {
+    return;
+  }
+
+  VkViewport viewport = {};
+  viewport.x = 0.0f;
+  viewport.y = 0.0f;
+  viewport.width = static_cast<float>(extent.width);
+  viewport.height = static_cast<float>(extent.height);
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+  VkRect2D scissor = {};
+  scissor.offset = {0, 0};
+  scissor.extent = extent;
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+  // The frame's vertices at binding 0 and the single instance at binding 1
+  VkBuffer vertexBuffers[] = {buffer, buffer};
+  VkDeviceSize offsets[] = {frameBase, instanceOffset};
+  vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+
+  vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+  // Every pipeline shares the layout, so these stay bound across them
+  heap.Bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout);
+  uniforms.Bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1,
+                frameUniforms);
+
+  // The quads' vertices are already where they go
+  ObjectConstants object;
+  VkPushConstantRange objectRange = GetObjectPushConstantRange();
+  vkCmdPushConstants(commandBuffer, layout, objectRange.stageFlags,
+                     objectRange.offset, sizeof(object), &object);
+
+  VkPipeline boundPipeline = VK_NULL_HANDLE;
+  for (const Draw &draw : draws) {
+    if (draw.pipeline != boundPipeline) {
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                        draw.pipeline);
+      boundPipeline = draw.pipeline;
+    }
+
+    DrawConstants constants;
+    constants.materials = materials;
+    constants.material = draw.material;
+    constants.texture = draw.texture;
+    VkPushConstantRange range = BindlessHeap::GetPushConstantRange();
+    vkCmdPushConstants(commandBuffer, layout, range.stageFlags, 0,
+                       sizeof(constants), &constants);
+
+    vkCmdDrawIndexed(commandBuffer, draw.quadCount * SPRITE_INDICES, 1,
+                     draw.firstQuad * SPRITE_INDICES, 0, 0);
+  }
+}
+
+} // namespace MiniEngine
@@ -0,0 +1,196 @@
+#include <miniengine/staging.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+namespace MiniEngine {
+
+// Keeps each copy's source offset aligned, this is generous but it is the
+// optimal buffer copy offset alignment on most hardware.
+constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+void StagingRing::Init(VkDevice device, GpuAllocator &allocator,
+                       uint32_t frameCount, VkDeviceSize frameCapacity,
+                       const VkAllocationCallbacks *hostCallbacks) {
+  SPDLOG_TRACE("StagingRing::Init({}, {})", frameCount, frameCapacity);
+
+  this->device = device;
+  this->hostCallbacks = hostCallbacks;
+  this->allocator = &allocator;
+  this->frameCapacity = frameCapacity;
+
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = frameCapacity * frameCount;
+  bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer(device, &bufferInfo, hostCallbacks, &buffer) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to create staging ring buffer");
+  }
+
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+  allocation = allocator.Allocate(memRequirements,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+  vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+}
+
+void StagingRing::Destroy() {
+  if (buffer == VK_NULL_HANDLE) {
+    return;
+  }
+
+  SPDLOG_TRACE("StagingRing::Destroy()");
+
+  vkDestroyBuffer(device, buffer, hostCallbacks);
+  allocator->Free(allocation);
+
+  buffer = VK_NULL_HANDLE;
+}
+
+void StagingRing::BeginFrame(uint32_t frameIndex) {
+  // The GPU is done with everything this region was used for last time
+  frameBase = frameIndex * frameCapacity;
+  head = 0;
+  pending.clear();
+}
+
+bool StagingRing::Upload(VkBuffer dstBuffer, VkDeviceSize dstOffset,
+                         const void *data, VkDeviceSize size) {
+  VkDeviceSize offset = (head + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+  if (offset + size > frameCapacity) {
+    spdlog::warn("Staging ring full, dropping {} byte upload", size);
+    return false;
+  }
+
+  memcpy(static_cast<char *>(allocation.mapped) + frameBase + offset, data,
+         (size_t)size);
+  head = offset + size;
+  bytesUploaded += size;
+
+  VkBufferCopy region = {};
+  region.srcOffset = frameBase + offset;
+  region.dstOffset = dstOffset;
+  region.size = size;
+  pending.push_back({buffer, dstBuffer, region, pending.size()});
+
+  return true;
+}
+
+void StagingRing::Flush(VkCommandBuffer commandBuffer,
+                        VkPipelineStageFlags dstStageMask,
+                        VkAccessFlags dstAccessMask) {
+  if (pending.empty()) {
+    return;
+  }
+
+  // Earlier frames may still be reading the destinations, a barrier's first
+  // scope covers everything submitted before it on the queue so this orders
+  // those reads before our writes (write-after-read only needs an execution
+  // dependency).
+  vkCmdPipelineBarrier(commandBuffer, dstStageMask,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 0, nullptr);
+
+  // One vkCmdCopyBuffer per destination, with every region going to it
+  RecordBufferCopies(commandBuffer, pending, regions);
+
+  // Make the writes visible to whatever reads the destinations this frame
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = dstAccessMask;
+
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       dstStageMask, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+  pending.clear();
+}
+
+void RecordBufferCopies(VkCommandBuffer commandBuffer,
+                        std::vector<QueuedCopy> &copies,
+                        std::vector<VkBufferCopy> &regions) {
+  // Grouped by destination, in the order they were queued. Handles are
+  // pointers on 64 bit, which only std::less orders.
+  std::sort(copies.begin(), copies.end(),
+            [](const QueuedCopy &a, const QueuedCopy &b) {
+              return a.dstBuffer != b.dstBuffer
+                         ? std::less<VkBuffer>()(a.dstBuffer, b.dstBuffer)
+                         : a.order < b.order;
+            });
+
+  auto record = [&](size_t first, size_t last) {
+    regions.clear();
+    for (size_t i = first; i < last; i++) {
+      regions.push_back(copies[i].region);
+    }
+    vkCmdCopyBuffer(commandBuffer, copies[first].srcBuffer,
+                    copies[first].dstBuffer,
+                    static_cast<uint32_t>(regions.size()), regions.data());
+  };
+
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+  for (size_t group = 0; group < copies.size();) {
+    size_t end = group;
+    while (end < copies.size() &&
+           copies[end].dstBuffer == copies[group].dstBuffer) {
+      end++;
+    }
+
+    // The copies since the last barrier, and the bytes they span. Uploads
+    // usually move forwards through a buffer, so most never need the search.
+    size_t since = group;
+    size_t run = group; // Start of the command being built
+    VkDeviceSize low = UINT64_MAX;
+    VkDeviceSize high = 0;
+
+    for (size_t i = group; i < end; i++) {
+      const VkBufferCopy &region = copies[i].region;
+      VkDeviceSize start = region.dstOffset;
+      VkDeviceSize stop = region.dstOffset + region.size;
+
+      bool overlaps = false;
+      if (start < high && stop > low) {
+        for (size_t j = since; j < i && !overlaps; j++) {
+          const VkBufferCopy &earlier = copies[j].region;
+          overlaps = start < earlier.dstOffset + earlier.size &&
+                     stop > earlier.dstOffset;
+        }
+      }
+
+      if (overlaps || copies[i].srcBuffer != copies[run].srcBuffer) {
+        record(run, i);
+        run = i;
+      }
+      if (overlaps) {
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0,
+                             nullptr, 0, nullptr);
+        since = i;
+        low = UINT64_MAX;
+        high = 0;
+      }
+
+      low = std::min(low, start);
+      high = std::max(high, stop);
+    }
+
+    record(run, end);
+    group = end;
+  }
+}
+
+} // namespace MiniEngine
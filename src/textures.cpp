@@ -0,0 +1,668 @@
+#include <miniengine/textures.h>
+
+#include <spdlog/spdlog.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace MiniEngine {
+
+// A multiple of every block size and at least the optimal buffer copy offset
+// alignment on most hardware
+constexpr VkDeviceSize TEXTURE_STAGING_ALIGNMENT = 16;
+
+TextureFormatInfo GetTextureFormatInfo(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_R8G8B8A8_UNORM:
+  case VK_FORMAT_R8G8B8A8_SRGB:
+  case VK_FORMAT_B8G8R8A8_UNORM:
+  case VK_FORMAT_B8G8R8A8_SRGB:
+    return {1, 1, 4, false};
+
+  // 8 bytes per 4x4 block
+  case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+  case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+  case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+  case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+  case VK_FORMAT_BC4_UNORM_BLOCK:
+  case VK_FORMAT_BC4_SNORM_BLOCK:
+  case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+  case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+  case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+  case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+  case VK_FORMAT_EAC_R11_UNORM_BLOCK:
+  case VK_FORMAT_EAC_R11_SNORM_BLOCK:
+    return {4, 4, 8, true};
+
+  // 16 bytes per 4x4 block
+  case VK_FORMAT_BC2_UNORM_BLOCK:
+  case VK_FORMAT_BC2_SRGB_BLOCK:
+  case VK_FORMAT_BC3_UNORM_BLOCK:
+  case VK_FORMAT_BC3_SRGB_BLOCK:
+  case VK_FORMAT_BC5_UNORM_BLOCK:
+  case VK_FORMAT_BC5_SNORM_BLOCK:
+  case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+  case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+  case VK_FORMAT_BC7_UNORM_BLOCK:
+  case VK_FORMAT_BC7_SRGB_BLOCK:
+  case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+  case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+  case VK_FORMAT_EAC_R11G11_UNORM_BLOCK:
+  case VK_FORMAT_EAC_R11G11_SNORM_BLOCK:
+  case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+  case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+    return {4, 4, 16, true};
+
+  // ASTC is always 16 bytes a block, bigger blocks are lower quality
+  case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:
+  case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
+    return {6, 6, 16, true};
+  case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
+  case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
+    return {8, 8, 16, true};
+
+  default:
+    return {};
+  }
+}
+
+VkDeviceSize GetMipSize(VkFormat format, uint32_t width, uint32_t height) {
+  TextureFormatInfo info = GetTextureFormatInfo(format);
+  VkDeviceSize blocksX = (width + info.blockWidth - 1) / info.blockWidth;
+  VkDeviceSize blocksY = (height + info.blockHeight - 1) / info.blockHeight;
+  return blocksX * blocksY * info.blockBytes;
+}
+
+static VkExtent3D GetMipExtent(uint32_t width, uint32_t height,
+                               uint32_t level) {
+  return {std::max(width >> level, 1u), std::max(height >> level, 1u), 1};
+}
+
+void TextureStreamer::Init(VkPhysicalDevice physicalDevice, VkDevice device,
+                           GpuAllocator &allocator, uint32_t frameCount,
+                           VkDeviceSize budget,
+                           const VkAllocationCallbacks *hostCallbacks) {
+  SPDLOG_TRACE("TextureStreamer::Init({}, {})", frameCount, budget);
+
+  this->physicalDevice = physicalDevice;
+  this->device = device;
+  this->hostCallbacks = hostCallbacks;
+  this->allocator = &allocator;
+  this->budget = budget;
+
+  VkSamplerCreateInfo samplerInfo = {};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.minLod = 0.0f;
+  // The views only ever hold the resident mips, so this samples the best one
+  // there is
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+  if (vkCreateSampler(device, &samplerInfo, hostCallbacks, &sampler) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to create texture sampler");
+  }
+
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = TEXTURE_STREAM_FRAME_SIZE * frameCount;
+  bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer(device, &bufferInfo, hostCallbacks, &stagingBuffer) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to create texture staging buffer");
+  }
+
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(device, stagingBuffer, &memRequirements);
+
+  stagingAllocation = allocator.Allocate(
+      memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+  vkBindBufferMemory(device, stagingBuffer, stagingAllocation.memory,
+                     stagingAllocation.offset);
+}
+
+void TextureStreamer::Destroy() {
+  if (device == VK_NULL_HANDLE) {
+    return;
+  }
+
+  SPDLOG_TRACE("TextureStreamer::Destroy()");
+
+  for (Texture &texture : textures) {
+    if (texture.image != VK_NULL_HANDLE) {
+      vkDestroyImageView(device, texture.view, hostCallbacks);
+      vkDestroyImage(device, texture.image, hostCallbacks);
+      allocator->Free(texture.allocation);
+    }
+  }
+  textures.clear();
+
+  for (RetiredImage &old : retired) {
+    vkDestroyImageView(device, old.view, hostCallbacks);
+    vkDestroyImage(device, old.image, hostCallbacks);
+    allocator->Free(old.allocation);
+  }
+  retired.clear();
+
+  vkDestroyBuffer(device, stagingBuffer, hostCallbacks);
+  allocator->Free(stagingAllocation);
+  vkDestroySampler(device, sampler, hostCallbacks);
+
+  device = VK_NULL_HANDLE;
+}
+
+TextureHandle TextureStreamer::Load(const AssetPackage &package,
+                                    std::string_view name) {
+  SPDLOG_TRACE("TextureStreamer::Load({})", name);
+
+  AssetView asset = package.Find(name);
+  if (!asset.IsValid()) {
+    spdlog::warn("No texture {} in the package", name);
+    return {};
+  }
+
+  TextureView view = AssetPackage::GetTexture(asset);
+
+  Texture texture;
+  texture.name = name;
+  texture.format = view.format;
+  texture.width = view.width;
+  texture.height = view.height;
+  texture.mipLevels = view.mipLevels;
+
+  if (GetTextureFormatInfo(view.format).blockBytes == 0) {
+    spdlog::warn("Texture {} has a format the streamer doesn't know ({})",
+                 name, static_cast<int>(view.format));
+    return {};
+  }
+
+  for (uint32_t i = 0; i < view.mipLevels; i++) {
+    VkExtent3D extent = GetMipExtent(view.width, view.height, i);
+    if (view.mips[i].size() !=
+        GetMipSize(view.format, extent.width, extent.height)) {
+      throw std::runtime_error("Texture " + texture.name +
+                               " has the wrong mip sizes");
+    }
+    texture.mips[i] = view.mips[i];
+  }
+
+  return Add(std::move(texture));
+}
+
+TextureHandle TextureStreamer::LoadFile(const std::string &path) {
+  SPDLOG_TRACE("TextureStreamer::LoadFile({})", path);
+
+  int width, height, channels;
+  stbi_uc *pixels = stbi_load(path.c_str(), &width, &height, &channels, 4);
+  if (pixels == nullptr) {
+    throw std::runtime_error("Failed to load texture " + path + ": " +
+                             stbi_failure_reason());
+  }
+
+  Texture texture;
+  texture.name = path;
+  texture.format = VK_FORMAT_R8G8B8A8_SRGB;
+  texture.width = static_cast<uint32_t>(width);
+  texture.height = static_cast<uint32_t>(height);
+  texture.mipLevels = std::min(
+      static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) +
+          1,
+      PACKAGE_MAX_MIPS);
+  texture.generateMips = true;
+
+  // Moving the texture moves the vector's storage with it, so the span stays
+  // pointing at it
+  const std::byte *bytes = reinterpret_cast<const std::byte *>(pixels);
+  texture.pixels.assign(bytes,
+                        bytes + static_cast<size_t>(width) * height * 4);
+  texture.mips[0] = texture.pixels;
+  stbi_image_free(pixels);
+
+  return Add(std::move(texture));
+}
+
+TextureHandle TextureStreamer::Add(Texture &&texture) {
+  // Nothing here transcodes, so a texture in a format the GPU can't sample
+  // (BC on most phones, ASTC on most desktops) is skipped
+  VkFormatProperties properties;
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, texture.format,
+                                      &properties);
+  VkFormatFeatureFlags features = properties.optimalTilingFeatures;
+  if (!(features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+    spdlog::warn("Skipping texture {}, this GPU can't sample its format",
+                 texture.name);
+    return {};
+  }
+
+  VkFormatFeatureFlags blitFeatures =
+      VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+      VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  if (texture.generateMips && (features & blitFeatures) != blitFeatures) {
+    spdlog::warn("Can't generate mips for {}, using mip 0 only",
+                 texture.name);
+    texture.mipLevels = 1;
+  }
+
+  // Generated mips only exist on the GPU, so those textures can't drop any.
+  // Everything else keeps the mips up to TEXTURE_TAIL_SIZE.
+  if (!texture.generateMips) {
+    texture.tailBase = texture.mipLevels - 1;
+    while (texture.tailBase > 0 &&
+           std::max(texture.width >> (texture.tailBase - 1),
+                    texture.height >> (texture.tailBase - 1)) <=
+               TEXTURE_TAIL_SIZE) {
+      texture.tailBase--;
+    }
+  }
+
+  // The tail goes in one frame and every other mip in one each
+  VkDeviceSize largest =
+      texture.generateMips ? texture.mips[0].size()
+                           : GetResidentSize(texture, texture.tailBase);
+  for (uint32_t i = 0; i < texture.tailBase; i++) {
+    largest = std::max<VkDeviceSize>(largest, texture.mips[i].size());
+  }
+  if (largest + TEXTURE_STAGING_ALIGNMENT * PACKAGE_MAX_MIPS >
+      TEXTURE_STREAM_FRAME_SIZE) {
+    throw std::runtime_error("Texture " + texture.name +
+                             " is too large to stream");
+  }
+
+  texture.residentBase = texture.mipLevels;
+
+  TextureHandle handle;
+  handle.index = static_cast<uint32_t>(textures.size());
+  textures.push_back(std::move(texture));
+  return handle;
+}
+
+void TextureStreamer::SetPriority(TextureHandle handle, float priority) {
+  if (handle.IsValid()) {
+    textures[handle.index].priority = priority;
+  }
+}
+
+void TextureStreamer::BeginFrame(uint32_t frameIndex,
+                                 uint64_t completedFrame) {
+  frameBase = frameIndex * TEXTURE_STREAM_FRAME_SIZE;
+  head = 0;
+
+  std::erase_if(retired, [&](RetiredImage &old) {
+    if (old.lastFrame > completedFrame) {
+      return false;
+    }
+    vkDestroyImageView(device, old.view, hostCallbacks);
+    vkDestroyImage(device, old.image, hostCallbacks);
+    allocator->Free(old.allocation);
+    return true;
+  });
+}
+
+VkDeviceSize TextureStreamer::GetResidentSize(const Texture &texture,
+                                              uint32_t base) const {
+  VkDeviceSize size = 0;
+  for (uint32_t i = base; i < texture.mipLevels; i++) {
+    VkExtent3D extent = GetMipExtent(texture.width, texture.height, i);
+    size += GetMipSize(texture.format, extent.width, extent.height);
+  }
+  return size;
+}
+
+bool TextureStreamer::Stage(const Texture &texture, uint32_t level,
+                            VkDeviceSize &offset) {
+  std::span<const std::byte> data = texture.mips[level];
+
+  VkDeviceSize start = (head + TEXTURE_STAGING_ALIGNMENT - 1) &
+                       ~(TEXTURE_STAGING_ALIGNMENT - 1);
+  if (start + data.size() > TEXTURE_STREAM_FRAME_SIZE) {
+    return false;
+  }
+
+  // Straight from the package's mapping (or the decoded file) into memory
+  // the GPU copies from
+  memcpy(static_cast<char *>(stagingAllocation.mapped) + frameBase + start,
+         data.data(), data.size());
+  head = start + data.size();
+  offset = frameBase + start;
+  return true;
+}
+
+bool TextureStreamer::Rebuild(VkCommandBuffer commandBuffer, Texture &texture,
+                              uint32_t base, uint64_t frame) {
+  bool hasImage = texture.image != VK_NULL_HANDLE;
+  uint32_t oldBase = texture.residentBase;
+  uint32_t levels = texture.mipLevels - base;
+
+  // Staged first, so running out of room leaves the texture as it was.
+  // Generated mips only need mip 0.
+  uint32_t stageEnd =
+      texture.generateMips ? 1 : std::min(oldBase, texture.mipLevels);
+  VkBufferImageCopy uploads[PACKAGE_MAX_MIPS];
+  uint32_t uploadCount = 0;
+  VkDeviceSize savedHead = head;
+  for (uint32_t level = base; level < stageEnd; level++) {
+    VkDeviceSize offset;
+    if (!Stage(texture, level, offset)) {
+      head = savedHead;
+      return false;
+    }
+
+    VkBufferImageCopy &copy = uploads[uploadCount++];
+    copy = {};
+    copy.bufferOffset = offset;
+    copy.bufferRowLength = 0; // Tightly packed
+    copy.bufferImageHeight = 0;
+    copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copy.imageSubresource.mipLevel = level - base;
+    copy.imageSubresource.baseArrayLayer = 0;
+    copy.imageSubresource.layerCount = 1;
+    copy.imageOffset = {0, 0, 0};
+    copy.imageExtent = GetMipExtent(texture.width, texture.height, level);
+  }
+  bytesStreamed += head - savedHead;
+
+  VkImageCreateInfo imageInfo = {};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = texture.format;
+  imageInfo.extent = GetMipExtent(texture.width, texture.height, base);
+  imageInfo.mipLevels = levels;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  // Transfer source too, for when its mips are copied into the next image
+  imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                    VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                    VK_IMAGE_USAGE_SAMPLED_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  VkImage image;
+  if (vkCreateImage(device, &imageInfo, hostCallbacks, &image) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create texture image");
+  }
+
+  VkMemoryRequirements memRequirements;
+  vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+  Allocation allocation =
+      allocator->Allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                          ResourceKind::Optimal);
+  vkBindImageMemory(device, image, allocation.memory, allocation.offset);
+
+  // The new image is written, the old one read. Earlier frames may still be
+  // sampling the old one, which only needs an execution dependency.
+  VkImageMemoryBarrier barriers[2] = {};
+  barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barriers[0].srcAccessMask = 0;
+  barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].image = image;
+  barriers[0].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1};
+
+  barriers[1] = barriers[0];
+  barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barriers[1].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barriers[1].image = texture.image;
+  barriers[1].subresourceRange.levelCount = texture.mipLevels - oldBase;
+
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, hasImage ? 2 : 1, barriers);
+
+  // The mips both images have
+  if (hasImage) {
+    VkImageCopy copies[PACKAGE_MAX_MIPS];
+    uint32_t copyCount = 0;
+    for (uint32_t level = std::max(base, oldBase); level < texture.mipLevels;
+         level++) {
+      VkImageCopy &copy = copies[copyCount++];
+      copy = {};
+      copy.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - oldBase, 0, 1};
+      copy.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - base, 0, 1};
+      copy.extent = GetMipExtent(texture.width, texture.height, level);
+    }
+
+    vkCmdCopyImage(commandBuffer, texture.image,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copyCount, copies);
+  }
+
+  if (uploadCount > 0) {
+    vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uploadCount,
+                           uploads);
+  }
+
+  if (texture.generateMips) {
+    GenerateMips(commandBuffer, image, texture);
+  }
+
+  VkImageMemoryBarrier ready = barriers[0];
+  ready.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  ready.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  ready.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  ready.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &ready);
+
+  VkImageViewCreateInfo viewInfo = {};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = texture.format;
+  viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1};
+
+  VkImageView view;
+  if (vkCreateImageView(device, &viewInfo, hostCallbacks, &view) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to create texture image view");
+  }
+
+  // This frame's copies read the old image, so it goes when this frame is
+  // done with it
+  if (hasImage) {
+    retired.push_back({texture.image, texture.view, texture.allocation, frame});
+    if (base < oldBase) {
+      mipsStreamed += oldBase - base;
+    } else {
+      mipsEvicted += base - oldBase;
+    }
+  }
+
+  residentBytes -= texture.residentBytes;
+  texture.residentBytes = GetResidentSize(texture, base);
+  residentBytes += texture.residentBytes;
+
+  texture.image = image;
+  texture.view = view;
+  texture.allocation = allocation;
+  texture.residentBase = base;
+  texture.lastChanged = frame;
+  texture.generation++;
+  return true;
+}
+
+void TextureStreamer::GenerateMips(VkCommandBuffer commandBuffer,
+                                   VkImage image, const Texture &texture) {
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+  // Each mip is blitted from the one before it once that has been written
+  for (uint32_t level = 1; level < texture.mipLevels; level++) {
+    barrier.subresourceRange.baseMipLevel = level - 1;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+
+    VkExtent3D src = GetMipExtent(texture.width, texture.height, level - 1);
+    VkExtent3D dst = GetMipExtent(texture.width, texture.height, level);
+
+    VkImageBlit blit = {};
+    blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1};
+    blit.srcOffsets[1] = {static_cast<int32_t>(src.width),
+                          static_cast<int32_t>(src.height), 1};
+    blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+    blit.dstOffsets[1] = {static_cast<int32_t>(dst.width),
+                          static_cast<int32_t>(dst.height), 1};
+
+    vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                   VK_FILTER_LINEAR);
+  }
+
+  // Back to where the others are, so one barrier makes them all readable
+  if (texture.mipLevels > 1) {
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = texture.mipLevels - 1;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+  }
+}
+
+TextureStreamer::Texture *TextureStreamer::FindEvictable(float priority,
+                                                         uint64_t frame) {
+  Texture *victim = nullptr;
+  for (Texture &texture : textures) {
+    // Strictly lower, so textures of the same priority never take turns
+    // evicting each other
+    if (texture.image == VK_NULL_HANDLE ||
+        texture.residentBase >= texture.tailBase ||
+        texture.lastChanged == frame || texture.priority >= priority) {
+      continue;
+    }
+    if (victim == nullptr || texture.priority < victim->priority) {
+      victim = &texture;
+    }
+  }
+  return victim;
+}
+
+void TextureStreamer::Record(VkCommandBuffer commandBuffer, uint64_t frame) {
+  // New textures first, their tails are what gets sampled until the rest
+  // streams in
+  for (Texture &texture : textures) {
+    if (texture.image == VK_NULL_HANDLE &&
+        !Rebuild(commandBuffer, texture, texture.tailBase, frame)) {
+      return;
+    }
+  }
+
+  // The budget was lowered, so drop mips until it is met again
+  while (residentBytes > budget) {
+    Texture *victim = FindEvictable(INFINITY, frame);
+    if (victim == nullptr) {
+      break;
+    }
+    Rebuild(commandBuffer, *victim, victim->residentBase + 1, frame);
+  }
+
+  order.clear();
+  for (uint32_t i = 0; i < textures.size(); i++) {
+    const Texture &texture = textures[i];
+    if (texture.image != VK_NULL_HANDLE && texture.residentBase > 0 &&
+        texture.priority > 0.0f && texture.lastChanged != frame) {
+      order.push_back(i);
+    }
+  }
+  // Ties by index, as stable_sort would, without its temporary buffer
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return textures[a].priority != textures[b].priority
+               ? textures[a].priority > textures[b].priority
+               : a < b;
+  });
+
+  // One mip for each texture at most, the largest missing one is the next
+  // most useful
+  for (uint32_t index : order) {
+    Texture &texture = textures[index];
+    uint32_t next = texture.residentBase - 1;
+    VkDeviceSize size = texture.mips[next].size();
+
+    VkDeviceSize start = (head + TEXTURE_STAGING_ALIGNMENT - 1) &
+                         ~(TEXTURE_STAGING_ALIGNMENT - 1);
+    if (start + size > TEXTURE_STREAM_FRAME_SIZE) {
+      break;
+    }
+
+    bool fits = true;
+    while (residentBytes + size > budget) {
+      Texture *victim = FindEvictable(texture.priority, frame);
+      if (victim == nullptr) {
+        fits = false;
+        break;
+      }
+      Rebuild(commandBuffer, *victim, victim->residentBase + 1, frame);
+    }
+
+    // A smaller mip of something lower down may still fit
+    if (!fits) {
+      continue;
+    }
+
+    if (!Rebuild(commandBuffer, texture, next, frame)) {
+      break;
+    }
+  }
+}
+
+VkImageView TextureStreamer::GetView(TextureHandle handle) const {
+  return handle.IsValid() ? textures[handle.index].view : VK_NULL_HANDLE;
+}
+
+uint32_t TextureStreamer::GetGeneration(TextureHandle handle) const {
+  return handle.IsValid() ? textures[handle.index].generation : 0;
+}
+
+TextureStats TextureStreamer::GetStats() const {
+  TextureStats stats;
+  stats.textures = static_cast<uint32_t>(textures.size());
+  stats.residentBytes = residentBytes;
+  stats.budgetBytes = budget;
+  stats.mipsStreamed = mipsStreamed;
+  stats.mipsEvicted = mipsEvicted;
+  stats.bytesStreamed = bytesStreamed;
+
+  for (const Texture &texture : textures) {
+    stats.wantedBytes += GetResidentSize(texture, 0);
+    if (texture.image != VK_NULL_HANDLE && texture.residentBase == 0) {
+      stats.fullyResident++;
+    }
+  }
+  return stats;
+}
+
+} // namespace MiniEngine
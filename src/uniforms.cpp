@@ -0,0 +1,164 @@
+#include <miniengine/uniforms.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace MiniEngine {
+
+VkPushConstantRange GetObjectPushConstantRange() {
+  VkPushConstantRange range = {};
+  range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  range.offset = OBJECT_CONSTANTS_OFFSET;
+  range.size = sizeof(ObjectConstants);
+  return range;
+}
+
+void UniformRing::Init(VkDevice device, GpuAllocator &allocator,
+                       uint32_t frameCount, VkDeviceSize blockSize,
+                       uint32_t blocksPerFrame,
+                       const VkAllocationCallbacks *hostCallbacks) {
+  SPDLOG_TRACE("UniformRing::Init({}, {}, {})", frameCount, blockSize,
+               blocksPerFrame);
+
+  this->device = device;
+  this->hostCallbacks = hostCallbacks;
+  this->allocator = &allocator;
+  this->blockSize = blockSize;
+  this->blocksPerFrame = blocksPerFrame;
+
+  // Dynamic offsets have to be a multiple of this, which is a power of two
+  VkDeviceSize alignment = std::max<VkDeviceSize>(
+      allocator.GetDeviceProperties().limits.minUniformBufferOffsetAlignment,
+      1);
+  stride = (blockSize + alignment - 1) & ~(alignment - 1);
+
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = stride * blocksPerFrame * frameCount;
+  bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer(device, &bufferInfo, hostCallbacks, &buffer) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to create uniform ring buffer");
+  }
+
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+  // The GPU reads the blocks straight out of host memory, they are small and
+  // read once per draw at most
+  allocation = allocator.Allocate(memRequirements,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+  vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+
+  VkDescriptorSetLayoutBinding binding = {};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &binding;
+
+  if (vkCreateDescriptorSetLayout(device, &layoutInfo, hostCallbacks,
+                                  &setLayout) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create uniform descriptor set layout");
+  }
+
+  VkDescriptorPoolSize poolSize = {};
+  poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  poolSize.descriptorCount = 1;
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+
+  if (vkCreateDescriptorPool(device, &poolInfo, hostCallbacks,
+                             &descriptorPool) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create uniform descriptor pool");
+  }
+
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &setLayout;
+
+  if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate uniform descriptor set");
+  }
+
+  // Written once, every frame and block is a different dynamic offset into
+  // the same range
+  VkDescriptorBufferInfo bufferDescriptor = {};
+  bufferDescriptor.buffer = buffer;
+  bufferDescriptor.offset = 0;
+  bufferDescriptor.range = blockSize;
+
+  VkWriteDescriptorSet write = {};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = descriptorSet;
+  write.dstBinding = 0;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  write.pBufferInfo = &bufferDescriptor;
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+void UniformRing::Destroy() {
+  if (buffer == VK_NULL_HANDLE) {
+    return;
+  }
+
+  SPDLOG_TRACE("UniformRing::Destroy()");
+
+  // Frees the set with it
+  vkDestroyDescriptorPool(device, descriptorPool, hostCallbacks);
+  vkDestroyDescriptorSetLayout(device, setLayout, hostCallbacks);
+  vkDestroyBuffer(device, buffer, hostCallbacks);
+  allocator->Free(allocation);
+
+  buffer = VK_NULL_HANDLE;
+}
+
+void UniformRing::BeginFrame(uint32_t frameIndex) {
+  // The GPU is done with every block this region held last time
+  frameBase = stride * blocksPerFrame * frameIndex;
+  head = 0;
+}
+
+uint32_t UniformRing::Push(const void *data, VkDeviceSize size) {
+  if (size > blockSize) {
+    throw std::runtime_error("Uniform data is larger than a block");
+  }
+  if (head >= blocksPerFrame) {
+    spdlog::warn("Uniform ring full, dropping a {} byte block", size);
+    return UNIFORM_NONE;
+  }
+
+  VkDeviceSize offset = frameBase + stride * head++;
+  memcpy(static_cast<char *>(allocation.mapped) + offset, data, (size_t)size);
+  bytesWritten += size;
+
+  return static_cast<uint32_t>(offset);
+}
+
+void UniformRing::Bind(VkCommandBuffer commandBuffer,
+                       VkPipelineBindPoint bindPoint, VkPipelineLayout layout,
+                       uint32_t set, uint32_t offset) const {
+  vkCmdBindDescriptorSets(commandBuffer, bindPoint, layout, set, 1,
+                          &descriptorSet, 1, &offset);
+}
+
+} // namespace MiniEngine
@@ -0,0 +1,293 @@
+#include <miniengine/upload.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace MiniEngine {
+
+// Most uploads are small, so they share pages. Anything bigger than a page
+// gets a page of its own which is released once its batch completes.
+constexpr VkDeviceSize UPLOAD_PAGE_SIZE = 8 * 1024 * 1024;
+constexpr VkDeviceSize UPLOAD_ALIGNMENT = 16;
+
+void UploadEngine::Init(VkDevice device, GpuAllocator &allocator,
+                        uint32_t queueFamily, VkQueue queue,
+                        const VkAllocationCallbacks *hostCallbacks) {
+  SPDLOG_TRACE("UploadEngine::Init({})", queueFamily);
+
+  this->device = device;
+  this->hostCallbacks = hostCallbacks;
+  this->allocator = &allocator;
+  this->queue = queue;
+
+  VkCommandPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT |
+                   VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  poolInfo.queueFamilyIndex = queueFamily;
+
+  if (vkCreateCommandPool(device, &poolInfo, hostCallbacks, &commandPool) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to create upload command pool");
+  }
+
+  // A timeline semaphore counts up once per batch, so a single semaphore can
+  // tell us about every upload ever submitted.
+  VkSemaphoreTypeCreateInfo timelineInfo = {};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  timelineInfo.initialValue = 0;
+
+  VkSemaphoreCreateInfo semaphoreInfo = {};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphoreInfo.pNext = &timelineInfo;
+
+  if (vkCreateSemaphore(device, &semaphoreInfo, hostCallbacks, &timeline) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to create upload timeline semaphore");
+  }
+}
+
+void UploadEngine::Destroy() {
+  if (device == VK_NULL_HANDLE) {
+    return;
+  }
+
+  SPDLOG_TRACE("UploadEngine::Destroy()");
+
+  // Anything still queued is dropped, anything submitted is waited for
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.clear();
+    for (auto &page : currentPages) {
+      ReleasePage(page);
+    }
+    currentPages.clear();
+  }
+
+  if (nextValue > 1) {
+    Wait({nextValue - 1});
+  }
+  Collect();
+
+  for (auto &page : freePages) {
+    vkDestroyBuffer(device, page.buffer, hostCallbacks);
+    allocator->Free(page.allocation);
+  }
+  freePages.clear();
+  freeCommandBuffers.clear();
+
+  vkDestroySemaphore(device, timeline, hostCallbacks);
+  vkDestroyCommandPool(device, commandPool, hostCallbacks);
+
+  device = VK_NULL_HANDLE;
+}
+
+UploadEngine::StagingPage UploadEngine::AcquirePage(VkDeviceSize minSize) {
+  if (minSize <= UPLOAD_PAGE_SIZE && !freePages.empty()) {
+    StagingPage page = freePages.back();
+    freePages.pop_back();
+    page.head = 0;
+    return page;
+  }
+
+  StagingPage page;
+  page.capacity = std::max(minSize, UPLOAD_PAGE_SIZE);
+
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = page.capacity;
+  bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer(device, &bufferInfo, hostCallbacks, &page.buffer) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to create upload staging buffer");
+  }
+
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(device, page.buffer, &memRequirements);
+
+  page.allocation = allocator->Allocate(
+      memRequirements,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      ResourceKind::Linear, AllocationStrategy::Linear);
+
+  vkBindBufferMemory(device, page.buffer, page.allocation.memory,
+                     page.allocation.offset);
+
+  return page;
+}
+
+void UploadEngine::ReleasePage(StagingPage &page) {
+  if (page.capacity == UPLOAD_PAGE_SIZE) {
+    freePages.push_back(page);
+    return;
+  }
+
+  vkDestroyBuffer(device, page.buffer, hostCallbacks);
+  allocator->Free(page.allocation);
+}
+
+UploadTicket UploadEngine::Enqueue(VkBuffer dstBuffer, VkDeviceSize dstOffset,
+                                   const void *data, VkDeviceSize size) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  StagingPage *page = currentPages.empty() ? nullptr : &currentPages.back();
+  VkDeviceSize offset =
+      page ? (page->head + UPLOAD_ALIGNMENT - 1) & ~(UPLOAD_ALIGNMENT - 1) : 0;
+
+  if (page == nullptr || offset + size > page->capacity) {
+    currentPages.push_back(AcquirePage(size));
+    page = &currentPages.back();
+    offset = 0;
+  }
+
+  memcpy(static_cast<char *>(page->allocation.mapped) + offset, data,
+         (size_t)size);
+  page->head = offset + size;
+
+  VkBufferCopy region = {};
+  region.srcOffset = offset;
+  region.dstOffset = dstOffset;
+  region.size = size;
+  pending.push_back({page->buffer, dstBuffer, region, pending.size()});
+
+  return {nextValue};
+}
+
+void UploadEngine::Submit() {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (pending.empty()) {
+    return;
+  }
+
+  VkCommandBuffer commandBuffer;
+  if (!freeCommandBuffers.empty()) {
+    commandBuffer = freeCommandBuffers.back();
+    freeCommandBuffers.pop_back();
+  } else {
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = commandPool;
+    allocInfo.commandBufferCount = 1;
+
+    if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("Failed to allocate upload command buffer");
+    }
+  }
+
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+  // Each source/destination pair is a single command where it can be
+  std::vector<VkBufferCopy> regions;
+  RecordBufferCopies(commandBuffer, pending, regions);
+
+  vkEndCommandBuffer(commandBuffer);
+
+  // The semaphore signal makes the copies available to whoever waits on it
+  VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.signalSemaphoreValueCount = 1;
+  timelineInfo.pSignalSemaphoreValues = &nextValue;
+
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.pSignalSemaphores = &timeline;
+
+  if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to submit upload batch");
+  }
+
+  for (const QueuedCopy &copy : pending) {
+    stats.bytesUploaded += copy.region.size;
+  }
+  stats.copiesSubmitted += pending.size();
+  stats.batchesSubmitted++;
+
+  inFlight.push_back({nextValue, commandBuffer, std::move(currentPages)});
+  currentPages.clear();
+  pending.clear();
+
+  nextValue++;
+}
+
+void UploadEngine::Collect() {
+  uint64_t completed = GetCompletedValue();
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  while (!inFlight.empty() && inFlight.front().value <= completed) {
+    Batch &batch = inFlight.front();
+
+    for (auto &page : batch.pages) {
+      ReleasePage(page);
+    }
+
+    vkResetCommandBuffer(batch.commandBuffer, 0);
+    freeCommandBuffers.push_back(batch.commandBuffer);
+
+    inFlight.pop_front();
+  }
+}
+
+bool UploadEngine::IsComplete(UploadTicket ticket) const {
+  return GetCompletedValue() >= ticket.value;
+}
+
+bool UploadEngine::Wait(UploadTicket ticket, uint64_t timeout) {
+  // Waiting on a batch that was never submitted would never return
+  bool submitted;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    submitted = ticket.value < nextValue;
+  }
+  if (!submitted) {
+    Submit();
+  }
+
+  VkSemaphoreWaitInfo waitInfo = {};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &timeline;
+  waitInfo.pValues = &ticket.value;
+
+  VkResult result = vkWaitSemaphores(device, &waitInfo, timeout);
+  if (result == VK_TIMEOUT) {
+    return false;
+  }
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("Failed to wait for upload");
+  }
+  return true;
+}
+
+uint64_t UploadEngine::GetCompletedValue() const {
+  uint64_t value = 0;
+  vkGetSemaphoreCounterValue(device, timeline, &value);
+  return value;
+}
+
+UploadStats UploadEngine::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  UploadStats result = stats;
+  result.batchesInFlight = static_cast<uint32_t>(inFlight.size());
+  return result;
+}
+
+} // namespace MiniEngine
@@ -0,0 +1,301 @@
+#include <miniengine/app.h>
+#include <miniengine/package.h>
+#include <miniengine/textures.h>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <string>
+#include <vector>
+
+// Packs assets into one file the engine maps with AssetPackage (see
+// package.h), e.g.
+//
+//   MiniEnginePack demo.mepk --scene demo/shaders/*.spv
+//
+// Assets are named by the path they were given as, which is also the path the
+// engine asks for, so a packaged shader replaces the loose file of the same
+// name. Images are decoded here so the engine never has to, and block
+// compressed textures (.dds or .ktx, from any texture compressor) are packed
+// as they are.
+
+static void PrintUsage() {
+  fmt::print(stderr, "Usage: MiniEnginePack OUTPUT [--scene] [FILE]...\n");
+}
+
+static bool HasExtension(const std::string &path,
+                         std::initializer_list<const char *> extensions) {
+  for (const char *extension : extensions) {
+    std::string suffix = extension;
+    if (path.size() >= suffix.size() &&
+        path.compare(path.size() - suffix.size(), suffix.size(), suffix) ==
+            0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Little endian, 0 past the end so a truncated header fails the checks after
+static uint32_t ReadU32(const std::vector<char> &data, size_t offset) {
+  uint32_t value = 0;
+  if (offset + sizeof(value) <= data.size()) {
+    memcpy(&value, data.data() + offset, sizeof(value));
+  }
+  return value;
+}
+
+static VkFormat DxgiToVulkan(uint32_t format) {
+  switch (format) {
+  case 28:
+    return VK_FORMAT_R8G8B8A8_UNORM;
+  case 29:
+    return VK_FORMAT_R8G8B8A8_SRGB;
+  case 71:
+    return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+  case 72:
+    return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+  case 74:
+    return VK_FORMAT_BC2_UNORM_BLOCK;
+  case 75:
+    return VK_FORMAT_BC2_SRGB_BLOCK;
+  case 77:
+    return VK_FORMAT_BC3_UNORM_BLOCK;
+  case 78:
+    return VK_FORMAT_BC3_SRGB_BLOCK;
+  case 80:
+    return VK_FORMAT_BC4_UNORM_BLOCK;
+  case 81:
+    return VK_FORMAT_BC4_SNORM_BLOCK;
+  case 83:
+    return VK_FORMAT_BC5_UNORM_BLOCK;
+  case 84:
+    return VK_FORMAT_BC5_SNORM_BLOCK;
+  case 95:
+    return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+  case 96:
+    return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+  case 98:
+    return VK_FORMAT_BC7_UNORM_BLOCK;
+  case 99:
+    return VK_FORMAT_BC7_SRGB_BLOCK;
+  default:
+    return VK_FORMAT_UNDEFINED;
+  }
+}
+
+// KTX 1 stores OpenGL's internal format
+static VkFormat GlToVulkan(uint32_t format) {
+  switch (format) {
+  case 0x83f1:
+    return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+  case 0x83f3:
+    return VK_FORMAT_BC3_UNORM_BLOCK;
+  case 0x8e8c:
+    return VK_FORMAT_BC7_UNORM_BLOCK;
+  case 0x8e8d:
+    return VK_FORMAT_BC7_SRGB_BLOCK;
+  case 0x9274:
+    return VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK;
+  case 0x9275:
+    return VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK;
+  case 0x9276:
+    return VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK;
+  case 0x9277:
+    return VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK;
+  case 0x9278:
+    return VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK;
+  case 0x9279:
+    return VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK;
+  case 0x93b0:
+    return VK_FORMAT_ASTC_4x4_UNORM_BLOCK;
+  case 0x93b4:
+    return VK_FORMAT_ASTC_6x6_UNORM_BLOCK;
+  case 0x93b7:
+    return VK_FORMAT_ASTC_8x8_UNORM_BLOCK;
+  case 0x93d0:
+    return VK_FORMAT_ASTC_4x4_SRGB_BLOCK;
+  case 0x93d4:
+    return VK_FORMAT_ASTC_6x6_SRGB_BLOCK;
+  case 0x93d7:
+    return VK_FORMAT_ASTC_8x8_SRGB_BLOCK;
+  default:
+    return VK_FORMAT_UNDEFINED;
+  }
+}
+
+// Finds every mip in a .dds (BC formats) or .ktx (ETC2, ASTC, BC7) file. Only
+// plain 2D textures, no arrays, cubes or volumes.
+static bool AddCompressed(MiniEngine::PackageWriter &writer,
+                          const std::string &path,
+                          const std::vector<char> &data) {
+  using MiniEngine::GetMipSize;
+
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  uint32_t width = 0, height = 0, mipLevels = 0;
+  size_t offset = 0;
+  bool ktx = HasExtension(path, {".ktx"});
+
+  if (ktx) {
+    static const unsigned char identifier[12] = {
+        0xab, 0x4b, 0x54, 0x58, 0x20, 0x31, 0x31, 0xbb, 0x0d, 0x0a, 0x1a, 0x0a};
+    if (data.size() < 64 || memcmp(data.data(), identifier, 12) != 0 ||
+        ReadU32(data, 12) != 0x04030201) {
+      spdlog::error("{} isn't a little endian KTX 1 file", path);
+      return false;
+    }
+    if (ReadU32(data, 44) > 1 || ReadU32(data, 48) > 1 ||
+        ReadU32(data, 52) != 1) {
+      spdlog::error("{} isn't a plain 2D texture", path);
+      return false;
+    }
+
+    format = GlToVulkan(ReadU32(data, 28));
+    width = ReadU32(data, 36);
+    height = ReadU32(data, 40);
+    mipLevels = ReadU32(data, 56);
+    offset = 64 + static_cast<size_t>(ReadU32(data, 60));
+  } else {
+    if (data.size() < 128 || memcmp(data.data(), "DDS ", 4) != 0) {
+      spdlog::error("{} isn't a DDS file", path);
+      return false;
+    }
+
+    height = ReadU32(data, 12);
+    width = ReadU32(data, 16);
+    mipLevels = ReadU32(data, 28);
+    offset = 128;
+
+    uint32_t fourCC = ReadU32(data, 84);
+    if (fourCC == 0x30315844) { // "DX10", the format is in the next header
+      format = DxgiToVulkan(ReadU32(data, 128));
+      offset = 148;
+    } else if (fourCC == 0x31545844) { // "DXT1"
+      format = VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+    } else if (fourCC == 0x33545844) { // "DXT3"
+      format = VK_FORMAT_BC2_UNORM_BLOCK;
+    } else if (fourCC == 0x35545844) { // "DXT5"
+      format = VK_FORMAT_BC3_UNORM_BLOCK;
+    } else if (fourCC == 0x32495441 || fourCC == 0x55354342) { // ATI2, BC5U
+      format = VK_FORMAT_BC5_UNORM_BLOCK;
+    }
+  }
+
+  if (format == VK_FORMAT_UNDEFINED || width == 0 || height == 0) {
+    spdlog::error("{} has a format the engine doesn't support", path);
+    return false;
+  }
+
+  // Files without mips say 0. The smallest ones past what a package holds
+  // are left out.
+  mipLevels = std::clamp(mipLevels, 1u, MiniEngine::PACKAGE_MAX_MIPS);
+
+  std::vector<std::span<const std::byte>> mips;
+  for (uint32_t level = 0; level < mipLevels; level++) {
+    size_t size = GetMipSize(format, std::max(width >> level, 1u),
+                             std::max(height >> level, 1u));
+
+    // KTX gives each mip's size first, and pads each one to 4 bytes
+    if (ktx) {
+      if (ReadU32(data, offset) != size) {
+        spdlog::error("{} has the wrong size for mip {}", path, level);
+        return false;
+      }
+      offset += 4;
+    }
+
+    if (offset + size > data.size()) {
+      spdlog::error("{} is truncated", path);
+      return false;
+    }
+    mips.push_back(std::as_bytes(std::span(data.data() + offset, size)));
+    offset += ktx ? (size + 3) & ~size_t(3) : size;
+  }
+
+  writer.AddTexture(path, format, width, height, mips);
+  return true;
+}
+
+static bool AddFile(MiniEngine::PackageWriter &writer,
+                    const std::string &path) {
+  using MiniEngine::AssetType;
+
+  if (HasExtension(path, {".png", ".jpg", ".jpeg", ".tga", ".bmp"})) {
+    int width, height, channels;
+    stbi_uc *pixels = stbi_load(path.c_str(), &width, &height, &channels, 4);
+    if (pixels == nullptr) {
+      spdlog::error("Failed to load {}: {}", path, stbi_failure_reason());
+      return false;
+    }
+
+    writer.AddTexture(path, static_cast<uint32_t>(width),
+                      static_cast<uint32_t>(height), pixels);
+    stbi_image_free(pixels);
+    return true;
+  }
+
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    spdlog::error("Failed to open {}", path);
+    return false;
+  }
+
+  std::vector<char> data((std::istreambuf_iterator<char>(file)),
+                         std::istreambuf_iterator<char>());
+
+  if (HasExtension(path, {".dds", ".ktx"})) {
+    return AddCompressed(writer, path, data);
+  }
+
+  AssetType type =
+      HasExtension(path, {".spv"}) ? AssetType::Shader : AssetType::Raw;
+  writer.Add(path, type, std::as_bytes(std::span(data)));
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    PrintUsage();
+    return EXIT_FAILURE;
+  }
+
+  std::string outputPath = argv[1];
+  MiniEngine::PackageWriter writer;
+
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+
+    if (arg == "--scene") {
+      // The demo scene, optimised once here instead of on every load
+      MiniEngine::Mesh<MiniEngine::Vertex> mesh;
+      mesh.vertices.assign(MiniEngine::vertices.begin(),
+                           MiniEngine::vertices.end());
+      mesh.indices.assign(MiniEngine::indices.begin(),
+                          MiniEngine::indices.end());
+      MiniEngine::OptimizeMesh(mesh);
+      writer.AddMesh(MiniEngine::SCENE_MESH_ASSET, mesh);
+    } else if (arg.starts_with("--")) {
+      PrintUsage();
+      return EXIT_FAILURE;
+    } else if (!AddFile(writer, arg)) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  try {
+    writer.Write(outputPath);
+  } catch (const std::exception &e) {
+    spdlog::error("{}", e.what());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}